@@ -145,6 +145,31 @@ static void init_delay_params(SyncClocks *sc, const CPUState *cpu)
 }
 #endif /* CONFIG USER ONLY */
 
+static inline bool tb_lookup_match(CPUState *cpu, TranslationBlock *tb,
+                                   target_ulong pc, target_ulong cs_base,
+                                   uint32_t flags, uint32_t cflags)
+{
+    return tb &&
+           tb->pc == pc &&
+           tb->cs_base == cs_base &&
+           tb->flags == flags &&
+           tb->trace_vcpu_dstate == *cpu->trace_dstate &&
+           tb_lookup_cflags(tb) == cflags;
+}
+
+/*
+ * Return true while @tb has not been entered often enough to reach the
+ * threshold of tb_count_exec().  Until then it is neither chained to nor
+ * reached through lookup_tb_ptr, so that every entry into it goes through
+ * tb_find() and is counted; otherwise a hot loop, once chained, would
+ * never be seen again by the execution loop.
+ */
+static inline bool tb_counting(TranslationBlock *tb)
+{
+    return unlikely(tb_trace_threshold) && !(tb_cflags(tb) & CF_TRACE) &&
+           qatomic_read(&tb->exec_count) < tb_trace_threshold;
+}
+
 /* Might cause an exception, so have a longjmp destination ready */
 static inline TranslationBlock *tb_lookup(CPUState *cpu, target_ulong pc,
                                           target_ulong cs_base,
@@ -152,26 +177,29 @@ static inline TranslationBlock *tb_lookup(CPUState *cpu, target_ulong pc,
 {
     TranslationBlock *tb;
     uint32_t hash;
+    int way;
 
     /* we should never be trying to look up an INVALID tb */
     tcg_debug_assert(!(cflags & CF_INVALID));
 
     hash = tb_jmp_cache_hash_func(pc);
-    tb = qatomic_rcu_read(&cpu->tb_jmp_cache[hash]);
-
-    if (likely(tb &&
-               tb->pc == pc &&
-               tb->cs_base == cs_base &&
-               tb->flags == flags &&
-               tb->trace_vcpu_dstate == *cpu->trace_dstate &&
-               tb_cflags(tb) == cflags)) {
+    tb = qatomic_rcu_read(&cpu->tb_jmp_cache[hash][0]);
+    if (likely(tb_lookup_match(cpu, tb, pc, cs_base, flags, cflags))) {
         return tb;
     }
+    for (way = 1; way < TB_JMP_CACHE_WAYS; way++) {
+        tb = qatomic_rcu_read(&cpu->tb_jmp_cache[hash][way]);
+        if (tb_lookup_match(cpu, tb, pc, cs_base, flags, cflags)) {
+            tb_jmp_cache_promote(cpu, hash, tb, way);
+            return tb;
+        }
+    }
+
     tb = tb_htable_lookup(cpu, pc, cs_base, flags, cflags);
     if (tb == NULL) {
         return NULL;
     }
-    qatomic_set(&cpu->tb_jmp_cache[hash], tb);
+    tb_jmp_cache_promote(cpu, hash, tb, TB_JMP_CACHE_WAYS - 1);
     return tb;
 }
 
@@ -212,20 +240,99 @@ static inline void log_cpu_exec(target_ulong pc, CPUState *cpu,
  * Look for an existing TB matching the current cpu state.
  * If found, return the code pointer.  If not found, return
  * the tcg epilogue so that we return into cpu_tb_exec.
+ *
+ * Each call site, i.e. each indirect branch of a TB, first tries the
+ * TB it went to last time, so that branches with a stable target, such
+ * as most indirect calls and returns, need not search the jump cache.
  */
 const void *HELPER(lookup_tb_ptr)(CPUArchState *env)
 {
     CPUState *cpu = env_cpu(env);
+    uintptr_t site = GETPC();
+    TBJmpPred *pred = &cpu->tb_jmp_pred[tb_jmp_pred_hash_func(site)];
     TranslationBlock *tb;
     target_ulong cs_base, pc;
-    uint32_t flags;
+    uint32_t flags, cflags;
 
     cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+    cflags = curr_cflags(cpu);
 
-    tb = tb_lookup(cpu, pc, cs_base, flags, curr_cflags(cpu));
-    if (tb == NULL) {
+    tb = qatomic_read(&pred->tb);
+    if (likely(pred->site == site &&
+               tb_lookup_match(cpu, tb, pc, cs_base, flags, cflags))) {
+        log_cpu_exec(pc, cpu, tb);
+        return tb->tc.ptr;
+    }
+
+    tb = tb_lookup(cpu, pc, cs_base, flags, cflags);
+    if (tb == NULL || tb_counting(tb)) {
+        return tcg_code_gen_epilogue;
+    }
+    pred->site = site;
+    qatomic_set(&pred->tb, tb);
+
+    log_cpu_exec(pc, cpu, tb);
+
+    return tb->tc.ptr;
+}
+
+/*
+ * Unlike the jump cache, the TB cached by a caller for its return
+ * address is not dropped when the guest changes the mapping of that
+ * address, e.g. with a page flush or an address space switch: only use
+ * it if it was translated from the code mapped there now.
+ */
+static inline bool tb_ret_match(CPUArchState *env, TranslationBlock *tb,
+                                target_ulong pc)
+{
+    return tb->page_addr[1] == -1 &&
+           tb->page_addr[0] == (get_page_addr_code(env, pc) &
+                                TARGET_PAGE_MASK);
+}
+
+/**
+ * helper_lookup_tb_ptr_ret: quick check for the TB a guest return goes to
+ * @env: current cpu state
+ *
+ * As helper_lookup_tb_ptr, but first pop the return address stack: if
+ * the guest returns where the matching call said it would, the TB that
+ * the call returned to last time is tried before anything else.
+ */
+const void *HELPER(lookup_tb_ptr_ret)(CPUArchState *env)
+{
+    CPUState *cpu = env_cpu(env);
+    uint32_t top = cpu->tb_ret_top;
+    TBRetEntry *e = &cpu->tb_ret_stack[top];
+    TranslationBlock *caller = qatomic_read(&e->caller);
+    TranslationBlock *tb;
+    target_ulong cs_base, pc;
+    uint32_t flags, cflags;
+
+    cpu->tb_ret_top = (top - 1) & (TB_RET_STACK_SIZE - 1);
+    qatomic_set(&e->caller, NULL);
+
+    cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+    cflags = curr_cflags(cpu);
+
+    if (caller && e->pc != pc) {
+        caller = NULL;
+    }
+    if (caller) {
+        tb = qatomic_read(&caller->ret_tb);
+        if (likely(tb_lookup_match(cpu, tb, pc, cs_base, flags, cflags) &&
+                   tb_ret_match(env, tb, pc))) {
+            log_cpu_exec(pc, cpu, tb);
+            return tb->tc.ptr;
+        }
+    }
+
+    tb = tb_lookup(cpu, pc, cs_base, flags, cflags);
+    if (tb == NULL || tb_counting(tb)) {
         return tcg_code_gen_epilogue;
     }
+    if (caller) {
+        qatomic_set(&caller->ret_tb, tb);
+    }
 
     log_cpu_exec(pc, cpu, tb);
 
@@ -383,7 +490,7 @@ static bool tb_lookup_cmp(const void *p, const void *d)
         tb->cs_base == desc->cs_base &&
         tb->flags == desc->flags &&
         tb->trace_vcpu_dstate == desc->trace_vcpu_dstate &&
-        tb_cflags(tb) == desc->cflags) {
+        tb_lookup_cflags(tb) == desc->cflags) {
         /* check next page if needed */
         if (tb->page_addr[1] == -1) {
             return true;
@@ -478,6 +585,50 @@ static inline void tb_add_jump(TranslationBlock *tb, int n,
     return;
 }
 
+/*
+ * Number of entries from the execution loop after which a TB is
+ * retranslated as a superblock (CF_TRACE); 0 disables retranslation.
+ */
+unsigned int tb_trace_threshold;
+
+/*
+ * Queue the successors of each new TB for translation by idle vCPUs.
+ */
+bool tb_spec_enabled;
+
+/*
+ * Count an entry into @tb from the execution loop (see tb_counting) and,
+ * once it becomes hot, replace it with a superblock starting at the same
+ * pc.  Superblocks continue translation across direct jumps that the
+ * frontend agrees to follow (see translator_follow_jump), so that the
+ * optimizer and register allocator see the code on both sides of the
+ * jump at once.
+ */
+static TranslationBlock *tb_count_exec(CPUState *cpu, TranslationBlock *tb)
+{
+    uint32_t count = qatomic_read(&tb->exec_count) + 1;
+    uint32_t cflags = tb_cflags(tb);
+
+    /* Racy increment: losing a count only delays retranslation. */
+    qatomic_set(&tb->exec_count, count);
+    if (likely(count != tb_trace_threshold) ||
+        (cflags & (CF_TRACE | CF_INVALID)) || tb->page_addr[0] == -1) {
+        return tb;
+    }
+
+    qemu_log_mask_and_addr(CPU_LOG_EXEC, tb->pc,
+                           "Retranslating hot TB %p [" TARGET_FMT_lx
+                           "] as a superblock\n", tb->tc.ptr, tb->pc);
+
+    mmap_lock();
+    tb_phys_invalidate(tb, -1);
+    tb = tb_gen_code(cpu, tb->pc, tb->cs_base, tb->flags, cflags | CF_TRACE);
+    mmap_unlock();
+    tb_jmp_cache_insert(cpu, tb);
+    qatomic_set(&tb_ctx.tb_trace_count, tb_ctx.tb_trace_count + 1);
+    return tb;
+}
+
 static inline TranslationBlock *tb_find(CPUState *cpu,
                                         TranslationBlock *last_tb,
                                         int tb_exit, uint32_t cflags)
@@ -493,9 +644,18 @@ static inline TranslationBlock *tb_find(CPUState *cpu,
     if (tb == NULL) {
         mmap_lock();
         tb = tb_gen_code(cpu, pc, cs_base, flags, cflags);
+        tb_cache_prewarm(cpu, tb);
         mmap_unlock();
         /* We add the TB in the virtual pc hash table for the fast lookup */
-        qatomic_set(&cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)], tb);
+        tb_jmp_cache_insert(cpu, tb);
+        if (unlikely(tb_spec_enabled)) {
+            tb_spec_queue(tb, 0);
+        }
+    } else if (unlikely(tb_trace_threshold)) {
+        tb = tb_count_exec(cpu, tb);
+    }
+    if (tb_counting(tb)) {
+        last_tb = NULL;
     }
 #ifndef CONFIG_USER_ONLY
     /* We don't take care of direct jumps when address mapping changes in
@@ -750,8 +910,12 @@ static inline void cpu_loop_exec_tb(CPUState *cpu, TranslationBlock *tb,
          * will also have set something else (eg exit_request or
          * interrupt_request) which will be handled by
          * cpu_handle_interrupt.  cpu_handle_interrupt will also
-         * clear cpu->icount_decr.u16.high.
+         * clear cpu->icount_decr.u16.high.  The profiler is the
+         * exception: it only wants to know where we stopped.
          */
+        if (unlikely(qatomic_read(&cpu->profile_request))) {
+            tb_profile_sample(cpu);
+        }
         return;
     }
 
@@ -788,6 +952,9 @@ int cpu_exec(CPUState *cpu)
     current_cpu = cpu;
 
     if (cpu_handle_halt(cpu)) {
+        if (unlikely(tb_spec_enabled)) {
+            tb_spec_run(cpu);
+        }
         return EXCP_HALTED;
     }
 
@@ -28,6 +28,9 @@
 #include "exec/ram_addr.h"
 #include "tcg/tcg.h"
 #include "qemu/error-report.h"
+#include "qapi/error.h"
+#include "qapi/qapi-commands-machine.h"
+#include "sysemu/tcg.h"
 #include "exec/log.h"
 #include "exec/helper-proto.h"
 #include "qemu/atomic.h"
@@ -100,10 +103,29 @@ static void tlb_window_reset(CPUTLBDesc *desc, int64_t ns,
 
 static void tb_jmp_cache_clear_page(CPUState *cpu, target_ulong page_addr)
 {
-    unsigned int i, i0 = tb_jmp_cache_hash_page(page_addr);
+    unsigned int i, j, i0 = tb_jmp_cache_hash_page(page_addr);
 
     for (i = 0; i < TB_JMP_PAGE_SIZE; i++) {
-        qatomic_set(&cpu->tb_jmp_cache[i0 + i], NULL);
+        for (j = 0; j < TB_JMP_CACHE_WAYS; j++) {
+            qatomic_set(&cpu->tb_jmp_cache[i0 + i][j], NULL);
+        }
+    }
+}
+
+/*
+ * The indirect branch predictions are keyed by call site, and checked
+ * against the virtual pc only: drop those whose TB starts on @page_addr.
+ */
+static void tb_jmp_pred_clear_page(CPUState *cpu, target_ulong page_addr)
+{
+    unsigned int i;
+
+    for (i = 0; i < TB_JMP_PRED_SIZE; i++) {
+        TranslationBlock *tb = qatomic_read(&cpu->tb_jmp_pred[i].tb);
+
+        if (tb && (tb->pc & TARGET_PAGE_MASK) == page_addr) {
+            qatomic_set(&cpu->tb_jmp_pred[i].tb, NULL);
+        }
     }
 }
 
@@ -113,6 +135,10 @@ static void tb_flush_jmp_cache(CPUState *cpu, target_ulong addr)
        overlap the flushed page.  */
     tb_jmp_cache_clear_page(cpu, addr - TARGET_PAGE_SIZE);
     tb_jmp_cache_clear_page(cpu, addr);
+
+    addr &= TARGET_PAGE_MASK;
+    tb_jmp_pred_clear_page(cpu, addr - TARGET_PAGE_SIZE);
+    tb_jmp_pred_clear_page(cpu, addr);
 }
 
 /**
@@ -154,6 +180,11 @@ static void tb_flush_jmp_cache(CPUState *cpu, target_ulong addr)
  * is direct mapped, so we want the use rate to be low (or at least not too
  * high), since otherwise we are likely to have a significant amount of
  * conflict misses.
+ *
+ * 4. Treat a high number of victim TLB hits since the last flush like a high
+ * use rate. Victim TLB hits are conflict misses of the main TLB, so many of
+ * them mean that the working set does not spread well over the current size,
+ * even if the use rate is moderate; and shrinking would make it worse.
  */
 static void tlb_mmu_resize_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast,
                                   int64_t now)
@@ -161,16 +192,18 @@ static void tlb_mmu_resize_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast,
     size_t old_size = tlb_n_entries(fast);
     size_t rate;
     size_t new_size = old_size;
+    size_t conflicts = desc->vtlb_hit_count - desc->flush_vtlb_hits;
     int64_t window_len_ms = 100;
     int64_t window_len_ns = window_len_ms * 1000 * 1000;
     bool window_expired = now > desc->window_begin_ns + window_len_ns;
 
+    desc->flush_vtlb_hits = desc->vtlb_hit_count;
     if (desc->n_used_entries > desc->window_max_entries) {
         desc->window_max_entries = desc->n_used_entries;
     }
     rate = desc->window_max_entries * 100 / old_size;
 
-    if (rate > 70) {
+    if (rate > 70 || conflicts > old_size / 2) {
         new_size = MIN(old_size << 1, 1 << CPU_TLB_DYN_MAX_BITS);
     } else if (rate < 30 && window_expired) {
         size_t ceil = pow2ceil(desc->window_max_entries);
@@ -235,7 +268,9 @@ static void tlb_mmu_flush_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast)
     desc->n_used_entries = 0;
     desc->large_page_addr = -1;
     desc->large_page_mask = -1;
-    desc->vindex = 0;
+    desc->large_page_bits = 0;
+    memset(desc->lpage, -1, sizeof(desc->lpage));
+    memset(desc->vindex, 0, sizeof(desc->vindex));
     memset(fast->table, -1, sizeof_tlb(fast));
     memset(desc->vtable, -1, sizeof(desc->vtable));
 }
@@ -246,16 +281,41 @@ static void tlb_flush_one_mmuidx_locked(CPUArchState *env, int mmu_idx,
     CPUTLBDesc *desc = &env_tlb(env)->d[mmu_idx];
     CPUTLBDescFast *fast = &env_tlb(env)->f[mmu_idx];
 
+    qatomic_set(&desc->flush_count, desc->flush_count + 1);
     tlb_mmu_resize_locked(desc, fast, now);
     tlb_mmu_flush_locked(desc, fast);
 }
 
+/* The tlb of an mmu_idx is filled for an ASID that is not known. */
+#define TLB_ASID_UNKNOWN  UINT32_MAX
+
+static void tlb_saved_free(CPUTLBSaved *sv)
+{
+    if (sv->valid) {
+        g_free(sv->table);
+        g_free(sv->iotlb);
+        sv->valid = false;
+    }
+}
+
+static void tlb_mmu_drop_saved_locked(CPUTLBDesc *desc)
+{
+    int i;
+
+    for (i = 0; i < CPU_TLB_ASID_SAVED; i++) {
+        tlb_saved_free(&desc->saved[i]);
+    }
+}
+
 static void tlb_mmu_init(CPUTLBDesc *desc, CPUTLBDescFast *fast, int64_t now)
 {
     size_t n_entries = 1 << CPU_TLB_DYN_DEFAULT_BITS;
 
     tlb_window_reset(desc, now, 0);
     desc->n_used_entries = 0;
+    desc->asid = TLB_ASID_UNKNOWN;
+    desc->saved_next = 0;
+    memset(desc->saved, 0, sizeof(desc->saved));
     fast->mask = (n_entries - 1) << CPU_TLB_ENTRY_BITS;
     fast->table = g_new(CPUTLBEntry, n_entries);
     desc->iotlb = g_new(CPUIOTLBEntry, n_entries);
@@ -300,6 +360,7 @@ void tlb_destroy(CPUState *cpu)
 
         g_free(fast->table);
         g_free(desc->iotlb);
+        tlb_mmu_drop_saved_locked(desc);
     }
 }
 
@@ -339,6 +400,46 @@ void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
     *pelide = elide;
 }
 
+TlbStatsList *qmp_query_tlb_stats(Error **errp)
+{
+    TlbStatsList *head = NULL, **tail = &head;
+    CPUState *cpu;
+
+    if (!tcg_enabled()) {
+        error_setg(errp, "TLB statistics are only available with accel=tcg");
+        return NULL;
+    }
+
+    CPU_FOREACH(cpu) {
+        CPUArchState *env = cpu->env_ptr;
+        TlbStats *stats = g_new0(TlbStats, 1);
+        TlbMmuStatsList **mmu_tail = &stats->mmu;
+        int mmu_idx;
+
+        stats->cpu_index = cpu->cpu_index;
+        for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+            CPUTLBDesc *desc = &env_tlb(env)->d[mmu_idx];
+            TlbMmuStats *m = g_new0(TlbMmuStats, 1);
+
+            /* Racy with the vCPU, but the values are only indicative. */
+            m->mmu_idx = mmu_idx;
+            m->size = (qatomic_read(&env_tlb(env)->f[mmu_idx].mask)
+                       >> CPU_TLB_ENTRY_BITS) + 1;
+            m->used = qatomic_read(&desc->n_used_entries);
+            m->victim_hits = qatomic_read(&desc->vtlb_hit_count);
+            m->misses = qatomic_read(&desc->miss_count);
+            m->fills = qatomic_read(&desc->fill_count);
+            m->flushes = qatomic_read(&desc->flush_count);
+            m->page_flushes = qatomic_read(&desc->page_flush_count);
+            m->large_page_fills = qatomic_read(&desc->large_page_fill_count);
+            QAPI_LIST_APPEND(mmu_tail, m);
+        }
+        QAPI_LIST_APPEND(tail, stats);
+    }
+
+    return head;
+}
+
 static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
 {
     CPUArchState *env = cpu->env_ptr;
@@ -362,6 +463,18 @@ static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
         tlb_flush_one_mmuidx_locked(env, mmu_idx, now);
     }
 
+    /*
+     * The tlbs of other ASIDs are dropped even if the current one is
+     * clean, and since the flush may come from a change of ASID that
+     * was not told with tlb_set_asid_by_mmuidx, the ASID is forgotten.
+     */
+    for (work = asked; work != 0; work &= work - 1) {
+        CPUTLBDesc *desc = &env_tlb(env)->d[ctz32(work)];
+
+        tlb_mmu_drop_saved_locked(desc);
+        desc->asid = TLB_ASID_UNKNOWN;
+    }
+
     qemu_spin_unlock(&env_tlb(env)->c.lock);
 
     cpu_tb_jmp_cache_clear(cpu);
@@ -427,6 +540,197 @@ void tlb_flush_all_cpus_synced(CPUState *src_cpu)
     tlb_flush_by_mmuidx_all_cpus_synced(src_cpu, ALL_MMUIDX_BITS);
 }
 
+/*
+ * The mmu indexes and the ASID of tlb_set_asid_by_mmuidx and
+ * tlb_flush_asid_by_mmuidx are packed together in the run_on_cpu data.
+ */
+static inline run_on_cpu_data tlb_asid_data(uint16_t idxmap, uint16_t asid)
+{
+    return RUN_ON_CPU_HOST_ULONG(((unsigned long)asid << 16) | idxmap);
+}
+
+static CPUTLBSaved *tlb_saved_find(CPUTLBDesc *desc, uint32_t asid)
+{
+    int i;
+
+    for (i = 0; i < CPU_TLB_ASID_SAVED; i++) {
+        if (desc->saved[i].valid && desc->saved[i].asid == asid) {
+            return &desc->saved[i];
+        }
+    }
+    return NULL;
+}
+
+/* Return a slot for a tlb to keep, evicting one if all are in use. */
+static CPUTLBSaved *tlb_saved_alloc(CPUTLBDesc *desc)
+{
+    CPUTLBSaved *sv;
+    int i;
+
+    for (i = 0; i < CPU_TLB_ASID_SAVED; i++) {
+        if (!desc->saved[i].valid) {
+            return &desc->saved[i];
+        }
+    }
+    sv = &desc->saved[desc->saved_next++ % CPU_TLB_ASID_SAVED];
+    tlb_saved_free(sv);
+    return sv;
+}
+
+static void tlb_set_asid_locked(CPUArchState *env, int midx, uint32_t asid)
+{
+    CPUTLBDesc *desc = &env_tlb(env)->d[midx];
+    CPUTLBDescFast *fast = &env_tlb(env)->f[midx];
+    CPUTLBSaved cur = {
+        .valid = desc->asid != TLB_ASID_UNKNOWN && desc->n_used_entries,
+        .asid = desc->asid,
+        .mask = fast->mask,
+        .table = fast->table,
+        .iotlb = desc->iotlb,
+        .large_page_addr = desc->large_page_addr,
+        .large_page_mask = desc->large_page_mask,
+        .large_page_bits = desc->large_page_bits,
+        .n_used_entries = desc->n_used_entries,
+    };
+    CPUTLBSaved *sv;
+
+    if (desc->asid == asid) {
+        return;
+    }
+
+    sv = tlb_saved_find(desc, asid);
+    if (sv) {
+        fast->mask = sv->mask;
+        fast->table = sv->table;
+        desc->iotlb = sv->iotlb;
+        desc->large_page_addr = sv->large_page_addr;
+        desc->large_page_mask = sv->large_page_mask;
+        desc->large_page_bits = sv->large_page_bits;
+        desc->n_used_entries = sv->n_used_entries;
+        sv->valid = false;
+        /*
+         * The victim tlb and the large pages only hold translations
+         * of the previous ASID.
+         */
+        memset(desc->lpage, -1, sizeof(desc->lpage));
+        memset(desc->vindex, 0, sizeof(desc->vindex));
+        memset(desc->vtable, -1, sizeof(desc->vtable));
+    } else {
+        if (cur.valid) {
+            size_t n_entries = tlb_n_entries(fast);
+
+            fast->table = g_new(CPUTLBEntry, n_entries);
+            desc->iotlb = g_new(CPUIOTLBEntry, n_entries);
+        }
+        tlb_mmu_flush_locked(desc, fast);
+    }
+
+    /*
+     * Keep the tlb of the previous ASID, unless it is empty or it is not
+     * known which ASID it was filled for; in that case it is either the
+     * one that was just flushed, or it was replaced and is freed.
+     */
+    if (cur.valid) {
+        *tlb_saved_alloc(desc) = cur;
+    } else if (sv) {
+        g_free(cur.table);
+        g_free(cur.iotlb);
+    }
+
+    desc->asid = asid;
+    if (desc->n_used_entries) {
+        env_tlb(env)->c.dirty |= 1 << midx;
+    }
+}
+
+static void tlb_set_asid_by_mmuidx_async_work(CPUState *cpu,
+                                              run_on_cpu_data data)
+{
+    CPUArchState *env = cpu->env_ptr;
+    uint16_t idxmap = data.host_ulong;
+    uint16_t asid = data.host_ulong >> 16;
+    uint16_t work;
+
+    assert_cpu_is_self(cpu);
+
+    tlb_debug("mmu_idx:0x%04" PRIx16 " asid:0x%04" PRIx16 "\n", idxmap, asid);
+
+    qemu_spin_lock(&env_tlb(env)->c.lock);
+    for (work = idxmap; work != 0; work &= work - 1) {
+        tlb_set_asid_locked(env, ctz32(work), asid);
+    }
+    qemu_spin_unlock(&env_tlb(env)->c.lock);
+
+    cpu_tb_jmp_cache_clear(cpu);
+}
+
+void tlb_set_asid_by_mmuidx(CPUState *cpu, uint16_t idxmap, uint16_t asid)
+{
+    run_on_cpu_data data = tlb_asid_data(idxmap, asid);
+
+    if (cpu->created && !qemu_cpu_is_self(cpu)) {
+        async_run_on_cpu(cpu, tlb_set_asid_by_mmuidx_async_work, data);
+    } else {
+        tlb_set_asid_by_mmuidx_async_work(cpu, data);
+    }
+}
+
+static void tlb_flush_asid_by_mmuidx_async_work(CPUState *cpu,
+                                                run_on_cpu_data data)
+{
+    CPUArchState *env = cpu->env_ptr;
+    uint16_t idxmap = data.host_ulong;
+    uint16_t asid = data.host_ulong >> 16;
+    int64_t now = get_clock_realtime();
+    uint16_t work;
+
+    assert_cpu_is_self(cpu);
+
+    tlb_debug("mmu_idx:0x%04" PRIx16 " asid:0x%04" PRIx16 "\n", idxmap, asid);
+
+    qemu_spin_lock(&env_tlb(env)->c.lock);
+    for (work = idxmap; work != 0; work &= work - 1) {
+        int mmu_idx = ctz32(work);
+        CPUTLBDesc *desc = &env_tlb(env)->d[mmu_idx];
+        CPUTLBSaved *sv;
+
+        /* The current tlb may hold @asid if its ASID is not known. */
+        if ((desc->asid == asid || desc->asid == TLB_ASID_UNKNOWN) &&
+            (env_tlb(env)->c.dirty & (1 << mmu_idx))) {
+            env_tlb(env)->c.dirty &= ~(1 << mmu_idx);
+            tlb_flush_one_mmuidx_locked(env, mmu_idx, now);
+        }
+        sv = tlb_saved_find(desc, asid);
+        if (sv) {
+            tlb_saved_free(sv);
+        }
+    }
+    qemu_spin_unlock(&env_tlb(env)->c.lock);
+
+    cpu_tb_jmp_cache_clear(cpu);
+}
+
+void tlb_flush_asid_by_mmuidx(CPUState *cpu, uint16_t idxmap, uint16_t asid)
+{
+    run_on_cpu_data data = tlb_asid_data(idxmap, asid);
+
+    if (cpu->created && !qemu_cpu_is_self(cpu)) {
+        async_run_on_cpu(cpu, tlb_flush_asid_by_mmuidx_async_work, data);
+    } else {
+        tlb_flush_asid_by_mmuidx_async_work(cpu, data);
+    }
+}
+
+void tlb_flush_asid_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
+                                              uint16_t idxmap, uint16_t asid)
+{
+    const run_on_cpu_func fn = tlb_flush_asid_by_mmuidx_async_work;
+    run_on_cpu_data data = tlb_asid_data(idxmap, asid);
+
+    flush_all_helper(src_cpu, fn, data);
+    async_safe_run_on_cpu(src_cpu, fn, data);
+}
+
 static bool tlb_hit_page_mask_anyprot(CPUTLBEntry *tlb_entry,
                                       target_ulong page, target_ulong mask)
 {
@@ -471,16 +775,59 @@ static inline bool tlb_flush_entry_locked(CPUTLBEntry *tlb_entry,
     return tlb_flush_entry_mask_locked(tlb_entry, page, -1);
 }
 
+/* Return the page of a non-empty tlb entry.  */
+static target_ulong tlb_entry_page(const CPUTLBEntry *te)
+{
+    target_ulong addr = te->addr_read;
+
+    if (addr == -1) {
+        addr = tlb_addr_write(te);
+    }
+    if (addr == -1) {
+        addr = te->addr_code;
+    }
+    return addr & TARGET_PAGE_MASK;
+}
+
+/* Return true if @te maps a page of [@start, @last], compared under @mask. */
+static bool tlb_entry_in_range(const CPUTLBEntry *te, target_ulong start,
+                               target_ulong last, target_ulong mask)
+{
+    return !tlb_entry_is_empty(te) &&
+           ((tlb_entry_page(te) - start) & mask) <= ((last - start) & mask);
+}
+
+/* Return the first index of the victim tlb set that may hold @page. */
+static inline size_t vtlb_set_index(target_ulong page)
+{
+    uint64_t vpn = page >> TARGET_PAGE_BITS;
+
+    return ((vpn * 0x9e3779b97f4a7c15ull) >> (64 - CPU_VTLB_SET_BITS))
+           * CPU_VTLB_WAYS;
+}
+
 /* Called with tlb_c.lock held */
 static void tlb_flush_vtlb_page_mask_locked(CPUArchState *env, int mmu_idx,
                                             target_ulong page,
                                             target_ulong mask)
 {
     CPUTLBDesc *d = &env_tlb(env)->d[mmu_idx];
-    int k;
+    size_t k, end;
 
     assert_cpu_is_self(env_cpu(env));
-    for (k = 0; k < CPU_VTLB_SIZE; k++) {
+
+    /*
+     * With a partial mask, pages that differ in the ignored bits match
+     * too, and they may be in any set.
+     */
+    if (mask == (target_ulong)-1) {
+        k = vtlb_set_index(page);
+        end = k + CPU_VTLB_WAYS;
+    } else {
+        k = 0;
+        end = CPU_VTLB_SIZE;
+    }
+    for (; k < end; k++) {
         if (tlb_flush_entry_mask_locked(&d->vtable[k], page, mask)) {
             tlb_n_used_entries_dec(env, mmu_idx);
         }
@@ -493,24 +840,137 @@ static inline void tlb_flush_vtlb_page_locked(CPUArchState *env, int mmu_idx,
     tlb_flush_vtlb_page_mask_locked(env, mmu_idx, page, -1);
 }
 
+/*
+ * Flush the pages of [@addr, @addr + @len), compared under @mask, from
+ * the tlbs kept for other ASIDs.  As for the current tlb, a tlb that
+ * would take long to walk, or that maps a large page over the range,
+ * is dropped instead.
+ */
+static void tlb_flush_saved_range_locked(CPUTLBDesc *desc, target_ulong addr,
+                                         target_ulong len, target_ulong mask)
+{
+    int i;
+
+    for (i = 0; i < CPU_TLB_ASID_SAVED; i++) {
+        CPUTLBSaved *sv = &desc->saved[i];
+        uintptr_t index_mask = sv->mask >> CPU_TLB_ENTRY_BITS;
+
+        if (!sv->valid) {
+            continue;
+        }
+        if (mask < sv->mask || len > sv->mask ||
+            ((addr + len - 1) & sv->large_page_mask) == sv->large_page_addr) {
+            tlb_saved_free(sv);
+            continue;
+        }
+        for (target_ulong j = 0; j < len; j += TARGET_PAGE_SIZE) {
+            target_ulong page = addr + j;
+            CPUTLBEntry *entry =
+                &sv->table[(page >> TARGET_PAGE_BITS) & index_mask];
+
+            if (tlb_flush_entry_mask_locked(entry, page, mask)) {
+                sv->n_used_entries--;
+            }
+        }
+    }
+}
+
+/*
+ * Flush the pages of [@start, @last], compared under @mask, from the
+ * tlb and the victim tlb.  When the range has more pages than the tlb
+ * has entries, each entry is checked rather than each page.
+ */
+static void tlb_flush_vrange_locked(CPUArchState *env, int midx,
+                                    target_ulong start, target_ulong last,
+                                    target_ulong mask)
+{
+    CPUTLBDesc *d = &env_tlb(env)->d[midx];
+    CPUTLBDescFast *f = &env_tlb(env)->f[midx];
+    target_ulong last_page = (last - start) >> TARGET_PAGE_BITS;
+    size_t n = tlb_n_entries(f);
+    size_t i;
+
+    if (last_page >= n) {
+        for (i = 0; i < n; i++) {
+            if (tlb_entry_in_range(&f->table[i], start, last, mask)) {
+                memset(&f->table[i], -1, sizeof(f->table[i]));
+                tlb_n_used_entries_dec(env, midx);
+            }
+        }
+    } else {
+        for (target_ulong j = 0; j <= last_page; j++) {
+            target_ulong page = start + (j << TARGET_PAGE_BITS);
+
+            if (tlb_flush_entry_mask_locked(tlb_entry(env, midx, page),
+                                            page, mask)) {
+                tlb_n_used_entries_dec(env, midx);
+            }
+        }
+    }
+
+    for (i = 0; i < CPU_VTLB_SIZE; i++) {
+        if (tlb_entry_in_range(&d->vtable[i], start, last, mask)) {
+            memset(&d->vtable[i], -1, sizeof(d->vtable[i]));
+            tlb_n_used_entries_dec(env, midx);
+        }
+    }
+}
+
+/*
+ * Flush the pages of [@addr, @last], which are within the large page
+ * region, along with all the pages of any large page containing them.
+ * Since the large pages of a smaller size are within those of the
+ * largest size, it is enough to flush the latter.
+ */
+static void tlb_flush_large_pages_locked(CPUArchState *env, int midx,
+                                         target_ulong addr, target_ulong last,
+                                         target_ulong mask)
+{
+    CPUTLBDesc *d = &env_tlb(env)->d[midx];
+    target_ulong size_m1 = 0;
+    int i;
+
+    if (d->large_page_bits) {
+        size_m1 = ((target_ulong)1 << (63 - clz64(d->large_page_bits))) - 1;
+    }
+
+    tlb_debug("flushing large pages midx %d ("
+              TARGET_FMT_lx "-" TARGET_FMT_lx ")\n",
+              midx, addr & ~size_m1, last | size_m1);
+    tlb_flush_vrange_locked(env, midx, addr & ~size_m1, last | size_m1, mask);
+
+    for (i = 0; i < CPU_TLB_LARGE_PAGES; i++) {
+        CPUTLBLargePage *lp = &d->lpage[i];
+
+        if (lp->vaddr != -1 &&
+            (mask != (target_ulong)-1 ||
+             (lp->vaddr <= last && addr <= (lp->vaddr | ~lp->mask)))) {
+            memset(lp, -1, sizeof(*lp));
+        }
+    }
+}
+
 static void tlb_flush_page_locked(CPUArchState *env, int midx,
                                   target_ulong page)
 {
     target_ulong lp_addr = env_tlb(env)->d[midx].large_page_addr;
     target_ulong lp_mask = env_tlb(env)->d[midx].large_page_mask;
 
-    /* Check if we need to flush due to large pages.  */
+    qatomic_set(&env_tlb(env)->d[midx].page_flush_count,
+                env_tlb(env)->d[midx].page_flush_count + 1);
+
+    /* Check if we need to flush large pages.  */
     if ((page & lp_mask) == lp_addr) {
-        tlb_debug("forcing full flush midx %d ("
-                  TARGET_FMT_lx "/" TARGET_FMT_lx ")\n",
-                  midx, lp_addr, lp_mask);
-        tlb_flush_one_mmuidx_locked(env, midx, get_clock_realtime());
+        tlb_flush_large_pages_locked(env, midx, page,
+                                     page + TARGET_PAGE_SIZE - 1, -1);
     } else {
         if (tlb_flush_entry_locked(tlb_entry(env, midx, page), page)) {
             tlb_n_used_entries_dec(env, midx);
         }
         tlb_flush_vtlb_page_locked(env, midx, page);
     }
+    tlb_flush_saved_range_locked(&env_tlb(env)->d[midx], page,
+                                 TARGET_PAGE_SIZE, -1);
 }
 
 /**
@@ -715,6 +1175,9 @@ static void tlb_flush_range_locked(CPUArchState *env, int midx,
     CPUTLBDescFast *f = &env_tlb(env)->f[midx];
     target_ulong mask = MAKE_64BIT_MASK(0, bits);
 
+    qatomic_set(&d->page_flush_count, d->page_flush_count + 1);
+    tlb_flush_saved_range_locked(d, addr, len, mask);
+
     /*
      * If @bits is smaller than the tlb size, there may be multiple entries
      * within the TLB; otherwise all addresses that match under @mask hit
@@ -734,15 +1197,12 @@ static void tlb_flush_range_locked(CPUArchState *env, int midx,
     }
 
     /*
-     * Check if we need to flush due to large pages.
+     * Check if we need to flush large pages.
      * Because large_page_mask contains all 1's from the msb,
      * we only need to test the end of the range.
      */
     if (((addr + len - 1) & d->large_page_mask) == d->large_page_addr) {
-        tlb_debug("forcing full flush midx %d ("
-                  TARGET_FMT_lx "/" TARGET_FMT_lx ")\n",
-                  midx, d->large_page_addr, d->large_page_mask);
-        tlb_flush_one_mmuidx_locked(env, midx, get_clock_realtime());
+        tlb_flush_large_pages_locked(env, midx, addr, addr + len - 1, mask);
         return;
     }
 
@@ -999,6 +1459,31 @@ static inline void copy_tlb_helper_locked(CPUTLBEntry *d, const CPUTLBEntry *s)
     *d = *s;
 }
 
+/*
+ * Move a tlb entry to its set in the victim tlb, in a free way if any,
+ * otherwise replacing the ways of the set in turn.
+ * Called with tlb_c.lock held.
+ */
+static void tlb_vtlb_insert_locked(CPUTLBDesc *desc, const CPUTLBEntry *te,
+                                   const CPUIOTLBEntry *io)
+{
+    size_t set = vtlb_set_index(tlb_entry_page(te));
+    size_t vidx;
+
+    for (vidx = set; vidx < set + CPU_VTLB_WAYS; vidx++) {
+        if (tlb_entry_is_empty(&desc->vtable[vidx])) {
+            break;
+        }
+    }
+    if (vidx == set + CPU_VTLB_WAYS) {
+        uint8_t *next = &desc->vindex[set / CPU_VTLB_WAYS];
+
+        vidx = set + (*next)++ % CPU_VTLB_WAYS;
+    }
+    copy_tlb_helper_locked(&desc->vtable[vidx], te);
+    desc->viotlb[vidx] = *io;
+}
+
 /* This is a cross vCPU call (i.e. another vCPU resetting the flags of
  * the target vCPU).
  * We must take tlb_c.lock to avoid racing with another vCPU update. The only
@@ -1025,6 +1510,19 @@ void tlb_reset_dirty(CPUState *cpu, ram_addr_t start1, ram_addr_t length)
             tlb_reset_dirty_range_locked(&env_tlb(env)->d[mmu_idx].vtable[i],
                                          start1, length);
         }
+
+        for (i = 0; i < CPU_TLB_ASID_SAVED; i++) {
+            CPUTLBSaved *sv = &env_tlb(env)->d[mmu_idx].saved[i];
+            unsigned int j;
+
+            if (!sv->valid) {
+                continue;
+            }
+            n = (sv->mask >> CPU_TLB_ENTRY_BITS) + 1;
+            for (j = 0; j < n; j++) {
+                tlb_reset_dirty_range_locked(&sv->table[j], start1, length);
+            }
+        }
     }
     qemu_spin_unlock(&env_tlb(env)->c.lock);
 }
@@ -1062,8 +1560,9 @@ void tlb_set_dirty(CPUState *cpu, target_ulong vaddr)
     qemu_spin_unlock(&env_tlb(env)->c.lock);
 }
 
-/* Our TLB does not support large pages, so remember the area covered by
-   large pages and trigger a full TLB flush if these are invalidated.  */
+/* Our TLB maps large pages one target page at a time, so remember the
+   area covered by large pages and their sizes, and flush all the pages
+   of a large page if any of them is invalidated.  */
 static void tlb_add_large_page(CPUArchState *env, int mmu_idx,
                                target_ulong vaddr, target_ulong size)
 {
@@ -1084,6 +1583,7 @@ static void tlb_add_large_page(CPUArchState *env, int mmu_idx,
     }
     env_tlb(env)->d[mmu_idx].large_page_addr = lp_addr & lp_mask;
     env_tlb(env)->d[mmu_idx].large_page_mask = lp_mask;
+    env_tlb(env)->d[mmu_idx].large_page_bits |= 1ull << ctz64(size);
 }
 
 /* Add a new TLB entry. At most one entry for a given virtual address
@@ -1196,6 +1696,7 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
 
     /* Note that the tlb is no longer clean.  */
     tlb->c.dirty |= 1 << mmu_idx;
+    qatomic_set(&desc->fill_count, desc->fill_count + 1);
 
     /* Make sure there's no cached translation for the new page.  */
     tlb_flush_vtlb_page_locked(env, mmu_idx, vaddr_page);
@@ -1205,12 +1706,8 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
      * different page; otherwise just overwrite the stale data.
      */
     if (!tlb_hit_page_anyprot(te, vaddr_page) && !tlb_entry_is_empty(te)) {
-        unsigned vidx = desc->vindex++ % CPU_VTLB_SIZE;
-        CPUTLBEntry *tv = &desc->vtable[vidx];
-
         /* Evict the old entry into the victim tlb.  */
-        copy_tlb_helper_locked(tv, te);
-        desc->viotlb[vidx] = desc->iotlb[index];
+        tlb_vtlb_insert_locked(desc, te, &desc->iotlb[index]);
         tlb_n_used_entries_dec(env, mmu_idx);
     }
 
@@ -1263,6 +1760,77 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
     qemu_spin_unlock(&tlb->c.lock);
 }
 
+void tlb_set_large_page_with_attrs(CPUState *cpu, target_ulong vaddr,
+                                   hwaddr paddr, MemTxAttrs attrs, int prot,
+                                   int mmu_idx, target_ulong size)
+{
+    CPUArchState *env = cpu->env_ptr;
+    CPUTLBDesc *desc = &env_tlb(env)->d[mmu_idx];
+    target_ulong mask = ~(size - 1);
+    CPUTLBLargePage *lp;
+    int i;
+
+    tlb_set_page_with_attrs(cpu, vaddr, paddr, attrs, prot, mmu_idx, size);
+    if (size <= TARGET_PAGE_SIZE || (prot & PAGE_WRITE_INV)) {
+        return;
+    }
+
+    qemu_spin_lock(&env_tlb(env)->c.lock);
+    for (i = 0; i < CPU_TLB_LARGE_PAGES; i++) {
+        if (desc->lpage[i].vaddr == (vaddr & mask)) {
+            break;
+        }
+    }
+    if (i == CPU_TLB_LARGE_PAGES) {
+        i = desc->lpage_next++ % CPU_TLB_LARGE_PAGES;
+    }
+    lp = &desc->lpage[i];
+    lp->vaddr = vaddr & mask;
+    lp->mask = mask;
+    lp->paddr = paddr - (vaddr & ~mask);
+    lp->attrs = attrs;
+    lp->prot = prot;
+    qemu_spin_unlock(&env_tlb(env)->c.lock);
+}
+
+/*
+ * Fill the tlb entry for @addr from a large page remembered by
+ * tlb_set_large_page_with_attrs, without walking the page tables.
+ * Return false if no large page contains @addr, or if it does not
+ * allow @access_type, in which case the target must be asked.
+ */
+static bool tlb_fill_large_page(CPUState *cpu, target_ulong addr,
+                                MMUAccessType access_type, int mmu_idx)
+{
+    static const int access_prot[] = {
+        [MMU_DATA_LOAD] = PAGE_READ,
+        [MMU_DATA_STORE] = PAGE_WRITE,
+        [MMU_INST_FETCH] = PAGE_EXEC,
+    };
+    CPUArchState *env = cpu->env_ptr;
+    CPUTLBDesc *desc = &env_tlb(env)->d[mmu_idx];
+    target_ulong page = addr & TARGET_PAGE_MASK;
+    int i;
+
+    /* Only this vCPU modifies its large pages, no need for the lock.  */
+    for (i = 0; i < CPU_TLB_LARGE_PAGES; i++) {
+        CPUTLBLargePage *lp = &desc->lpage[i];
+
+        if ((page & lp->mask) == lp->vaddr) {
+            if (!(lp->prot & access_prot[access_type])) {
+                return false;
+            }
+            tlb_set_page_with_attrs(cpu, page, lp->paddr + (page - lp->vaddr),
+                                    lp->attrs, lp->prot, mmu_idx,
+                                    ~lp->mask + 1);
+            qatomic_set(&desc->large_page_fill_count,
+                        desc->large_page_fill_count + 1);
+            return true;
+        }
+    }
+    return false;
+}
+
 /* Add a new TLB entry, but without specifying the memory
  * transaction attributes to be used.
  */
@@ -1297,6 +1865,22 @@ static void tlb_fill(CPUState *cpu, target_ulong addr, int size,
     CPUClass *cc = CPU_GET_CLASS(cpu);
     bool ok;
 
+    if (tlb_fill_large_page(cpu, addr, access_type, mmu_idx)) {
+        return;
+    }
+
+    /*
+     * Speculative translation must not raise guest exceptions: give up
+     * on the TB if the code it reaches is not mapped.
+     */
+    if (unlikely(tb_spec_translating) && access_type == MMU_INST_FETCH) {
+        if (!cc->tcg_ops->tlb_fill(cpu, addr, size,
+                                   access_type, mmu_idx, true, retaddr)) {
+            cpu_loop_exit(cpu);
+        }
+        return;
+    }
+
     /*
      * This is not a probe, so only valid return is success; failure
      * should result in exception + longjmp to the cpu loop.
@@ -1447,11 +2031,13 @@ static inline target_ulong tlb_read_ofs(CPUTLBEntry *entry, size_t ofs)
 static bool victim_tlb_hit(CPUArchState *env, size_t mmu_idx, size_t index,
                            size_t elt_ofs, target_ulong page)
 {
+    CPUTLBDesc *desc = &env_tlb(env)->d[mmu_idx];
+    size_t set = vtlb_set_index(page);
     size_t vidx;
 
     assert_cpu_is_self(env_cpu(env));
-    for (vidx = 0; vidx < CPU_VTLB_SIZE; ++vidx) {
-        CPUTLBEntry *vtlb = &env_tlb(env)->d[mmu_idx].vtable[vidx];
+    for (vidx = set; vidx < set + CPU_VTLB_WAYS; ++vidx) {
+        CPUTLBEntry *vtlb = &desc->vtable[vidx];
         target_ulong cmp;
 
         /* elt_ofs might correspond to .addr_write, so use qatomic_read */
@@ -1462,21 +2048,29 @@ static bool victim_tlb_hit(CPUArchState *env, size_t mmu_idx, size_t index,
 #endif
 
         if (cmp == page) {
-            /* Found entry in victim tlb, swap tlb and iotlb.  */
+            /*
+             * Found entry in victim tlb: move it to the tlb, and the
+             * entry it replaces to its own set in the victim tlb.
+             */
             CPUTLBEntry tmptlb, *tlb = &env_tlb(env)->f[mmu_idx].table[index];
+            CPUIOTLBEntry tmpio, *io = &desc->iotlb[index];
 
             qemu_spin_lock(&env_tlb(env)->c.lock);
             copy_tlb_helper_locked(&tmptlb, tlb);
+            tmpio = *io;
             copy_tlb_helper_locked(tlb, vtlb);
-            copy_tlb_helper_locked(vtlb, &tmptlb);
+            *io = desc->viotlb[vidx];
+            memset(vtlb, -1, sizeof(*vtlb));
+            if (!tlb_entry_is_empty(&tmptlb)) {
+                tlb_vtlb_insert_locked(desc, &tmptlb, &tmpio);
+            }
             qemu_spin_unlock(&env_tlb(env)->c.lock);
 
-            CPUIOTLBEntry tmpio, *io = &env_tlb(env)->d[mmu_idx].iotlb[index];
-            CPUIOTLBEntry *vio = &env_tlb(env)->d[mmu_idx].viotlb[vidx];
-            tmpio = *io; *io = *vio; *vio = tmpio;
+            qatomic_set(&desc->vtlb_hit_count, desc->vtlb_hit_count + 1);
             return true;
         }
     }
+    qatomic_set(&desc->miss_count, desc->miss_count + 1);
     return false;
 }
 
@@ -1599,7 +2193,8 @@ static int probe_access_internal(CPUArchState *env, target_ulong addr,
             CPUState *cs = env_cpu(env);
             CPUClass *cc = CPU_GET_CLASS(cs);
 
-            if (!cc->tcg_ops->tlb_fill(cs, addr, fault_size, access_type,
+            if (!tlb_fill_large_page(cs, addr, access_type, mmu_idx) &&
+                !cc->tcg_ops->tlb_fill(cs, addr, fault_size, access_type,
                                        mmu_idx, nonfault, retaddr)) {
                 /* Non-faulting page table read failed.  */
                 *phost = NULL;
@@ -1935,6 +2530,10 @@ load_helper(CPUArchState *env, target_ulong addr, TCGMemOpIdx oi,
 
         /* Handle I/O access.  */
         if (likely(tlb_addr & TLB_MMIO)) {
+            if (code_read && unlikely(tb_spec_translating)) {
+                /* Do not read devices for speculative translation.  */
+                cpu_loop_exit(env_cpu(env));
+            }
             return io_readx(env, iotlbentry, mmu_idx, addr, retaddr,
                             access_type, op ^ (need_swap * MO_BSWAP));
         }
@@ -1,8 +1,12 @@
 #include "qemu/osdep.h"
 #include "qemu/error-report.h"
+#include "qapi/error.h"
+#include "qapi/qapi-commands-machine.h"
+#include "qapi/qmp/qdict.h"
 #include "exec/exec-all.h"
 #include "monitor/monitor.h"
 #include "sysemu/tcg.h"
+#include "internal.h"
 
 static void hmp_info_jit(Monitor *mon, const QDict *qdict)
 {
@@ -20,10 +24,56 @@ static void hmp_info_opcount(Monitor *mon, const QDict *qdict)
     dump_opcount_info();
 }
 
+static void hmp_info_tlb_stats(Monitor *mon, const QDict *qdict)
+{
+    Error *err = NULL;
+    TlbStatsList *list = qmp_query_tlb_stats(&err);
+    TlbStatsList *l;
+
+    if (err) {
+        error_report_err(err);
+        return;
+    }
+
+    for (l = list; l; l = l->next) {
+        TlbMmuStatsList *m;
+
+        monitor_printf(mon, "CPU #%" PRId64 ":\n", l->value->cpu_index);
+        monitor_printf(mon, "  mmu_idx %8s %8s %12s %12s %12s %8s %12s"
+                       " %12s\n",
+                       "size", "used", "victim-hits", "misses", "fills",
+                       "flushes", "page-flushes", "lpage-fills");
+        for (m = l->value->mmu; m; m = m->next) {
+            TlbMmuStats *s = m->value;
+
+            monitor_printf(mon, "  %7" PRId64 " %8" PRId64 " %8" PRId64
+                           " %12" PRId64 " %12" PRId64 " %12" PRId64
+                           " %8" PRId64 " %12" PRId64 " %12" PRId64 "\n",
+                           s->mmu_idx, s->size, s->used, s->victim_hits,
+                           s->misses, s->fills, s->flushes, s->page_flushes,
+                           s->large_page_fills);
+        }
+    }
+
+    qapi_free_TlbStatsList(list);
+}
+
+static void hmp_info_tcg_profile(Monitor *mon, const QDict *qdict)
+{
+    if (!tcg_enabled()) {
+        error_report("The profiler is only available with accel=tcg");
+        return;
+    }
+
+    tb_profile_dump(mon, qdict_get_try_int(qdict, "max", 20));
+}
+
 static void hmp_tcg_register(void)
 {
     monitor_register_hmp("jit", true, hmp_info_jit);
     monitor_register_hmp("opcount", true, hmp_info_opcount);
+    monitor_register_hmp("tlb-stats", true, hmp_info_tlb_stats);
+    monitor_register_hmp("tcg-profile", true, hmp_info_tcg_profile);
 }
 
 type_init(hmp_tcg_register);
@@ -19,4 +19,26 @@ void QEMU_NORETURN cpu_io_recompile(CPUState *cpu, uintptr_t retaddr);
 void page_init(void);
 void tb_htable_init(void);
 
+extern unsigned int tb_trace_threshold;
+extern bool tb_spec_enabled;
+
+#ifdef CONFIG_SOFTMMU
+void tb_cache_init(const char *path);
+void tb_cache_record(CPUState *cpu, TranslationBlock *tb);
+void tb_cache_prewarm(CPUState *cpu, TranslationBlock *tb);
+void tb_spec_queue(TranslationBlock *tb, int depth);
+void tb_spec_run(CPUState *cpu);
+/* Set while this thread translates speculatively, see tb-spec.c */
+extern __thread bool tb_spec_translating;
+void tb_profile_init(const char *path, uint32_t freq);
+void tb_profile_sample(CPUState *cpu);
+void tb_profile_dump(Monitor *mon, int max);
+#else
+static inline void tb_cache_record(CPUState *cpu, TranslationBlock *tb) { }
+static inline void tb_cache_prewarm(CPUState *cpu, TranslationBlock *tb) { }
+static inline void tb_spec_queue(TranslationBlock *tb, int depth) { }
+static inline void tb_spec_run(CPUState *cpu) { }
+static inline void tb_profile_sample(CPUState *cpu) { }
+#endif
+
 #endif /* ACCEL_TCG_INTERNAL_H */
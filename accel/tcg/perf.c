@@ -0,0 +1,341 @@
+/*
+ * Linux perf perf-<pid>.map and jit-<pid>.dump integration
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Code generated by TCG lives in an anonymous mapping, so perf cannot
+ * tell which TB a sample hit.  Two ways of telling it are supported:
+ *
+ * - /tmp/perf-<pid>.map lists the host range and a name for every TB.
+ *   It is read by "perf report" after the run and carries no time, so
+ *   once tb_flush or region eviction reuses part of the code buffer,
+ *   samples in that part may be attributed to an older TB.
+ *
+ * - ./jit-<pid>.dump is the format documented in perf's
+ *   tools/perf/Documentation/jitdump-specification.txt.  It records the
+ *   host code of every TB along with the guest PC of each instruction,
+ *   and timestamps every TB, so that "perf inject --jit" attributes each
+ *   sample to the TB that occupied the address when the sample was
+ *   taken, however many times the code buffer was reused before.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/error-report.h"
+#include "qemu/timer.h"
+#include "disas/disas.h"
+#include "exec/exec-all.h"
+#include "exec/perf.h"
+#include "elf.h"
+#include "tcg/tcg.h"
+
+static FILE *perfmap;
+static FILE *jitdump;
+static uint64_t jitdump_code_index;
+
+static FILE *safe_fopen_w(const char *path)
+{
+    int saved_errno;
+    FILE *f;
+    int fd;
+
+    /* Delete the old file, if any. */
+    unlink(path);
+
+    /* Avoid symlink attacks by using O_CREAT | O_EXCL. */
+    fd = open(path, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    /* Convert fd to FILE*. */
+    f = fdopen(fd, "w");
+    if (f == NULL) {
+        saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return NULL;
+    }
+
+    return f;
+}
+
+void perf_enable_perfmap(void)
+{
+    g_autofree char *map_file = g_strdup_printf("/tmp/perf-%d.map", getpid());
+
+    perfmap = safe_fopen_w(map_file);
+    if (perfmap == NULL) {
+        warn_report("Could not open %s: %s, proceeding without perfmap",
+                    map_file, strerror(errno));
+    }
+}
+
+/* Get the host PC of the code generated for guest instruction #INSN. */
+static const void *get_host_pc(const void *start, size_t insn)
+{
+    return start + (insn ? tcg_ctx->gen_insn_end_off[insn - 1] : 0);
+}
+
+/* Name of a TB, or of one of its guest instructions. */
+static char *format_guest_pc(uint64_t guest_pc)
+{
+    const char *sym = lookup_symbol(guest_pc);
+
+    if (sym[0]) {
+        return g_strdup_printf("%s [guest 0x%" PRIx64 "]", sym, guest_pc);
+    }
+    return g_strdup_printf("guest-0x%" PRIx64, guest_pc);
+}
+
+static void write_perfmap_entry(const void *start, size_t size,
+                                const char *name)
+{
+    fprintf(perfmap, "%" PRIxPTR " %zx %s\n", (uintptr_t)start, size, name);
+}
+
+/* Magic, version and record types from jitdump-specification.txt. */
+#define JITHEADER_MAGIC 0x4A695444
+#define JITHEADER_VERSION 1
+
+enum {
+    JIT_CODE_LOAD = 0,
+    JIT_CODE_DEBUG_INFO = 2,
+    JIT_CODE_CLOSE = 3,
+};
+
+struct jitheader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_size;
+    uint32_t elf_mach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+};
+
+struct jr_prefix {
+    uint32_t id;
+    uint32_t total_size;
+    uint64_t timestamp;
+};
+
+struct jr_code_load {
+    struct jr_prefix p;
+
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+};
+
+struct debug_entry {
+    uint64_t addr;
+    int lineno;
+    int discrim;
+    const char name[];
+};
+
+struct jr_code_debug_info {
+    struct jr_prefix p;
+
+    uint64_t code_addr;
+    uint64_t nr_entry;
+    struct debug_entry entries[];
+};
+
+/*
+ * perf wants the ELF machine of the code, which is that of QEMU itself:
+ * read it from our own executable rather than mapping host macros.
+ */
+static uint32_t get_e_machine(void)
+{
+    Elf64_Ehdr elf_header;
+    FILE *exe;
+    size_t n;
+
+    QEMU_BUILD_BUG_ON(offsetof(Elf32_Ehdr, e_machine) !=
+                      offsetof(Elf64_Ehdr, e_machine));
+
+    exe = fopen("/proc/self/exe", "r");
+    if (exe == NULL) {
+        return EM_NONE;
+    }
+
+    n = fread(&elf_header, sizeof(elf_header), 1, exe);
+    fclose(exe);
+    if (n != 1) {
+        return EM_NONE;
+    }
+
+    return elf_header.e_machine;
+}
+
+void perf_enable_jitdump(void)
+{
+    g_autofree char *jitdump_file = NULL;
+    struct jitheader header;
+
+    jitdump_file = g_strdup_printf("jit-%d.dump", getpid());
+    jitdump = safe_fopen_w(jitdump_file);
+    if (jitdump == NULL) {
+        warn_report("Could not open %s: %s, proceeding without jitdump",
+                    jitdump_file, strerror(errno));
+        return;
+    }
+
+    /*
+     * "perf inject" will see that the mapped file name in the corresponding
+     * PERF_RECORD_MMAP or PERF_RECORD_MMAP2 event is of the form jit-%d.dump
+     * and will process it as a jitdump file.
+     */
+    if (mmap(NULL, qemu_real_host_page_size, PROT_READ | PROT_EXEC,
+             MAP_PRIVATE, fileno(jitdump), 0) == MAP_FAILED) {
+        warn_report("Could not map %s: %s, proceeding without jitdump",
+                    jitdump_file, strerror(errno));
+        fclose(jitdump);
+        jitdump = NULL;
+        return;
+    }
+
+    header.magic = JITHEADER_MAGIC;
+    header.version = JITHEADER_VERSION;
+    header.total_size = sizeof(header);
+    header.elf_mach = get_e_machine();
+    header.pad1 = 0;
+    header.pid = getpid();
+    header.timestamp = get_clock();
+    header.flags = 0;
+    fwrite(&header, sizeof(header), 1, jitdump);
+}
+
+void perf_report_prologue(const void *start, size_t size)
+{
+    if (perfmap) {
+        write_perfmap_entry(start, size, "TCG prologue");
+    }
+}
+
+/*
+ * Write a JIT_CODE_DEBUG_INFO record mapping each host instruction of
+ * the TB at @start to the guest instruction it was generated from.  perf
+ * shows the guest PC as the source of the host code.
+ */
+static void write_jr_code_debug_info(const void *start, size_t icount,
+                                     uint64_t timestamp)
+{
+    g_autoptr(GPtrArray) names = g_ptr_array_new_with_free_func(g_free);
+    struct jr_code_debug_info rec;
+    struct debug_entry ent;
+    size_t insn, size;
+
+    size = sizeof(rec);
+    for (insn = 0; insn < icount; insn++) {
+        char *name = g_strdup_printf("guest-0x%" PRIx64,
+                                     (uint64_t)tcg_ctx->gen_insn_data[insn][0]);
+
+        g_ptr_array_add(names, name);
+        size += sizeof(ent) + strlen(name) + 1;
+    }
+
+    rec.p.id = JIT_CODE_DEBUG_INFO;
+    rec.p.total_size = size;
+    rec.p.timestamp = timestamp;
+    rec.code_addr = (uintptr_t)start;
+    rec.nr_entry = icount;
+    fwrite(&rec, sizeof(rec), 1, jitdump);
+
+    for (insn = 0; insn < icount; insn++) {
+        const char *name = g_ptr_array_index(names, insn);
+
+        ent.addr = (uintptr_t)get_host_pc(start, insn);
+        ent.lineno = 1;
+        ent.discrim = 0;
+        fwrite(&ent, sizeof(ent), 1, jitdump);
+        fwrite(name, strlen(name) + 1, 1, jitdump);
+    }
+}
+
+/* Write a JIT_CODE_LOAD record, which includes the host code. */
+static void write_jr_code_load(const void *start, size_t size,
+                               const char *name, uint64_t timestamp)
+{
+    static uint32_t pid;
+    struct jr_code_load rec;
+    size_t name_size;
+
+    if (!pid) {
+        pid = getpid();
+    }
+
+    name_size = strlen(name) + 1;
+    rec.p.id = JIT_CODE_LOAD;
+    rec.p.total_size = sizeof(rec) + name_size + size;
+    rec.p.timestamp = timestamp;
+    rec.pid = pid;
+    rec.tid = qemu_get_thread_id();
+    rec.vma = (uintptr_t)start;
+    rec.code_addr = (uintptr_t)start;
+    rec.code_size = size;
+    rec.code_index = jitdump_code_index++;
+    fwrite(&rec, sizeof(rec), 1, jitdump);
+    fwrite(name, name_size, 1, jitdump);
+    fwrite(start, size, 1, jitdump);
+}
+
+void perf_report_code(uint64_t guest_pc, TranslationBlock *tb,
+                      const void *start)
+{
+    g_autofree char *name = NULL;
+    uint64_t timestamp;
+
+    if (!perfmap && !jitdump) {
+        return;
+    }
+
+    name = format_guest_pc(guest_pc);
+
+    /*
+     * Taken before the code can run, so that perf never attributes a
+     * sample in this TB to whatever occupied the same addresses before.
+     */
+    timestamp = get_clock();
+
+    if (perfmap) {
+        write_perfmap_entry(start, tb->tc.size, name);
+    }
+
+    /* Serialize the records of the vCPU threads translating in parallel. */
+    if (jitdump) {
+        flockfile(jitdump);
+        write_jr_code_debug_info(start, tb->icount, timestamp);
+        write_jr_code_load(start, tb->tc.size, name, timestamp);
+        funlockfile(jitdump);
+    }
+}
+
+/*
+ * Other threads may still be translating, so the files are flushed but
+ * left open until the process exits.
+ */
+void perf_exit(void)
+{
+    if (perfmap) {
+        fflush(perfmap);
+    }
+
+    if (jitdump) {
+        struct jr_prefix rec = {
+            .id = JIT_CODE_CLOSE,
+            .total_size = sizeof(rec),
+            .timestamp = get_clock(),
+        };
+
+        flockfile(jitdump);
+        fwrite(&rec, sizeof(rec), 1, jitdump);
+        fflush(jitdump);
+        funlockfile(jitdump);
+    }
+}
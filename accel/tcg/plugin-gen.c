@@ -41,6 +41,10 @@
  * optimization to avoid generating redundant operations. For instance, for the
  * second and all subsequent callbacks of an event, we do not need to reload the
  * CPU's index into a TCG temp, since the first callback did it already.
+ *
+ * Inline ops, and the test guarding conditional callbacks, do not call any
+ * function: they are generated in place with the usual tcg_gen_* functions,
+ * through TCGContext.emit_before_op.
  */
 #include "qemu/osdep.h"
 #include "tcg/tcg.h"
@@ -87,6 +91,12 @@ enum plugin_gen_cb {
 void HELPER(plugin_vcpu_udata_cb)(uint32_t cpu_index, void *udata)
 { }
 
+void HELPER(plugin_vcpu_udata_cb_r)(uint32_t cpu_index, void *udata)
+{ }
+
+void HELPER(plugin_vcpu_udata_cb_rw)(uint32_t cpu_index, void *udata)
+{ }
+
 void HELPER(plugin_vcpu_mem_cb)(unsigned int vcpu_index,
                                 qemu_plugin_meminfo_t info, uint64_t vaddr,
                                 void *userdata)
@@ -124,21 +134,9 @@ static void gen_empty_udata_cb(void)
     tcg_temp_free_i32(cpu_index);
 }
 
-/*
- * For now we only support addi_i64.
- * When we support more ops, we can generate one empty inline cb for each.
- */
+/* Inline ops are generated when injected; only mark where they go. */
 static void gen_empty_inline_cb(void)
 {
-    TCGv_i64 val = tcg_temp_new_i64();
-    TCGv_ptr ptr = tcg_const_ptr(NULL); /* overwritten later */
-
-    tcg_gen_ld_i64(val, ptr, 0);
-    /* pass an immediate != 0 so that it doesn't get optimized away */
-    tcg_gen_addi_i64(val, val, 0xdeadface);
-    tcg_gen_st_i64(val, ptr, 0);
-    tcg_temp_free_ptr(ptr);
-    tcg_temp_free_i64(val);
 }
 
 static void gen_empty_mem_cb(TCGv addr, uint32_t info)
@@ -330,19 +328,6 @@ static TCGOp *copy_extu_tl_i64(TCGOp **begin_op, TCGOp *op)
     return op;
 }
 
-static TCGOp *copy_ld_i64(TCGOp **begin_op, TCGOp *op)
-{
-    if (TCG_TARGET_REG_BITS == 32) {
-        /* 2x ld_i32 */
-        op = copy_op(begin_op, op, INDEX_op_ld_i32);
-        op = copy_op(begin_op, op, INDEX_op_ld_i32);
-    } else {
-        /* ld_i64 */
-        op = copy_op(begin_op, op, INDEX_op_ld_i64);
-    }
-    return op;
-}
-
 static TCGOp *copy_st_i64(TCGOp **begin_op, TCGOp *op)
 {
     if (TCG_TARGET_REG_BITS == 32) {
@@ -356,21 +341,6 @@ static TCGOp *copy_st_i64(TCGOp **begin_op, TCGOp *op)
     return op;
 }
 
-static TCGOp *copy_add_i64(TCGOp **begin_op, TCGOp *op, uint64_t v)
-{
-    if (TCG_TARGET_REG_BITS == 32) {
-        /* all 32-bit backends must implement add2_i32 */
-        g_assert(TCG_TARGET_HAS_add2_i32);
-        op = copy_op(begin_op, op, INDEX_op_add2_i32);
-        op->args[4] = tcgv_i32_arg(tcg_constant_i32(v));
-        op->args[5] = tcgv_i32_arg(tcg_constant_i32(v >> 32));
-    } else {
-        op = copy_op(begin_op, op, INDEX_op_add_i64);
-        op->args[2] = tcgv_i64_arg(tcg_constant_i64(v));
-    }
-    return op;
-}
-
 static TCGOp *copy_st_ptr(TCGOp **begin_op, TCGOp *op)
 {
     if (UINTPTR_MAX == UINT32_MAX) {
@@ -417,13 +387,95 @@ static TCGOp *copy_call(TCGOp **begin_op, TCGOp *op, void *empty_func,
 }
 
 /*
- * When we append/replace ops here we are sensitive to changing patterns of
- * TCGOps generated by the tcg_gen_FOO calls when we generated the
- * empty callbacks. This will assert very quickly in a debug build as
- * we assert the ops we are replacing are the correct ones.
+ * Generate ops with the usual tcg_gen_* functions, but inserted after @op
+ * rather than at the end of the TB.  end_gen_after() returns the last op
+ * generated.
  */
-static TCGOp *append_udata_cb(const struct qemu_plugin_dyn_cb *cb,
-                              TCGOp *begin_op, TCGOp *op, int *cb_idx)
+static void begin_gen_after(TCGOp *op)
+{
+    tcg_debug_assert(tcg_ctx->emit_before_op == NULL);
+    tcg_ctx->emit_before_op = QTAILQ_NEXT(op, link);
+}
+
+static TCGOp *end_gen_after(void)
+{
+    TCGOp *next = tcg_ctx->emit_before_op;
+
+    tcg_ctx->emit_before_op = NULL;
+    return next ? QTAILQ_PREV(next, link) : tcg_last_op();
+}
+
+/* Return the address of @entry for the vCPU executing the code. */
+static TCGv_ptr gen_plugin_u64_ptr(qemu_plugin_u64 entry)
+{
+    TCGv_ptr ptr = tcg_temp_new_ptr();
+    TCGv_i32 cpu_index = tcg_temp_new_i32();
+    GArray *arr = entry.score->data;
+
+    tcg_gen_ld_i32(cpu_index, cpu_env,
+                   -offsetof(ArchCPU, env) + offsetof(CPUState, cpu_index));
+    tcg_gen_muli_i32(cpu_index, cpu_index, g_array_get_element_size(arr));
+    tcg_gen_ext_i32_ptr(ptr, cpu_index);
+    tcg_temp_free_i32(cpu_index);
+    /* The scoreboards only move with the code cache flushed. */
+    tcg_gen_addi_ptr(ptr, ptr, (intptr_t)arr->data + entry.offset);
+    return ptr;
+}
+
+static TCGCond plugin_cond_to_tcg(enum qemu_plugin_cond cond)
+{
+    switch (cond) {
+    case QEMU_PLUGIN_COND_EQ:
+        return TCG_COND_EQ;
+    case QEMU_PLUGIN_COND_NE:
+        return TCG_COND_NE;
+    case QEMU_PLUGIN_COND_LT:
+        return TCG_COND_LTU;
+    case QEMU_PLUGIN_COND_LE:
+        return TCG_COND_LEU;
+    case QEMU_PLUGIN_COND_GT:
+        return TCG_COND_GTU;
+    case QEMU_PLUGIN_COND_GE:
+        return TCG_COND_GEU;
+    default:
+        /* ALWAYS needs no test, and NEVER callbacks are not registered */
+        g_assert_not_reached();
+    }
+}
+
+/*
+ * The callback has the call flags of the empty helper it replaces.
+ * Those of the template only suit callbacks that do not access the
+ * registers, so generate the others with the helper of the right flags.
+ */
+static TCGOp *gen_udata_cb_regs(const struct qemu_plugin_dyn_cb *cb,
+                                TCGOp *op)
+{
+    TCGv_i32 cpu_index;
+    TCGv_ptr udata;
+
+    begin_gen_after(op);
+    cpu_index = tcg_temp_new_i32();
+    udata = tcg_const_ptr(cb->userp);
+    tcg_gen_ld_i32(cpu_index, cpu_env,
+                   -offsetof(ArchCPU, env) + offsetof(CPUState, cpu_index));
+    if (cb->flags == QEMU_PLUGIN_CB_R_REGS) {
+        gen_helper_plugin_vcpu_udata_cb_r(cpu_index, udata);
+    } else {
+        gen_helper_plugin_vcpu_udata_cb_rw(cpu_index, udata);
+    }
+    tcg_temp_free_ptr(udata);
+    tcg_temp_free_i32(cpu_index);
+    op = end_gen_after();
+
+    tcg_debug_assert(op->opc == INDEX_op_call);
+    op->args[TCGOP_CALLO(op) + TCGOP_CALLI(op)] =
+        (uintptr_t)cb->f.vcpu_udata;
+    return op;
+}
+
+static TCGOp *copy_udata_cb(const struct qemu_plugin_dyn_cb *cb,
+                            TCGOp *begin_op, TCGOp *op, int *cb_idx)
 {
     /* const_ptr */
     op = copy_const_ptr(&begin_op, op, cb->userp);
@@ -437,9 +489,52 @@ static TCGOp *append_udata_cb(const struct qemu_plugin_dyn_cb *cb,
     }
 
     /* call */
-    op = copy_call(&begin_op, op, HELPER(plugin_vcpu_udata_cb),
-                   cb->f.vcpu_udata, cb_idx);
+    return copy_call(&begin_op, op, HELPER(plugin_vcpu_udata_cb),
+                     cb->f.vcpu_udata, cb_idx);
+}
 
+/*
+ * When we append/replace ops here we are sensitive to changing patterns of
+ * TCGOps generated by the tcg_gen_FOO calls when we generated the
+ * empty callbacks. This will assert very quickly in a debug build as
+ * we assert the ops we are replacing are the correct ones.
+ */
+static TCGOp *append_udata_cb(const struct qemu_plugin_dyn_cb *cb,
+                              TCGOp *begin_op, TCGOp *op, int *cb_idx)
+{
+    TCGLabel *skip = NULL;
+
+    if (cb->cond.cond != QEMU_PLUGIN_COND_ALWAYS) {
+        TCGCond cond = plugin_cond_to_tcg(cb->cond.cond);
+        TCGv_ptr ptr;
+        TCGv_i64 val;
+
+        begin_gen_after(op);
+        skip = gen_new_label();
+        ptr = gen_plugin_u64_ptr(cb->cond.entry);
+        val = tcg_temp_new_i64();
+        tcg_gen_ld_i64(val, ptr, 0);
+        tcg_gen_brcondi_i64(tcg_invert_cond(cond), val, cb->cond.imm, skip);
+        tcg_temp_free_i64(val);
+        tcg_temp_free_ptr(ptr);
+        op = end_gen_after();
+        /* the branch ends the basic block; do load the CPU's index */
+        *cb_idx = -1;
+    }
+
+    if (cb->flags != QEMU_PLUGIN_CB_NO_REGS) {
+        op = gen_udata_cb_regs(cb, op);
+    } else {
+        op = copy_udata_cb(cb, begin_op, op, cb_idx);
+    }
+
+    if (skip) {
+        begin_gen_after(op);
+        gen_set_label(skip);
+        op = end_gen_after();
+        /* the CPU's index loaded above is dead past the label */
+        *cb_idx = -1;
+    }
     return op;
 }
 
@@ -447,19 +542,33 @@ static TCGOp *append_inline_cb(const struct qemu_plugin_dyn_cb *cb,
                                TCGOp *begin_op, TCGOp *op,
                                int *unused)
 {
-    /* const_ptr */
-    op = copy_const_ptr(&begin_op, op, cb->userp);
-
-    /* ld_i64 */
-    op = copy_ld_i64(&begin_op, op);
+    TCGv_ptr ptr;
+    TCGv_i64 val;
 
-    /* add_i64 */
-    op = copy_add_i64(&begin_op, op, cb->inline_insn.imm);
+    begin_gen_after(op);
+    if (cb->inline_insn.entry.score) {
+        ptr = gen_plugin_u64_ptr(cb->inline_insn.entry);
+    } else {
+        ptr = tcg_const_ptr(cb->userp);
+    }
 
-    /* st_i64 */
-    op = copy_st_i64(&begin_op, op);
+    switch (cb->inline_insn.op) {
+    case QEMU_PLUGIN_INLINE_ADD_U64:
+        val = tcg_temp_new_i64();
+        tcg_gen_ld_i64(val, ptr, 0);
+        tcg_gen_addi_i64(val, val, cb->inline_insn.imm);
+        tcg_gen_st_i64(val, ptr, 0);
+        tcg_temp_free_i64(val);
+        break;
+    case QEMU_PLUGIN_INLINE_STORE_U64:
+        tcg_gen_st_i64(tcg_constant_i64(cb->inline_insn.imm), ptr, 0);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+    tcg_temp_free_ptr(ptr);
 
-    return op;
+    return end_gen_after();
 }
 
 static TCGOp *append_mem_cb(const struct qemu_plugin_dyn_cb *cb,
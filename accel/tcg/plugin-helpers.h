@@ -1,4 +1,6 @@
 #ifdef CONFIG_PLUGIN
 DEF_HELPER_FLAGS_2(plugin_vcpu_udata_cb, TCG_CALL_NO_RWG, void, i32, ptr)
+DEF_HELPER_FLAGS_2(plugin_vcpu_udata_cb_r, TCG_CALL_NO_WG, void, i32, ptr)
+DEF_HELPER_2(plugin_vcpu_udata_cb_rw, void, i32, ptr)
 DEF_HELPER_FLAGS_4(plugin_vcpu_mem_cb, TCG_CALL_NO_RWG, void, i32, i32, i64, ptr)
 #endif
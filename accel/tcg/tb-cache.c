@@ -0,0 +1,307 @@
+/*
+ * Persistent translation block index
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * The TBs translated during a run are recorded, keyed by their guest
+ * virtual address, CPU state flags and a checksum of the guest code they
+ * cover, and written to a file at exit.  On the next run, when the first
+ * TB is translated on a guest page, every TB recorded for that page with
+ * the same CPU state and unchanged guest code is translated right away,
+ * rather than one at a time as execution reaches it, as long as the code
+ * buffer has room for them.
+ *
+ * Only the index is persisted, never host code: generated code embeds
+ * host addresses (helpers, TranslationBlock structs, per-CPU data built
+ * at run time) that change from one run to the next.  Since the index is
+ * only ever used to decide what to translate, a stale or corrupted file
+ * costs some wasted translations but cannot affect guest execution.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qemu/crc32c.h"
+#include "qemu/cutils.h"
+#include "qemu/error-report.h"
+#include "qemu/notify.h"
+#include "qemu/thread.h"
+#include "qapi/error.h"
+#include "exec/exec-all.h"
+#include "sysemu/sysemu.h"
+#include "tcg/tcg.h"
+#include "internal.h"
+
+#define TB_CACHE_MAGIC    "QEMUTBC"
+#define TB_CACHE_VERSION  1
+
+typedef struct QEMU_PACKED TBCacheHeader {
+    char magic[8];
+    uint32_t version;
+    char target[28];
+} TBCacheHeader;
+
+typedef struct QEMU_PACKED TBCacheEntry {
+    uint64_t pc;
+    uint64_t cs_base;
+    uint32_t flags;
+    uint32_t cflags;
+    uint32_t size;
+    uint32_t csum;
+} TBCacheEntry;
+
+static struct {
+    QemuMutex lock;
+    char *path;
+    /* TBCacheEntry -> TBCacheEntry, TBs translated in this run */
+    GHashTable *seen;
+    /* guest page -> GArray of TBCacheEntry, loaded and not yet translated */
+    GHashTable *pending;
+    Notifier exit_notifier;
+} tb_cache;
+
+static guint tb_cache_entry_hash(gconstpointer p)
+{
+    const TBCacheEntry *e = p;
+
+    return e->pc ^ (e->pc >> 32) ^ e->cs_base ^ e->flags ^ e->cflags;
+}
+
+static gboolean tb_cache_entry_equal(gconstpointer ap, gconstpointer bp)
+{
+    const TBCacheEntry *a = ap;
+    const TBCacheEntry *b = bp;
+
+    return a->pc == b->pc && a->cs_base == b->cs_base &&
+           a->flags == b->flags && a->cflags == b->cflags;
+}
+
+static void tb_cache_pending_free(gpointer p)
+{
+    g_array_free(p, true);
+}
+
+/*
+ * Checksum the guest code of a TB that lies within a single page.
+ * Returns false if the code is not in RAM or crosses a page boundary.
+ */
+static bool tb_cache_csum(CPUState *cpu, target_ulong pc, uint32_t size,
+                          uint32_t *csum)
+{
+    void *hostp;
+
+    if (size == 0 ||
+        (pc & TARGET_PAGE_MASK) != ((pc + size - 1) & TARGET_PAGE_MASK)) {
+        return false;
+    }
+    if (get_page_addr_code_hostp(cpu->env_ptr, pc, &hostp) == -1) {
+        return false;
+    }
+    *csum = crc32c(0xffffffff, hostp, size);
+    return true;
+}
+
+static void tb_cache_load(const char *path)
+{
+    TBCacheHeader hdr;
+    TBCacheEntry e;
+    size_t n = 0;
+    FILE *f;
+
+    f = fopen(path, "rb");
+    if (!f) {
+        /* First run: nothing to load yet. */
+        return;
+    }
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+        memcmp(hdr.magic, TB_CACHE_MAGIC, sizeof(TB_CACHE_MAGIC)) ||
+        le32_to_cpu(hdr.version) != TB_CACHE_VERSION ||
+        strncmp(hdr.target, TARGET_NAME, sizeof(hdr.target))) {
+        warn_report("tb-cache: ignoring incompatible file %s", path);
+        fclose(f);
+        return;
+    }
+
+    while (fread(&e, sizeof(e), 1, f) == 1) {
+        uint64_t page;
+        GArray *arr;
+
+        e.pc = le64_to_cpu(e.pc);
+        e.cs_base = le64_to_cpu(e.cs_base);
+        e.flags = le32_to_cpu(e.flags);
+        e.cflags = le32_to_cpu(e.cflags);
+        e.size = le32_to_cpu(e.size);
+        e.csum = le32_to_cpu(e.csum);
+
+        page = e.pc & TARGET_PAGE_MASK;
+        arr = g_hash_table_lookup(tb_cache.pending, &page);
+        if (!arr) {
+            uint64_t *key = g_new(uint64_t, 1);
+
+            *key = page;
+            arr = g_array_new(false, false, sizeof(TBCacheEntry));
+            g_hash_table_insert(tb_cache.pending, key, arr);
+        }
+        g_array_append_val(arr, e);
+        n++;
+    }
+    fclose(f);
+    info_report("tb-cache: loaded %zu entries from %s", n, path);
+}
+
+static void tb_cache_save(Notifier *n, void *data)
+{
+    TBCacheHeader hdr = { .magic = TB_CACHE_MAGIC };
+    GHashTableIter iter;
+    TBCacheEntry *e;
+    g_autofree char *tmp = g_strdup_printf("%s.tmp", tb_cache.path);
+    FILE *f;
+
+    f = fopen(tmp, "wb");
+    if (!f) {
+        warn_report("tb-cache: cannot create %s: %s", tmp, strerror(errno));
+        return;
+    }
+    hdr.version = cpu_to_le32(TB_CACHE_VERSION);
+    pstrcpy(hdr.target, sizeof(hdr.target), TARGET_NAME);
+    if (fwrite(&hdr, sizeof(hdr), 1, f) != 1) {
+        goto fail;
+    }
+
+    qemu_mutex_lock(&tb_cache.lock);
+    g_hash_table_iter_init(&iter, tb_cache.seen);
+    while (g_hash_table_iter_next(&iter, (gpointer *)&e, NULL)) {
+        TBCacheEntry le = {
+            .pc = cpu_to_le64(e->pc),
+            .cs_base = cpu_to_le64(e->cs_base),
+            .flags = cpu_to_le32(e->flags),
+            .cflags = cpu_to_le32(e->cflags),
+            .size = cpu_to_le32(e->size),
+            .csum = cpu_to_le32(e->csum),
+        };
+
+        if (fwrite(&le, sizeof(le), 1, f) != 1) {
+            qemu_mutex_unlock(&tb_cache.lock);
+            goto fail;
+        }
+    }
+    qemu_mutex_unlock(&tb_cache.lock);
+
+    if (fclose(f) != 0 || rename(tmp, tb_cache.path) != 0) {
+        warn_report("tb-cache: cannot write %s: %s",
+                    tb_cache.path, strerror(errno));
+        unlink(tmp);
+    }
+    return;
+
+ fail:
+    warn_report("tb-cache: cannot write %s: %s", tmp, strerror(errno));
+    fclose(f);
+    unlink(tmp);
+}
+
+void tb_cache_init(const char *path)
+{
+    qemu_mutex_init(&tb_cache.lock);
+    tb_cache.path = g_strdup(path);
+    tb_cache.seen = g_hash_table_new_full(tb_cache_entry_hash,
+                                          tb_cache_entry_equal,
+                                          g_free, NULL);
+    tb_cache.pending = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                             g_free, tb_cache_pending_free);
+    tb_cache_load(path);
+
+    tb_cache.exit_notifier.notify = tb_cache_save;
+    qemu_add_exit_notifier(&tb_cache.exit_notifier);
+}
+
+void tb_cache_record(CPUState *cpu, TranslationBlock *tb)
+{
+    TBCacheEntry *e;
+
+    if (!tb_cache.path) {
+        return;
+    }
+
+    e = g_new(TBCacheEntry, 1);
+    e->pc = tb->pc;
+    e->cs_base = tb->cs_base;
+    e->flags = tb->flags;
+    e->cflags = tb_lookup_cflags(tb) & ~CF_INVALID;
+    e->size = tb->size;
+    if (!tb_cache_csum(cpu, tb->pc, tb->size, &e->csum)) {
+        g_free(e);
+        return;
+    }
+
+    qemu_mutex_lock(&tb_cache.lock);
+    g_hash_table_replace(tb_cache.seen, e, e);
+    qemu_mutex_unlock(&tb_cache.lock);
+}
+
+/*
+ * Prewarming is speculative: stop once the code buffer is mostly full,
+ * rather than evict code that is in use for code that may never run.
+ */
+static bool tb_cache_has_room(void)
+{
+    return tcg_code_size() < tcg_code_capacity() - tcg_code_capacity() / 8;
+}
+
+/*
+ * Remove and return in @e the next entry recorded on @page, if any.
+ * Entries are taken one at a time because tb_gen_code() may still exit
+ * to the execution loop when the code buffer fills up; the entries not
+ * taken yet stay pending for the next translation on the page.
+ */
+static bool tb_cache_pop(uint64_t page, TBCacheEntry *e)
+{
+    GArray *arr;
+    bool found = false;
+
+    qemu_mutex_lock(&tb_cache.lock);
+    arr = g_hash_table_lookup(tb_cache.pending, &page);
+    if (arr) {
+        *e = g_array_index(arr, TBCacheEntry, arr->len - 1);
+        g_array_set_size(arr, arr->len - 1);
+        if (arr->len == 0) {
+            g_hash_table_remove(tb_cache.pending, &page);
+        }
+        found = true;
+    }
+    qemu_mutex_unlock(&tb_cache.lock);
+    return found;
+}
+
+/*
+ * Translate the TBs that were recorded on @tb's page in a previous run
+ * with the same CPU state as @tb.  The CPU state requirement ensures that
+ * the MMU context used to look up the page is the one the TBs were
+ * recorded with.
+ */
+void tb_cache_prewarm(CPUState *cpu, TranslationBlock *tb)
+{
+    uint64_t page = tb->pc & TARGET_PAGE_MASK;
+    uint32_t cflags = tb_lookup_cflags(tb) & ~CF_INVALID;
+    TBCacheEntry e;
+
+    if (!tb_cache.path || tb->page_addr[0] == -1) {
+        return;
+    }
+
+    /*
+     * Entries recorded with a different CPU state are dropped: the page
+     * is not looked at again, but they were recorded anew in this run
+     * if they were translated.
+     */
+    while (tb_cache_has_room() && tb_cache_pop(page, &e)) {
+        uint32_t csum;
+
+        if (e.cs_base != tb->cs_base || e.flags != tb->flags ||
+            e.cflags != cflags ||
+            !tb_cache_csum(cpu, e.pc, e.size, &csum) || csum != e.csum ||
+            tb_htable_lookup(cpu, e.pc, e.cs_base, e.flags, e.cflags)) {
+            continue;
+        }
+        tb_gen_code(cpu, e.pc, e.cs_base, e.flags, e.cflags);
+    }
+}
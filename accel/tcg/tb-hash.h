@@ -59,6 +59,47 @@ static inline unsigned int tb_jmp_cache_hash_func(target_ulong pc)
 
 #endif /* CONFIG_SOFTMMU */
 
+/*
+ * Make @tb, found in way @way of set @hash, the most recently used entry
+ * of the set.  With @way == TB_JMP_CACHE_WAYS - 1 this inserts a new TB,
+ * dropping the least recently used one.  Only the owner of @cpu updates
+ * the order; a concurrent tb_jmp_cache_remove() may leave a stale TB in
+ * the set, which is harmless since invalid TBs never match a lookup.
+ */
+static inline void tb_jmp_cache_promote(CPUState *cpu, unsigned int hash,
+                                        TranslationBlock *tb, int way)
+{
+    TranslationBlock **set = cpu->tb_jmp_cache[hash];
+
+    for (; way > 0; way--) {
+        qatomic_set(&set[way], qatomic_read(&set[way - 1]));
+    }
+    qatomic_set(&set[0], tb);
+}
+
+static inline void tb_jmp_cache_insert(CPUState *cpu, TranslationBlock *tb)
+{
+    tb_jmp_cache_promote(cpu, tb_jmp_cache_hash_func(tb->pc), tb,
+                         TB_JMP_CACHE_WAYS - 1);
+}
+
+static inline void tb_jmp_cache_remove(CPUState *cpu, TranslationBlock *tb)
+{
+    TranslationBlock **set = cpu->tb_jmp_cache[tb_jmp_cache_hash_func(tb->pc)];
+    int way;
+
+    for (way = 0; way < TB_JMP_CACHE_WAYS; way++) {
+        if (qatomic_read(&set[way]) == tb) {
+            qatomic_set(&set[way], NULL);
+        }
+    }
+}
+
+static inline unsigned int tb_jmp_pred_hash_func(uintptr_t site)
+{
+    return (site ^ (site >> TB_JMP_PRED_BITS)) & (TB_JMP_PRED_SIZE - 1);
+}
+
 static inline
 uint32_t tb_hash_func(tb_page_addr_t phys_pc, target_ulong pc, uint32_t flags,
                       uint32_t cf_mask, uint32_t trace_vcpu_dstate)
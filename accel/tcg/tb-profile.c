@@ -0,0 +1,221 @@
+/*
+ * Statistical profiling of the guest
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * A host timer fires at a fixed frequency and asks every vCPU that is not
+ * halted to stop executing chained TBs, exactly as cpu_exit() does but
+ * without requesting an exit from the execution loop.  The vCPU notices
+ * the request on the path taken by such stops, records the guest PC it
+ * was about to execute, and carries on.  The TB execution path itself is
+ * left alone, so the cost is one unchained TB per vCPU and sample.
+ *
+ * Samples are counted per vCPU and PC, and written at exit in the folded
+ * format used by flame graph tools, one "vcpu0;symbol;0xpc count" line
+ * per PC, with the symbols of the ELF images loaded by QEMU.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/error-report.h"
+#include "qemu/main-loop.h"
+#include "qemu/notify.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "disas/disas.h"
+#include "exec/exec-all.h"
+#include "monitor/monitor.h"
+#include "sysemu/sysemu.h"
+#include "internal.h"
+
+typedef struct TBProfileSample {
+    uint64_t pc;
+    int cpu_index;
+    uint64_t count;
+} TBProfileSample;
+
+static struct {
+    QemuMutex lock;
+    char *path;
+    int64_t period_ns;
+    QEMUTimer *timer;
+    /* TBProfileSample, keyed by vCPU and PC */
+    GHashTable *samples;
+    uint64_t total;
+    Notifier exit_notifier;
+} tb_profile;
+
+static guint tb_profile_sample_hash(gconstpointer p)
+{
+    const TBProfileSample *s = p;
+
+    return s->pc ^ (s->pc >> 32) ^ s->cpu_index;
+}
+
+static gboolean tb_profile_sample_equal(gconstpointer ap, gconstpointer bp)
+{
+    const TBProfileSample *a = ap;
+    const TBProfileSample *b = bp;
+
+    return a->pc == b->pc && a->cpu_index == b->cpu_index;
+}
+
+static void tb_profile_tick(void *opaque)
+{
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        if (cpu->halted) {
+            continue;
+        }
+        qatomic_set(&cpu->profile_request, true);
+        /* Make the request visible before the stop, as cpu_exit() does. */
+        smp_wmb();
+        qatomic_set(&cpu_neg(cpu)->icount_decr.u16.high, -1);
+    }
+    timer_mod(tb_profile.timer,
+              qemu_clock_get_ns(QEMU_CLOCK_REALTIME) + tb_profile.period_ns);
+}
+
+/* Called by @cpu when it stops executing chained TBs at our request. */
+void tb_profile_sample(CPUState *cpu)
+{
+    CPUArchState *env = cpu->env_ptr;
+    TBProfileSample key, *s;
+    target_ulong pc, cs_base;
+    uint32_t flags;
+
+    if (!qatomic_xchg(&cpu->profile_request, false)) {
+        return;
+    }
+    cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+    key.pc = pc;
+    key.cpu_index = cpu->cpu_index;
+
+    qemu_mutex_lock(&tb_profile.lock);
+    s = g_hash_table_lookup(tb_profile.samples, &key);
+    if (!s) {
+        s = g_memdup(&key, sizeof(key));
+        s->count = 0;
+        g_hash_table_add(tb_profile.samples, s);
+    }
+    s->count++;
+    tb_profile.total++;
+    qemu_mutex_unlock(&tb_profile.lock);
+}
+
+static const char *tb_profile_symbol(uint64_t pc)
+{
+    const char *sym = lookup_symbol(pc);
+
+    return sym[0] ? sym : "[unknown]";
+}
+
+static void tb_profile_save(Notifier *n, void *data)
+{
+    GHashTableIter iter;
+    TBProfileSample *s;
+    FILE *f;
+
+    timer_del(tb_profile.timer);
+
+    f = fopen(tb_profile.path, "w");
+    if (!f) {
+        warn_report("tcg profile: cannot create %s: %s",
+                    tb_profile.path, strerror(errno));
+        return;
+    }
+
+    qemu_mutex_lock(&tb_profile.lock);
+    g_hash_table_iter_init(&iter, tb_profile.samples);
+    while (g_hash_table_iter_next(&iter, (gpointer *)&s, NULL)) {
+        fprintf(f, "vcpu%d;%s;0x%" PRIx64 " %" PRIu64 "\n",
+                s->cpu_index, tb_profile_symbol(s->pc), s->pc, s->count);
+    }
+    qemu_mutex_unlock(&tb_profile.lock);
+
+    if (fclose(f) != 0) {
+        warn_report("tcg profile: cannot write %s: %s",
+                    tb_profile.path, strerror(errno));
+    }
+}
+
+void tb_profile_init(const char *path, uint32_t freq)
+{
+    qemu_mutex_init(&tb_profile.lock);
+    tb_profile.path = g_strdup(path);
+    tb_profile.period_ns = NANOSECONDS_PER_SECOND / MAX(freq, 1);
+    tb_profile.samples = g_hash_table_new_full(tb_profile_sample_hash,
+                                               tb_profile_sample_equal,
+                                               g_free, NULL);
+    tb_profile.timer = timer_new_ns(QEMU_CLOCK_REALTIME, tb_profile_tick,
+                                    NULL);
+    timer_mod(tb_profile.timer,
+              qemu_clock_get_ns(QEMU_CLOCK_REALTIME) + tb_profile.period_ns);
+
+    tb_profile.exit_notifier.notify = tb_profile_save;
+    qemu_add_exit_notifier(&tb_profile.exit_notifier);
+}
+
+typedef struct TBProfileSymbol {
+    const char *name;
+    uint64_t count;
+} TBProfileSymbol;
+
+static gint tb_profile_symbol_cmp(gconstpointer ap, gconstpointer bp)
+{
+    const TBProfileSymbol *a = ap;
+    const TBProfileSymbol *b = bp;
+
+    return a->count < b->count ? 1 : a->count > b->count ? -1 : 0;
+}
+
+/* Print the @max symbols with the most samples, all vCPUs together. */
+void tb_profile_dump(Monitor *mon, int max)
+{
+    g_autoptr(GHashTable) syms = g_hash_table_new(g_str_hash, g_str_equal);
+    g_autoptr(GArray) sorted = g_array_new(false, false,
+                                           sizeof(TBProfileSymbol));
+    GHashTableIter iter;
+    TBProfileSample *s;
+    gpointer name, count;
+    uint64_t total;
+    guint i;
+
+    if (!tb_profile.path) {
+        monitor_printf(mon, "The profiler is not enabled, "
+                       "see -accel tcg,profile=FILE\n");
+        return;
+    }
+
+    qemu_mutex_lock(&tb_profile.lock);
+    total = tb_profile.total;
+    g_hash_table_iter_init(&iter, tb_profile.samples);
+    while (g_hash_table_iter_next(&iter, (gpointer *)&s, NULL)) {
+        const char *sym = tb_profile_symbol(s->pc);
+        uint64_t *c = g_hash_table_lookup(syms, sym);
+
+        if (!c) {
+            c = g_new0(uint64_t, 1);
+            g_hash_table_insert(syms, (gpointer)sym, c);
+        }
+        *c += s->count;
+    }
+    qemu_mutex_unlock(&tb_profile.lock);
+
+    g_hash_table_iter_init(&iter, syms);
+    while (g_hash_table_iter_next(&iter, &name, &count)) {
+        TBProfileSymbol sym = { name, *(uint64_t *)count };
+
+        g_array_append_val(sorted, sym);
+        g_free(count);
+    }
+    g_array_sort(sorted, tb_profile_symbol_cmp);
+
+    monitor_printf(mon, "%" PRIu64 " samples\n", total);
+    for (i = 0; i < sorted->len && i < max; i++) {
+        TBProfileSymbol *sym = &g_array_index(sorted, TBProfileSymbol, i);
+
+        monitor_printf(mon, "%12" PRIu64 " %6.2f%%  %s\n", sym->count,
+                       100.0 * sym->count / total, sym->name);
+    }
+}
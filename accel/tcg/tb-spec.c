@@ -0,0 +1,180 @@
+/*
+ * Speculative translation of the successors of new TBs
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * When a TB is translated, the targets of its direct jumps on the same
+ * page are queued: they are not translated yet, since the TB could not
+ * have run before, and are likely to be needed soon.  A vCPU that halts,
+ * and would otherwise sit idle until its next interrupt, translates
+ * queued TBs that are not in the hash table yet, so that the vCPUs that
+ * are running find them there instead of stopping to translate them.
+ * The successors of speculatively translated TBs are queued in turn, up
+ * to TB_SPEC_DEPTH jumps away from code that actually ran.
+ *
+ * Translation is done by the halted vCPU with its own TCG context and its
+ * own view of guest memory, so it needs MTTCG: with a single TCG thread it
+ * would delay the running vCPUs.  The TB is keyed by the physical address
+ * the halted vCPU sees, so it is only ever found by vCPUs mapping its code
+ * at the same physical address.  The first page is probed without faulting
+ * before translation; if the translator goes on to a page that would fault
+ * or is not RAM, the TB is dropped rather than a guest exception raised.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/thread.h"
+#include "qemu/rcu.h"
+#include "cpu.h"
+#include "exec/exec-all.h"
+#include "tb-context.h"
+#include "internal.h"
+
+/*
+ * Requests kept at most; the oldest ones are dropped.  The most recent
+ * requests, which are closest to the code running now, are served first.
+ */
+#define TB_SPEC_QUEUE_SIZE  256
+
+/* TBs translated at most each time a vCPU halts. */
+#define TB_SPEC_BUDGET      16
+
+/* Direct jumps followed at most from a TB that was executed. */
+#define TB_SPEC_DEPTH       2
+
+typedef struct TBSpecRequest {
+    target_ulong pc;
+    target_ulong cs_base;
+    uint32_t flags;
+    uint32_t cflags;
+    int depth;
+} TBSpecRequest;
+
+__thread bool tb_spec_translating;
+
+static struct {
+    QemuSpin lock;
+    unsigned head;
+    unsigned tail;
+    TBSpecRequest req[TB_SPEC_QUEUE_SIZE];
+} tb_spec;
+
+static void __attribute__((constructor)) tb_spec_init(void)
+{
+    qemu_spin_init(&tb_spec.lock);
+}
+
+/*
+ * Queue the successors of @tb, which is @depth direct jumps away from
+ * code that was executed.
+ */
+void tb_spec_queue(TranslationBlock *tb, int depth)
+{
+    uint32_t cflags = tb_lookup_cflags(tb);
+    uint32_t i;
+
+    if ((cflags & CF_INVALID) || depth >= TB_SPEC_DEPTH) {
+        return;
+    }
+
+    qemu_spin_lock(&tb_spec.lock);
+    for (i = 0; i < tb->num_succ; i++) {
+        TBSpecRequest *r;
+
+        if (tb_spec.tail - tb_spec.head == TB_SPEC_QUEUE_SIZE) {
+            tb_spec.head++;
+        }
+        r = &tb_spec.req[tb_spec.tail++ % TB_SPEC_QUEUE_SIZE];
+        r->pc = tb->succ_pc[i];
+        r->cs_base = tb->cs_base;
+        r->flags = tb->flags;
+        r->cflags = cflags;
+        r->depth = depth + 1;
+    }
+    qemu_spin_unlock(&tb_spec.lock);
+}
+
+static bool tb_spec_pop(TBSpecRequest *r)
+{
+    bool ret = false;
+
+    qemu_spin_lock(&tb_spec.lock);
+    if (tb_spec.head != tb_spec.tail) {
+        *r = tb_spec.req[--tb_spec.tail % TB_SPEC_QUEUE_SIZE];
+        ret = true;
+    }
+    qemu_spin_unlock(&tb_spec.lock);
+    return ret;
+}
+
+/* Return true if the code at @addr can be fetched by @cpu without faults. */
+static bool tb_spec_probe(CPUState *cpu, target_ulong addr)
+{
+    CPUArchState *env = cpu->env_ptr;
+    void *host;
+    int flags;
+
+    flags = probe_access_flags(env, addr, MMU_INST_FETCH,
+                               cpu_mmu_index(env, true), true, &host, 0);
+    return !(flags & (TLB_INVALID_MASK | TLB_MMIO));
+}
+
+static void tb_spec_translate(CPUState *cpu, const TBSpecRequest *r)
+{
+    TranslationBlock *tb;
+
+    if ((r->cflags & CF_CLUSTER_MASK) !=
+        (curr_cflags(cpu) & CF_CLUSTER_MASK)) {
+        /* The TB would be translated for another kind of CPU. */
+        return;
+    }
+
+    /* A second page, if any, is checked by tlb_fill as it is reached.  */
+    if (!tb_spec_probe(cpu, r->pc)) {
+        return;
+    }
+    if (tb_htable_lookup(cpu, r->pc, r->cs_base, r->flags, r->cflags)) {
+        return;
+    }
+
+    mmap_lock();
+    tb_spec_translating = true;
+    tb = tb_gen_code(cpu, r->pc, r->cs_base, r->flags, r->cflags);
+    tb_spec_translating = false;
+    mmap_unlock();
+    qatomic_set(&tb_ctx.tb_spec_count, tb_ctx.tb_spec_count + 1);
+    tb_spec_queue(tb, r->depth);
+}
+
+/*
+ * Called by a halted vCPU, between cpu_exec_start and cpu_exec_end, so
+ * that translation does not race with exclusive work such as tb_flush.
+ */
+void tb_spec_run(CPUState *cpu)
+{
+    int exception_index = cpu->exception_index;
+    TBSpecRequest r;
+    int budget;
+
+    rcu_read_lock();
+    if (sigsetjmp(cpu->jmp_env, 0) != 0) {
+        /*
+         * Either the code of the TB is not mapped, or the code buffer is
+         * full: then tb_gen_code has scheduled the flush and requested an
+         * exit, which the halted vCPU does not need.
+         */
+        tb_spec_translating = false;
+        assert_no_pages_locked();
+        cpu->exception_index = exception_index;
+        rcu_read_unlock();
+        return;
+    }
+
+    for (budget = TB_SPEC_BUDGET; budget > 0; budget--) {
+        if (cpu_has_work(cpu) || qatomic_read(&cpu->exit_request) ||
+            !tb_spec_pop(&r)) {
+            break;
+        }
+        tb_spec_translate(cpu, &r);
+    }
+    rcu_read_unlock();
+}
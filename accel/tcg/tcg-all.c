@@ -33,8 +33,10 @@
 #include "qemu/accel.h"
 #include "qapi/qapi-builtin-visit.h"
 #include "qemu/units.h"
+#include "exec/perf.h"
 #if !defined(CONFIG_USER_ONLY)
 #include "hw/boards.h"
+#include "sysemu/sysemu.h"
 #endif
 #include "internal.h"
 
@@ -44,6 +46,14 @@ struct TCGState {
     bool mttcg_enabled;
     int splitwx_enabled;
     unsigned long tb_size;
+    bool tb_evict_region;
+    char *tb_cache;
+    uint32_t tb_trace_threshold;
+    bool tb_spec;
+    char *profile;
+    uint32_t profile_freq;
+    bool perfmap;
+    bool jitdump;
 };
 typedef struct TCGState TCGState;
 
@@ -106,10 +116,20 @@ static void tcg_accel_instance_init(Object *obj)
 #else
     s->splitwx_enabled = 0;
 #endif
+    s->profile_freq = 100;
 }
 
 bool mttcg_enabled;
 
+#if defined(CONFIG_SOFTMMU)
+static Notifier perf_exit_notifier;
+
+static void tcg_perf_exit(Notifier *n, void *data)
+{
+    perf_exit();
+}
+#endif
+
 static int tcg_init_machine(MachineState *ms)
 {
     TCGState *s = TCG_STATE(current_accel());
@@ -117,16 +137,45 @@ static int tcg_init_machine(MachineState *ms)
     unsigned max_cpus = 1;
 #else
     unsigned max_cpus = ms->smp.max_cpus;
+
+    /*
+     * With a single TCG thread, a halted vCPU would translate on the
+     * thread that runs the other vCPUs, and only slow them down.
+     */
+    if (s->tb_spec && !s->mttcg_enabled) {
+        error_report("tb-spec=on requires thread=multi");
+        return -EINVAL;
+    }
 #endif
 
     tcg_allowed = true;
     mttcg_enabled = s->mttcg_enabled;
+    tb_trace_threshold = s->tb_trace_threshold;
 
     page_init();
     tb_htable_init();
-    tcg_init(s->tb_size * MiB, s->splitwx_enabled, max_cpus);
+    tcg_init(s->tb_size * MiB, s->splitwx_enabled, max_cpus,
+             s->tb_evict_region);
 
 #if defined(CONFIG_SOFTMMU)
+    if (s->tb_cache) {
+        tb_cache_init(s->tb_cache);
+    }
+    tb_spec_enabled = s->tb_spec;
+    if (s->profile) {
+        tb_profile_init(s->profile, s->profile_freq);
+    }
+    if (s->perfmap) {
+        perf_enable_perfmap();
+    }
+    if (s->jitdump) {
+        perf_enable_jitdump();
+    }
+    if (s->perfmap || s->jitdump) {
+        perf_exit_notifier.notify = tcg_perf_exit;
+        qemu_add_exit_notifier(&perf_exit_notifier);
+    }
+
     /*
      * There's no guest base to take into account, so go ahead and
      * initialize the prologue now.
@@ -196,6 +245,147 @@ static void tcg_set_tb_size(Object *obj, Visitor *v,
     s->tb_size = value;
 }
 
+static void tcg_get_tb_trace_threshold(Object *obj, Visitor *v,
+                                       const char *name, void *opaque,
+                                       Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->tb_trace_threshold;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_tb_trace_threshold(Object *obj, Visitor *v,
+                                       const char *name, void *opaque,
+                                       Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+
+    s->tb_trace_threshold = value;
+}
+
+static bool tcg_get_tb_spec(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    return s->tb_spec;
+}
+
+static void tcg_set_tb_spec(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    s->tb_spec = value;
+}
+
+static char *tcg_get_tb_evict(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    return g_strdup(s->tb_evict_region ? "region" : "flush");
+}
+
+static void tcg_set_tb_evict(Object *obj, const char *value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    if (strcmp(value, "region") == 0) {
+        s->tb_evict_region = true;
+    } else if (strcmp(value, "flush") == 0) {
+        s->tb_evict_region = false;
+    } else {
+        error_setg(errp, "Invalid 'tb-evict' setting %s", value);
+    }
+}
+
+#if !defined(CONFIG_USER_ONLY)
+static char *tcg_get_tb_cache(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    return g_strdup(s->tb_cache);
+}
+
+static void tcg_set_tb_cache(Object *obj, const char *value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    g_free(s->tb_cache);
+    s->tb_cache = g_strdup(value);
+}
+
+static char *tcg_get_profile(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    return g_strdup(s->profile);
+}
+
+static void tcg_set_profile(Object *obj, const char *value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    g_free(s->profile);
+    s->profile = g_strdup(value);
+}
+
+static void tcg_get_profile_freq(Object *obj, Visitor *v,
+                                 const char *name, void *opaque,
+                                 Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->profile_freq;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_profile_freq(Object *obj, Visitor *v,
+                                 const char *name, void *opaque,
+                                 Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (value == 0 || value > 10000) {
+        error_setg(errp, "Invalid 'profile-freq' %u, "
+                   "must be between 1 and 10000", value);
+        return;
+    }
+
+    s->profile_freq = value;
+}
+
+static bool tcg_get_perfmap(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    return s->perfmap;
+}
+
+static void tcg_set_perfmap(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    s->perfmap = value;
+}
+
+static bool tcg_get_jitdump(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    return s->jitdump;
+}
+
+static void tcg_set_jitdump(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    s->jitdump = value;
+}
+#endif
+
 static bool tcg_get_splitwx(Object *obj, Error **errp)
 {
     TCGState *s = TCG_STATE(obj);
@@ -225,6 +415,53 @@ static void tcg_accel_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "tb-size",
         "TCG translation block cache size");
 
+    object_class_property_add(oc, "tb-trace-threshold", "int",
+        tcg_get_tb_trace_threshold, tcg_set_tb_trace_threshold,
+        NULL, NULL);
+    object_class_property_set_description(oc, "tb-trace-threshold",
+        "Executions after which a TB is retranslated as a superblock");
+
+    object_class_property_add_str(oc, "tb-evict",
+                                  tcg_get_tb_evict,
+                                  tcg_set_tb_evict);
+    object_class_property_set_description(oc, "tb-evict",
+        "TCG translation block cache eviction policy (flush or region)");
+
+#if !defined(CONFIG_USER_ONLY)
+    object_class_property_add_str(oc, "tb-cache",
+                                  tcg_get_tb_cache,
+                                  tcg_set_tb_cache);
+    object_class_property_set_description(oc, "tb-cache",
+        "File recording translated blocks across runs");
+
+    object_class_property_add_bool(oc, "tb-spec",
+        tcg_get_tb_spec, tcg_set_tb_spec);
+    object_class_property_set_description(oc, "tb-spec",
+        "Translate the successors of new TBs on idle vCPUs");
+
+    object_class_property_add_str(oc, "profile",
+                                  tcg_get_profile,
+                                  tcg_set_profile);
+    object_class_property_set_description(oc, "profile",
+        "File receiving the samples of the guest profiler");
+
+    object_class_property_add(oc, "profile-freq", "int",
+        tcg_get_profile_freq, tcg_set_profile_freq,
+        NULL, NULL);
+    object_class_property_set_description(oc, "profile-freq",
+        "Guest profiler samples per second and vCPU");
+
+    object_class_property_add_bool(oc, "perfmap",
+        tcg_get_perfmap, tcg_set_perfmap);
+    object_class_property_set_description(oc, "perfmap",
+        "Write translated blocks to /tmp/perf-<pid>.map for perf");
+
+    object_class_property_add_bool(oc, "jitdump",
+        tcg_get_jitdump, tcg_set_jitdump);
+    object_class_property_set_description(oc, "jitdump",
+        "Write translated blocks to jit-<pid>.dump for perf");
+#endif
+
     object_class_property_add_bool(oc, "split-wx",
         tcg_get_splitwx, tcg_set_splitwx);
     object_class_property_set_description(oc, "split-wx",
@@ -52,6 +52,7 @@
 #include "qemu/timer.h"
 #include "qemu/main-loop.h"
 #include "exec/log.h"
+#include "exec/perf.h"
 #include "sysemu/cpus.h"
 #include "sysemu/cpu-timers.h"
 #include "sysemu/tcg.h"
@@ -893,7 +894,8 @@ static bool tb_cmp(const void *ap, const void *bp)
     return a->pc == b->pc &&
         a->cs_base == b->cs_base &&
         a->flags == b->flags &&
-        (tb_cflags(a) & ~CF_INVALID) == (tb_cflags(b) & ~CF_INVALID) &&
+        (tb_lookup_cflags(a) & ~CF_INVALID) ==
+        (tb_lookup_cflags(b) & ~CF_INVALID) &&
         a->trace_vcpu_dstate == b->trace_vcpu_dstate &&
         a->page_addr[0] == b->page_addr[0] &&
         a->page_addr[1] == b->page_addr[1];
@@ -1017,6 +1019,87 @@ void tb_flush(CPUState *cpu)
     }
 }
 
+static gboolean tb_clear_ret_iter(gpointer key, gpointer value, gpointer data)
+{
+    TranslationBlock *tb = value;
+
+    qatomic_set(&tb->ret_tb, NULL);
+    return false;
+}
+
+static gboolean tb_evict_iter(gpointer key, gpointer value, gpointer data)
+{
+    TranslationBlock *tb = value;
+    size_t *nb_tbs = data;
+
+    tb_phys_invalidate(tb, -1);
+    (*nb_tbs)++;
+    return false;
+}
+
+/*
+ * Make room in the code buffer by invalidating the TBs of a single region,
+ * leaving those of the other regions in place.  Unlike do_tb_flush we do
+ * not invoke the plugin flush callback: TBs outside of the evicted region
+ * still reference their plugin data.
+ */
+static void do_tb_evict(CPUState *cpu, run_on_cpu_data tb_flush_count)
+{
+    CPUState *other;
+    size_t nb_tbs = 0;
+    bool evicted;
+
+    mmap_lock();
+    /* A full flush since the request was made has already made room. */
+    if (tb_ctx.tb_flush_count != tb_flush_count.host_int) {
+        mmap_unlock();
+        return;
+    }
+
+    qemu_thread_jit_write();
+    evicted = tcg_region_evict(tb_evict_iter, &nb_tbs);
+    qemu_thread_jit_execute();
+    if (evicted) {
+        /*
+         * The jump caches and return address stacks may still hold stale
+         * or predicted TBs of the evicted region, whose memory is about
+         * to be reused.
+         */
+        CPU_FOREACH(other) {
+            cpu_tb_jmp_cache_clear(other);
+        }
+        /* Likewise for the returns predicted by the remaining TBs. */
+        tcg_tb_foreach(tb_clear_ret_iter, NULL);
+        qatomic_mb_set(&tb_ctx.tb_evict_count, tb_ctx.tb_evict_count + 1);
+        if (DEBUG_TB_FLUSH_GATE) {
+            printf("qemu: evict nb_tbs=%zu code_size=%zu\n",
+                   nb_tbs, tcg_code_size());
+        }
+    }
+    mmap_unlock();
+
+    if (!evicted) {
+        do_tb_flush(cpu, tb_flush_count);
+    }
+}
+
+/*
+ * Called when the code buffer is full.  Reclaims a single region when
+ * "-accel tcg,tb-evict=region" is in use, and otherwise (or when no
+ * region is evictable) flushes the whole buffer like tb_flush.
+ */
+static void tb_evict(CPUState *cpu)
+{
+    unsigned tb_flush_count = qatomic_mb_read(&tb_ctx.tb_flush_count);
+
+    if (cpu_in_exclusive_context(cpu)) {
+        do_tb_evict(cpu, RUN_ON_CPU_HOST_INT(tb_flush_count));
+    } else {
+        async_safe_run_on_cpu(cpu, do_tb_evict,
+                              RUN_ON_CPU_HOST_INT(tb_flush_count));
+    }
+}
+
 /*
  * Formerly ifdef DEBUG_TB_CHECK. These debug functions are user-mode-only,
  * so in order to prevent bit rot we compile them unconditionally in user-mode,
@@ -1175,7 +1258,7 @@ static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
     PageDesc *p;
     uint32_t h;
     tb_page_addr_t phys_pc;
-    uint32_t orig_cflags = tb_cflags(tb);
+    uint32_t orig_cflags = tb_lookup_cflags(tb);
 
     assert_memory_lock();
 
@@ -1204,12 +1287,12 @@ static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
         }
     }
 
-    /* remove the TB from the hash list */
-    h = tb_jmp_cache_hash_func(tb->pc);
+    /*
+     * remove the TB from the hash list; jump predictions are checked
+     * against CF_INVALID and need not be cleared
+     */
     CPU_FOREACH(cpu) {
-        if (qatomic_read(&cpu->tb_jmp_cache[h]) == tb) {
-            qatomic_set(&cpu->tb_jmp_cache[h], NULL);
-        }
+        tb_jmp_cache_remove(cpu, tb);
     }
 
     /* suppress this TB from the two jump lists */
@@ -1372,7 +1455,7 @@ tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
     }
 
     /* add in the hash table */
-    h = tb_hash_func(phys_pc, tb->pc, tb->flags, tb->cflags,
+    h = tb_hash_func(phys_pc, tb->pc, tb->flags, tb->cflags & ~CF_TRACE,
                      tb->trace_vcpu_dstate);
     qht_insert(&tb_ctx.htable, tb, h, &existing_tb);
 
@@ -1440,8 +1523,8 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
  buffer_overflow:
     tb = tcg_tb_alloc(tcg_ctx);
     if (unlikely(!tb)) {
-        /* flush must be done */
-        tb_flush(cpu);
+        /* eviction or flush must be done */
+        tb_evict(cpu);
         mmap_unlock();
         /* Make the execution loop process the flush as soon as possible.  */
         cpu->exception_index = EXCP_INTERRUPT;
@@ -1455,6 +1538,8 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->flags = flags;
     tb->cflags = cflags;
     tb->trace_vcpu_dstate = *cpu->trace_dstate;
+    tb->exec_count = 0;
+    tb->ret_tb = NULL;
     tcg_ctx->tb_cflags = cflags;
  tb_overflow:
 
@@ -1545,6 +1630,12 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     }
     tb->tc.size = gen_code_size;
 
+    /*
+     * Report the TB before it can run.  If tb_link_page() below discards
+     * it, the next TB takes its place and is reported in turn.
+     */
+    perf_report_code(pc, tb, tb->tc.ptr);
+
 #ifdef CONFIG_PROFILER
     qatomic_set(&prof->code_time, prof->code_time + profile_getclock() - ti);
     qatomic_set(&prof->code_in_len, prof->code_in_len + tb->size);
@@ -1679,6 +1770,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
         tcg_tb_remove(tb);
         return existing_tb;
     }
+    tb_cache_record(cpu, tb);
     return tb;
 }
 
@@ -2094,6 +2186,7 @@ void dump_exec_info(void)
     struct tb_tree_stats tst = {};
     struct qht_stats hst;
     size_t nb_tbs, flush_full, flush_part, flush_elide;
+    TCGOptCounts opt = {};
 
     tcg_tb_foreach(tb_tree_stats_iter, &tst);
     nb_tbs = tst.nb_tbs;
@@ -2128,6 +2221,12 @@ void dump_exec_info(void)
     qemu_printf("\nStatistics:\n");
     qemu_printf("TB flush count      %u\n",
                 qatomic_read(&tb_ctx.tb_flush_count));
+    qemu_printf("TB evict count      %u\n",
+                qatomic_read(&tb_ctx.tb_evict_count));
+    qemu_printf("TB superblock count %u\n",
+                qatomic_read(&tb_ctx.tb_trace_count));
+    qemu_printf("TB speculative count %u\n",
+                qatomic_read(&tb_ctx.tb_spec_count));
     qemu_printf("TB invalidate count %u\n",
                 qatomic_read(&tb_ctx.tb_phys_invalidate_count));
 
@@ -2135,6 +2234,11 @@ void dump_exec_info(void)
     qemu_printf("TLB full flushes    %zu\n", flush_full);
     qemu_printf("TLB partial flushes %zu\n", flush_part);
     qemu_printf("TLB elided flushes  %zu\n", flush_elide);
+
+    tcg_opt_counts(&opt);
+    qemu_printf("env loads elided    %zu\n", opt.env_ld_elim);
+    qemu_printf("env stores elided   %zu\n", opt.env_st_elim);
+    qemu_printf("common subexprs     %zu\n", opt.cse_elim);
     tcg_dump_info();
 }
 
@@ -33,13 +33,106 @@ void translator_loop_temp_check(DisasContextBase *db)
 
 bool translator_use_goto_tb(DisasContextBase *db, target_ulong dest)
 {
+    int i;
+
     /* Suppress goto_tb in the case of single-steping.  */
     if (db->singlestep_enabled || singlestep) {
         return false;
     }
 
     /* Check for the dest on the same page as the start of the TB.  */
-    return ((db->pc_first ^ dest) & TARGET_PAGE_MASK) == 0;
+    if ((db->pc_first ^ dest) & TARGET_PAGE_MASK) {
+        return false;
+    }
+
+    /* Remember the successor for speculative translation.  */
+    for (i = 0; i < db->num_succ; i++) {
+        if (db->succ_pc[i] == dest) {
+            return true;
+        }
+    }
+    if (db->num_succ < ARRAY_SIZE(db->succ_pc)) {
+        db->succ_pc[db->num_succ++] = dest;
+    }
+    return true;
+}
+
+bool translator_follow_jump(DisasContextBase *db, target_ulong dest)
+{
+    if (!(tb_cflags(db->tb) & CF_TRACE) ||
+        db->singlestep_enabled || singlestep) {
+        return false;
+    }
+    if (dest < db->pc_next || ((db->pc_first ^ dest) & TARGET_PAGE_MASK)) {
+        return false;
+    }
+    if (tcg_op_buf_full() || db->num_insns >= db->max_insns) {
+        return false;
+    }
+    db->pc_next = dest;
+    return true;
+}
+
+TCGLabel *translator_loop_head(DisasContextBase *db, target_ulong dest)
+{
+    return dest == db->pc_first ? db->trace_head : NULL;
+}
+
+bool translator_side_exit(DisasContextBase *db)
+{
+    return db->trace_head &&
+           !tcg_op_buf_full() && db->num_insns < db->max_insns;
+}
+
+void translator_push_return(DisasContextBase *db, target_ulong ret_pc)
+{
+    intptr_t top_ofs = offsetof(CPUState, tb_ret_top) - offsetof(ArchCPU, env);
+    intptr_t stack_ofs = offsetof(CPUState, tb_ret_stack) -
+                         offsetof(ArchCPU, env);
+    TCGv_i32 top;
+    TCGv_ptr ptr, caller;
+
+    if (qemu_loglevel_mask(CPU_LOG_TB_NOCHAIN)) {
+        return;
+    }
+
+    QEMU_BUILD_BUG_ON(TB_RET_STACK_SIZE & (TB_RET_STACK_SIZE - 1));
+    QEMU_BUILD_BUG_ON(sizeof(TBRetEntry) & (sizeof(TBRetEntry) - 1));
+
+    top = tcg_temp_new_i32();
+    tcg_gen_ld_i32(top, cpu_env, top_ofs);
+    tcg_gen_addi_i32(top, top, 1);
+    tcg_gen_andi_i32(top, top, TB_RET_STACK_SIZE - 1);
+    tcg_gen_st_i32(top, cpu_env, top_ofs);
+    tcg_gen_shli_i32(top, top, ctz32(sizeof(TBRetEntry)));
+
+    ptr = tcg_temp_new_ptr();
+    tcg_gen_ext_i32_ptr(ptr, top);
+    tcg_gen_add_ptr(ptr, ptr, cpu_env);
+    tcg_temp_free_i32(top);
+
+    tcg_gen_st_i64(tcg_constant_i64(ret_pc), ptr,
+                   stack_ofs + offsetof(TBRetEntry, pc));
+    caller = tcg_const_ptr(db->tb);
+    tcg_gen_st_ptr(caller, ptr, stack_ofs + offsetof(TBRetEntry, caller));
+    tcg_temp_free_ptr(caller);
+    tcg_temp_free_ptr(ptr);
+}
+
+void translator_goto_return(DisasContextBase *db)
+{
+    TCGv_ptr ptr;
+
+    if (qemu_loglevel_mask(CPU_LOG_TB_NOCHAIN)) {
+        tcg_gen_exit_tb(NULL, 0);
+        return;
+    }
+
+    plugin_gen_disable_mem_helpers();
+    ptr = tcg_temp_new_ptr();
+    gen_helper_lookup_tb_ptr_ret(ptr, cpu_env);
+    tcg_gen_op1i(INDEX_op_goto_ptr, tcgv_ptr_arg(ptr));
+    tcg_temp_free_ptr(ptr);
 }
 
 void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
@@ -56,6 +149,8 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
     db->num_insns = 0;
     db->max_insns = max_insns;
     db->singlestep_enabled = cpu->singlestep_enabled;
+    db->num_succ = 0;
+    db->trace_head = NULL;
 
     ops->init_disas_context(db, cpu);
     tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
@@ -63,6 +158,19 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
     /* Reset the temp count so that we can identify leaks */
     tcg_clear_temp_count();
 
+    /*
+     * A superblock may loop back to its start, where pending interrupts
+     * are checked as on entry into the TB.  Side exits and loops would
+     * make the insn count charged on entry wrong with icount, and would
+     * bypass the TB callbacks of plugins.
+     */
+    if ((tb_cflags(db->tb) & (CF_TRACE | CF_USE_ICOUNT)) == CF_TRACE &&
+        !db->singlestep_enabled && !singlestep &&
+        !qemu_loglevel_mask(CPU_LOG_TB_NOCHAIN)) {
+        db->trace_head = gen_new_label();
+        gen_set_label(db->trace_head);
+    }
+
     /* Start translating.  */
     gen_tb_start(db->tb);
     ops->tb_start(db, cpu);
@@ -70,6 +178,9 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
 
     plugin_enabled = plugin_gen_tb_start(cpu, tb,
                                          tb_cflags(db->tb) & CF_MEMI_ONLY);
+    if (plugin_enabled) {
+        db->trace_head = NULL;
+    }
 
     while (true) {
         db->num_insns++;
@@ -148,6 +259,8 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
     /* The disas_log hook may use these values rather than recompute.  */
     tb->size = db->pc_next - db->pc_first;
     tb->icount = db->num_insns;
+    memcpy(tb->succ_pc, db->succ_pc, sizeof(tb->succ_pc));
+    tb->num_succ = db->num_succ;
 
 #ifdef DEBUG_DISAS
     if (qemu_loglevel_mask(CPU_LOG_TB_IN_ASM)
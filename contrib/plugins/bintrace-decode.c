@@ -0,0 +1,332 @@
+/*
+ * Decode the traces written by the bintrace plugin.
+ *
+ * Usage: bintrace-decode [-i] [-s] TRACE
+ *
+ * By default one line is printed for each TB executed and each memory
+ * access; -i prints each instruction of the TBs instead of the TBs, and
+ * -s only prints a summary of the events of each vCPU.
+ *
+ * Note that a TB is recorded as executed when it is entered, so an
+ * exception or an early exit makes it look as if its last instructions
+ * were executed as well.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+#include <zstd.h>
+
+#include "bintrace.h"
+
+typedef struct {
+    uint64_t vaddr;
+    size_t n_insns;
+    uint64_t *insn_vaddr;
+} TBDef;
+
+typedef struct {
+    /* state of the delta decoding */
+    uint64_t last_tb;
+    uint64_t last_vaddr;
+    const TBDef *tb;
+    /* summary */
+    uint64_t tbs;
+    uint64_t insns;
+    uint64_t loads;
+    uint64_t stores;
+} VCPUState;
+
+static bool print_insns;
+static bool summary;
+
+/* TBDef of each TB id */
+static GHashTable *tbs;
+/* VCPUState of each vCPU */
+static GPtrArray *vcpus;
+
+static void G_GNUC_NORETURN corrupt(const char *what)
+{
+    fprintf(stderr, "bintrace-decode: corrupt trace (%s)\n", what);
+    exit(1);
+}
+
+static size_t get_uleb(const uint8_t *p, size_t len, uint64_t *val)
+{
+    size_t n = bintrace_get_uleb(p, len, val);
+
+    if (!n) {
+        corrupt("truncated number");
+    }
+    return n;
+}
+
+static size_t get_sleb(const uint8_t *p, size_t len, int64_t *val)
+{
+    size_t n = bintrace_get_sleb(p, len, val);
+
+    if (!n) {
+        corrupt("truncated number");
+    }
+    return n;
+}
+
+static void decode_tb_defs(const uint8_t *p, size_t len)
+{
+    const uint8_t *end = p + len;
+
+    while (p < end) {
+        TBDef *def = g_new0(TBDef, 1);
+        uint64_t id, vaddr, n, size;
+        int64_t delta;
+        size_t i;
+
+        p += get_uleb(p, end - p, &id);
+        p += get_uleb(p, end - p, &vaddr);
+        p += get_uleb(p, end - p, &n);
+        def->vaddr = vaddr;
+        def->n_insns = n;
+        def->insn_vaddr = g_new(uint64_t, n);
+        for (i = 0; i < n; i++) {
+            p += get_sleb(p, end - p, &delta);
+            p += get_uleb(p, end - p, &size);
+            if (size > (size_t)(end - p)) {
+                corrupt("truncated instruction");
+            }
+            def->insn_vaddr[i] = vaddr + delta;
+            vaddr = def->insn_vaddr[i] + size;
+            p += size;
+        }
+        g_hash_table_insert(tbs, GSIZE_TO_POINTER(id), def);
+    }
+}
+
+static VCPUState *get_vcpu(unsigned int vcpu_index)
+{
+    if (vcpu_index >= vcpus->len) {
+        g_ptr_array_set_size(vcpus, vcpu_index + 1);
+    }
+    if (!g_ptr_array_index(vcpus, vcpu_index)) {
+        g_ptr_array_index(vcpus, vcpu_index) = g_new0(VCPUState, 1);
+    }
+    return g_ptr_array_index(vcpus, vcpu_index);
+}
+
+static void decode_events(unsigned int vcpu_index, const uint8_t *p,
+                          size_t len)
+{
+    VCPUState *s = get_vcpu(vcpu_index);
+    const uint8_t *end = p + len;
+    uint64_t idx;
+    int64_t delta;
+    size_t i;
+
+    while (p < end) {
+        uint8_t ev = *p++;
+
+        switch (ev & BINTRACE_KIND_MASK) {
+        case BINTRACE_EXEC:
+            p += get_sleb(p, end - p, &delta);
+            s->last_tb += delta;
+            s->tb = g_hash_table_lookup(tbs, GSIZE_TO_POINTER(s->last_tb));
+            if (!s->tb) {
+                corrupt("unknown TB");
+            }
+            s->tbs++;
+            s->insns += s->tb->n_insns;
+            if (summary) {
+                break;
+            }
+            if (print_insns) {
+                for (i = 0; i < s->tb->n_insns; i++) {
+                    printf("%u, insn, 0x%" PRIx64 "\n",
+                           vcpu_index, s->tb->insn_vaddr[i]);
+                }
+            } else {
+                printf("%u, tb, 0x%" PRIx64 ", %zu\n",
+                       vcpu_index, s->tb->vaddr, s->tb->n_insns);
+            }
+            break;
+        case BINTRACE_MEM:
+            p += get_uleb(p, end - p, &idx);
+            p += get_sleb(p, end - p, &delta);
+            s->last_vaddr += delta;
+            if (!s->tb || idx >= s->tb->n_insns) {
+                corrupt("access outside of a TB");
+            }
+            if (ev & BINTRACE_MEM_STORE) {
+                s->stores++;
+            } else {
+                s->loads++;
+            }
+            if (!summary) {
+                printf("%u, %s%u, 0x%" PRIx64 ", insn 0x%" PRIx64 "\n",
+                       vcpu_index, ev & BINTRACE_MEM_STORE ? "store" : "load",
+                       8 << ((ev >> BINTRACE_MEM_SHIFT) & 3),
+                       s->last_vaddr, s->tb->insn_vaddr[idx]);
+            }
+            break;
+        default:
+            corrupt("unknown event");
+        }
+    }
+}
+
+/*
+ * Decode the header or the complete chunks at the start of @buf, and
+ * return the number of bytes used.
+ */
+static size_t decode(const uint8_t *buf, size_t len, bool *header)
+{
+    size_t done = 0;
+
+    if (!*header) {
+        uint64_t version, name_len;
+        size_t n = strlen(BINTRACE_MAGIC), m;
+
+        if (len < n) {
+            return 0;
+        }
+        if (memcmp(buf, BINTRACE_MAGIC, n)) {
+            corrupt("not a bintrace file");
+        }
+        m = bintrace_get_uleb(buf + n, len - n, &version);
+        if (!m) {
+            return 0;
+        }
+        n += m;
+        if (version != BINTRACE_VERSION) {
+            fprintf(stderr, "bintrace-decode: unsupported version %" PRIu64
+                    "\n", version);
+            exit(1);
+        }
+        m = bintrace_get_uleb(buf + n, len - n, &name_len);
+        if (!m || name_len > len - n - m) {
+            return 0;
+        }
+        n += m;
+        if (!summary) {
+            printf("# target %.*s\n", (int)name_len, buf + n);
+        }
+        done = n + name_len;
+        *header = true;
+    }
+
+    for (;;) {
+        uint64_t stream, chunk_len;
+        size_t n, m;
+
+        n = bintrace_get_uleb(buf + done, len - done, &stream);
+        if (!n) {
+            break;
+        }
+        m = bintrace_get_uleb(buf + done + n, len - done - n, &chunk_len);
+        if (!m || chunk_len > len - done - n - m) {
+            break;
+        }
+        if (stream == BINTRACE_STREAM_TB) {
+            decode_tb_defs(buf + done + n + m, chunk_len);
+        } else {
+            decode_events(stream - 1, buf + done + n + m, chunk_len);
+        }
+        done += n + m + chunk_len;
+    }
+    return done;
+}
+
+static void print_summary(void)
+{
+    guint i;
+
+    printf("vcpu, tbs, insns, loads, stores\n");
+    for (i = 0; i < vcpus->len; i++) {
+        VCPUState *s = g_ptr_array_index(vcpus, i);
+
+        if (s) {
+            printf("%u, %" PRIu64 ", %" PRIu64 ", %" PRIu64 ", %" PRIu64 "\n",
+                   i, s->tbs, s->insns, s->loads, s->stores);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    g_autoptr(GByteArray) buf = g_byte_array_new();
+    size_t in_size = ZSTD_DStreamInSize();
+    size_t out_size = ZSTD_DStreamOutSize();
+    g_autofree uint8_t *in_buf = g_malloc(in_size);
+    ZSTD_DCtx *dctx;
+    bool header = false;
+    size_t ret = 0;
+    FILE *f;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "is")) != -1) {
+        switch (opt) {
+        case 'i':
+            print_insns = true;
+            break;
+        case 's':
+            summary = true;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-i] [-s] TRACE\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "usage: %s [-i] [-s] TRACE\n", argv[0]);
+        return 1;
+    }
+
+    f = fopen(argv[optind], "rb");
+    if (!f) {
+        perror(argv[optind]);
+        return 1;
+    }
+    tbs = g_hash_table_new(NULL, NULL);
+    vcpus = g_ptr_array_new();
+    dctx = ZSTD_createDCtx();
+
+    for (;;) {
+        size_t n = fread(in_buf, 1, in_size, f);
+        ZSTD_inBuffer zin = { in_buf, n, 0 };
+
+        if (n == 0) {
+            break;
+        }
+        while (zin.pos < zin.size) {
+            guint len = buf->len;
+            ZSTD_outBuffer zout;
+            size_t used;
+
+            g_byte_array_set_size(buf, len + out_size);
+            zout = (ZSTD_outBuffer) { buf->data + len, out_size, 0 };
+            ret = ZSTD_decompressStream(dctx, &zout, &zin);
+            if (ZSTD_isError(ret)) {
+                fprintf(stderr, "bintrace-decode: %s\n",
+                        ZSTD_getErrorName(ret));
+                return 1;
+            }
+            g_byte_array_set_size(buf, len + zout.pos);
+
+            used = decode(buf->data, buf->len, &header);
+            g_byte_array_remove_range(buf, 0, used);
+        }
+    }
+    fclose(f);
+    ZSTD_freeDCtx(dctx);
+
+    if (ret != 0 || buf->len) {
+        fprintf(stderr, "bintrace-decode: trace is truncated\n");
+    }
+    if (summary) {
+        print_summary();
+    }
+    return 0;
+}
@@ -0,0 +1,354 @@
+/*
+ * Binary execution trace, compressed with zstd.
+ *
+ * Every TB entered and, optionally, every memory access is recorded in
+ * the compact format described in bintrace.h.  The vCPUs never wait for
+ * each other: each one appends its events to its own ring buffer, which
+ * a writer thread drains, compresses and writes out.  Decode the result
+ * with bintrace-decode.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <zstd.h>
+
+#include <qemu-plugin.h>
+
+#include "bintrace.h"
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
+
+/*
+ * Single-producer single-consumer ring of encoded events.  Only the
+ * vCPU writes @head and only the writer thread writes @tail; both only
+ * ever grow, and are masked to index @buf.
+ */
+typedef struct {
+    uint8_t *buf;
+    size_t size;
+    unsigned int vcpu_index;
+    size_t head __attribute__((aligned(64)));
+    size_t tail __attribute__((aligned(64)));
+    /* state of the delta encoding, private to the vCPU */
+    uint64_t last_tb __attribute__((aligned(64)));
+    uint64_t last_vaddr;
+} VCPURing;
+
+/* Options */
+static const char *path = "trace.bin.zst";
+static size_t ring_size = 1 << 20;
+static int zstd_level = 3;
+static bool trace_mem = true;
+
+/* VCPURing pointer of each vCPU */
+static struct qemu_plugin_scoreboard *vcpu_rings;
+
+/* All rings, for the writer thread */
+static GMutex rings_lock;
+static GPtrArray *rings;
+
+/* TB definitions not written out yet */
+static GMutex tbs_lock;
+static GByteArray *tb_defs;
+static uint64_t next_tb_id;
+
+static GThread *writer;
+static bool stopping;
+static uint64_t dropped;
+
+static FILE *out;
+static ZSTD_CCtx *cctx;
+static uint8_t *zbuf;
+static size_t zbuf_size;
+
+/*
+ * vCPU side
+ */
+
+static VCPURing *get_ring(unsigned int vcpu_index)
+{
+    return *(VCPURing **)qemu_plugin_scoreboard_find(vcpu_rings, vcpu_index);
+}
+
+static void ring_push(VCPURing *r, const uint8_t *rec, size_t len)
+{
+    size_t ofs = r->head & (r->size - 1);
+    size_t first = MIN(len, r->size - ofs);
+
+    /* wait for the writer thread rather than lose events */
+    while (r->head + len - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >
+           r->size) {
+        if (__atomic_load_n(&stopping, __ATOMIC_RELAXED)) {
+            __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        g_thread_yield();
+    }
+
+    memcpy(r->buf + ofs, rec, first);
+    memcpy(r->buf, rec + first, len - first);
+    __atomic_store_n(&r->head, r->head + len, __ATOMIC_RELEASE);
+}
+
+static void vcpu_tb_exec(unsigned int cpu_index, void *udata)
+{
+    VCPURing *r = get_ring(cpu_index);
+    uint64_t id = GPOINTER_TO_SIZE(udata);
+    uint8_t rec[BINTRACE_EVENT_MAX];
+    size_t len;
+
+    rec[0] = BINTRACE_EXEC;
+    len = 1 + bintrace_put_sleb(rec + 1, id - r->last_tb);
+    r->last_tb = id;
+    ring_push(r, rec, len);
+}
+
+static void vcpu_mem(unsigned int cpu_index, qemu_plugin_meminfo_t info,
+                     uint64_t vaddr, void *udata)
+{
+    VCPURing *r = get_ring(cpu_index);
+    uint8_t rec[BINTRACE_EVENT_MAX];
+    size_t len;
+
+    rec[0] = BINTRACE_MEM |
+             (qemu_plugin_mem_is_store(info) ? BINTRACE_MEM_STORE : 0) |
+             qemu_plugin_mem_size_shift(info) << BINTRACE_MEM_SHIFT;
+    len = 1 + bintrace_put_uleb(rec + 1, GPOINTER_TO_SIZE(udata));
+    len += bintrace_put_sleb(rec + len, vaddr - r->last_vaddr);
+    r->last_vaddr = vaddr;
+    ring_push(r, rec, len);
+}
+
+static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
+{
+    size_t n = qemu_plugin_tb_n_insns(tb);
+    uint64_t prev_end = qemu_plugin_tb_vaddr(tb);
+    uint8_t buf[10];
+    uint64_t tb_id;
+    size_t i;
+
+    g_mutex_lock(&tbs_lock);
+    tb_id = next_tb_id++;
+    g_byte_array_append(tb_defs, buf, bintrace_put_uleb(buf, tb_id));
+    g_byte_array_append(tb_defs, buf, bintrace_put_uleb(buf, prev_end));
+    g_byte_array_append(tb_defs, buf, bintrace_put_uleb(buf, n));
+    for (i = 0; i < n; i++) {
+        struct qemu_plugin_insn *insn = qemu_plugin_tb_get_insn(tb, i);
+        uint64_t vaddr = qemu_plugin_insn_vaddr(insn);
+        size_t size = qemu_plugin_insn_size(insn);
+
+        g_byte_array_append(tb_defs, buf,
+                            bintrace_put_sleb(buf, vaddr - prev_end));
+        g_byte_array_append(tb_defs, buf, bintrace_put_uleb(buf, size));
+        g_byte_array_append(tb_defs, qemu_plugin_insn_data(insn), size);
+        prev_end = vaddr + size;
+
+        if (trace_mem) {
+            qemu_plugin_register_vcpu_mem_cb(insn, vcpu_mem,
+                                             QEMU_PLUGIN_CB_NO_REGS,
+                                             QEMU_PLUGIN_MEM_RW,
+                                             GSIZE_TO_POINTER(i));
+        }
+    }
+    g_mutex_unlock(&tbs_lock);
+
+    qemu_plugin_register_vcpu_tb_exec_cb(tb, vcpu_tb_exec,
+                                         QEMU_PLUGIN_CB_NO_REGS,
+                                         GSIZE_TO_POINTER(tb_id));
+}
+
+static void vcpu_init(qemu_plugin_id_t id, unsigned int vcpu_index)
+{
+    VCPURing *r = g_new0(VCPURing, 1);
+
+    r->buf = g_malloc(ring_size);
+    r->size = ring_size;
+    r->vcpu_index = vcpu_index;
+    *(VCPURing **)qemu_plugin_scoreboard_find(vcpu_rings, vcpu_index) = r;
+
+    g_mutex_lock(&rings_lock);
+    g_ptr_array_add(rings, r);
+    g_mutex_unlock(&rings_lock);
+}
+
+/*
+ * Writer side
+ */
+
+static void compress(const void *data, size_t len, ZSTD_EndDirective mode)
+{
+    ZSTD_inBuffer in = { data, len, 0 };
+    size_t remaining;
+
+    do {
+        ZSTD_outBuffer zout = { zbuf, zbuf_size, 0 };
+
+        remaining = ZSTD_compressStream2(cctx, &zout, &in, mode);
+        if (ZSTD_isError(remaining)) {
+            g_error("bintrace: %s", ZSTD_getErrorName(remaining));
+        }
+        if (fwrite(zbuf, 1, zout.pos, out) != zout.pos) {
+            g_error("bintrace: cannot write %s", path);
+        }
+    } while (mode == ZSTD_e_continue ? in.pos < in.size : remaining);
+}
+
+static void write_chunk_header(uint64_t stream, uint64_t len)
+{
+    uint8_t buf[20];
+    size_t n;
+
+    n = bintrace_put_uleb(buf, stream);
+    n += bintrace_put_uleb(buf + n, len);
+    compress(buf, n, ZSTD_e_continue);
+}
+
+/*
+ * Write out the TB definitions and the events queued so far.  Events are
+ * only taken up to the heads sampled before the definitions: the TBs they
+ * refer to were defined before, so the decoder always knows them.
+ */
+static bool drain(void)
+{
+    g_autofree size_t *heads = NULL;
+    GByteArray *defs;
+    bool busy = false;
+    guint i;
+
+    g_mutex_lock(&rings_lock);
+    heads = g_new(size_t, rings->len);
+    for (i = 0; i < rings->len; i++) {
+        VCPURing *r = g_ptr_array_index(rings, i);
+        heads[i] = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    }
+
+    g_mutex_lock(&tbs_lock);
+    defs = tb_defs;
+    tb_defs = g_byte_array_new();
+    g_mutex_unlock(&tbs_lock);
+    if (defs->len) {
+        write_chunk_header(BINTRACE_STREAM_TB, defs->len);
+        compress(defs->data, defs->len, ZSTD_e_continue);
+        busy = true;
+    }
+    g_byte_array_unref(defs);
+
+    for (i = 0; i < rings->len; i++) {
+        VCPURing *r = g_ptr_array_index(rings, i);
+        size_t len = heads[i] - r->tail;
+        size_t ofs = r->tail & (r->size - 1);
+        size_t first = MIN(len, r->size - ofs);
+
+        if (!len) {
+            continue;
+        }
+        write_chunk_header(r->vcpu_index + 1, len);
+        compress(r->buf + ofs, first, ZSTD_e_continue);
+        if (len > first) {
+            compress(r->buf, len - first, ZSTD_e_continue);
+        }
+        __atomic_store_n(&r->tail, heads[i], __ATOMIC_RELEASE);
+        busy = true;
+    }
+    g_mutex_unlock(&rings_lock);
+    return busy;
+}
+
+static gpointer writer_thread(gpointer data)
+{
+    while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+        if (!drain()) {
+            g_usleep(1000);
+        }
+    }
+    return NULL;
+}
+
+static void plugin_exit(qemu_plugin_id_t id, void *p)
+{
+    g_autoptr(GString) report = g_string_new("");
+
+    __atomic_store_n(&stopping, true, __ATOMIC_RELEASE);
+    g_thread_join(writer);
+    drain();
+    compress(NULL, 0, ZSTD_e_end);
+    fclose(out);
+    ZSTD_freeCCtx(cctx);
+
+    g_string_printf(report, "bintrace: %" PRIu64 " TBs traced to %s",
+                    next_tb_id, path);
+    if (dropped) {
+        g_string_append_printf(report, ", %" PRIu64 " events dropped at exit",
+                               dropped);
+    }
+    g_string_append_c(report, '\n');
+    qemu_plugin_outs(report->str);
+}
+
+static void write_header(const char *target_name)
+{
+    uint8_t buf[20];
+    size_t n;
+
+    compress(BINTRACE_MAGIC, strlen(BINTRACE_MAGIC), ZSTD_e_continue);
+    n = bintrace_put_uleb(buf, BINTRACE_VERSION);
+    n += bintrace_put_uleb(buf + n, strlen(target_name));
+    compress(buf, n, ZSTD_e_continue);
+    compress(target_name, strlen(target_name), ZSTD_e_continue);
+}
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
+                                           const qemu_info_t *info,
+                                           int argc, char **argv)
+{
+    int i;
+
+    for (i = 0; i < argc; i++) {
+        char *opt = argv[i];
+        if (g_str_has_prefix(opt, "file=")) {
+            path = g_strdup(opt + 5);
+        } else if (g_str_has_prefix(opt, "bufsize=")) {
+            /* in KiB, rounded up to a power of 2 */
+            size_t kib = g_ascii_strtoull(opt + 8, NULL, 10);
+            ring_size = 1024;
+            while (ring_size < kib * 1024) {
+                ring_size <<= 1;
+            }
+        } else if (g_str_has_prefix(opt, "level=")) {
+            zstd_level = g_ascii_strtoll(opt + 6, NULL, 10);
+        } else if (g_strcmp0(opt, "mem=off") == 0) {
+            trace_mem = false;
+        } else if (g_strcmp0(opt, "mem=on") == 0) {
+            trace_mem = true;
+        } else {
+            fprintf(stderr, "option parsing failed: %s\n", opt);
+            return -1;
+        }
+    }
+
+    out = fopen(path, "wb");
+    if (!out) {
+        fprintf(stderr, "bintrace: cannot open %s\n", path);
+        return -1;
+    }
+    cctx = ZSTD_createCCtx();
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, zstd_level);
+    zbuf_size = ZSTD_CStreamOutSize();
+    zbuf = g_malloc(zbuf_size);
+    write_header(info->target_name);
+
+    vcpu_rings = qemu_plugin_scoreboard_new(sizeof(VCPURing *));
+    rings = g_ptr_array_new();
+    tb_defs = g_byte_array_new();
+    writer = g_thread_new("bintrace-writer", writer_thread, NULL);
+
+    qemu_plugin_register_vcpu_init_cb(id, vcpu_init);
+    qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
+    qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
+    return 0;
+}
@@ -0,0 +1,109 @@
+/*
+ * Binary execution trace format, shared by the bintrace plugin and
+ * the bintrace-decode tool.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#ifndef BINTRACE_H
+#define BINTRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A trace file is a single zstd stream.  Once decompressed it holds a
+ * header followed by chunks.
+ *
+ * Header:
+ *   BINTRACE_MAGIC (8 bytes), version (uleb), target name (uleb length
+ *   followed by the characters).
+ *
+ * Chunk:
+ *   stream (uleb), length (uleb), then length bytes of records.
+ *   Stream 0 holds the TB definitions, stream N + 1 the events of vCPU N.
+ *   The records of a stream are split across chunks at record boundaries
+ *   only, and a TB is always defined in a chunk preceding the first chunk
+ *   referring to it.
+ *
+ * TB definition, in stream 0:
+ *   id (uleb), vaddr of the first instruction (uleb), number of
+ *   instructions (uleb), then for each instruction its distance from
+ *   the end of the previous one (sleb), its size (uleb) and its bytes.
+ *
+ * vCPU events: one byte, whose low bits give the kind of the event.
+ *   BINTRACE_EXEC: a TB was entered; followed by the difference between
+ *     its id and the previous TB id of the vCPU (sleb).
+ *   BINTRACE_MEM: a memory access by the current TB; the next bit is set
+ *     for stores and the next two give log2 of the size.  Followed by the
+ *     index of the instruction in the TB (uleb), and by the difference
+ *     between the vaddr accessed and the previous one of the vCPU (sleb).
+ *
+ * All deltas start from 0.
+ */
+
+#define BINTRACE_MAGIC      "QEMUBTRC"
+#define BINTRACE_VERSION    1
+
+#define BINTRACE_STREAM_TB  0
+
+#define BINTRACE_KIND_MASK  0x3
+#define BINTRACE_EXEC       0
+#define BINTRACE_MEM        1
+#define BINTRACE_MEM_STORE  (1 << 2)
+#define BINTRACE_MEM_SHIFT  3
+
+/* Longest encoding of a vCPU event */
+#define BINTRACE_EVENT_MAX  (1 + 10 + 10)
+
+static inline size_t bintrace_put_uleb(uint8_t *p, uint64_t val)
+{
+    size_t n = 0;
+
+    do {
+        uint8_t byte = val & 0x7f;
+
+        val >>= 7;
+        p[n++] = byte | (val ? 0x80 : 0);
+    } while (val);
+    return n;
+}
+
+static inline size_t bintrace_put_sleb(uint8_t *p, int64_t val)
+{
+    /* zigzag encoding, so that small negative values stay short */
+    return bintrace_put_uleb(p, ((uint64_t)val << 1) ^ (uint64_t)(val >> 63));
+}
+
+/*
+ * Decode the number at @p, of at most @len bytes.  Return the number of
+ * bytes used, or 0 if the number is truncated.
+ */
+static inline size_t bintrace_get_uleb(const uint8_t *p, size_t len,
+                                       uint64_t *val)
+{
+    uint64_t ret = 0;
+    size_t n;
+
+    for (n = 0; n < len && n < 10; n++) {
+        ret |= (uint64_t)(p[n] & 0x7f) << (7 * n);
+        if (!(p[n] & 0x80)) {
+            *val = ret;
+            return n + 1;
+        }
+    }
+    return 0;
+}
+
+static inline size_t bintrace_get_sleb(const uint8_t *p, size_t len,
+                                       int64_t *val)
+{
+    uint64_t u;
+    size_t n = bintrace_get_uleb(p, len, &u);
+
+    *val = (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+    return n;
+}
+
+#endif /* BINTRACE_H */
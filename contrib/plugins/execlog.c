@@ -20,6 +20,12 @@ QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
 /* Store last executed instruction on each vCPU as a GString */
 GArray *last_exec;
 
+/* Names of the registers to log, from the reg= arguments */
+static GPtrArray *reg_names;
+/* Registers matching them, looked up on the first translation */
+static GArray *regs;
+static GMutex regs_lock;
+
 /**
  * Add memory read or write information to current instruction log
  */
@@ -50,6 +56,33 @@ static void vcpu_mem(unsigned int cpu_index, qemu_plugin_meminfo_t info,
     }
 }
 
+/**
+ * Add the values of the registers, as the instruction left them, to its log.
+ * Values are printed most significant byte first, assuming a little-endian
+ * target.
+ */
+static void log_registers(GString *s)
+{
+    g_autoptr(GByteArray) buf = g_byte_array_new();
+    guint i;
+    int j, size;
+
+    for (i = 0; i < regs->len; i++) {
+        qemu_plugin_reg_descriptor *rd =
+            &g_array_index(regs, qemu_plugin_reg_descriptor, i);
+
+        g_byte_array_set_size(buf, 0);
+        size = qemu_plugin_read_register(rd->handle, buf);
+        if (size <= 0) {
+            continue;
+        }
+        g_string_append_printf(s, ", %s=0x", rd->name);
+        for (j = size - 1; j >= 0; j--) {
+            g_string_append_printf(s, "%02x", buf->data[j]);
+        }
+    }
+}
+
 /**
  * Log instruction execution
  */
@@ -66,6 +99,9 @@ static void vcpu_insn_exec(unsigned int cpu_index, void *udata)
 
     /* Print previous instruction in cache */
     if (s->len) {
+        if (regs) {
+            log_registers(s);
+        }
         qemu_plugin_outs(s->str);
         qemu_plugin_outs("s\n");
     }
@@ -82,12 +118,47 @@ static void vcpu_insn_exec(unsigned int cpu_index, void *udata)
  * QEMU convert code by translation block (TB). By hooking here we can then hook
  * a callback on each instruction and memory access.
  */
+static void find_registers(void)
+{
+    g_autoptr(GArray) all = qemu_plugin_get_registers();
+    guint i, j;
+
+    regs = g_array_new(false, false, sizeof(qemu_plugin_reg_descriptor));
+    for (i = 0; i < reg_names->len; i++) {
+        for (j = 0; j < all->len; j++) {
+            qemu_plugin_reg_descriptor *rd =
+                &g_array_index(all, qemu_plugin_reg_descriptor, j);
+
+            if (g_str_equal(rd->name, g_ptr_array_index(reg_names, i))) {
+                g_array_append_val(regs, *rd);
+                break;
+            }
+        }
+        if (j == all->len) {
+            g_autofree char *msg =
+                g_strdup_printf("execlog: no register %s\n",
+                                (char *)g_ptr_array_index(reg_names, i));
+            qemu_plugin_outs(msg);
+        }
+    }
+}
+
 static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
 {
     struct qemu_plugin_insn *insn;
     uint64_t insn_vaddr;
     uint32_t insn_opcode;
     char *insn_disas;
+    enum qemu_plugin_cb_flags flags = QEMU_PLUGIN_CB_NO_REGS;
+
+    if (reg_names) {
+        g_mutex_lock(&regs_lock);
+        if (!regs) {
+            find_registers();
+        }
+        g_mutex_unlock(&regs_lock);
+        flags = QEMU_PLUGIN_CB_R_REGS;
+    }
 
     size_t n = qemu_plugin_tb_n_insns(tb);
     for (size_t i = 0; i < n; i++) {
@@ -112,7 +183,7 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
 
         /* Register callback on instruction */
         qemu_plugin_register_vcpu_insn_exec_cb(insn, vcpu_insn_exec,
-                                               QEMU_PLUGIN_CB_NO_REGS, output);
+                                               flags, output);
     }
 }
 
@@ -145,6 +216,18 @@ QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
      */
     last_exec = g_array_new(FALSE, FALSE, sizeof(GString *));
 
+    for (int i = 0; i < argc; i++) {
+        if (g_str_has_prefix(argv[i], "reg=")) {
+            if (!reg_names) {
+                reg_names = g_ptr_array_new();
+            }
+            g_ptr_array_add(reg_names, g_strdup(argv[i] + 4));
+        } else {
+            fprintf(stderr, "option parsing failed: %s\n", argv[i]);
+            return -1;
+        }
+    }
+
     /* Register translation block and exit callbacks */
     qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
     qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
@@ -232,15 +232,120 @@ GEN_INPUT_FLUSH3(float64_input_flush3, float64)
 # define QEMU_SOFTFLOAT_ATTR QEMU_FLATTEN __attribute__((noinline))
 #endif
 
+/*
+ * Most results are inexact, and the inexact flag is sticky: once it is set,
+ * hardfloat does not need to know whether an operation was inexact.  Until
+ * it is set, which is most of the time for guests that clear the flags
+ * often, the inexact flag of the host is used instead on hosts where the
+ * status register of the FPU used for float and double is cheap to access.
+ * It is cleared before the operation, only if it is set, and read back
+ * after it.  Other hosts use softfloat until the inexact flag is set.
+ */
+#if defined(__x86_64__)
+# define QEMU_HARDFLOAT_HOST_INEXACT 1
+# define HOST_FPSR_INEXACT 0x20 /* MXCSR.PE */
+typedef uint32_t host_fpsr;
+
+static inline host_fpsr host_fpsr_get(void)
+{
+    host_fpsr r;
+
+    asm volatile("stmxcsr %0" : "=m"(r));
+    return r;
+}
+
+static inline void host_fpsr_set(host_fpsr r)
+{
+    asm volatile("ldmxcsr %0" : : "m"(r));
+}
+
+/* Keep the computation of @x between the accesses to the status register. */
+# define hardfloat_barrier(x) asm volatile("" : "+x"(x))
+#elif defined(__aarch64__)
+# define QEMU_HARDFLOAT_HOST_INEXACT 1
+# define HOST_FPSR_INEXACT 0x10 /* FPSR.IXC */
+typedef uint64_t host_fpsr;
+
+static inline host_fpsr host_fpsr_get(void)
+{
+    host_fpsr r;
+
+    asm volatile("mrs %0, fpsr" : "=r"(r));
+    return r;
+}
+
+static inline void host_fpsr_set(host_fpsr r)
+{
+    asm volatile("msr fpsr, %0" : : "r"(r));
+}
+
+# define hardfloat_barrier(x) asm volatile("" : "+w"(x))
+#else
+# define QEMU_HARDFLOAT_HOST_INEXACT 0
+# define HOST_FPSR_INEXACT 0
+typedef int host_fpsr;
+
+static inline host_fpsr host_fpsr_get(void)
+{
+    return 0;
+}
+
+static inline void host_fpsr_set(host_fpsr r)
+{
+}
+
+# define hardfloat_barrier(x) do { } while (0)
+#endif
+
 static inline bool can_use_fpu(const float_status *s)
 {
     if (QEMU_NO_HARDFLOAT) {
         return false;
     }
-    return likely(s->float_exception_flags & float_flag_inexact &&
+    return likely((QEMU_HARDFLOAT_HOST_INEXACT ||
+                   s->float_exception_flags & float_flag_inexact) &&
                   s->float_rounding_mode == float_round_nearest_even);
 }
 
+/*
+ * Prepare the host FPU for a hardfloat operation.  Return true if its
+ * inexact flag must be passed on to @s by hardfloat_end().
+ */
+static inline bool hardfloat_begin(const float_status *s)
+{
+    host_fpsr r;
+
+    if (likely(s->float_exception_flags & float_flag_inexact)) {
+        return false;
+    }
+    r = host_fpsr_get();
+    if (unlikely(r & HOST_FPSR_INEXACT)) {
+        host_fpsr_set(r & ~HOST_FPSR_INEXACT);
+    }
+    return true;
+}
+
+static inline void hardfloat_end(bool track, float_status *s)
+{
+    if (track && (host_fpsr_get() & HOST_FPSR_INEXACT)) {
+        float_raise(float_flag_inexact, s);
+    }
+}
+
+/*
+ * Integer to float conversions need no help from the host: they are
+ * inexact if the magnitude @m of the integer has more significant bits
+ * than the @frac_bits of precision of the format.
+ */
+static inline void hardfloat_int_to_float_flags(uint64_t m, int frac_bits,
+                                                float_status *s)
+{
+    if (!(s->float_exception_flags & float_flag_inexact) &&
+        m && (m >> ctz64(m)) >> frac_bits) {
+        float_raise(float_flag_inexact, s);
+    }
+}
+
 /*
  * Hardfloat generation functions. Each operation can have two flavors:
  * either using softfloat primitives (e.g. float32_is_zero_or_normal) for
@@ -345,6 +450,7 @@ float32_gen2(float32 xa, float32 xb, float_status *s,
              f32_check_fn pre, f32_check_fn post)
 {
     union_float32 ua, ub, ur;
+    bool track;
 
     ua.s = xa;
     ub.s = xb;
@@ -358,12 +464,17 @@ float32_gen2(float32 xa, float32 xb, float_status *s,
         goto soft;
     }
 
+    track = hardfloat_begin(s);
+    hardfloat_barrier(ua.h);
+    hardfloat_barrier(ub.h);
     ur.h = hard(ua.h, ub.h);
+    hardfloat_barrier(ur.h);
     if (unlikely(f32_is_inf(ur))) {
         float_raise(float_flag_overflow, s);
     } else if (unlikely(fabsf(ur.h) <= FLT_MIN) && post(ua, ub)) {
         goto soft;
     }
+    hardfloat_end(track, s);
     return ur.s;
 
  soft:
@@ -376,6 +487,7 @@ float64_gen2(float64 xa, float64 xb, float_status *s,
              f64_check_fn pre, f64_check_fn post)
 {
     union_float64 ua, ub, ur;
+    bool track;
 
     ua.s = xa;
     ub.s = xb;
@@ -389,12 +501,17 @@ float64_gen2(float64 xa, float64 xb, float_status *s,
         goto soft;
     }
 
+    track = hardfloat_begin(s);
+    hardfloat_barrier(ua.h);
+    hardfloat_barrier(ub.h);
     ur.h = hard(ua.h, ub.h);
+    hardfloat_barrier(ur.h);
     if (unlikely(f64_is_inf(ur))) {
         float_raise(float_flag_overflow, s);
     } else if (unlikely(fabs(ur.h) <= DBL_MIN) && post(ua, ub)) {
         goto soft;
     }
+    hardfloat_end(track, s);
     return ur.s;
 
  soft:
@@ -2153,6 +2270,7 @@ float32 QEMU_FLATTEN
 float32_muladd(float32 xa, float32 xb, float32 xc, int flags, float_status *s)
 {
     union_float32 ua, ub, uc, ur;
+    bool track;
 
     ua.s = xa;
     ub.s = xb;
@@ -2174,6 +2292,11 @@ float32_muladd(float32 xa, float32 xb, float32 xc, int flags, float_status *s)
         goto soft;
     }
 
+    track = hardfloat_begin(s);
+    hardfloat_barrier(ua.h);
+    hardfloat_barrier(ub.h);
+    hardfloat_barrier(uc.h);
+
     /*
      * When (a || b) == 0, there's no need to check for under/over flow,
      * since we know the addend is (normal || 0) and the product is 0.
@@ -2211,6 +2334,8 @@ float32_muladd(float32 xa, float32 xb, float32 xc, int flags, float_status *s)
             goto soft;
         }
     }
+    hardfloat_barrier(ur.h);
+    hardfloat_end(track, s);
     if (flags & float_muladd_negate_result) {
         return float32_chs(ur.s);
     }
@@ -2224,6 +2349,7 @@ float64 QEMU_FLATTEN
 float64_muladd(float64 xa, float64 xb, float64 xc, int flags, float_status *s)
 {
     union_float64 ua, ub, uc, ur;
+    bool track;
 
     ua.s = xa;
     ub.s = xb;
@@ -2245,6 +2371,11 @@ float64_muladd(float64 xa, float64 xb, float64 xc, int flags, float_status *s)
         goto soft;
     }
 
+    track = hardfloat_begin(s);
+    hardfloat_barrier(ua.h);
+    hardfloat_barrier(ub.h);
+    hardfloat_barrier(uc.h);
+
     /*
      * When (a || b) == 0, there's no need to check for under/over flow,
      * since we know the addend is (normal || 0) and the product is 0.
@@ -2282,6 +2413,8 @@ float64_muladd(float64 xa, float64 xb, float64 xc, int flags, float_status *s)
             goto soft;
         }
     }
+    hardfloat_barrier(ur.h);
+    hardfloat_end(track, s);
     if (flags & float_muladd_negate_result) {
         return float64_chs(ur.s);
     }
@@ -2697,6 +2830,23 @@ float32 float64_to_float32(float64 a, float_status *s)
 {
     FloatParts64 p;
 
+    if (likely(float64_is_normal(a)) && can_use_fpu(s)) {
+        union_float64 ud;
+        union_float32 uf;
+        bool track;
+
+        ud.s = a;
+        track = hardfloat_begin(s);
+        hardfloat_barrier(ud.h);
+        uf.h = ud.h;
+        hardfloat_barrier(uf.h);
+        /* Leave overflow and underflow to softfloat, as in float32_gen2. */
+        if (likely(fabsf(uf.h) > FLT_MIN && !f32_is_inf(uf))) {
+            hardfloat_end(track, s);
+            return uf.s;
+        }
+    }
+
     float64_unpack_canonical(&p, a, s);
     parts_float_to_float(&p, s);
     return float32_round_pack_canonical(&p, s);
@@ -3567,6 +3717,7 @@ float32 int64_to_float32_scalbn(int64_t a, int scale, float_status *status)
     if (likely(scale == 0) && can_use_fpu(status)) {
         union_float32 ur;
         ur.h = a;
+        hardfloat_int_to_float_flags(a < 0 ? -(uint64_t)a : a, 24, status);
         return ur.s;
     }
 
@@ -3607,6 +3758,7 @@ float64 int64_to_float64_scalbn(int64_t a, int scale, float_status *status)
     if (likely(scale == 0) && can_use_fpu(status)) {
         union_float64 ur;
         ur.h = a;
+        hardfloat_int_to_float_flags(a < 0 ? -(uint64_t)a : a, 53, status);
         return ur.s;
     }
 
@@ -3748,6 +3900,7 @@ float32 uint64_to_float32_scalbn(uint64_t a, int scale, float_status *status)
     if (likely(scale == 0) && can_use_fpu(status)) {
         union_float32 ur;
         ur.h = a;
+        hardfloat_int_to_float_flags(a, 24, status);
         return ur.s;
     }
 
@@ -3788,6 +3941,7 @@ float64 uint64_to_float64_scalbn(uint64_t a, int scale, float_status *status)
     if (likely(scale == 0) && can_use_fpu(status)) {
         union_float64 ur;
         ur.h = a;
+        hardfloat_int_to_float_flags(a, 53, status);
         return ur.s;
     }
 
@@ -4225,6 +4379,7 @@ soft_f64_sqrt(float64 a, float_status *status)
 float32 QEMU_FLATTEN float32_sqrt(float32 xa, float_status *s)
 {
     union_float32 ua, ur;
+    bool track;
 
     ua.s = xa;
     if (unlikely(!can_use_fpu(s))) {
@@ -4242,7 +4397,11 @@ float32 QEMU_FLATTEN float32_sqrt(float32 xa, float_status *s)
                         float32_is_neg(ua.s))) {
         goto soft;
     }
+    track = hardfloat_begin(s);
+    hardfloat_barrier(ua.h);
     ur.h = sqrtf(ua.h);
+    hardfloat_barrier(ur.h);
+    hardfloat_end(track, s);
     return ur.s;
 
  soft:
@@ -4252,6 +4411,7 @@ float32 QEMU_FLATTEN float32_sqrt(float32 xa, float_status *s)
 float64 QEMU_FLATTEN float64_sqrt(float64 xa, float_status *s)
 {
     union_float64 ua, ur;
+    bool track;
 
     ua.s = xa;
     if (unlikely(!can_use_fpu(s))) {
@@ -4269,7 +4429,11 @@ float64 QEMU_FLATTEN float64_sqrt(float64 xa, float_status *s)
                         float64_is_neg(ua.s))) {
         goto soft;
     }
+    track = hardfloat_begin(s);
+    hardfloat_barrier(ua.h);
     ur.h = sqrt(ua.h);
+    hardfloat_barrier(ur.h);
+    hardfloat_end(track, s);
     return ur.s;
 
  soft:
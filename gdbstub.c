@@ -865,12 +865,35 @@ static CPUState *gdb_get_cpu(uint32_t pid, uint32_t tid)
     }
 }
 
+/* Return the XML of the feature named by the @len characters at @p. */
+static const char *lookup_feature_xml(CPUState *cpu, const char *p,
+                                      size_t len)
+{
+    CPUClass *cc = CPU_GET_CLASS(cpu);
+    const char *name;
+    int i;
+
+    if (cc->gdb_get_dynamic_xml) {
+        char *xmlname = g_strndup(p, len);
+        const char *xml = cc->gdb_get_dynamic_xml(cpu, xmlname);
+
+        g_free(xmlname);
+        if (xml) {
+            return xml;
+        }
+    }
+    for (i = 0; ; i++) {
+        name = xml_builtin[i][0];
+        if (!name || (strncmp(name, p, len) == 0 && strlen(name) == len))
+            break;
+    }
+    return name ? xml_builtin[i][1] : NULL;
+}
+
 static const char *get_feature_xml(const char *p, const char **newp,
                                    GDBProcess *process)
 {
     size_t len;
-    int i;
-    const char *name;
     CPUState *cpu = get_first_cpu_in_process(process);
     CPUClass *cc = CPU_GET_CLASS(cpu);
 
@@ -879,7 +902,6 @@ static const char *get_feature_xml(const char *p, const char **newp,
         len++;
     *newp = p + len;
 
-    name = NULL;
     if (strncmp(p, "target.xml", len) == 0) {
         char *buf = process->target_xml;
         const size_t buf_sz = sizeof(process->target_xml);
@@ -911,24 +933,94 @@ static const char *get_feature_xml(const char *p, const char **newp,
         }
         return buf;
     }
-    if (cc->gdb_get_dynamic_xml) {
-        char *xmlname = g_strndup(p, len);
-        const char *xml = cc->gdb_get_dynamic_xml(cpu, xmlname);
+    return lookup_feature_xml(cpu, p, len);
+}
 
-        g_free(xmlname);
-        if (xml) {
-            return xml;
+/*
+ * Register descriptions for plugins.  The registers of each XML file are
+ * numbered from the first register of its coprocessor, in order; the
+ * regnum attributes are only honoured in the core XML, as the position of
+ * a coprocessor depends on the features of the CPU.
+ */
+typedef struct GDBRegListState {
+    GArray *regs;
+    const char *feature_name;
+    int next_reg;
+    bool core;
+} GDBRegListState;
+
+static void gdb_reg_list_start(GMarkupParseContext *context,
+                               const gchar *element_name,
+                               const gchar **attribute_names,
+                               const gchar **attribute_values,
+                               gpointer user_data, GError **error)
+{
+    GDBRegListState *s = user_data;
+    GDBRegDesc desc;
+    const char *name = NULL;
+    int i;
+
+    for (i = 0; attribute_names[i]; i++) {
+        if (!strcmp(attribute_names[i], "name")) {
+            name = attribute_values[i];
+        } else if (s->core && !strcmp(attribute_names[i], "regnum") &&
+                   !strcmp(element_name, "reg")) {
+            qemu_strtoi(attribute_values[i], NULL, 10, &s->next_reg);
         }
     }
-    for (i = 0; ; i++) {
-        name = xml_builtin[i][0];
-        if (!name || (strncmp(name, p, len) == 0 && strlen(name) == len))
-            break;
+
+    if (!strcmp(element_name, "feature") && name) {
+        s->feature_name = g_intern_string(name);
+    } else if (!strcmp(element_name, "reg") && name) {
+        desc.gdb_reg = s->next_reg++;
+        desc.name = g_intern_string(name);
+        desc.feature_name = s->feature_name;
+        g_array_append_val(s->regs, desc);
     }
-    return name ? xml_builtin[i][1] : NULL;
 }
 
-static int gdb_read_register(CPUState *cpu, GByteArray *buf, int reg)
+static const GMarkupParser gdb_reg_list_parser = {
+    .start_element = gdb_reg_list_start,
+};
+
+static void gdb_reg_list_add(CPUState *cpu, GDBRegListState *s,
+                             const char *xmlname, int base_reg, bool core)
+{
+    const char *xml = lookup_feature_xml(cpu, xmlname, strlen(xmlname));
+    GMarkupParseContext *context;
+
+    if (!xml) {
+        return;
+    }
+    s->feature_name = g_intern_string(xmlname);
+    s->next_reg = base_reg;
+    s->core = core;
+    context = g_markup_parse_context_new(&gdb_reg_list_parser, 0, s, NULL);
+    if (!g_markup_parse_context_parse(context, xml, -1, NULL)) {
+        warn_report("gdbstub: cannot parse %s", xmlname);
+    }
+    g_markup_parse_context_free(context);
+}
+
+GArray *gdb_get_register_list(CPUState *cpu)
+{
+    CPUClass *cc = CPU_GET_CLASS(cpu);
+    GDBRegListState s = {
+        .regs = g_array_new(false, false, sizeof(GDBRegDesc)),
+    };
+    GDBRegisterState *r;
+
+    if (!cc->gdb_core_xml_file) {
+        return s.regs;
+    }
+    gdb_reg_list_add(cpu, &s, cc->gdb_core_xml_file, 0, true);
+    for (r = cpu->gdb_regs; r; r = r->next) {
+        gdb_reg_list_add(cpu, &s, r->xml, r->base_reg, false);
+    }
+    return s.regs;
+}
+
+int gdb_read_register(CPUState *cpu, GByteArray *buf, int reg)
 {
     CPUClass *cc = CPU_GET_CLASS(cpu);
     CPUArchState *env = cpu->env_ptr;
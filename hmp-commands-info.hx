@@ -296,6 +296,37 @@ SRST
     Show dynamic compiler opcode counters
 ERST
 
+#if defined(CONFIG_TCG)
+    {
+        .name       = "tlb-stats",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show software TLB statistics of each vCPU",
+    },
+#endif
+
+SRST
+  ``info tlb-stats``
+    Show the software TLB statistics of each vCPU, per MMU index.
+ERST
+
+#if defined(CONFIG_TCG)
+    {
+        .name       = "tcg-profile",
+        .args_type  = "max:i?",
+        .params     = "[max]",
+        .help       = "show the guest functions with the most samples of "
+                      "the TCG profiler, up to max entries (default: 20)",
+    },
+#endif
+
+SRST
+  ``info tcg-profile`` [*max*]
+    Show the guest functions with the most samples of the TCG profiler
+    enabled with ``-accel tcg,profile=file``, up to *max* entries
+    (default: 20).
+ERST
+
     {
         .name       = "sync-profile",
         .args_type  = "mean:-m,no_coalesce:-n,max:i?",
@@ -877,3 +908,17 @@ SRST
   ``info dirty_rate``
     Display the vcpu dirty rate information.
 ERST
+
+    {
+        .name       = "vcpu_dirty_limit",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show dirty page rate limit information of the vcpus",
+        .cmd        = hmp_info_vcpu_dirty_limit,
+    },
+
+SRST
+  ``info vcpu_dirty_limit``
+    Display the dirty page rate limit and the current dirty page rate of
+    the limited vcpus.
+ERST
@@ -1743,3 +1743,33 @@ ERST
         .help       = "start a round of guest dirty rate measurement",
         .cmd        = hmp_calc_dirty_rate,
     },
+
+SRST
+``set_vcpu_dirty_limit`` *dirty_rate* [*cpu_index*]
+  Limit the dirty page rate of the vcpu with *cpu_index* to *dirty_rate*
+  MB/s, or of all the vcpus if *cpu_index* is not specified.  This requires
+  the KVM dirty ring.  The limits may be observed with ``info
+  vcpu_dirty_limit``.
+ERST
+
+    {
+        .name       = "set_vcpu_dirty_limit",
+        .args_type  = "dirty_rate:l,cpu_index:l?",
+        .params     = "dirty_rate [cpu_index]",
+        .help       = "limit the dirty page rate of a vcpu, or of all vcpus",
+        .cmd        = hmp_set_vcpu_dirty_limit,
+    },
+
+SRST
+``cancel_vcpu_dirty_limit`` [*cpu_index*]
+  Lift the dirty page rate limit of the vcpu with *cpu_index*, or of all
+  the vcpus if *cpu_index* is not specified.
+ERST
+
+    {
+        .name       = "cancel_vcpu_dirty_limit",
+        .args_type  = "cpu_index:l?",
+        .params     = "[cpu_index]",
+        .help       = "lift the dirty page rate limit of a vcpu, or of all vcpus",
+        .cmd        = hmp_cancel_vcpu_dirty_limit,
+    },
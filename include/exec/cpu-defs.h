@@ -76,8 +76,14 @@ typedef uint64_t target_ulong;
 
 #if !defined(CONFIG_USER_ONLY) && defined(CONFIG_TCG)
 
-/* use a fully associative victim tlb of 8 entries */
-#define CPU_VTLB_SIZE 8
+/*
+ * The victim tlb is a second level tlb, set associative and indexed by
+ * a hash of the page number.
+ */
+#define CPU_VTLB_WAYS 4
+#define CPU_VTLB_SET_BITS 4
+#define CPU_VTLB_SETS (1 << CPU_VTLB_SET_BITS)
+#define CPU_VTLB_SIZE (CPU_VTLB_WAYS * CPU_VTLB_SETS)
 
 #if HOST_LONG_BITS == 32 && TARGET_LONG_BITS == 32
 #define CPU_TLB_ENTRY_BITS 4
@@ -85,6 +91,12 @@ typedef uint64_t target_ulong;
 #define CPU_TLB_ENTRY_BITS 5
 #endif
 
+/* Number of tlbs kept per MMU mode for ASIDs other than the current one */
+#define CPU_TLB_ASID_SAVED 4
+
+/* Number of large pages remembered per MMU mode to fill the tlb from */
+#define CPU_TLB_LARGE_PAGES 8
+
 #define CPU_TLB_DYN_MIN_BITS 6
 #define CPU_TLB_DYN_DEFAULT_BITS 8
 
@@ -150,6 +162,34 @@ typedef struct CPUIOTLBEntry {
     MemTxAttrs attrs;
 } CPUIOTLBEntry;
 
+/*
+ * The tlb of an MMU mode for an ASID that is not the current one,
+ * see tlb_set_asid_by_mmuidx.
+ */
+typedef struct CPUTLBSaved {
+    bool valid;
+    uint32_t asid;
+    uintptr_t mask;
+    CPUTLBEntry *table;
+    CPUIOTLBEntry *iotlb;
+    target_ulong large_page_addr;
+    target_ulong large_page_mask;
+    uint64_t large_page_bits;
+    size_t n_used_entries;
+} CPUTLBSaved;
+
+/*
+ * A physically contiguous large page, see tlb_set_large_page_with_attrs.
+ * The page is matched if (addr & mask) == vaddr.
+ */
+typedef struct CPUTLBLargePage {
+    target_ulong vaddr;
+    target_ulong mask;
+    hwaddr paddr;
+    MemTxAttrs attrs;
+    int prot;
+} CPUTLBLargePage;
+
 /*
  * Data elements that are per MMU mode, minus the bits accessed by
  * the TCG fast path.
@@ -157,24 +197,48 @@ typedef struct CPUIOTLBEntry {
 typedef struct CPUTLBDesc {
     /*
      * Describe a region covering all of the large pages allocated
-     * into the tlb.  When any page within this region is flushed,
-     * we must flush the entire tlb.  The region is matched if
+     * into the tlb, and the sizes of these pages as a bitmap of their
+     * log2.  When any page within this region is flushed, we must flush
+     * the pages of each size that contain it.  The region is matched if
      * (addr & large_page_mask) == large_page_addr.
      */
     target_ulong large_page_addr;
     target_ulong large_page_mask;
+    uint64_t large_page_bits;
     /* host time (in ns) at the beginning of the time window */
     int64_t window_begin_ns;
     /* maximum number of entries observed in the window */
     size_t window_max_entries;
     size_t n_used_entries;
-    /* The next index to use in the tlb victim table.  */
-    size_t vindex;
-    /* The tlb victim table, in two parts.  */
+    /* victim tlb hits observed at the last flush */
+    size_t flush_vtlb_hits;
+    /*
+     * Statistics, read and written atomically as those of CPUTLBCommon:
+     * hits in the victim tlb, misses in both tlbs, entries filled,
+     * full and per-page flushes, and entries filled from a large page
+     * without a page walk.  Hits in the main tlb are handled by generated
+     * code and not counted.
+     */
+    size_t vtlb_hit_count;
+    size_t miss_count;
+    size_t fill_count;
+    size_t flush_count;
+    size_t page_flush_count;
+    size_t large_page_fill_count;
+    /* The next way to use in each set of the tlb victim table.  */
+    uint8_t vindex[CPU_VTLB_SETS];
+    /* The tlb victim table, in two parts, indexed by set * ways + way.  */
     CPUTLBEntry vtable[CPU_VTLB_SIZE];
     CPUIOTLBEntry viotlb[CPU_VTLB_SIZE];
     /* The iotlb.  */
     CPUIOTLBEntry *iotlb;
+    /* The ASID the tlb is filled for, and the tlbs of other ASIDs.  */
+    uint32_t asid;
+    unsigned saved_next;
+    CPUTLBSaved saved[CPU_TLB_ASID_SAVED];
+    /* The large pages that entries are filled from without a page walk.  */
+    unsigned lpage_next;
+    CPUTLBLargePage lpage[CPU_TLB_LARGE_PAGES];
 } CPUTLBDesc;
 
 /*
@@ -286,6 +286,37 @@ void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *cpu,
                                                uint16_t idxmap,
                                                unsigned bits);
 
+/**
+ * tlb_set_asid_by_mmuidx:
+ * @cpu: CPU whose TLB should be switched
+ * @idxmap: bitmap of mmu indexes to switch
+ * @asid: address space identifier now in use
+ *
+ * Tell the TLB that the translations of the mmu indexes in @idxmap
+ * are now those of @asid.  The entries of the previous ASID are kept
+ * aside and reused, rather than flushed, when the guest switches back
+ * to it; the number of ASIDs kept per mmu index is bounded.
+ *
+ * A target calling this must flush with tlb_flush_asid_by_mmuidx
+ * (or a full flush) whenever it invalidates the translations of an
+ * ASID, since they may be in use again later.  Page and range flushes
+ * apply to all the ASIDs kept.
+ */
+void tlb_set_asid_by_mmuidx(CPUState *cpu, uint16_t idxmap, uint16_t asid);
+/**
+ * tlb_flush_asid_by_mmuidx:
+ * @cpu: CPU whose TLB should be flushed
+ * @idxmap: bitmap of mmu indexes to flush
+ * @asid: address space identifier to flush
+ *
+ * Flush the entries of @asid from the TLBs of the mmu indexes in
+ * @idxmap, leaving those of the other ASIDs kept.
+ */
+void tlb_flush_asid_by_mmuidx(CPUState *cpu, uint16_t idxmap, uint16_t asid);
+/* Similarly, with broadcast and syncing. */
+void tlb_flush_asid_by_mmuidx_all_cpus_synced(CPUState *cpu, uint16_t idxmap,
+                                              uint16_t asid);
+
 /**
  * tlb_set_page_with_attrs:
  * @cpu: CPU to add this TLB entry for
@@ -306,11 +337,25 @@ void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *cpu,
  *
  * At most one entry for a given virtual address is permitted. Only a
  * single TARGET_PAGE_SIZE region is mapped; the supplied @size is only
- * used by tlb_flush_page.
+ * used by tlb_flush_page, to flush all the target pages of a large page.
  */
 void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
                              hwaddr paddr, MemTxAttrs attrs,
                              int prot, int mmu_idx, target_ulong size);
+/**
+ * tlb_set_large_page_with_attrs:
+ *
+ * This function is equivalent to tlb_set_page_with_attrs(), for a page
+ * of @size bytes that maps a physically contiguous range with the same
+ * @attrs and @prot throughout.  The page is remembered so that misses
+ * on its other target pages are filled without calling tlb_fill(), as
+ * long as @prot allows the access; it is forgotten when any part of it
+ * is flushed.  Targets must not use it when the mapping may be split
+ * further, e.g. by a second stage of translation.
+ */
+void tlb_set_large_page_with_attrs(CPUState *cpu, target_ulong vaddr,
+                                   hwaddr paddr, MemTxAttrs attrs,
+                                   int prot, int mmu_idx, target_ulong size);
 /* tlb_set_page:
  *
  * This function is equivalent to calling tlb_set_page_with_attrs()
@@ -408,6 +453,19 @@ static inline void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *cpu,
                                                              unsigned bits)
 {
 }
+static inline void tlb_set_asid_by_mmuidx(CPUState *cpu, uint16_t idxmap,
+                                          uint16_t asid)
+{
+}
+static inline void tlb_flush_asid_by_mmuidx(CPUState *cpu, uint16_t idxmap,
+                                            uint16_t asid)
+{
+}
+static inline void tlb_flush_asid_by_mmuidx_all_cpus_synced(CPUState *cpu,
+                                                            uint16_t idxmap,
+                                                            uint16_t asid)
+{
+}
 #endif
 /**
  * probe_access:
@@ -498,6 +556,7 @@ struct TranslationBlock {
 #define CF_USE_ICOUNT  0x00020000
 #define CF_INVALID     0x00040000 /* TB is stale. Set with @jmp_lock held */
 #define CF_PARALLEL    0x00080000 /* Generate code for a parallel context */
+#define CF_TRACE       0x00100000 /* Superblock retranslation of a hot TB */
 #define CF_CLUSTER_MASK 0xff000000 /* Top 8 bits are cluster ID */
 #define CF_CLUSTER_SHIFT 24
 
@@ -512,6 +571,25 @@ struct TranslationBlock {
     uint16_t size;
     uint16_t icount;
 
+    /*
+     * Number of times the TB was entered from the execution loop; only
+     * maintained with tb-trace-threshold.  The TB is not chained to until
+     * the count reaches the threshold.
+     */
+    uint32_t exec_count;
+
+    /* Targets of the direct jumps on the first page of the TB */
+    uint32_t num_succ;
+    target_ulong succ_pc[2];
+
+    /*
+     * TB that the guest call ending this TB last returned to, see
+     * translator_push_return().  Cleared when TB memory is reused; since
+     * it is not dropped on TLB flushes, its physical page is checked
+     * against the current mapping of the return address before use.
+     */
+    struct TranslationBlock *ret_tb;
+
     struct tb_tc tc;
 
     /* first and second physical page containing code. The lower bit
@@ -562,6 +640,15 @@ static inline uint32_t tb_cflags(const TranslationBlock *tb)
     return qatomic_read(&tb->cflags);
 }
 
+/*
+ * cflags used for lookup: a CF_TRACE TB replaces the TB it was
+ * retranslated from, so it must be found with the same cflags.
+ */
+static inline uint32_t tb_lookup_cflags(const TranslationBlock *tb)
+{
+    return tb_cflags(tb) & ~CF_TRACE;
+}
+
 /* current cflags for hashing/comparison */
 static inline uint32_t curr_cflags(CPUState *cpu)
 {
@@ -84,6 +84,41 @@ void gdb_register_coprocessor(CPUState *cpu,
                               gdb_get_reg_cb get_reg, gdb_set_reg_cb set_reg,
                               int num_regs, const char *xml, int g_pos);
 
+/**
+ * GDBRegDesc: a register described by the gdb XML of a CPU
+ * @gdb_reg: the register number, as passed to gdb_read_register()
+ * @name: the name of the register, e.g. "rax"
+ * @feature_name: the name of the feature it belongs to, e.g.
+ *   "org.gnu.gdb.i386.core"
+ *
+ * The strings are interned and are never freed.
+ */
+typedef struct GDBRegDesc {
+    int gdb_reg;
+    const char *name;
+    const char *feature_name;
+} GDBRegDesc;
+
+/**
+ * gdb_get_register_list: list the registers of a CPU
+ * @cpu: the CPU
+ *
+ * Returns a GArray of GDBRegDesc, to be freed by the caller, for the
+ * registers described by the XML of the core and of every coprocessor
+ * registered so far.  The array is empty if the CPU has no XML.
+ */
+GArray *gdb_get_register_list(CPUState *cpu);
+
+/**
+ * gdb_read_register: read a register of a CPU
+ * @cpu: the CPU
+ * @buf: the array the value is appended to, in target byte order
+ * @reg: the register number
+ *
+ * Returns the size of the register, or 0 if there is no such register.
+ */
+int gdb_read_register(CPUState *cpu, GByteArray *buf, int reg);
+
 /*
  * The GDB remote protocol transfers values in target byte order. As
  * the gdbstub may be batching up several register values we always
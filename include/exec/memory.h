@@ -61,7 +61,15 @@ static inline void fuzz_dma_read_cb(size_t addr,
 }
 #endif
 
-extern bool global_dirty_log;
+/* Dirty tracking enabled because of a live migration */
+#define GLOBAL_DIRTY_MIGRATION  (1U << 0)
+
+/* Dirty tracking enabled to limit the dirty page rate of the vCPUs */
+#define GLOBAL_DIRTY_LIMIT      (1U << 1)
+
+#define GLOBAL_DIRTY_MASK  (GLOBAL_DIRTY_MIGRATION | GLOBAL_DIRTY_LIMIT)
+
+extern unsigned int global_dirty_tracking;
 
 typedef struct MemoryRegionOps MemoryRegionOps;
 
@@ -2367,13 +2375,20 @@ void memory_listener_unregister(MemoryListener *listener);
 
 /**
  * memory_global_dirty_log_start: begin dirty logging for all regions
+ *
+ * Dirty logging stays enabled until every user that started it has
+ * stopped it.
+ *
+ * @flags: the users of dirty logging to add, a mask of GLOBAL_DIRTY_*
  */
-void memory_global_dirty_log_start(void);
+void memory_global_dirty_log_start(unsigned int flags);
 
 /**
  * memory_global_dirty_log_stop: end dirty logging for all regions
+ *
+ * @flags: the users of dirty logging to remove, a mask of GLOBAL_DIRTY_*
  */
-void memory_global_dirty_log_stop(void);
+void memory_global_dirty_log_stop(unsigned int flags);
 
 void mtree_info(bool flatview, bool dispatch_tree, bool owner, bool disabled);
 
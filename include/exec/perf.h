@@ -0,0 +1,38 @@
+/*
+ * Linux perf perf-<pid>.map and jit-<pid>.dump integration.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef EXEC_PERF_H
+#define EXEC_PERF_H
+
+#ifdef CONFIG_LINUX
+/* Start writing perf-<pid>.map. */
+void perf_enable_perfmap(void);
+
+/* Start writing jit-<pid>.dump. */
+void perf_enable_jitdump(void);
+
+/* Add information about TCG prologue to profiler maps. */
+void perf_report_prologue(const void *start, size_t size);
+
+/*
+ * Add information about the TB just generated into the tcg_ctx of the
+ * calling thread, at executable address @start, to profiler maps.
+ */
+void perf_report_code(uint64_t guest_pc, TranslationBlock *tb,
+                      const void *start);
+
+/* Flush perf-<pid>.map and jit-<pid>.dump before exiting. */
+void perf_exit(void);
+#else
+static inline void perf_enable_perfmap(void) { }
+static inline void perf_enable_jitdump(void) { }
+static inline void perf_report_prologue(const void *start, size_t size) { }
+static inline void perf_report_code(uint64_t guest_pc, TranslationBlock *tb,
+                                    const void *start) { }
+static inline void perf_exit(void) { }
+#endif
+
+#endif /* EXEC_PERF_H */
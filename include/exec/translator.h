@@ -63,6 +63,9 @@ typedef enum DisasJumpType {
  * @num_insns: Number of translated instructions (including current).
  * @max_insns: Maximum number of instructions to be translated in this TB.
  * @singlestep_enabled: "Hardware" single stepping enabled.
+ * @succ_pc: Targets of the direct jumps allowed by translator_use_goto_tb.
+ * @num_succ: Number of valid entries in @succ_pc.
+ * @trace_head: Label at the start of a superblock that may loop, or NULL.
  *
  * Architecture-agnostic disassembly context.
  */
@@ -74,6 +77,9 @@ typedef struct DisasContextBase {
     int num_insns;
     int max_insns;
     bool singlestep_enabled;
+    target_ulong succ_pc[2];
+    int num_succ;
+    TCGLabel *trace_head;
 } DisasContextBase;
 
 /**
@@ -151,10 +157,74 @@ void translator_loop_temp_check(DisasContextBase *db);
  * @dest: target pc of the goto
  *
  * Return true if goto_tb is allowed between the current TB
- * and the destination PC.
+ * and the destination PC.  The first two such destinations are
+ * recorded in the TB as its successors.
  */
 bool translator_use_goto_tb(DisasContextBase *db, target_ulong dest);
 
+/**
+ * translator_follow_jump
+ * @db: Disassembly context
+ * @dest: target pc of an unconditional direct jump
+ *
+ * When translating a superblock (CF_TRACE), return true and set
+ * @db->pc_next to @dest if translation may continue at @dest instead of
+ * ending the TB with a goto_tb.  Only forward jumps within the first page
+ * of the TB are followed, so that [pc_first, pc_next) still covers all of
+ * the guest code of the TB.  The caller remains responsible for bounding
+ * @db->max_insns if it depends on the distance to the end of the page.
+ */
+bool translator_follow_jump(DisasContextBase *db, target_ulong dest);
+
+/**
+ * translator_loop_head
+ * @db: Disassembly context
+ * @dest: target pc of a direct branch
+ *
+ * When translating a superblock (CF_TRACE), return the label at the start
+ * of the TB if @dest is its first instruction, so that a loop back-edge
+ * can branch within the TB instead of leaving it; otherwise return NULL.
+ * Pending interrupts are checked at the label.  The caller must only
+ * branch there if the CPU state that selected the TB (pc, cs_base and
+ * flags) is the same at the branch as on entry into the TB.
+ */
+TCGLabel *translator_loop_head(DisasContextBase *db, target_ulong dest);
+
+/**
+ * translator_side_exit
+ * @db: Disassembly context
+ *
+ * When translating a superblock (CF_TRACE), return true if a conditional
+ * branch may leave the TB through a side exit when taken, with
+ * translation going on along the not-taken path.  The side exit must not
+ * use goto_tb, whose slots are left to the end of the TB.
+ */
+bool translator_side_exit(DisasContextBase *db);
+
+/**
+ * translator_push_return
+ * @db: Disassembly context
+ * @ret_pc: address that the guest call being translated returns to
+ *
+ * Emit code pushing @ret_pc on the return address stack of the vCPU,
+ * for the next translator_goto_return() to check.  To be called by the
+ * frontend for call instructions, once nothing can raise an exception
+ * before the jump to the callee.  The calls of a TB share the TB it last
+ * returned to as their prediction.
+ */
+void translator_push_return(DisasContextBase *db, target_ulong ret_pc);
+
+/**
+ * translator_goto_return
+ * @db: Disassembly context
+ *
+ * Like tcg_gen_lookup_and_goto_ptr(), for the return instructions of
+ * the guest.  When the return address matches the top of the return
+ * address stack, the TB is looked up there first.  The stack is only a
+ * prediction: mismatched calls and returns cost a normal lookup.
+ */
+void translator_goto_return(DisasContextBase *db);
+
 /*
  * Translator Load Functions
  *
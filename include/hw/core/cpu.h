@@ -216,8 +216,30 @@ struct kvm_run;
 struct hax_vcpu_state;
 struct hvf_vcpu_state;
 
-#define TB_JMP_CACHE_BITS 12
+/*
+ * The jump cache has TB_JMP_CACHE_SIZE sets of TB_JMP_CACHE_WAYS TBs,
+ * the most recently used first in each set.
+ */
+#define TB_JMP_CACHE_BITS 10
 #define TB_JMP_CACHE_SIZE (1 << TB_JMP_CACHE_BITS)
+#define TB_JMP_CACHE_WAYS 4
+
+/* Last target of the indirect branches of TBs, keyed by host call site */
+#define TB_JMP_PRED_BITS 8
+#define TB_JMP_PRED_SIZE (1 << TB_JMP_PRED_BITS)
+
+typedef struct TBJmpPred {
+    uintptr_t site;
+    TranslationBlock *tb;
+} TBJmpPred;
+
+/* Return address stack, see translator_push_return() */
+#define TB_RET_STACK_SIZE 16
+
+typedef struct TBRetEntry {
+    uint64_t pc;
+    TranslationBlock *caller;
+} QEMU_ALIGNED(16) TBRetEntry;
 
 /* work queue */
 
@@ -297,6 +319,8 @@ struct qemu_work_item;
  *    ring is enabled.
  * @kvm_fetch_index: Keeps the index that we last fetched from the per-vCPU
  *    dirty ring structure.
+ * @dirty_pages: Number of pages collected from the dirty ring of this CPU,
+ *    used to measure its dirty page rate.
  *
  * State of one CPU core or thread.
  */
@@ -326,6 +350,8 @@ struct CPUState {
     bool unplug;
     bool crash_occurred;
     bool exit_request;
+    /* set by the TCG profiler to sample the PC at the next TB boundary */
+    bool profile_request;
     bool in_exclusive_context;
     uint32_t cflags_next_tb;
     /* updates protected by BQL */
@@ -348,7 +374,11 @@ struct CPUState {
     IcountDecr *icount_decr_ptr;
 
     /* Accessed in parallel; all accesses must be atomic */
-    TranslationBlock *tb_jmp_cache[TB_JMP_CACHE_SIZE];
+    TranslationBlock *tb_jmp_cache[TB_JMP_CACHE_SIZE][TB_JMP_CACHE_WAYS];
+    TBJmpPred tb_jmp_pred[TB_JMP_PRED_SIZE];
+    /* Only accessed by the vCPU thread, or when it is stopped */
+    TBRetEntry tb_ret_stack[TB_RET_STACK_SIZE];
+    uint32_t tb_ret_top;
 
     struct GDBRegisterState *gdb_regs;
     int gdb_num_regs;
@@ -374,6 +404,7 @@ struct CPUState {
     struct kvm_run *kvm_run;
     struct kvm_dirty_gfn *kvm_dirty_gfns;
     uint32_t kvm_fetch_index;
+    uint64_t dirty_pages;
 
     /* Used for events with 'vcpu' and *without* the 'disabled' properties */
     DECLARE_BITMAP(trace_dstate_delayed, CPU_TRACE_DSTATE_MAX_EVENTS);
@@ -426,10 +457,18 @@ extern __thread CPUState *current_cpu;
 
 static inline void cpu_tb_jmp_cache_clear(CPUState *cpu)
 {
-    unsigned int i;
+    unsigned int i, j;
 
     for (i = 0; i < TB_JMP_CACHE_SIZE; i++) {
-        qatomic_set(&cpu->tb_jmp_cache[i], NULL);
+        for (j = 0; j < TB_JMP_CACHE_WAYS; j++) {
+            qatomic_set(&cpu->tb_jmp_cache[i][j], NULL);
+        }
+    }
+    for (i = 0; i < TB_JMP_PRED_SIZE; i++) {
+        qatomic_set(&cpu->tb_jmp_pred[i].tb, NULL);
+    }
+    for (i = 0; i < TB_RET_STACK_SIZE; i++) {
+        qatomic_set(&cpu->tb_ret_stack[i].caller, NULL);
     }
 }
 
@@ -32,12 +32,15 @@ OBJECT_DECLARE_TYPE(QIOChannel, QIOChannelClass,
 
 #define QIO_CHANNEL_ERR_BLOCK -2
 
+#define QIO_CHANNEL_WRITE_FLAG_ZERO_COPY 0x1
+
 typedef enum QIOChannelFeature QIOChannelFeature;
 
 enum QIOChannelFeature {
     QIO_CHANNEL_FEATURE_FD_PASS,
     QIO_CHANNEL_FEATURE_SHUTDOWN,
     QIO_CHANNEL_FEATURE_LISTEN,
+    QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY,
 };
 
 
@@ -104,6 +107,7 @@ struct QIOChannelClass {
                          size_t niov,
                          int *fds,
                          size_t nfds,
+                         int flags,
                          Error **errp);
     ssize_t (*io_readv)(QIOChannel *ioc,
                         const struct iovec *iov,
@@ -136,6 +140,8 @@ struct QIOChannelClass {
                                   IOHandler *io_read,
                                   IOHandler *io_write,
                                   void *opaque);
+    int (*io_flush)(QIOChannel *ioc,
+                    Error **errp);
 };
 
 /* General I/O handling functions */
@@ -228,6 +234,7 @@ ssize_t qio_channel_readv_full(QIOChannel *ioc,
  * @niov: the length of the @iov array
  * @fds: an array of file handles to send
  * @nfds: number of file handles in @fds
+ * @flags: write flags (QIO_CHANNEL_WRITE_FLAG_*)
  * @errp: pointer to a NULL-initialized error object
  *
  * Write data to the IO channel, reading it from the
@@ -251,6 +258,16 @@ ssize_t qio_channel_readv_full(QIOChannel *ioc,
  * unless qio_channel_has_feature() returns a true
  * value for the QIO_CHANNEL_FEATURE_FD_PASS constant.
  *
+ * If @flags contains QIO_CHANNEL_WRITE_FLAG_ZERO_COPY,
+ * the channel may send the data straight from the
+ * memory regions referenced by @iov after this call
+ * returns, so they must not be freed or reused until
+ * qio_channel_flush() has been called. Data written to
+ * them in the meantime may or may not be sent. It is
+ * an error to pass this flag unless
+ * qio_channel_has_feature() returns a true value for
+ * the QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY constant.
+ *
  * Returns: the number of bytes sent, or -1 on error,
  * or QIO_CHANNEL_ERR_BLOCK if no data is can be sent
  * and the channel is non-blocking
@@ -260,6 +277,7 @@ ssize_t qio_channel_writev_full(QIOChannel *ioc,
                                 size_t niov,
                                 int *fds,
                                 size_t nfds,
+                                int flags,
                                 Error **errp);
 
 /**
@@ -837,6 +855,7 @@ int qio_channel_readv_full_all(QIOChannel *ioc,
  * @niov: the length of the @iov array
  * @fds: an array of file handles to send
  * @nfds: number of file handles in @fds
+ * @flags: write flags (QIO_CHANNEL_WRITE_FLAG_*)
  * @errp: pointer to a NULL-initialized error object
  *
  *
@@ -846,6 +865,10 @@ int qio_channel_readv_full_all(QIOChannel *ioc,
  * to be written, yielding from the current coroutine
  * if required.
  *
+ * If QIO_CHANNEL_WRITE_FLAG_ZERO_COPY is passed in @flags,
+ * the memory regions must be left untouched until a later
+ * qio_channel_flush(), as for qio_channel_writev_full().
+ *
  * Returns: 0 if all bytes were written, or -1 on error
  */
 
@@ -853,6 +876,23 @@ int qio_channel_writev_full_all(QIOChannel *ioc,
                                 const struct iovec *iov,
                                 size_t niov,
                                 int *fds, size_t nfds,
-                                Error **errp);
+                                int flags, Error **errp);
+
+/**
+ * qio_channel_flush:
+ * @ioc: the channel object
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Wait until every write made with QIO_CHANNEL_WRITE_FLAG_ZERO_COPY
+ * has been completed by the channel, after which the memory regions
+ * they referenced may be reused.  Channels without the
+ * QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY feature return immediately.
+ *
+ * Returns: 1 if the channel fell back to copying the data of every
+ * such write, 0 if at least one of them was sent without copying it
+ * or there was nothing to wait for, or -1 on error
+ */
+int qio_channel_flush(QIOChannel *ioc,
+                      Error **errp);
 
 #endif /* QIO_CHANNEL_H */
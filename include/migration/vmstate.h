@@ -183,6 +183,12 @@ struct VMStateDescription {
     int minimum_version_id;
     int minimum_version_id_old;
     MigrationPriority priority;
+    /*
+     * The section can be saved and loaded by a worker thread, without
+     * the BQL, concurrently with any other section of the same priority
+     * (see "Device ordering" in docs/devel/migration.rst).
+     */
+    bool parallel;
     LoadStateHandler *load_state_old;
     int (*pre_load)(void *opaque);
     int (*post_load)(void *opaque, int version_id);
@@ -1175,6 +1181,13 @@ int vmstate_save_state_v(QEMUFile *f, const VMStateDescription *vmsd,
 
 bool vmstate_save_needed(const VMStateDescription *vmsd, void *opaque);
 
+/*
+ * For post_load callbacks of parallel sections: run @fn(@opaque) with
+ * the BQL held once all the sections of the current priority are
+ * loaded, or right away if the caller holds the BQL already.
+ */
+void vmstate_run_locked(void (*fn)(void *opaque), void *opaque);
+
 #define  VMSTATE_INSTANCE_ID_ANY  -1
 
 /* Returns: 0 on success, -1 on failure */
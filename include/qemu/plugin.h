@@ -80,17 +80,42 @@ struct qemu_plugin_dyn_cb {
     union qemu_plugin_cb_sig f;
     void *userp;
     enum plugin_dyn_cb_subtype type;
+    /* @flags applies to regular callbacks other than for memory accesses */
+    enum qemu_plugin_cb_flags flags;
     /* @rw applies to mem callbacks only (both regular and inline) */
     enum qemu_plugin_mem_rw rw;
     /* fields specific to each dyn_cb type go here */
     union {
+        /* PLUGIN_CB_INLINE; applies to @userp if @entry.score is NULL */
         struct {
             enum qemu_plugin_op op;
+            qemu_plugin_u64 entry;
             uint64_t imm;
         } inline_insn;
+        /* PLUGIN_CB_REGULAR, other than for memory accesses */
+        struct {
+            enum qemu_plugin_cond cond;
+            qemu_plugin_u64 entry;
+            uint64_t imm;
+        } cond;
     };
 };
 
+/* Storage of a scoreboard: one element per vCPU, indexed by cpu_index */
+struct qemu_plugin_scoreboard {
+    GArray *data;
+    QLIST_ENTRY(qemu_plugin_scoreboard) entry;
+};
+
+static inline void *
+qemu_plugin_scoreboard_entry(struct qemu_plugin_scoreboard *score,
+                             unsigned int vcpu_index)
+{
+    GArray *arr = score->data;
+
+    return arr->data + vcpu_index * g_array_get_element_size(arr);
+}
+
 /* Internal context for instrumenting an instruction */
 struct qemu_plugin_insn {
     GByteArray *data;
@@ -13,6 +13,7 @@
 #include <inttypes.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <glib.h>
 
 /*
  * For best performance, build the plugin with -fvisibility=hidden so that
@@ -50,7 +51,7 @@ typedef uint64_t qemu_plugin_id_t;
 
 extern QEMU_PLUGIN_EXPORT int qemu_plugin_version;
 
-#define QEMU_PLUGIN_VERSION 1
+#define QEMU_PLUGIN_VERSION 2
 
 /**
  * struct qemu_info_t - system information for plugins
@@ -217,8 +218,11 @@ struct qemu_plugin_insn;
  * @QEMU_PLUGIN_CB_R_REGS: callback reads the CPU's regs
  * @QEMU_PLUGIN_CB_RW_REGS: callback reads and writes the CPU's regs
  *
- * Note: currently unused, plugins cannot read or change system
- * register state.
+ * The registers are only guaranteed to be up to date in TB and
+ * instruction execution callbacks registered with R_REGS or RW_REGS;
+ * the others are cheaper to call as they let the generated code keep
+ * the registers it caches in host registers.  Plugins cannot write
+ * registers for now.
  */
 enum qemu_plugin_cb_flags {
     QEMU_PLUGIN_CB_NO_REGS,
@@ -273,14 +277,55 @@ void qemu_plugin_register_vcpu_tb_exec_cb(struct qemu_plugin_tb *tb,
  * enum qemu_plugin_op - describes an inline op
  *
  * @QEMU_PLUGIN_INLINE_ADD_U64: add an immediate value uint64_t
- *
- * Note: currently only a single inline op is supported.
+ * @QEMU_PLUGIN_INLINE_STORE_U64: store an immediate value uint64_t
  */
 
 enum qemu_plugin_op {
     QEMU_PLUGIN_INLINE_ADD_U64,
+    QEMU_PLUGIN_INLINE_STORE_U64,
+};
+
+/**
+ * enum qemu_plugin_cond - condition to enable a callback
+ *
+ * @QEMU_PLUGIN_COND_NEVER: false
+ * @QEMU_PLUGIN_COND_ALWAYS: true
+ * @QEMU_PLUGIN_COND_EQ: is equal?
+ * @QEMU_PLUGIN_COND_NE: is not equal?
+ * @QEMU_PLUGIN_COND_LT: is less than?
+ * @QEMU_PLUGIN_COND_LE: is less than or equal?
+ * @QEMU_PLUGIN_COND_GT: is greater than?
+ * @QEMU_PLUGIN_COND_GE: is greater than or equal?
+ *
+ * Comparisons are unsigned.
+ */
+enum qemu_plugin_cond {
+    QEMU_PLUGIN_COND_NEVER,
+    QEMU_PLUGIN_COND_ALWAYS,
+    QEMU_PLUGIN_COND_EQ,
+    QEMU_PLUGIN_COND_NE,
+    QEMU_PLUGIN_COND_LT,
+    QEMU_PLUGIN_COND_LE,
+    QEMU_PLUGIN_COND_GT,
+    QEMU_PLUGIN_COND_GE,
 };
 
+/** struct qemu_plugin_scoreboard - Opaque handle for a scoreboard */
+struct qemu_plugin_scoreboard;
+
+/**
+ * typedef qemu_plugin_u64 - uint64_t member of a scoreboard entry
+ * @score: the scoreboard
+ * @offset: offset of the member within each entry
+ *
+ * Inline ops and conditional callbacks take this to designate, for the
+ * vCPU executing the code, the uint64_t in that vCPU's entry.
+ */
+typedef struct {
+    struct qemu_plugin_scoreboard *score;
+    size_t offset;
+} qemu_plugin_u64;
+
 /**
  * qemu_plugin_register_vcpu_tb_exec_inline() - execution inline op
  * @tb: the opaque qemu_plugin_tb handle for the translation
@@ -299,6 +344,45 @@ void qemu_plugin_register_vcpu_tb_exec_inline(struct qemu_plugin_tb *tb,
                                               enum qemu_plugin_op op,
                                               void *ptr, uint64_t imm);
 
+/**
+ * qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu() - per-vCPU inline op
+ * @tb: the opaque qemu_plugin_tb handle for the translation
+ * @op: the type of qemu_plugin_op (e.g. ADD_U64)
+ * @entry: the scoreboard member to apply the op to
+ * @imm: the op data (e.g. 1)
+ *
+ * Insert an inline op on @entry of the executing vCPU every time a
+ * translated unit executes.  Since each vCPU has its own entry, the
+ * result is exact even with multiple vCPUs running in parallel.
+ */
+void qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+    struct qemu_plugin_tb *tb,
+    enum qemu_plugin_op op,
+    qemu_plugin_u64 entry,
+    uint64_t imm);
+
+/**
+ * qemu_plugin_register_vcpu_tb_exec_cond_cb() - register conditional cb
+ * @tb: the opaque qemu_plugin_tb handle for the translation
+ * @cb: callback function
+ * @flags: does the plugin read or write the CPU's registers?
+ * @cond: condition to enable the callback
+ * @entry: first operand of the condition
+ * @imm: second operand of the condition
+ * @userdata: any plugin data to pass to the @cb?
+ *
+ * The @cb function is called when a translated unit executes and
+ * @entry of the executing vCPU compares to @imm as @cond requests.
+ * The comparison itself is done inline.
+ */
+void qemu_plugin_register_vcpu_tb_exec_cond_cb(struct qemu_plugin_tb *tb,
+                                               qemu_plugin_vcpu_udata_cb_t cb,
+                                               enum qemu_plugin_cb_flags flags,
+                                               enum qemu_plugin_cond cond,
+                                               qemu_plugin_u64 entry,
+                                               uint64_t imm,
+                                               void *userdata);
+
 /**
  * qemu_plugin_register_vcpu_insn_exec_cb() - register insn execution cb
  * @insn: the opaque qemu_plugin_insn handle for an instruction
@@ -327,6 +411,44 @@ void qemu_plugin_register_vcpu_insn_exec_inline(struct qemu_plugin_insn *insn,
                                                 enum qemu_plugin_op op,
                                                 void *ptr, uint64_t imm);
 
+/**
+ * qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu() - per-vCPU inline op
+ * @insn: the opaque qemu_plugin_insn handle for an instruction
+ * @op: the type of qemu_plugin_op (e.g. ADD_U64)
+ * @entry: the scoreboard member to apply the op to
+ * @imm: the op data (e.g. 1)
+ *
+ * Insert an inline op on @entry of the executing vCPU every time an
+ * instruction executes.
+ */
+void qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+    struct qemu_plugin_insn *insn,
+    enum qemu_plugin_op op,
+    qemu_plugin_u64 entry,
+    uint64_t imm);
+
+/**
+ * qemu_plugin_register_vcpu_insn_exec_cond_cb() - conditional insn cb
+ * @insn: the opaque qemu_plugin_insn handle for an instruction
+ * @cb: callback function
+ * @flags: does the plugin read or write the CPU's registers?
+ * @cond: condition to enable the callback
+ * @entry: first operand of the condition
+ * @imm: second operand of the condition
+ * @userdata: any plugin data to pass to the @cb?
+ *
+ * The @cb function is called when an instruction executes and @entry of
+ * the executing vCPU compares to @imm as @cond requests.
+ */
+void qemu_plugin_register_vcpu_insn_exec_cond_cb(
+    struct qemu_plugin_insn *insn,
+    qemu_plugin_vcpu_udata_cb_t cb,
+    enum qemu_plugin_cb_flags flags,
+    enum qemu_plugin_cond cond,
+    qemu_plugin_u64 entry,
+    uint64_t imm,
+    void *userdata);
+
 /**
  * qemu_plugin_tb_n_insns() - query helper for number of insns in TB
  * @tb: opaque handle to TB passed to callback
@@ -496,6 +618,23 @@ void qemu_plugin_register_vcpu_mem_inline(struct qemu_plugin_insn *insn,
                                           enum qemu_plugin_op op, void *ptr,
                                           uint64_t imm);
 
+/**
+ * qemu_plugin_register_vcpu_mem_inline_per_vcpu() - per-vCPU inline mem op
+ * @insn: handle for instruction to instrument
+ * @rw: apply to reads, writes or both
+ * @op: the op, of type qemu_plugin_op
+ * @entry: the scoreboard member to apply the op to
+ * @imm: immediate data for @op
+ *
+ * Insert an inline op on @entry of the executing vCPU every time the
+ * instruction accesses memory.
+ */
+void qemu_plugin_register_vcpu_mem_inline_per_vcpu(
+    struct qemu_plugin_insn *insn,
+    enum qemu_plugin_mem_rw rw,
+    enum qemu_plugin_op op,
+    qemu_plugin_u64 entry,
+    uint64_t imm);
 
 
 typedef void
@@ -558,6 +697,141 @@ int qemu_plugin_n_vcpus(void);
 /* returns -1 in user-mode */
 int qemu_plugin_n_max_vcpus(void);
 
+/**
+ * qemu_plugin_scoreboard_new() - alloc a new scoreboard
+ * @element_size: size (bytes) for one entry
+ *
+ * A scoreboard is an array of entries, one per vCPU, that inline ops
+ * and conditional callbacks can access from generated code.  Entries are
+ * zeroed, and so are those added later for vCPUs created afterwards.
+ *
+ * Returns a pointer to a new scoreboard. It must be freed using
+ * qemu_plugin_scoreboard_free.
+ */
+struct qemu_plugin_scoreboard *qemu_plugin_scoreboard_new(size_t element_size);
+
+/**
+ * qemu_plugin_scoreboard_free() - free a scoreboard
+ * @score: scoreboard to free
+ *
+ * Code that was instrumented with the scoreboard may still run until the
+ * translation cache is flushed, so this is usually only called on exit.
+ */
+void qemu_plugin_scoreboard_free(struct qemu_plugin_scoreboard *score);
+
+/**
+ * qemu_plugin_scoreboard_find() - get pointer to an entry of a scoreboard
+ * @score: scoreboard to query
+ * @vcpu_index: entry index
+ *
+ * Returns address of entry of a scoreboard matching a given vcpu_index.
+ * This address is only valid until the next vCPU is created, since the
+ * scoreboard may be reallocated then.
+ */
+void *qemu_plugin_scoreboard_find(struct qemu_plugin_scoreboard *score,
+                                  unsigned int vcpu_index);
+
+/* Macros to define a qemu_plugin_u64 */
+#define qemu_plugin_scoreboard_u64(score) \
+    (qemu_plugin_u64) {score, 0}
+#define qemu_plugin_scoreboard_u64_in_struct(score, type, member) \
+    (qemu_plugin_u64) {score, offsetof(type, member)}
+
+/**
+ * qemu_plugin_u64_add() - add a value to a qemu_plugin_u64 for a given vcpu
+ * @entry: entry to query
+ * @vcpu_index: entry index
+ * @added: value to add
+ */
+void qemu_plugin_u64_add(qemu_plugin_u64 entry, unsigned int vcpu_index,
+                         uint64_t added);
+
+/**
+ * qemu_plugin_u64_get() - get value of a qemu_plugin_u64 for a given vcpu
+ * @entry: entry to query
+ * @vcpu_index: entry index
+ */
+uint64_t qemu_plugin_u64_get(qemu_plugin_u64 entry, unsigned int vcpu_index);
+
+/**
+ * qemu_plugin_u64_set() - set value of a qemu_plugin_u64 for a given vcpu
+ * @entry: entry to query
+ * @vcpu_index: entry index
+ * @val: new value
+ */
+void qemu_plugin_u64_set(qemu_plugin_u64 entry, unsigned int vcpu_index,
+                         uint64_t val);
+
+/**
+ * qemu_plugin_u64_sum() - return sum of all vcpu entries in a scoreboard
+ * @entry: entry to sum
+ */
+uint64_t qemu_plugin_u64_sum(qemu_plugin_u64 entry);
+
+/** struct qemu_plugin_register - Opaque handle for register access */
+struct qemu_plugin_register;
+
+/**
+ * typedef qemu_plugin_reg_descriptor - register descriptions
+ *
+ * @handle: opaque handle for retrieving value with qemu_plugin_read_register
+ * @name: register name, as in the gdb XML description (e.g. "rax")
+ * @feature: the gdb feature the register belongs to
+ *   (e.g. "org.gnu.gdb.i386.core")
+ */
+typedef struct {
+    struct qemu_plugin_register *handle;
+    const char *name;
+    const char *feature;
+} qemu_plugin_reg_descriptor;
+
+/**
+ * qemu_plugin_get_registers() - return register list for the current vCPU
+ *
+ * Must be called from a callback running on a vCPU, e.g. on translation
+ * or execution, but not from the vCPU initialisation callback: not all
+ * registers are known yet at that point.  The handles are valid for all
+ * the vCPUs of the same type.
+ *
+ * Returns a GArray of qemu_plugin_reg_descriptor, to be freed by the
+ * caller with g_array_free(); the strings it points to are never freed.
+ */
+GArray *qemu_plugin_get_registers(void);
+
+/**
+ * qemu_plugin_read_register() - read a register of the current vCPU
+ *
+ * @handle: a handle from qemu_plugin_get_registers()
+ * @buf: a GByteArray the value is appended to, in target byte order
+ *
+ * Must be called from an execution callback registered with
+ * QEMU_PLUGIN_CB_R_REGS or QEMU_PLUGIN_CB_RW_REGS.  Note that the
+ * program counter is only up to date at the start of a TB; use
+ * qemu_plugin_insn_vaddr() at translation time for instructions.
+ *
+ * Returns the size of the register in bytes, or -1 on error.
+ */
+int qemu_plugin_read_register(struct qemu_plugin_register *handle,
+                              GByteArray *buf);
+
+/**
+ * qemu_plugin_read_memory_vaddr() - read guest memory at a virtual address
+ *
+ * @addr: the virtual address, as seen by the current vCPU
+ * @data: a GByteArray the bytes are appended to
+ * @len: the number of bytes to read
+ *
+ * Must be called from a callback running on a vCPU.  The access does not
+ * fault, trigger watchpoints or touch the TLB: the guest page tables are
+ * walked as a debugger would, which is slower than the access itself.
+ * Only RAM and ROM can be read, never device registers.
+ *
+ * Returns true if all @len bytes were read; @data is left unchanged
+ * otherwise.
+ */
+bool qemu_plugin_read_memory_vaddr(uint64_t addr, GByteArray *data,
+                                   size_t len);
+
 /**
  * qemu_plugin_outs() - output string via QEMU's logging system
  * @string: a string
@@ -0,0 +1,64 @@
+/*
+ * Per-vCPU dirty page rate limit
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef SYSEMU_DIRTYLIMIT_H
+#define SYSEMU_DIRTYLIMIT_H
+
+/**
+ * dirtylimit_supported:
+ *
+ * Returns: %true if the dirty page rate of each vCPU can be measured,
+ * which requires the KVM dirty ring.
+ */
+bool dirtylimit_supported(void);
+
+/**
+ * dirtylimit_set_vcpu:
+ * @cpu_index: index of the vCPU to limit
+ * @quota: dirty page rate limit in MB/s, 0 to lift the limit
+ *
+ * Throttle the vCPU, if it dirties memory faster than @quota, by making
+ * it sleep for a share of its time that is adjusted at each measurement
+ * period.  Must be called with the BQL held.
+ */
+void dirtylimit_set_vcpu(int cpu_index, uint64_t quota);
+
+/**
+ * dirtylimit_set_all:
+ * @quota: dirty page rate limit in MB/s, 0 to lift the limits
+ *
+ * Like dirtylimit_set_vcpu, for all the vCPUs.
+ */
+void dirtylimit_set_all(uint64_t quota);
+
+/**
+ * dirtylimit_migration_set:
+ * @quota: dirty page rate limit in MB/s, must not be 0
+ *
+ * Limit all the vCPUs for migration.  The first call saves the limits set
+ * by the user, which cannot be changed until dirtylimit_migration_stop;
+ * a vCPU whose own limit is lower keeps it.  Must be called with the BQL
+ * held.
+ */
+void dirtylimit_migration_set(uint64_t quota);
+
+/**
+ * dirtylimit_migration_stop:
+ *
+ * Give back to the vCPUs the limits saved by dirtylimit_migration_set, if
+ * it was called.  Must be called with the BQL held.
+ */
+void dirtylimit_migration_stop(void);
+
+/**
+ * dirtylimit_in_service:
+ *
+ * Returns: %true if the dirty page rate of any vCPU is limited.
+ */
+bool dirtylimit_in_service(void);
+
+#endif /* SYSEMU_DIRTYLIMIT_H */
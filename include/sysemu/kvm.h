@@ -233,6 +233,14 @@ int kvm_has_intx_set_mask(void);
  */
 bool kvm_arm_supports_user_irq(void);
 
+/**
+ * kvm_dirty_ring_enabled:
+ *
+ * Returns: true if KVM reports dirty pages through the per-vCPU dirty
+ * rings, which tell which vCPU dirtied each page
+ */
+bool kvm_dirty_ring_enabled(void);
+
 
 #ifdef NEED_CPU_H
 #include "cpu.h"
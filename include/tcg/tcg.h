@@ -533,6 +533,13 @@ typedef struct TCGProfile {
     int64_t table_op_count[NB_OPS];
 } TCGProfile;
 
+/* Ops removed or simplified by tcg_optimize(), see tcg_opt_counts() */
+typedef struct TCGOptCounts {
+    size_t env_ld_elim;
+    size_t env_st_elim;
+    size_t cse_elim;
+} TCGOptCounts;
+
 struct TCGContext {
     uint8_t *pool_cur, *pool_end;
     TCGPool *pool_first, *pool_current, *pool_first_large;
@@ -560,6 +567,7 @@ struct TCGContext {
 #ifdef CONFIG_PROFILER
     TCGProfile prof;
 #endif
+    TCGOptCounts opt_counts;
 
 #ifdef CONFIG_DEBUG_TCG
     int temps_in_use;
@@ -609,6 +617,9 @@ struct TCGContext {
     QSIMPLEQ_HEAD(, TCGOp) plugin_ops;
 #endif
 
+    /* If not NULL, tcg_emit_op() inserts new ops before this one. */
+    TCGOp *emit_before_op;
+
     GHashTable *const_table[TCG_TYPE_COUNT];
     TCGTempSet free_temps[TCG_TYPE_COUNT * 2];
     TCGTemp temps[TCG_MAX_TEMPS]; /* globals first, temps after */
@@ -807,6 +818,7 @@ void tcg_pool_reset(TCGContext *s);
 TranslationBlock *tcg_tb_alloc(TCGContext *s);
 
 void tcg_region_reset_all(void);
+bool tcg_region_evict(GTraverseFunc func, gpointer user_data);
 
 size_t tcg_code_size(void);
 size_t tcg_code_capacity(void);
@@ -816,6 +828,7 @@ void tcg_tb_remove(TranslationBlock *tb);
 TranslationBlock *tcg_tb_lookup(uintptr_t tc_ptr);
 void tcg_tb_foreach(GTraverseFunc func, gpointer user_data);
 size_t tcg_nb_tbs(void);
+void tcg_opt_counts(TCGOptCounts *counts);
 
 /* user-mode: Called with mmap_lock held.  */
 static inline void *tcg_malloc(int size)
@@ -836,7 +849,7 @@ static inline void *tcg_malloc(int size)
     }
 }
 
-void tcg_init(size_t tb_size, int splitwx, unsigned max_cpus);
+void tcg_init(size_t tb_size, int splitwx, unsigned max_cpus, bool evict);
 void tcg_register_thread(void);
 void tcg_prologue_init(TCGContext *s);
 void tcg_func_start(TCGContext *s);
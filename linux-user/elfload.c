@@ -2414,6 +2414,41 @@ static void pgb_dynamic(const char *image_name, long align)
     }
 }
 
+/*
+ * Try to reserve the guest address space at the same host addresses,
+ * so that guest_base is 0 and generated code can use guest addresses
+ * as host addresses without adding anything.  As with an explicit
+ * "-B 0", the guest cannot map anything below mmap_min_addr; give up
+ * if the image itself needs to.
+ */
+static bool pgb_reserved_va_identity(abi_ulong guest_loaddr, long align)
+{
+    int flags = MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE |
+                MAP_FIXED_NOREPLACE;
+    uintptr_t start = ROUND_UP(mmap_min_addr, align);
+    void *addr;
+
+    if (guest_loaddr && guest_loaddr < start) {
+        return false;
+    }
+    if (start >= reserved_va) {
+        return false;
+    }
+
+    addr = mmap((void *)start, reserved_va - start, PROT_NONE, flags, -1, 0);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+    if (addr != (void *)start) {
+        /* MAP_FIXED_NOREPLACE is unknown to the kernel and was ignored. */
+        munmap(addr, reserved_va - start);
+        return false;
+    }
+
+    guest_base = 0;
+    return true;
+}
+
 static void pgb_reserved_va(const char *image_name, abi_ulong guest_loaddr,
                             abi_ulong guest_hiaddr, long align)
 {
@@ -2427,6 +2462,10 @@ static void pgb_reserved_va(const char *image_name, abi_ulong guest_loaddr,
         exit(EXIT_FAILURE);
     }
 
+    if (pgb_reserved_va_identity(guest_loaddr, align)) {
+        return;
+    }
+
     /* Widen the "image" to the entire reserved address space. */
     pgb_static(image_name, 0, reserved_va, align);
 
@@ -24,6 +24,7 @@
 #include "sysemu/runstate.h"
 #include "sysemu/sysemu.h"
 #include "sysemu/cpu-throttle.h"
+#include "sysemu/dirtylimit.h"
 #include "rdma.h"
 #include "ram.h"
 #include "migration/global_state.h"
@@ -1214,6 +1215,39 @@ static bool migrate_caps_check(bool *cap_list,
         }
     }
 
+    if (cap_list[MIGRATION_CAPABILITY_MULTIFD_ZERO_PAGE] &&
+        !cap_list[MIGRATION_CAPABILITY_MULTIFD]) {
+        error_setg(errp, "Multifd-zero-page requires multifd");
+        return false;
+    }
+
+#ifdef CONFIG_LINUX
+    if (cap_list[MIGRATION_CAPABILITY_ZERO_COPY_SEND]) {
+        MigrationState *s = migrate_get_current();
+
+        if (!cap_list[MIGRATION_CAPABILITY_MULTIFD] ||
+            s->parameters.multifd_compression != MULTIFD_COMPRESSION_NONE ||
+            (s->parameters.tls_creds && *s->parameters.tls_creds)) {
+            error_setg(errp, "Zero copy only available for non-compressed "
+                       "non-TLS multifd migration");
+            return false;
+        }
+    }
+#endif
+
+    if (cap_list[MIGRATION_CAPABILITY_DIRTY_LIMIT]) {
+        if (cap_list[MIGRATION_CAPABILITY_AUTO_CONVERGE]) {
+            error_setg(errp, "Dirty-limit conflicts with auto-converge, "
+                       "only one of them can be enabled");
+            return false;
+        }
+        if (!dirtylimit_supported()) {
+            error_setg(errp, "Dirty-limit requires KVM with the dirty ring "
+                       "enabled");
+            return false;
+        }
+    }
+
     if (cap_list[MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT]) {
         WriteTrackingSupport wt_support;
         int idx;
@@ -1408,6 +1442,16 @@ static bool migrate_params_check(MigrationParameters *params, Error **errp)
         return false;
     }
 
+    if (migrate_use_zero_copy_send() &&
+        ((params->has_multifd_compression &&
+          params->multifd_compression != MULTIFD_COMPRESSION_NONE) ||
+         (params->has_tls_creds && params->tls_creds &&
+          *params->tls_creds))) {
+        error_setg(errp, "Zero copy only available for non-compressed "
+                   "non-TLS multifd migration");
+        return false;
+    }
+
     if (params->has_xbzrle_cache_size &&
         (params->xbzrle_cache_size < qemu_target_page_size() ||
          !is_power_of_2(params->xbzrle_cache_size))) {
@@ -2479,6 +2523,46 @@ bool migrate_use_multifd(void)
     return s->enabled_capabilities[MIGRATION_CAPABILITY_MULTIFD];
 }
 
+bool migrate_multifd_zero_page(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_MULTIFD_ZERO_PAGE];
+}
+
+bool migrate_dirty_limit(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_DIRTY_LIMIT];
+}
+
+bool migrate_parallel_device_state(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_PARALLEL_DEVICE_STATE];
+}
+
+bool migrate_use_zero_copy_send(void)
+{
+#ifdef CONFIG_LINUX
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_ZERO_COPY_SEND];
+#else
+    return false;
+#endif
+}
+
 bool migrate_pause_before_switchover(void)
 {
     MigrationState *s;
@@ -3556,6 +3640,9 @@ static void migration_iteration_finish(MigrationState *s)
     cpu_throttle_stop();
 
     qemu_mutex_lock_iothread();
+    /* Likewise, give the vCPUs back the dirty page rate limits of the user */
+    dirtylimit_migration_stop();
+
     switch (s->state) {
     case MIGRATION_STATUS_COMPLETED:
         migration_calculate_complete(s);
@@ -4177,6 +4264,15 @@ static Property migration_properties[] = {
     DEFINE_PROP_MIG_CAP("x-block", MIGRATION_CAPABILITY_BLOCK),
     DEFINE_PROP_MIG_CAP("x-return-path", MIGRATION_CAPABILITY_RETURN_PATH),
     DEFINE_PROP_MIG_CAP("x-multifd", MIGRATION_CAPABILITY_MULTIFD),
+    DEFINE_PROP_MIG_CAP("x-multifd-zero-page",
+            MIGRATION_CAPABILITY_MULTIFD_ZERO_PAGE),
+#ifdef CONFIG_LINUX
+    DEFINE_PROP_MIG_CAP("x-zero-copy-send",
+            MIGRATION_CAPABILITY_ZERO_COPY_SEND),
+#endif
+    DEFINE_PROP_MIG_CAP("x-parallel-device-state",
+            MIGRATION_CAPABILITY_PARALLEL_DEVICE_STATE),
+    DEFINE_PROP_MIG_CAP("x-dirty-limit", MIGRATION_CAPABILITY_DIRTY_LIMIT),
     DEFINE_PROP_MIG_CAP("x-background-snapshot",
             MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT),
 
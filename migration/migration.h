@@ -323,7 +323,11 @@ bool migrate_ignore_shared(void);
 bool migrate_validate_uuid(void);
 
 bool migrate_auto_converge(void);
+bool migrate_dirty_limit(void);
 bool migrate_use_multifd(void);
+bool migrate_multifd_zero_page(void);
+bool migrate_use_zero_copy_send(void);
+bool migrate_parallel_device_state(void);
 bool migrate_pause_before_switchover(void);
 int migrate_multifd_channels(void);
 MultiFDCompression migrate_multifd_compression(void);
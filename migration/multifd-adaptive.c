@@ -0,0 +1,344 @@
+/*
+ * Multifd adaptive compression implementation
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/rcu.h"
+#include "qemu/timer.h"
+#include "exec/target_page.h"
+#include "qapi/error.h"
+#include "migration.h"
+#include "trace.h"
+#include "multifd.h"
+
+/*
+ * Each packet is sent with whichever of no compression, lz4 and zstd
+ * is expected to put its pages on the other side first, given how fast
+ * each method compresses, how well it compresses and how fast the
+ * channel drains.  The method used is recorded in the packet flags, so
+ * the receiving side just follows.
+ */
+
+typedef enum {
+    ADAPTIVE_NONE,
+    ADAPTIVE_LZ4,
+    ADAPTIVE_ZSTD,
+    ADAPTIVE__MAX,
+} AdaptiveMethod;
+
+static const struct {
+    const char *name;
+    MultiFDCompression compression;
+    uint32_t flag;
+} adaptive_methods[ADAPTIVE__MAX] = {
+    [ADAPTIVE_NONE] = { "none", MULTIFD_COMPRESSION_NONE, MULTIFD_FLAG_NOCOMP },
+    [ADAPTIVE_LZ4] = { "lz4", MULTIFD_COMPRESSION_LZ4, MULTIFD_FLAG_LZ4 },
+    [ADAPTIVE_ZSTD] = { "zstd", MULTIFD_COMPRESSION_ZSTD, MULTIFD_FLAG_ZSTD },
+};
+
+/*
+ * Every ADAPTIVE_PROBE_INTERVAL packets, each method is used once so that
+ * its statistics follow the changes of the guest workload.
+ */
+#define ADAPTIVE_PROBE_INTERVAL 64
+/* Weight of the last sample in the moving averages */
+#define ADAPTIVE_EWMA_WEIGHT 0.25
+
+struct adaptive_data {
+    /* per method data, swapped into p->data around each call */
+    void *data[ADAPTIVE__MAX];
+    /* method used for the packet being sent */
+    AdaptiveMethod cur;
+    /* packets sent */
+    uint64_t packets;
+    /* compression time, in ns per input byte */
+    double comp_cost[ADAPTIVE__MAX];
+    /* output size per input byte */
+    double ratio[ADAPTIVE__MAX];
+    /* whether comp_cost and ratio hold a sample */
+    bool sampled[ADAPTIVE__MAX];
+    /* channel write time, in ns per byte sent */
+    double wire_cost;
+};
+
+static MultiFDMethods *adaptive_ops(AdaptiveMethod m)
+{
+    return multifd_get_ops(adaptive_methods[m].compression);
+}
+
+static double adaptive_ewma(double avg, double sample, bool first)
+{
+    return first ? sample
+                 : avg + ADAPTIVE_EWMA_WEIGHT * (sample - avg);
+}
+
+/* Estimated time to put one input byte on the wire with method @m */
+static double adaptive_cost(struct adaptive_data *a, AdaptiveMethod m)
+{
+    return a->comp_cost[m] + a->ratio[m] * a->wire_cost;
+}
+
+static AdaptiveMethod adaptive_choose(struct adaptive_data *a)
+{
+    uint64_t slot = a->packets++ % ADAPTIVE_PROBE_INTERVAL;
+    AdaptiveMethod best = ADAPTIVE_NONE;
+    AdaptiveMethod m;
+
+    if (slot < ADAPTIVE__MAX) {
+        return slot;
+    }
+    for (m = ADAPTIVE_NONE + 1; m < ADAPTIVE__MAX; m++) {
+        if (adaptive_cost(a, m) < adaptive_cost(a, best)) {
+            best = m;
+        }
+    }
+    return best;
+}
+
+/* Multifd adaptive compression */
+
+/**
+ * adaptive_send_cleanup: cleanup send side
+ *
+ * Cleanup each of the methods that were setup.
+ *
+ * @p: Params for the channel that we are using
+ */
+static void adaptive_send_cleanup(MultiFDSendParams *p, Error **errp)
+{
+    struct adaptive_data *a = p->data;
+    AdaptiveMethod m;
+
+    if (!a) {
+        return;
+    }
+    for (m = 0; m < ADAPTIVE__MAX; m++) {
+        if (a->data[m] || m == ADAPTIVE_NONE) {
+            p->data = a->data[m];
+            adaptive_ops(m)->send_cleanup(p, errp);
+        }
+    }
+    g_free(a);
+    p->data = NULL;
+}
+
+/**
+ * adaptive_send_setup: setup send side
+ *
+ * Setup each channel with all the methods it can choose from.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int adaptive_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    struct adaptive_data *a = g_new0(struct adaptive_data, 1);
+    AdaptiveMethod m;
+
+    for (m = 0; m < ADAPTIVE__MAX; m++) {
+        p->data = NULL;
+        if (adaptive_ops(m)->send_setup(p, errp)) {
+            p->data = a;
+            adaptive_send_cleanup(p, NULL);
+            return -1;
+        }
+        a->data[m] = p->data;
+    }
+    p->data = a;
+    return 0;
+}
+
+/**
+ * adaptive_send_prepare: prepare date to be able to send
+ *
+ * Pick the method for this packet and let it prepare the data.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ * @errp: pointer to an error
+ */
+static int adaptive_send_prepare(MultiFDSendParams *p, uint32_t used,
+                                 Error **errp)
+{
+    struct adaptive_data *a = p->data;
+    uint64_t in_size = (uint64_t)used * qemu_target_page_size();
+    AdaptiveMethod m = adaptive_choose(a);
+    int64_t start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int ret;
+
+    p->data = a->data[m];
+    ret = adaptive_ops(m)->send_prepare(p, used, errp);
+    p->data = a;
+    if (ret != 0) {
+        return ret;
+    }
+
+    a->cur = m;
+    if (m != ADAPTIVE_NONE) {
+        int64_t elapsed = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start;
+
+        a->comp_cost[m] = adaptive_ewma(a->comp_cost[m],
+                                        (double)MAX(elapsed, 1) / in_size,
+                                        !a->sampled[m]);
+        a->ratio[m] = adaptive_ewma(a->ratio[m],
+                                    (double)p->next_packet_size / in_size,
+                                    !a->sampled[m]);
+    } else {
+        a->ratio[m] = 1;
+    }
+    a->sampled[m] = true;
+
+    trace_multifd_adaptive_send(p->id, adaptive_methods[m].name, in_size,
+                                p->next_packet_size);
+    return 0;
+}
+
+/**
+ * adaptive_send_write: do the actual write of the data
+ *
+ * Let the method picked by adaptive_send_prepare write the data, and
+ * measure how fast the channel takes it.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ * @errp: pointer to an error
+ */
+static int adaptive_send_write(MultiFDSendParams *p, uint32_t used,
+                               Error **errp)
+{
+    struct adaptive_data *a = p->data;
+    uint32_t size = p->next_packet_size;
+    int64_t start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int64_t elapsed;
+    int ret;
+
+    p->data = a->data[a->cur];
+    ret = adaptive_ops(a->cur)->send_write(p, used, errp);
+    p->data = a;
+    if (ret != 0) {
+        return ret;
+    }
+
+    elapsed = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start;
+    if (size) {
+        a->wire_cost = adaptive_ewma(a->wire_cost,
+                                     (double)MAX(elapsed, 1) / size,
+                                     a->wire_cost == 0);
+    }
+    return 0;
+}
+
+/**
+ * adaptive_recv_cleanup: cleanup receive side
+ *
+ * Cleanup each of the methods that were setup.
+ *
+ * @p: Params for the channel that we are using
+ */
+static void adaptive_recv_cleanup(MultiFDRecvParams *p)
+{
+    struct adaptive_data *a = p->data;
+    AdaptiveMethod m;
+
+    if (!a) {
+        return;
+    }
+    for (m = 0; m < ADAPTIVE__MAX; m++) {
+        if (a->data[m] || m == ADAPTIVE_NONE) {
+            p->data = a->data[m];
+            adaptive_ops(m)->recv_cleanup(p);
+        }
+    }
+    g_free(a);
+    p->data = NULL;
+}
+
+/**
+ * adaptive_recv_setup: setup receive side
+ *
+ * Setup all the methods the sending side can choose from.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int adaptive_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    struct adaptive_data *a = g_new0(struct adaptive_data, 1);
+    AdaptiveMethod m;
+
+    for (m = 0; m < ADAPTIVE__MAX; m++) {
+        p->data = NULL;
+        if (adaptive_ops(m)->recv_setup(p, errp)) {
+            p->data = a;
+            adaptive_recv_cleanup(p);
+            return -1;
+        }
+        a->data[m] = p->data;
+    }
+    p->data = a;
+    return 0;
+}
+
+/**
+ * adaptive_recv_pages: read the data from the channel into actual pages
+ *
+ * Hand the packet to the method the sending side used for it.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ * @errp: pointer to an error
+ */
+static int adaptive_recv_pages(MultiFDRecvParams *p, uint32_t used,
+                               Error **errp)
+{
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+    struct adaptive_data *a = p->data;
+    AdaptiveMethod m;
+    int ret;
+
+    for (m = 0; m < ADAPTIVE__MAX; m++) {
+        if (flags == adaptive_methods[m].flag) {
+            break;
+        }
+    }
+    if (m == ADAPTIVE__MAX) {
+        error_setg(errp, "multifd %d: unknown compression flags received %x",
+                   p->id, flags);
+        return -1;
+    }
+
+    p->data = a->data[m];
+    ret = adaptive_ops(m)->recv_pages(p, used, errp);
+    p->data = a;
+    return ret;
+}
+
+static MultiFDMethods multifd_adaptive_ops = {
+    .send_setup = adaptive_send_setup,
+    .send_cleanup = adaptive_send_cleanup,
+    .send_prepare = adaptive_send_prepare,
+    .send_write = adaptive_send_write,
+    .recv_setup = adaptive_recv_setup,
+    .recv_cleanup = adaptive_recv_cleanup,
+    .recv_pages = adaptive_recv_pages
+};
+
+static void multifd_adaptive_register(void)
+{
+    multifd_register_ops(MULTIFD_COMPRESSION_ADAPTIVE, &multifd_adaptive_ops);
+}
+
+migration_init(multifd_adaptive_register);
@@ -11,6 +11,7 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/cutils.h"
 #include "qemu/rcu.h"
 #include "exec/target_page.h"
 #include "sysemu/sysemu.h"
@@ -95,7 +96,8 @@ static int nocomp_send_prepare(MultiFDSendParams *p, uint32_t used,
 /**
  * nocomp_send_write: do the actual write of the data
  *
- * For no compression we just have to write the data.
+ * For no compression we just have to write the data, straight from
+ * guest memory if zero copy send is enabled.
  *
  * Returns 0 for success or -1 for error
  *
@@ -105,7 +107,8 @@ static int nocomp_send_prepare(MultiFDSendParams *p, uint32_t used,
  */
 static int nocomp_send_write(MultiFDSendParams *p, uint32_t used, Error **errp)
 {
-    return qio_channel_writev_all(p->c, p->pages->iov, used, errp);
+    return qio_channel_writev_full_all(p->c, p->pages->iov, used, NULL, 0,
+                                       p->write_flags, errp);
 }
 
 /**
@@ -177,6 +180,12 @@ void multifd_register_ops(int method, MultiFDMethods *ops)
     multifd_ops[method] = ops;
 }
 
+MultiFDMethods *multifd_get_ops(int method)
+{
+    assert(0 <= method && method < MULTIFD_COMPRESSION__MAX);
+    return multifd_ops[method];
+}
+
 static int multifd_send_initial_packet(MultiFDSendParams *p, Error **errp)
 {
     MultiFDInit_t msg = {};
@@ -273,6 +282,7 @@ static void multifd_send_fill_packet(MultiFDSendParams *p)
     packet->pages_used = cpu_to_be32(p->pages->used);
     packet->next_packet_size = cpu_to_be32(p->next_packet_size);
     packet->packet_num = cpu_to_be64(p->packet_num);
+    packet->zero_pages = cpu_to_be32(p->zero_num);
 
     if (p->pages->block) {
         strncpy(packet->ramblock, p->pages->block->idstr, 256);
@@ -284,6 +294,12 @@ static void multifd_send_fill_packet(MultiFDSendParams *p)
 
         packet->offset[i] = cpu_to_be64(temp);
     }
+
+    for (i = 0; i < p->zero_num; i++) {
+        uint64_t temp = p->zero[i];
+
+        packet->offset[p->pages->used + i] = cpu_to_be64(temp);
+    }
 }
 
 static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
@@ -329,6 +345,8 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
     if (packet->pages_alloc > p->pages->allocated) {
         multifd_pages_clear(p->pages);
         p->pages = multifd_pages_init(packet->pages_alloc);
+        g_free(p->zero);
+        p->zero = g_new0(ram_addr_t, packet->pages_alloc);
     }
 
     p->pages->used = be32_to_cpu(packet->pages_used);
@@ -339,10 +357,18 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
         return -1;
     }
 
+    p->zero_num = be32_to_cpu(packet->zero_pages);
+    if (p->zero_num > packet->pages_alloc - p->pages->used) {
+        error_setg(errp, "multifd: received packet "
+                   "with %d zero pages and expected maximum zero pages are %d",
+                   p->zero_num, packet->pages_alloc - p->pages->used);
+        return -1;
+    }
+
     p->next_packet_size = be32_to_cpu(packet->next_packet_size);
     p->packet_num = be64_to_cpu(packet->packet_num);
 
-    if (p->pages->used == 0) {
+    if (p->pages->used == 0 && p->zero_num == 0) {
         return 0;
     }
 
@@ -368,6 +394,19 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
         p->pages->iov[i].iov_len = qemu_target_page_size();
     }
 
+    for (i = 0; i < p->zero_num; i++) {
+        uint64_t offset = be64_to_cpu(packet->offset[p->pages->used + i]);
+
+        if (offset > (block->used_length - qemu_target_page_size())) {
+            error_setg(errp, "multifd: zero page offset too long %" PRIu64
+                       " (max " RAM_ADDR_FMT ")",
+                       offset, block->used_length);
+            return -1;
+        }
+        p->zero[i] = offset;
+    }
+    p->pages->block = block;
+
     return 0;
 }
 
@@ -407,6 +446,25 @@ struct {
  * false.
  */
 
+/*
+ * Pages are accounted as normal pages when they are queued.  Correct the
+ * statistics for the zero pages that the channel found since last time,
+ * of which only the offset was sent.
+ *
+ * Called with p->mutex held.
+ */
+static void multifd_send_account_zero_pages(QEMUFile *f, MultiFDSendParams *p)
+{
+    uint64_t bytes = p->zero_pending * qemu_target_page_size();
+
+    ram_counters.normal -= p->zero_pending;
+    ram_counters.duplicate += p->zero_pending;
+    ram_counters.multifd_bytes -= bytes;
+    ram_counters.transferred -= bytes;
+    qemu_file_update_transfer(f, -(int64_t)bytes);
+    p->zero_pending = 0;
+}
+
 static int multifd_send_pages(QEMUFile *f)
 {
     int i;
@@ -445,6 +503,7 @@ static int multifd_send_pages(QEMUFile *f)
     assert(!p->pages->used);
     assert(!p->pages->block);
 
+    multifd_send_account_zero_pages(f, p);
     p->packet_num = multifd_send_state->packet_num++;
     multifd_send_state->pages = p->pages;
     p->pages = pages;
@@ -557,6 +616,8 @@ void multifd_save_cleanup(void)
         p->tls_hostname = NULL;
         multifd_pages_clear(p->pages);
         p->pages = NULL;
+        g_free(p->zero);
+        p->zero = NULL;
         p->packet_len = 0;
         g_free(p->packet);
         p->packet = NULL;
@@ -615,10 +676,65 @@ void multifd_send_sync_main(QEMUFile *f)
 
         trace_multifd_send_sync_main_wait(p->id);
         qemu_sem_wait(&p->sem_sync);
+
+        qemu_mutex_lock(&p->mutex);
+        multifd_send_account_zero_pages(f, p);
+        qemu_mutex_unlock(&p->mutex);
+
+        /*
+         * With zero copy send, the kernel reads the pages when it puts
+         * them on the wire.  A page dirtied after it was queued may
+         * go out with newer contents, which is fine because it is dirty
+         * again and will be resent; but before the pass is complete
+         * (and the source stops, at the end of migration), every page
+         * queued in it must really have been sent.  The channel is
+         * idle here, waiting for the next job.
+         */
+        if (p->write_flags & QIO_CHANNEL_WRITE_FLAG_ZERO_COPY) {
+            Error *local_err = NULL;
+
+            if (qio_channel_flush(p->c, &local_err) < 0) {
+                error_prepend(&local_err, "multifd %d: ", p->id);
+                multifd_send_terminate_threads(local_err);
+                error_free(local_err);
+                return;
+            }
+        }
     }
     trace_multifd_send_sync_main(multifd_send_state->packet_num);
 }
 
+/*
+ * multifd_send_zero_page_detect: take the zero pages out of the packet
+ *
+ * Only the offsets of the zero pages are sent, and the destination
+ * clears them if needed.  The other pages are kept at the start of
+ * p->pages.
+ *
+ * Returns the number of pages left to send with their data
+ *
+ * @p: Params for the channel that we are using
+ */
+static uint32_t multifd_send_zero_page_detect(MultiFDSendParams *p)
+{
+    MultiFDPages_t *pages = p->pages;
+    size_t page_size = qemu_target_page_size();
+    uint32_t i, used = 0;
+
+    for (i = 0; i < pages->used; i++) {
+        if (buffer_is_zero(pages->iov[i].iov_base, page_size)) {
+            p->zero[p->zero_num++] = pages->offset[i];
+        } else {
+            pages->offset[used] = pages->offset[i];
+            pages->iov[used] = pages->iov[i];
+            used++;
+        }
+    }
+    pages->used = used;
+    p->zero_pending += p->zero_num;
+    return used;
+}
+
 static void *multifd_send_thread(void *opaque)
 {
     MultiFDSendParams *p = opaque;
@@ -649,6 +765,11 @@ static void *multifd_send_thread(void *opaque)
             uint64_t packet_num = p->packet_num;
             flags = p->flags;
 
+            p->zero_num = 0;
+            p->next_packet_size = 0;
+            if (used && migrate_multifd_zero_page()) {
+                used = multifd_send_zero_page_detect(p);
+            }
             if (used) {
                 ret = multifd_send_state->ops->send_prepare(p, used,
                                                             &local_err);
@@ -665,7 +786,7 @@ static void *multifd_send_thread(void *opaque)
             p->pages->block = NULL;
             qemu_mutex_unlock(&p->mutex);
 
-            trace_multifd_send(p->id, packet_num, used, flags,
+            trace_multifd_send(p->id, packet_num, used, p->zero_num, flags,
                                p->next_packet_size);
 
             ret = qio_channel_write_all(p->c, (void *)p->packet,
@@ -850,6 +971,12 @@ static void multifd_new_send_channel_async(QIOTask *task, gpointer opaque)
     trace_multifd_new_send_channel_async(p->id);
     if (qio_task_propagate_error(task, &local_err)) {
         goto cleanup;
+    } else if ((p->write_flags & QIO_CHANNEL_WRITE_FLAG_ZERO_COPY) &&
+               !qio_channel_has_feature(sioc,
+                                        QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY)) {
+        error_setg(&local_err, "multifd %d: zero copy send is not supported "
+                   "by the channel", p->id);
+        goto cleanup;
     } else {
         p->c = QIO_CHANNEL(sioc);
         qio_channel_set_delay(p->c, false);
@@ -896,10 +1023,16 @@ int multifd_save_setup(Error **errp)
         p->packet_len = sizeof(MultiFDPacket_t)
                       + sizeof(uint64_t) * page_count;
         p->packet = g_malloc0(p->packet_len);
+        p->zero = g_new0(ram_addr_t, page_count);
         p->packet->magic = cpu_to_be32(MULTIFD_MAGIC);
         p->packet->version = cpu_to_be32(MULTIFD_VERSION);
         p->name = g_strdup_printf("multifdsend_%d", i);
         p->tls_hostname = g_strdup(s->hostname);
+        if (migrate_use_zero_copy_send()) {
+            p->write_flags = QIO_CHANNEL_WRITE_FLAG_ZERO_COPY;
+        } else {
+            p->write_flags = 0;
+        }
         socket_send_channel_create(multifd_new_send_channel_async, p);
     }
 
@@ -1003,6 +1136,8 @@ int multifd_load_cleanup(Error **errp)
         p->name = NULL;
         multifd_pages_clear(p->pages);
         p->pages = NULL;
+        g_free(p->zero);
+        p->zero = NULL;
         p->packet_len = 0;
         g_free(p->packet);
         p->packet = NULL;
@@ -1048,6 +1183,7 @@ static void *multifd_recv_thread(void *opaque)
 {
     MultiFDRecvParams *p = opaque;
     Error *local_err = NULL;
+    uint32_t i;
     int ret;
 
     trace_multifd_recv_thread_start(p->id);
@@ -1055,6 +1191,7 @@ static void *multifd_recv_thread(void *opaque)
 
     while (true) {
         uint32_t used;
+        uint32_t zero_num;
         uint32_t flags;
 
         if (p->quit) {
@@ -1078,10 +1215,11 @@ static void *multifd_recv_thread(void *opaque)
         }
 
         used = p->pages->used;
+        zero_num = p->zero_num;
         flags = p->flags;
         /* recv methods don't know how to handle the SYNC flag */
         p->flags &= ~MULTIFD_FLAG_SYNC;
-        trace_multifd_recv(p->id, p->packet_num, used, flags,
+        trace_multifd_recv(p->id, p->packet_num, used, zero_num, flags,
                            p->next_packet_size);
         p->num_packets++;
         p->num_pages += used;
@@ -1094,6 +1232,12 @@ static void *multifd_recv_thread(void *opaque)
             }
         }
 
+        for (i = 0; i < zero_num; i++) {
+            /* Only write to pages that are not zero already */
+            ram_handle_compressed(p->pages->block->host + p->zero[i], 0,
+                                  qemu_target_page_size());
+        }
+
         if (flags & MULTIFD_FLAG_SYNC) {
             qemu_sem_post(&multifd_recv_state->sem_sync);
             qemu_sem_wait(&p->sem_sync);
@@ -1141,6 +1285,7 @@ int multifd_load_setup(Error **errp)
         p->packet_len = sizeof(MultiFDPacket_t)
                       + sizeof(uint64_t) * page_count;
         p->packet = g_malloc0(p->packet_len);
+        p->zero = g_new0(ram_addr_t, page_count);
         p->name = g_strdup_printf("multifdrecv_%d", i);
     }
 
@@ -32,6 +32,7 @@ int multifd_queue_page(QEMUFile *f, RAMBlock *block, ram_addr_t offset);
 #define MULTIFD_FLAG_NOCOMP (0 << 1)
 #define MULTIFD_FLAG_ZLIB (1 << 1)
 #define MULTIFD_FLAG_ZSTD (2 << 1)
+#define MULTIFD_FLAG_LZ4 (3 << 1)
 
 /* This value needs to be a multiple of qemu_target_page_size() */
 #define MULTIFD_PACKET_SIZE (512 * 1024)
@@ -46,8 +47,15 @@ typedef struct {
     /* size of the next packet that contains pages */
     uint32_t next_packet_size;
     uint64_t packet_num;
-    uint64_t unused[4];    /* Reserved for future use */
+    /* number of zero pages, only with the multifd-zero-page capability */
+    uint32_t zero_pages;
+    uint32_t unused32[1];    /* Reserved for future use */
+    uint64_t unused64[3];    /* Reserved for future use */
     char ramblock[256];
+    /*
+     * The offsets of the pages_used pages sent after the packet,
+     * followed by the offsets of the zero_pages zero pages.
+     */
     uint64_t offset[];
 } __attribute__((packed)) MultiFDPacket_t;
 
@@ -104,6 +112,14 @@ typedef struct {
     uint64_t num_packets;
     /* pages sent through this channel */
     uint64_t num_pages;
+    /* zero pages found in the current packet */
+    uint32_t zero_num;
+    /* offsets of the zero pages found in the current packet */
+    ram_addr_t *zero;
+    /* zero pages not yet accounted for by the migration thread */
+    uint64_t zero_pending;
+    /* QIO_CHANNEL_WRITE_FLAG_* used to send the pages */
+    int write_flags;
     /* syncs main thread and channels */
     QemuSemaphore sem_sync;
     /* used for compression methods */
@@ -143,6 +159,10 @@ typedef struct {
     uint64_t num_packets;
     /* pages sent through this channel */
     uint64_t num_pages;
+    /* zero pages in the current packet */
+    uint32_t zero_num;
+    /* offsets of the zero pages in the current packet */
+    ram_addr_t *zero;
     /* syncs main thread and channels */
     QemuSemaphore sem_sync;
     /* used for de-compression methods */
@@ -167,6 +187,7 @@ typedef struct {
 } MultiFDMethods;
 
 void multifd_register_ops(int method, MultiFDMethods *ops);
+MultiFDMethods *multifd_get_ops(int method);
 
 #endif
 
@@ -31,6 +31,7 @@
 #include "qemu/bitops.h"
 #include "qemu/bitmap.h"
 #include "qemu/main-loop.h"
+#include "qemu/units.h"
 #include "xbzrle.h"
 #include "ram.h"
 #include "migration.h"
@@ -51,10 +52,12 @@
 #include "migration/colo.h"
 #include "block.h"
 #include "sysemu/cpu-throttle.h"
+#include "sysemu/dirtylimit.h"
 #include "savevm.h"
 #include "qemu/iov.h"
 #include "multifd.h"
 #include "sysemu/runstate.h"
+#include "hw/boards.h"
 
 #if defined(__linux__)
 #include "qemu/userfaultfd.h"
@@ -313,6 +316,8 @@ struct RAMState {
     uint32_t last_version;
     /* How many times we have dirty too many pages */
     int dirty_rate_high_cnt;
+    /* Dirty page rate limit of each vCPU set by dirty-limit, in MB/s */
+    uint64_t dirty_limit_quota;
     /* these variables are used for bitmap sync */
     /* last time we did a full bitmap_sync */
     int64_t time_last_bitmap_sync;
@@ -639,6 +644,35 @@ static void mig_throttle_guest_down(uint64_t bytes_dirty_period,
     }
 }
 
+/**
+ * mig_dirty_limit_guest: limit the dirty page rate of each vCPU
+ *
+ * Shares the dirty page rate that migration keeps up with between the
+ * vCPUs, so that only the vCPUs dirtying memory faster than their share
+ * are throttled.  If the limit was already set, it is halved.
+ *
+ * @rs: current RAM state
+ * @bytes_dirty_threshold: bytes that may be dirtied during the period
+ */
+static void mig_dirty_limit_guest(RAMState *rs, uint64_t bytes_dirty_threshold)
+{
+    int64_t period_ms = qemu_clock_get_ms(QEMU_CLOCK_REALTIME) -
+                        rs->time_last_bitmap_sync;
+    uint64_t quota = bytes_dirty_threshold * 1000 / period_ms / MiB /
+                     current_machine->smp.cpus;
+
+    if (rs->dirty_limit_quota) {
+        quota = MIN(quota, rs->dirty_limit_quota / 2);
+    }
+    quota = MAX(quota, 1);
+
+    if (quota != rs->dirty_limit_quota) {
+        trace_mig_dirty_limit_guest(quota);
+        rs->dirty_limit_quota = quota;
+        dirtylimit_migration_set(quota);
+    }
+}
+
 /**
  * xbzrle_cache_zero_page: insert a zero page in the XBZRLE cache
  *
@@ -931,7 +965,8 @@ static void migration_trigger_throttle(RAMState *rs)
     /* During block migration the auto-converge logic incorrectly detects
      * that ram migration makes no progress. Avoid this by disabling the
      * throttling logic during the bulk phase of block migration. */
-    if (migrate_auto_converge() && !blk_mig_bulk_active()) {
+    if ((migrate_auto_converge() || migrate_dirty_limit()) &&
+        !blk_mig_bulk_active()) {
         /* The following detection logic can be refined later. For now:
            Check to see if the ratio between dirtied bytes and the approx.
            amount of bytes that just got transferred since the last time
@@ -942,8 +977,12 @@ static void migration_trigger_throttle(RAMState *rs)
             (++rs->dirty_rate_high_cnt >= 2)) {
             trace_migration_throttle();
             rs->dirty_rate_high_cnt = 0;
-            mig_throttle_guest_down(bytes_dirty_period,
-                                    bytes_dirty_threshold);
+            if (migrate_dirty_limit()) {
+                mig_dirty_limit_guest(rs, bytes_dirty_threshold);
+            } else {
+                mig_throttle_guest_down(bytes_dirty_period,
+                                        bytes_dirty_threshold);
+            }
         }
     }
 }
@@ -1949,6 +1988,7 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss,
 {
     RAMBlock *block = pss->block;
     ram_addr_t offset = ((ram_addr_t)pss->page) << TARGET_PAGE_BITS;
+    bool use_multifd;
     int res;
 
     if (control_save_page(rs, block, offset, &res)) {
@@ -1959,28 +1999,33 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss,
         return 1;
     }
 
-    res = save_zero_page(rs, block, offset);
-    if (res > 0) {
-        /* Must let xbzrle know, otherwise a previous (now 0'd) cached
-         * page would be stale
-         */
-        if (!save_page_use_compression(rs)) {
-            XBZRLE_cache_lock();
-            xbzrle_cache_zero_page(rs, block->offset + offset);
-            XBZRLE_cache_unlock();
-        }
-        ram_release_pages(block->idstr, offset, res);
-        return res;
-    }
-
     /*
      * Do not use multifd for:
      * 1. Compression as the first page in the new block should be posted out
      *    before sending the compressed page
      * 2. In postcopy as one whole host page should be placed
      */
-    if (!save_page_use_compression(rs) && migrate_use_multifd()
-        && !migration_in_postcopy()) {
+    use_multifd = !save_page_use_compression(rs) && migrate_use_multifd()
+                  && !migration_in_postcopy();
+
+    /* With multifd-zero-page, the multifd channels look for zero pages */
+    if (!use_multifd || !migrate_multifd_zero_page()) {
+        res = save_zero_page(rs, block, offset);
+        if (res > 0) {
+            /* Must let xbzrle know, otherwise a previous (now 0'd) cached
+             * page would be stale
+             */
+            if (!save_page_use_compression(rs)) {
+                XBZRLE_cache_lock();
+                xbzrle_cache_zero_page(rs, block->offset + offset);
+                XBZRLE_cache_unlock();
+            }
+            ram_release_pages(block->idstr, offset, res);
+            return res;
+        }
+    }
+
+    if (use_multifd) {
         return ram_save_multifd_page(rs, block, offset);
     }
 
@@ -2188,7 +2233,10 @@ static void ram_save_cleanup(void *opaque)
         /* caller have hold iothread lock or is in a bh, so there is
          * no writing race against the migration bitmap
          */
-        memory_global_dirty_log_stop();
+        if (global_dirty_tracking & GLOBAL_DIRTY_MIGRATION) {
+            /* Stopping dirty log without starting it would be unbalanced */
+            memory_global_dirty_log_stop(GLOBAL_DIRTY_MIGRATION);
+        }
     }
 
     RAMBLOCK_FOREACH_NOT_IGNORED(block) {
@@ -2650,7 +2698,7 @@ static void ram_init_bitmaps(RAMState *rs)
         ram_list_init_bitmaps();
         /* We don't use dirty log with background snapshots */
         if (!migrate_background_snapshot()) {
-            memory_global_dirty_log_start();
+            memory_global_dirty_log_start(GLOBAL_DIRTY_MIGRATION);
             migration_bitmap_sync_precopy(rs);
         }
     }
@@ -3399,7 +3447,7 @@ void colo_incoming_start_dirty_log(void)
             /* Discard this dirty bitmap record */
             bitmap_zero(block->bmap, block->max_length >> TARGET_PAGE_BITS);
         }
-        memory_global_dirty_log_start();
+        memory_global_dirty_log_start(GLOBAL_DIRTY_MIGRATION);
     }
     ram_state->migration_dirty_pages = 0;
     qemu_mutex_unlock_ramlist();
@@ -3411,7 +3459,9 @@ void colo_release_ram_cache(void)
 {
     RAMBlock *block;
 
-    memory_global_dirty_log_stop();
+    if (global_dirty_tracking & GLOBAL_DIRTY_MIGRATION) {
+        memory_global_dirty_log_stop(GLOBAL_DIRTY_MIGRATION);
+    }
     RAMBLOCK_FOREACH_NOT_IGNORED(block) {
         g_free(block->bmap);
         block->bmap = NULL;
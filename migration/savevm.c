@@ -53,6 +53,7 @@
 #include "trace.h"
 #include "qemu/iov.h"
 #include "qemu/main-loop.h"
+#include "qemu/rcu.h"
 #include "block/snapshot.h"
 #include "qemu/cutils.h"
 #include "io/channel-buffer.h"
@@ -87,6 +88,8 @@ enum qemu_vm_cmd {
     MIG_CMD_ENABLE_COLO,       /* Enable COLO */
     MIG_CMD_POSTCOPY_RESUME,   /* resume postcopy on dest */
     MIG_CMD_RECV_BITMAP,       /* Request for recved bitmap on dst */
+    MIG_CMD_DEVICE_STATE,      /* A section to load in a worker thread */
+    MIG_CMD_DEVICE_STATE_SYNC, /* Wait for the DEVICE_STATE sections */
     MIG_CMD_MAX
 };
 
@@ -106,6 +109,8 @@ static struct mig_cmd_args {
     [MIG_CMD_POSTCOPY_RESUME]  = { .len =  0, .name = "POSTCOPY_RESUME" },
     [MIG_CMD_PACKAGED]         = { .len =  4, .name = "PACKAGED" },
     [MIG_CMD_RECV_BITMAP]      = { .len = -1, .name = "RECV_BITMAP" },
+    [MIG_CMD_DEVICE_STATE]     = { .len =  4, .name = "DEVICE_STATE" },
+    [MIG_CMD_DEVICE_STATE_SYNC] = { .len =  0, .name = "DEVICE_STATE_SYNC" },
     [MIG_CMD_MAX]              = { .len = -1, .name = "MAX" },
 };
 
@@ -1393,14 +1398,283 @@ int qemu_savevm_state_complete_precopy_iterable(QEMUFile *f, bool in_postcopy)
     return 0;
 }
 
+/*
+ * Worker threads for the sections of the devices that set
+ * VMStateDescription.parallel.  The thread that handles the migration
+ * stream submits the jobs of one priority, then waits for all of them
+ * before it moves on to the next priority.  The workers stay around for
+ * the next priority, so that no thread is created or joined on every
+ * priority change.
+ */
+#define DEVICE_STATE_THREADS_MAX 16
+
+typedef struct DeviceStateJob {
+    SaveStateEntry *se;
+    QIOChannelBuffer *bioc;
+    QEMUFile *f;
+    JSONWriter *vmdesc;
+    int ret;
+    QSIMPLEQ_ENTRY(DeviceStateJob) next;
+} DeviceStateJob;
+
+typedef struct DeviceStateDeferred {
+    void (*fn)(void *opaque);
+    void *opaque;
+    QSIMPLEQ_ENTRY(DeviceStateDeferred) next;
+} DeviceStateDeferred;
+
+typedef struct DeviceStatePool {
+    int (*fn)(DeviceStateJob *job);
+    QemuMutex lock;
+    /* signalled when a job is queued, or when the workers must exit */
+    QemuCond cond;
+    /* signalled when pending drops to zero */
+    QemuCond idle_cond;
+    /* jobs that were submitted and did not finish yet */
+    int pending;
+    /* jobs that no worker has picked yet */
+    QSIMPLEQ_HEAD(, DeviceStateJob) queue;
+    /* all the jobs, in submission order */
+    GPtrArray *jobs;
+    /* work queued by vmstate_run_locked(), run once the jobs are done */
+    QSIMPLEQ_HEAD(, DeviceStateDeferred) deferred;
+    QemuThread threads[DEVICE_STATE_THREADS_MAX];
+    int nr_threads;
+    bool done;
+} DeviceStatePool;
+
+static void *device_state_worker(void *opaque)
+{
+    DeviceStatePool *pool = opaque;
+    DeviceStateJob *job;
+
+    rcu_register_thread();
+
+    qemu_mutex_lock(&pool->lock);
+    while (true) {
+        job = QSIMPLEQ_FIRST(&pool->queue);
+        if (job) {
+            QSIMPLEQ_REMOVE_HEAD(&pool->queue, next);
+            qemu_mutex_unlock(&pool->lock);
+            job->ret = pool->fn(job);
+            qemu_mutex_lock(&pool->lock);
+            if (!--pool->pending) {
+                qemu_cond_signal(&pool->idle_cond);
+            }
+        } else if (pool->done) {
+            break;
+        } else {
+            qemu_cond_wait(&pool->cond, &pool->lock);
+        }
+    }
+    qemu_mutex_unlock(&pool->lock);
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void device_state_pool_init(DeviceStatePool *pool,
+                                   int (*fn)(DeviceStateJob *job))
+{
+    pool->fn = fn;
+    qemu_mutex_init(&pool->lock);
+    qemu_cond_init(&pool->cond);
+    qemu_cond_init(&pool->idle_cond);
+    pool->pending = 0;
+    QSIMPLEQ_INIT(&pool->queue);
+    QSIMPLEQ_INIT(&pool->deferred);
+    pool->jobs = g_ptr_array_new();
+    pool->nr_threads = 0;
+    pool->done = false;
+}
+
+/* Stop the workers; the jobs must have been waited for already */
+static void device_state_pool_destroy(DeviceStatePool *pool)
+{
+    int i;
+
+    qemu_mutex_lock(&pool->lock);
+    assert(!pool->pending);
+    pool->done = true;
+    qemu_cond_broadcast(&pool->cond);
+    qemu_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < pool->nr_threads; i++) {
+        qemu_thread_join(&pool->threads[i]);
+    }
+    pool->nr_threads = 0;
+
+    assert(!pool->jobs->len);
+    assert(QSIMPLEQ_EMPTY(&pool->deferred));
+    g_ptr_array_free(pool->jobs, true);
+    qemu_cond_destroy(&pool->idle_cond);
+    qemu_cond_destroy(&pool->cond);
+    qemu_mutex_destroy(&pool->lock);
+}
+
+static void device_state_pool_submit(DeviceStatePool *pool,
+                                     DeviceStateJob *job)
+{
+    int pending;
+
+    g_ptr_array_add(pool->jobs, job);
+
+    qemu_mutex_lock(&pool->lock);
+    QSIMPLEQ_INSERT_TAIL(&pool->queue, job, next);
+    pending = ++pool->pending;
+    qemu_cond_signal(&pool->cond);
+    qemu_mutex_unlock(&pool->lock);
+
+    if (pool->nr_threads < MIN(pending, DEVICE_STATE_THREADS_MAX)) {
+        qemu_thread_create(&pool->threads[pool->nr_threads++],
+                           "device_state", device_state_worker, pool,
+                           QEMU_THREAD_JOINABLE);
+    }
+}
+
+/* Wait until all the jobs in pool->jobs have run */
+static void device_state_pool_wait(DeviceStatePool *pool)
+{
+    qemu_mutex_lock(&pool->lock);
+    while (pool->pending) {
+        qemu_cond_wait(&pool->idle_cond, &pool->lock);
+    }
+    qemu_mutex_unlock(&pool->lock);
+}
+
+static void device_state_job_free(DeviceStateJob *job)
+{
+    if (job->f) {
+        qemu_fclose(job->f);
+    }
+    if (job->bioc) {
+        object_unref(OBJECT(job->bioc));
+    }
+    json_writer_free(job->vmdesc);
+    g_free(job);
+}
+
+/* Save one section, header and footer included, into a buffer */
+static int savevm_device_state_save(DeviceStateJob *job)
+{
+    SaveStateEntry *se = job->se;
+    int ret;
+
+    job->bioc = qio_channel_buffer_new(4096);
+    qio_channel_set_name(QIO_CHANNEL(job->bioc),
+                         "migration-device-state-buffer");
+    job->f = qemu_fopen_channel_output(QIO_CHANNEL(job->bioc));
+    job->vmdesc = json_writer_new(false);
+
+    trace_savevm_section_start(se->idstr, se->section_id);
+
+    json_writer_start_object(job->vmdesc, NULL);
+    json_writer_str(job->vmdesc, "name", se->idstr);
+    json_writer_int64(job->vmdesc, "instance_id", se->instance_id);
+
+    save_section_header(job->f, se, QEMU_VM_SECTION_FULL);
+    ret = vmstate_save(job->f, se, job->vmdesc);
+    if (ret) {
+        return ret;
+    }
+    trace_savevm_section_end(se->idstr, se->section_id, 0);
+    save_section_footer(job->f, se);
+
+    json_writer_end_object(job->vmdesc);
+
+    qemu_fflush(job->f);
+    return qemu_file_get_error(job->f);
+}
+
+/*
+ * Start saving the parallel sections that have the same priority as
+ * @se, from @se on.
+ */
+static void savevm_device_state_start(DeviceStatePool *pool,
+                                      SaveStateEntry *se)
+{
+    MigrationPriority priority = save_state_priority(se);
+    DeviceStateJob *job;
+
+    for (; se && save_state_priority(se) == priority;
+         se = QTAILQ_NEXT(se, entry)) {
+        if (!se->vmsd || !se->vmsd->parallel) {
+            continue;
+        }
+        if (!vmstate_save_needed(se->vmsd, se->opaque)) {
+            trace_savevm_section_skip(se->idstr, se->section_id);
+            continue;
+        }
+
+        job = g_new0(DeviceStateJob, 1);
+        job->se = se;
+        device_state_pool_submit(pool, job);
+    }
+}
+
+/*
+ * Wait for the parallel sections of the current priority and send
+ * them, each wrapped in a MIG_CMD_DEVICE_STATE so that the destination
+ * can load it in a worker thread too.
+ */
+static int savevm_device_state_finish(QEMUFile *f, DeviceStatePool *pool,
+                                      JSONWriter *vmdesc)
+{
+    DeviceStateJob *job;
+    uint32_t tmp;
+    int ret = 0;
+    guint i;
+
+    if (!pool->jobs->len) {
+        return 0;
+    }
+
+    device_state_pool_wait(pool);
+
+    for (i = 0; i < pool->jobs->len; i++) {
+        job = g_ptr_array_index(pool->jobs, i);
+        if (!ret) {
+            ret = job->ret;
+        }
+        if (!ret && job->bioc->usage > MAX_VM_CMD_PACKAGED_SIZE) {
+            error_report("%s: Unreasonably large device state for %s: %zu",
+                         __func__, job->se->idstr, job->bioc->usage);
+            ret = -EINVAL;
+        }
+        if (!ret) {
+            trace_qemu_savevm_send_device_state(job->se->idstr,
+                                                job->bioc->usage);
+            tmp = cpu_to_be32(job->bioc->usage);
+            qemu_savevm_command_send(f, MIG_CMD_DEVICE_STATE, 4,
+                                     (uint8_t *)&tmp);
+            qemu_put_buffer(f, job->bioc->data, job->bioc->usage);
+            json_writer_raw(vmdesc, NULL, json_writer_get(job->vmdesc));
+        }
+        device_state_job_free(job);
+    }
+    g_ptr_array_set_size(pool->jobs, 0);
+
+    if (!ret) {
+        qemu_savevm_command_send(f, MIG_CMD_DEVICE_STATE_SYNC, 0, NULL);
+    }
+    return ret;
+}
+
 int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
                                                     bool in_postcopy,
                                                     bool inactivate_disks)
 {
     g_autoptr(JSONWriter) vmdesc = NULL;
+    bool parallel = migrate_parallel_device_state();
+    DeviceStatePool pool;
+    int priority = -1;
     int vmdesc_len;
     SaveStateEntry *se;
-    int ret;
+    int ret = 0;
+
+    if (parallel) {
+        device_state_pool_init(&pool, savevm_device_state_save);
+    }
 
     vmdesc = json_writer_new(false);
     json_writer_start_object(vmdesc, NULL);
@@ -1411,6 +1685,21 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
         if ((!se->ops || !se->ops->save_state) && !se->vmsd) {
             continue;
         }
+
+        if (parallel) {
+            if (save_state_priority(se) != priority) {
+                ret = savevm_device_state_finish(f, &pool, vmdesc);
+                if (ret) {
+                    break;
+                }
+                priority = save_state_priority(se);
+                savevm_device_state_start(&pool, se);
+            }
+            if (se->vmsd && se->vmsd->parallel) {
+                continue;
+            }
+        }
+
         if (se->vmsd && !vmstate_save_needed(se->vmsd, se->opaque)) {
             trace_savevm_section_skip(se->idstr, se->section_id);
             continue;
@@ -1425,8 +1714,7 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
         save_section_header(f, se, QEMU_VM_SECTION_FULL);
         ret = vmstate_save(f, se, vmdesc);
         if (ret) {
-            qemu_file_set_error(f, ret);
-            return ret;
+            break;
         }
         trace_savevm_section_end(se->idstr, se->section_id, 0);
         save_section_footer(f, se);
@@ -1434,6 +1722,22 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
         json_writer_end_object(vmdesc);
     }
 
+    if (parallel) {
+        int finish_ret;
+
+        if (ret) {
+            /* Only wait for the workers, their sections are not sent */
+            qemu_file_set_error(f, ret);
+        }
+        finish_ret = savevm_device_state_finish(f, &pool, vmdesc);
+        ret = ret ? ret : finish_ret;
+        device_state_pool_destroy(&pool);
+    }
+    if (ret) {
+        qemu_file_set_error(f, ret);
+        return ret;
+    }
+
     if (inactivate_disks) {
         /* Inactivate before sending QEMU_VM_EOF so that the
          * bdrv_invalidate_cache_all() on the other end won't fail. */
@@ -2192,6 +2496,133 @@ static int loadvm_handle_cmd_packaged(MigrationIncomingState *mis)
     return ret;
 }
 
+static int qemu_loadvm_section_start_full(QEMUFile *f,
+                                          MigrationIncomingState *mis,
+                                          bool parallel);
+
+static DeviceStatePool *loadvm_device_state_pool;
+
+static int loadvm_device_state_load(DeviceStateJob *job)
+{
+    MigrationIncomingState *mis = migration_incoming_get_current();
+    uint8_t section_type;
+
+    job->f = qemu_fopen_channel_input(QIO_CHANNEL(job->bioc));
+    section_type = qemu_get_byte(job->f);
+    if (section_type != QEMU_VM_SECTION_FULL) {
+        error_report("CMD_DEVICE_STATE: unexpected section type %d",
+                     section_type);
+        return -EINVAL;
+    }
+
+    return qemu_loadvm_section_start_full(job->f, mis, true);
+}
+
+/*
+ * Receive one section saved by a worker thread on the source, and
+ * load it in a worker thread.  Payload format:
+ *
+ * length (4 bytes) + section (length bytes)
+ */
+static int loadvm_handle_device_state(QEMUFile *f)
+{
+    DeviceStateJob *job;
+    size_t length;
+    int ret;
+
+    length = qemu_get_be32(f);
+    trace_loadvm_handle_device_state(length);
+
+    job = g_new0(DeviceStateJob, 1);
+    job->bioc = qio_channel_buffer_new(length);
+    qio_channel_set_name(QIO_CHANNEL(job->bioc),
+                         "migration-loadvm-device-state");
+    ret = qemu_get_buffer(f, job->bioc->data, length);
+    if (ret != length) {
+        device_state_job_free(job);
+        error_report("CMD_DEVICE_STATE: Buffer receive fail ret=%d "
+                     "length=%zu", ret, length);
+        return (ret < 0) ? ret : -EAGAIN;
+    }
+    job->bioc->usage += length;
+
+    if (!loadvm_device_state_pool) {
+        loadvm_device_state_pool = g_new0(DeviceStatePool, 1);
+        device_state_pool_init(loadvm_device_state_pool,
+                               loadvm_device_state_load);
+    }
+    device_state_pool_submit(loadvm_device_state_pool, job);
+
+    return 0;
+}
+
+void vmstate_run_locked(void (*fn)(void *opaque), void *opaque)
+{
+    DeviceStatePool *pool = loadvm_device_state_pool;
+    DeviceStateDeferred *d;
+
+    if (qemu_mutex_iothread_locked()) {
+        fn(opaque);
+        return;
+    }
+
+    /* Only the loadvm workers run post_load without the BQL */
+    assert(pool);
+    d = g_new0(DeviceStateDeferred, 1);
+    d->fn = fn;
+    d->opaque = opaque;
+
+    qemu_mutex_lock(&pool->lock);
+    QSIMPLEQ_INSERT_TAIL(&pool->deferred, d, next);
+    qemu_mutex_unlock(&pool->lock);
+}
+
+/*
+ * Wait for the sections received with MIG_CMD_DEVICE_STATE to be loaded,
+ * then run the work they deferred with vmstate_run_locked().  The workers
+ * are kept for the next priority unless @stop.  Called with the BQL held.
+ */
+static int loadvm_device_state_sync(bool stop)
+{
+    DeviceStatePool *pool = loadvm_device_state_pool;
+    DeviceStateDeferred *d;
+    DeviceStateJob *job;
+    int ret = 0;
+    guint i;
+
+    if (!pool) {
+        return 0;
+    }
+
+    device_state_pool_wait(pool);
+
+    for (i = 0; i < pool->jobs->len; i++) {
+        job = g_ptr_array_index(pool->jobs, i);
+        if (!ret) {
+            ret = job->ret;
+        }
+        device_state_job_free(job);
+    }
+    g_ptr_array_set_size(pool->jobs, 0);
+
+    while ((d = QSIMPLEQ_FIRST(&pool->deferred))) {
+        QSIMPLEQ_REMOVE_HEAD(&pool->deferred, next);
+        if (!ret) {
+            d->fn(d->opaque);
+        }
+        g_free(d);
+    }
+
+    if (stop) {
+        device_state_pool_destroy(pool);
+        g_free(pool);
+        loadvm_device_state_pool = NULL;
+    }
+
+    trace_loadvm_device_state_sync(ret);
+    return ret;
+}
+
 /*
  * Handle request that source requests for recved_bitmap on
  * destination. Payload format:
@@ -2330,6 +2761,12 @@ static int loadvm_process_command(QEMUFile *f)
 
     case MIG_CMD_ENABLE_COLO:
         return loadvm_process_enable_colo(mis);
+
+    case MIG_CMD_DEVICE_STATE:
+        return loadvm_handle_device_state(f);
+
+    case MIG_CMD_DEVICE_STATE_SYNC:
+        return loadvm_device_state_sync(false);
     }
 
     return 0;
@@ -2379,7 +2816,8 @@ static bool check_section_footer(QEMUFile *f, SaveStateEntry *se)
 }
 
 static int
-qemu_loadvm_section_start_full(QEMUFile *f, MigrationIncomingState *mis)
+qemu_loadvm_section_start_full(QEMUFile *f, MigrationIncomingState *mis,
+                               bool parallel)
 {
     uint32_t instance_id, version_id, section_id;
     SaveStateEntry *se;
@@ -2421,6 +2859,11 @@ qemu_loadvm_section_start_full(QEMUFile *f, MigrationIncomingState *mis)
                      version_id, idstr, se->version_id);
         return -EINVAL;
     }
+    if (parallel && !(se->vmsd && se->vmsd->parallel)) {
+        error_report("savevm: section '%s' cannot be loaded in parallel",
+                     idstr);
+        return -EINVAL;
+    }
     se->load_version_id = version_id;
     se->load_section_id = section_id;
 
@@ -2601,6 +3044,7 @@ static bool postcopy_pause_incoming(MigrationIncomingState *mis)
 int qemu_loadvm_state_main(QEMUFile *f, MigrationIncomingState *mis)
 {
     uint8_t section_type;
+    int sync_ret;
     int ret = 0;
 
 retry:
@@ -2616,7 +3060,7 @@ retry:
         switch (section_type) {
         case QEMU_VM_SECTION_START:
         case QEMU_VM_SECTION_FULL:
-            ret = qemu_loadvm_section_start_full(f, mis);
+            ret = qemu_loadvm_section_start_full(f, mis, false);
             if (ret < 0) {
                 goto out;
             }
@@ -2646,6 +3090,12 @@ retry:
     }
 
 out:
+    /* Do not leave workers behind if the stream ended without a sync */
+    sync_ret = loadvm_device_state_sync(true);
+    if (ret >= 0 && sync_ret < 0) {
+        ret = sync_ret;
+    }
+
     if (ret < 0) {
         qemu_file_set_error(f, ret);
 
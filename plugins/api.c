@@ -40,6 +40,7 @@
 #include "exec/exec-all.h"
 #include "exec/ram_addr.h"
 #include "disas/disas.h"
+#include "exec/gdbstub.h"
 #include "plugin.h"
 #ifndef CONFIG_USER_ONLY
 #include "qemu/plugin-memory.h"
@@ -98,6 +99,33 @@ void qemu_plugin_register_vcpu_tb_exec_inline(struct qemu_plugin_tb *tb,
     }
 }
 
+void qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+    struct qemu_plugin_tb *tb,
+    enum qemu_plugin_op op,
+    qemu_plugin_u64 entry,
+    uint64_t imm)
+{
+    if (!tb->mem_only) {
+        plugin_register_inline_op_on_entry(&tb->cbs[PLUGIN_CB_INLINE],
+                                           0, op, entry, imm);
+    }
+}
+
+void qemu_plugin_register_vcpu_tb_exec_cond_cb(struct qemu_plugin_tb *tb,
+                                               qemu_plugin_vcpu_udata_cb_t cb,
+                                               enum qemu_plugin_cb_flags flags,
+                                               enum qemu_plugin_cond cond,
+                                               qemu_plugin_u64 entry,
+                                               uint64_t imm,
+                                               void *udata)
+{
+    if (!tb->mem_only) {
+        plugin_register_dyn_cond_cb__udata(&tb->cbs[PLUGIN_CB_REGULAR],
+                                           cb, flags, cond, entry, imm,
+                                           udata);
+    }
+}
+
 void qemu_plugin_register_vcpu_insn_exec_cb(struct qemu_plugin_insn *insn,
                                             qemu_plugin_vcpu_udata_cb_t cb,
                                             enum qemu_plugin_cb_flags flags,
@@ -119,6 +147,34 @@ void qemu_plugin_register_vcpu_insn_exec_inline(struct qemu_plugin_insn *insn,
     }
 }
 
+void qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+    struct qemu_plugin_insn *insn,
+    enum qemu_plugin_op op,
+    qemu_plugin_u64 entry,
+    uint64_t imm)
+{
+    if (!insn->mem_only) {
+        plugin_register_inline_op_on_entry(
+            &insn->cbs[PLUGIN_CB_INSN][PLUGIN_CB_INLINE], 0, op, entry, imm);
+    }
+}
+
+void qemu_plugin_register_vcpu_insn_exec_cond_cb(
+    struct qemu_plugin_insn *insn,
+    qemu_plugin_vcpu_udata_cb_t cb,
+    enum qemu_plugin_cb_flags flags,
+    enum qemu_plugin_cond cond,
+    qemu_plugin_u64 entry,
+    uint64_t imm,
+    void *udata)
+{
+    if (!insn->mem_only) {
+        plugin_register_dyn_cond_cb__udata(
+            &insn->cbs[PLUGIN_CB_INSN][PLUGIN_CB_REGULAR],
+            cb, flags, cond, entry, imm, udata);
+    }
+}
+
 
 /*
  * We always plant memory instrumentation because they don't finalise until
@@ -143,6 +199,17 @@ void qemu_plugin_register_vcpu_mem_inline(struct qemu_plugin_insn *insn,
                               rw, op, ptr, imm);
 }
 
+void qemu_plugin_register_vcpu_mem_inline_per_vcpu(
+    struct qemu_plugin_insn *insn,
+    enum qemu_plugin_mem_rw rw,
+    enum qemu_plugin_op op,
+    qemu_plugin_u64 entry,
+    uint64_t imm)
+{
+    plugin_register_inline_op_on_entry(
+        &insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_INLINE], rw, op, entry, imm);
+}
+
 void qemu_plugin_register_vcpu_tb_trans_cb(qemu_plugin_id_t id,
                                            qemu_plugin_vcpu_tb_trans_cb_t cb)
 {
@@ -376,6 +443,156 @@ int qemu_plugin_n_max_vcpus(void)
 #endif
 }
 
+/*
+ * Scoreboards
+ */
+
+struct qemu_plugin_scoreboard *qemu_plugin_scoreboard_new(size_t element_size)
+{
+    return plugin_scoreboard_new(element_size);
+}
+
+void qemu_plugin_scoreboard_free(struct qemu_plugin_scoreboard *score)
+{
+    plugin_scoreboard_free(score);
+}
+
+void *qemu_plugin_scoreboard_find(struct qemu_plugin_scoreboard *score,
+                                  unsigned int vcpu_index)
+{
+    g_assert(vcpu_index < score->data->len);
+    return qemu_plugin_scoreboard_entry(score, vcpu_index);
+}
+
+static uint64_t *plugin_u64_address(qemu_plugin_u64 entry,
+                                    unsigned int vcpu_index)
+{
+    return qemu_plugin_scoreboard_find(entry.score, vcpu_index) + entry.offset;
+}
+
+void qemu_plugin_u64_add(qemu_plugin_u64 entry, unsigned int vcpu_index,
+                         uint64_t added)
+{
+    *plugin_u64_address(entry, vcpu_index) += added;
+}
+
+uint64_t qemu_plugin_u64_get(qemu_plugin_u64 entry, unsigned int vcpu_index)
+{
+    return *plugin_u64_address(entry, vcpu_index);
+}
+
+void qemu_plugin_u64_set(qemu_plugin_u64 entry, unsigned int vcpu_index,
+                         uint64_t val)
+{
+    *plugin_u64_address(entry, vcpu_index) = val;
+}
+
+uint64_t qemu_plugin_u64_sum(qemu_plugin_u64 entry)
+{
+    uint64_t total = 0;
+    unsigned int i;
+
+    /* Entries of vCPUs that were never created are zero. */
+    for (i = 0; i < entry.score->data->len; i++) {
+        total += qemu_plugin_u64_get(entry, i);
+    }
+    return total;
+}
+
+/*
+ * Registers and memory
+ *
+ * Registers are those described to gdb, read with the gdbstub's
+ * accessors; the handle of a register is its gdb number plus one.
+ */
+
+GArray *qemu_plugin_get_registers(void)
+{
+    g_autoptr(GArray) regs = NULL;
+    GArray *ret;
+    guint i;
+
+    g_assert(current_cpu);
+    regs = gdb_get_register_list(current_cpu);
+    ret = g_array_sized_new(false, false, sizeof(qemu_plugin_reg_descriptor),
+                            regs->len);
+    for (i = 0; i < regs->len; i++) {
+        GDBRegDesc *grd = &g_array_index(regs, GDBRegDesc, i);
+        qemu_plugin_reg_descriptor desc = {
+            .handle = GINT_TO_POINTER(grd->gdb_reg + 1),
+            .name = grd->name,
+            .feature = grd->feature_name,
+        };
+
+        g_array_append_val(ret, desc);
+    }
+    return ret;
+}
+
+int qemu_plugin_read_register(struct qemu_plugin_register *handle,
+                              GByteArray *buf)
+{
+    int size;
+
+    g_assert(current_cpu);
+    size = gdb_read_register(current_cpu, buf, GPOINTER_TO_INT(handle) - 1);
+    return size ? size : -1;
+}
+
+bool qemu_plugin_read_memory_vaddr(uint64_t addr, GByteArray *data,
+                                   size_t len)
+{
+    guint orig_len = data->len;
+
+    g_assert(current_cpu);
+    if (len == 0) {
+        return true;
+    }
+    g_byte_array_set_size(data, orig_len + len);
+
+#ifdef CONFIG_USER_ONLY
+    if (cpu_memory_rw_debug(current_cpu, addr, data->data + orig_len,
+                            len, false)) {
+        g_byte_array_set_size(data, orig_len);
+        return false;
+    }
+#else
+    {
+        uint8_t *p = data->data + orig_len;
+
+        RCU_READ_LOCK_GUARD();
+        while (len) {
+            target_ulong page = addr & TARGET_PAGE_MASK;
+            hwaddr l = MIN(page + TARGET_PAGE_SIZE - addr, len);
+            hwaddr phys, xlat;
+            MemTxAttrs attrs;
+            MemoryRegion *mr;
+            int asidx;
+
+            phys = cpu_get_phys_page_attrs_debug(current_cpu, page, &attrs);
+            if (phys == -1) {
+                g_byte_array_set_size(data, orig_len);
+                return false;
+            }
+            asidx = cpu_asidx_from_attrs(current_cpu, attrs);
+            mr = address_space_translate(current_cpu->cpu_ases[asidx].as,
+                                         phys + (addr & ~TARGET_PAGE_MASK),
+                                         &xlat, &l, false, attrs);
+            if (!(memory_region_is_ram(mr) || memory_region_is_romd(mr))) {
+                /* never read device registers, it may have side effects */
+                g_byte_array_set_size(data, orig_len);
+                return false;
+            }
+            memcpy(p, memory_region_get_ram_ptr(mr) + xlat, l);
+            p += l;
+            addr += l;
+            len -= l;
+        }
+    }
+#endif
+    return true;
+}
+
 /*
  * Plugin output
  */
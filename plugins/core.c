@@ -211,11 +211,80 @@ plugin_register_cb_udata(qemu_plugin_id_t id, enum qemu_plugin_event ev,
     do_plugin_register_cb(id, ev, func, udata);
 }
 
+/*
+ * Make room for @cpu in the scoreboards.  Generated code embeds the
+ * address of scoreboard entries, so the scoreboards can only be moved
+ * with all vCPUs stopped, and the code cache must be flushed afterwards.
+ */
+static void plugin_grow_scoreboards__locked(CPUState *cpu)
+{
+    struct qemu_plugin_scoreboard *score;
+    size_t size;
+
+    if (cpu->cpu_index < plugin.scoreboard_alloc_size) {
+        return;
+    }
+    size = pow2ceil(cpu->cpu_index + 1);
+
+    if (QLIST_EMPTY(&plugin.scoreboards)) {
+        plugin.scoreboard_alloc_size = size;
+        return;
+    }
+
+    /*
+     * In system mode, scoreboards are sized for the maximum number of
+     * vCPUs.  In user mode, new vCPUs are created from the thread of the
+     * vCPU executing the clone syscall.
+     */
+    g_assert(current_cpu);
+
+    qemu_rec_mutex_unlock(&plugin.lock);
+    start_exclusive();
+    qemu_rec_mutex_lock(&plugin.lock);
+    /* another vCPU may have been created in the meantime */
+    if (size > plugin.scoreboard_alloc_size) {
+        QLIST_FOREACH(score, &plugin.scoreboards, entry) {
+            g_array_set_size(score->data, size);
+        }
+        plugin.scoreboard_alloc_size = size;
+        tb_flush(current_cpu);
+    }
+    end_exclusive();
+}
+
+struct qemu_plugin_scoreboard *plugin_scoreboard_new(size_t element_size)
+{
+    struct qemu_plugin_scoreboard *score;
+
+    score = g_new0(struct qemu_plugin_scoreboard, 1);
+    score->data = g_array_new(false, true, element_size);
+
+    QEMU_LOCK_GUARD(&plugin.lock);
+#ifndef CONFIG_USER_ONLY
+    plugin.scoreboard_alloc_size = MAX(plugin.scoreboard_alloc_size,
+                                       (size_t)qemu_plugin_n_max_vcpus());
+#endif
+    g_array_set_size(score->data, plugin.scoreboard_alloc_size);
+    QLIST_INSERT_HEAD(&plugin.scoreboards, score, entry);
+    return score;
+}
+
+void plugin_scoreboard_free(struct qemu_plugin_scoreboard *score)
+{
+    qemu_rec_mutex_lock(&plugin.lock);
+    QLIST_REMOVE(score, entry);
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    g_array_free(score->data, true);
+    g_free(score);
+}
+
 void qemu_plugin_vcpu_init_hook(CPUState *cpu)
 {
     bool success;
 
     qemu_rec_mutex_lock(&plugin.lock);
+    plugin_grow_scoreboards__locked(cpu);
     plugin_cpu_update__locked(&cpu->cpu_index, NULL, NULL);
     success = g_hash_table_insert(plugin.cpu_ht, &cpu->cpu_index,
                                   &cpu->cpu_index);
@@ -292,6 +361,25 @@ void plugin_register_inline_op(GArray **arr,
     dyn_cb->type = PLUGIN_CB_INLINE;
     dyn_cb->rw = rw;
     dyn_cb->inline_insn.op = op;
+    dyn_cb->inline_insn.entry.score = NULL;
+    dyn_cb->inline_insn.entry.offset = 0;
+    dyn_cb->inline_insn.imm = imm;
+}
+
+void plugin_register_inline_op_on_entry(GArray **arr,
+                                        enum qemu_plugin_mem_rw rw,
+                                        enum qemu_plugin_op op,
+                                        qemu_plugin_u64 entry,
+                                        uint64_t imm)
+{
+    struct qemu_plugin_dyn_cb *dyn_cb;
+
+    dyn_cb = plugin_get_dyn_cb(arr);
+    dyn_cb->userp = NULL;
+    dyn_cb->type = PLUGIN_CB_INLINE;
+    dyn_cb->rw = rw;
+    dyn_cb->inline_insn.op = op;
+    dyn_cb->inline_insn.entry = entry;
     dyn_cb->inline_insn.imm = imm;
 }
 
@@ -303,9 +391,36 @@ void plugin_register_dyn_cb__udata(GArray **arr,
     struct qemu_plugin_dyn_cb *dyn_cb = plugin_get_dyn_cb(arr);
 
     dyn_cb->userp = udata;
-    /* Note flags are discarded as unused. */
+    dyn_cb->flags = flags;
+    dyn_cb->f.vcpu_udata = cb;
+    dyn_cb->type = PLUGIN_CB_REGULAR;
+    dyn_cb->cond.cond = QEMU_PLUGIN_COND_ALWAYS;
+    dyn_cb->cond.entry.score = NULL;
+    dyn_cb->cond.entry.offset = 0;
+    dyn_cb->cond.imm = 0;
+}
+
+void plugin_register_dyn_cond_cb__udata(GArray **arr,
+                                        qemu_plugin_vcpu_udata_cb_t cb,
+                                        enum qemu_plugin_cb_flags flags,
+                                        enum qemu_plugin_cond cond,
+                                        qemu_plugin_u64 entry,
+                                        uint64_t imm,
+                                        void *udata)
+{
+    struct qemu_plugin_dyn_cb *dyn_cb;
+
+    if (cond == QEMU_PLUGIN_COND_NEVER) {
+        return;
+    }
+    dyn_cb = plugin_get_dyn_cb(arr);
+    dyn_cb->userp = udata;
+    dyn_cb->flags = flags;
     dyn_cb->f.vcpu_udata = cb;
     dyn_cb->type = PLUGIN_CB_REGULAR;
+    dyn_cb->cond.cond = cond;
+    dyn_cb->cond.entry = entry;
+    dyn_cb->cond.imm = imm;
 }
 
 void plugin_register_vcpu_mem_cb(GArray **arr,
@@ -318,7 +433,7 @@ void plugin_register_vcpu_mem_cb(GArray **arr,
 
     dyn_cb = plugin_get_dyn_cb(arr);
     dyn_cb->userp = udata;
-    /* Note flags are discarded as unused. */
+    /* Note flags are discarded: memory callbacks cannot access registers */
     dyn_cb->type = PLUGIN_CB_REGULAR;
     dyn_cb->rw = rw;
     dyn_cb->f.generic = cb;
@@ -433,14 +548,23 @@ void qemu_plugin_flush_cb(void)
     plugin_cb__simple(QEMU_PLUGIN_EV_FLUSH);
 }
 
-void exec_inline_op(struct qemu_plugin_dyn_cb *cb)
+void exec_inline_op(struct qemu_plugin_dyn_cb *cb, int cpu_index)
 {
+    qemu_plugin_u64 entry = cb->inline_insn.entry;
     uint64_t *val = cb->userp;
 
+    if (entry.score) {
+        val = qemu_plugin_scoreboard_entry(entry.score, cpu_index) +
+              entry.offset;
+    }
+
     switch (cb->inline_insn.op) {
     case QEMU_PLUGIN_INLINE_ADD_U64:
         *val += cb->inline_insn.imm;
         break;
+    case QEMU_PLUGIN_INLINE_STORE_U64:
+        *val = cb->inline_insn.imm;
+        break;
     default:
         g_assert_not_reached();
     }
@@ -467,7 +591,7 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr, uint32_t info)
             cb->f.vcpu_mem(cpu->cpu_index, info, vaddr, cb->userp);
             break;
         case PLUGIN_CB_INLINE:
-            exec_inline_op(cb);
+            exec_inline_op(cb, cpu->cpu_index);
             break;
         default:
             g_assert_not_reached();
@@ -515,5 +639,7 @@ static void __attribute__((__constructor__)) plugin_init(void)
     QTAILQ_INIT(&plugin.ctxs);
     qht_init(&plugin.dyn_cb_arr_ht, plugin_dyn_cb_arr_cmp, 16,
              QHT_MODE_AUTO_RESIZE);
+    QLIST_INIT(&plugin.scoreboards);
+    plugin.scoreboard_alloc_size = 1;
     atexit(qemu_plugin_atexit_cb);
 }
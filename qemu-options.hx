@@ -141,6 +141,14 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                kvm-shadow-mem=size of KVM shadow MMU in bytes\n"
     "                split-wx=on|off (enable TCG split w^x mapping)\n"
     "                tb-size=n (TCG translation block cache size)\n"
+    "                tb-trace-threshold=n (retranslate TBs executed n times as superblocks, default=0 (off))\n"
+    "                tb-evict=flush|region (TCG translation block cache eviction policy, default=flush)\n"
+    "                tb-cache=file (record translated blocks to file and pre-translate them on the next run)\n"
+    "                tb-spec=on|off (translate successors of new TBs on idle vCPUs, default=off)\n"
+    "                profile=file (sample the guest PC and write the profile to file at exit)\n"
+    "                profile-freq=n (samples per second of the profiler, default=100)\n"
+    "                perfmap=on|off (write translated blocks to /tmp/perf-<pid>.map, default=off)\n"
+    "                jitdump=on|off (write translated blocks to jit-<pid>.dump, default=off)\n"
     "                dirty-ring-size=n (KVM dirty ring GFN count, default 0)\n"
     "                thread=single|multi (enable multi-threaded TCG)\n", QEMU_ARCH_ALL)
 SRST
@@ -175,6 +183,74 @@ SRST
     ``tb-size=n``
         Controls the size (in MiB) of the TCG translation block cache.
 
+    ``tb-trace-threshold=n``
+        Once a translation block has been entered ``n`` times from the
+        TCG execution loop, it is retranslated as a superblock that
+        continues across forward direct jumps, loops back to its start
+        without leaving the generated code, and leaves it through side
+        exits when a conditional branch is taken, so that a hot loop
+        body becomes a single block.  Jumps into a translation block are
+        not chained until it has been counted that many times.
+        Superblocks are currently only formed by the AArch64 frontend,
+        across B, BL, B.cond, CBZ, CBNZ, TBZ and TBNZ instructions, and
+        not with icount or plugins.  The default of 0 disables
+        retranslation.
+
+    ``tb-evict=flush|region``
+        Controls what happens when the TCG translation block cache is
+        full. With ``flush`` (the default) every translation block is
+        discarded at once. With ``region`` the cache is split into
+        regions and only the least recently allocated region that no
+        vCPU is translating into is discarded, falling back to a full
+        flush if no such region exists.
+
+    ``tb-cache=file``
+        Records the guest code translated by TCG into ``file`` when QEMU
+        exits. On the next run with the same file, the blocks recorded
+        for a guest page are translated together as soon as that page is
+        first executed, provided the guest code and CPU state are
+        unchanged. Only the list of blocks is stored, not the generated
+        host code, so the file is safe to share between QEMU binaries
+        built for the same target.
+
+    ``tb-spec=on|off``
+        When a translation block is translated, the targets of its
+        direct jumps are queued for translation. vCPUs that halt
+        translate queued blocks, and the targets of their direct jumps
+        in turn, before going idle, so that busy vCPUs find them already
+        translated. It requires ``thread=multi``, and has no effect while
+        no vCPU is idle. Speculative translation is off by default.
+
+    ``profile=file``
+        Samples the guest PC of every running vCPU at a fixed rate of
+        host time, and writes the number of samples of each PC to
+        ``file`` when QEMU exits. Each line of the file has the form
+        ``vcpuN;symbol;0xpc count``, as expected by flame graph tools
+        such as ``flamegraph.pl``; the symbols are those of the ELF
+        images loaded by QEMU, e.g. with ``-kernel``. ``info
+        tcg-profile`` shows the hottest symbols while the guest runs.
+
+    ``profile-freq=n``
+        Sets the number of samples per second taken by the profiler,
+        between 1 and 10000. The default is 100.
+
+    ``perfmap=on|off``
+        Writes the host address, size and guest address of every
+        translated block to ``/tmp/perf-<pid>.map``, so that ``perf
+        report`` can name the TCG generated code that samples hit. The
+        file has no notion of time, so once the translation block cache
+        is flushed, or a region of it reused, samples may be attributed
+        to a block that used to occupy the same host address.
+
+    ``jitdump=on|off``
+        Writes every translated block to ``jit-<pid>.dump`` in the
+        current directory, in the jitdump format of Linux perf. Along
+        with the host code, the file records the guest address of each
+        instruction of the block and when the block was generated, so
+        that samples are attributed correctly even across flushes.
+        Record with ``perf record -k 1`` and run ``perf inject --jit``
+        before ``perf report`` or ``perf annotate``.
+
     ``thread=single|multi``
         Controls number of TCG threads. When the TCG is multi-threaded
         there will be one thread per vCPU therefore taking advantage of
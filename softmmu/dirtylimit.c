@@ -0,0 +1,433 @@
+/*
+ * Per-vCPU dirty page rate limit
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * The KVM dirty ring tells which vCPU dirtied each page, so the dirty page
+ * rate of every vCPU is measured by counting the pages collected from its
+ * ring over a period.  A vCPU that dirties memory faster than its limit is
+ * throttled like auto-converge does, by making it sleep for a share of
+ * every time slice, except that the share is specific to the vCPU and is
+ * adjusted after each measurement to bring its dirty page rate down to
+ * the limit.  The vCPUs that stay below their limit are left alone.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qapi/qapi-commands-migration.h"
+#include "qapi/qmp/qdict.h"
+#include "qemu/main-loop.h"
+#include "qemu/rcu.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "qemu/units.h"
+#include "exec/memory.h"
+#include "exec/target_page.h"
+#include "hw/boards.h"
+#include "hw/core/cpu.h"
+#include "monitor/hmp.h"
+#include "monitor/monitor.h"
+#include "sysemu/dirtylimit.h"
+#include "sysemu/kvm.h"
+#include "trace.h"
+
+/* Period of the dirty page rate measurement */
+#define DIRTYLIMIT_CALC_TIME_MS         1000
+
+#define DIRTYLIMIT_THROTTLE_PCT_MAX     99
+#define DIRTYLIMIT_TIMESLICE_NS         10000000
+
+typedef struct VcpuDirtyLimitState {
+    uint64_t quota;             /* dirty page rate limit in MB/s, 0 if none */
+    uint64_t dirty_rate;        /* last measured dirty page rate in MB/s */
+    uint64_t dirty_pages;       /* CPUState::dirty_pages at that time */
+    unsigned int throttle_pct;  /* percentage of each slice spent asleep */
+    bool sleep_scheduled;
+} VcpuDirtyLimitState;
+
+/* Indexed by cpu_index; everything below is protected by the BQL */
+static VcpuDirtyLimitState *vcpu_limits;
+static int nr_vcpu_limits;
+static unsigned int nr_limited;
+static bool dirtylimit_thread_running;
+static QEMUTimer *dirtylimit_timer;
+/* The limits set by the user while a migration limits the vCPUs, or NULL */
+static uint64_t *user_quotas;
+
+bool dirtylimit_supported(void)
+{
+    return kvm_enabled() && kvm_dirty_ring_enabled();
+}
+
+bool dirtylimit_in_service(void)
+{
+    return nr_limited != 0;
+}
+
+/*
+ * Update the dirty page rate of every vCPU from the pages collected from
+ * its dirty ring since the previous call, @period_ms ago.
+ */
+static void dirtylimit_measure(int64_t period_ms)
+{
+    CPUState *cpu;
+
+    /* Collect the pages still sitting in the dirty rings */
+    memory_global_dirty_log_sync();
+
+    CPU_FOREACH(cpu) {
+        VcpuDirtyLimitState *v = &vcpu_limits[cpu->cpu_index];
+        uint64_t pages = cpu->dirty_pages - v->dirty_pages;
+
+        v->dirty_pages = cpu->dirty_pages;
+        if (period_ms) {
+            v->dirty_rate = pages * qemu_target_page_size() * 1000 /
+                            period_ms / MiB;
+        }
+    }
+}
+
+/*
+ * The vCPU ran for (100 - throttle_pct)% of the period.  Assuming that it
+ * keeps dirtying memory at the same pace while it runs, letting it run for
+ * quota / dirty_rate of that time meets the limit.
+ */
+static void dirtylimit_adjust(CPUState *cpu, VcpuDirtyLimitState *v)
+{
+    uint64_t run_pct;
+    unsigned int pct = 0;
+
+    if (v->dirty_rate) {
+        run_pct = (100 - v->throttle_pct) * v->quota / v->dirty_rate;
+        if (run_pct < 100) {
+            pct = MIN(100 - run_pct, DIRTYLIMIT_THROTTLE_PCT_MAX);
+        }
+    }
+
+    trace_dirtylimit_adjust(cpu->cpu_index, v->quota, v->dirty_rate,
+                            v->throttle_pct, pct);
+    v->throttle_pct = pct;
+}
+
+static void *dirtylimit_thread(void *opaque)
+{
+    int64_t start_ms, end_ms;
+    CPUState *cpu;
+
+    rcu_register_thread();
+
+    qemu_mutex_lock_iothread();
+    start_ms = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    dirtylimit_measure(0);
+
+    while (nr_limited) {
+        qemu_mutex_unlock_iothread();
+        g_usleep(DIRTYLIMIT_CALC_TIME_MS * 1000);
+        qemu_mutex_lock_iothread();
+
+        end_ms = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+        dirtylimit_measure(end_ms - start_ms);
+        start_ms = end_ms;
+
+        CPU_FOREACH(cpu) {
+            VcpuDirtyLimitState *v = &vcpu_limits[cpu->cpu_index];
+
+            if (v->quota) {
+                dirtylimit_adjust(cpu, v);
+            }
+        }
+    }
+
+    dirtylimit_thread_running = false;
+    memory_global_dirty_log_stop(GLOBAL_DIRTY_LIMIT);
+    qemu_mutex_unlock_iothread();
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void dirtylimit_vcpu_sleep(CPUState *cpu, run_on_cpu_data opaque)
+{
+    VcpuDirtyLimitState *v = &vcpu_limits[cpu->cpu_index];
+    int64_t sleeptime_ns, endtime_ns;
+
+    sleeptime_ns = (int64_t)v->throttle_pct * DIRTYLIMIT_TIMESLICE_NS / 100;
+    endtime_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) + sleeptime_ns;
+    while (sleeptime_ns > 0 && !cpu->stop) {
+        if (sleeptime_ns > SCALE_MS) {
+            qemu_cond_timedwait_iothread(cpu->halt_cond,
+                                         sleeptime_ns / SCALE_MS);
+        } else {
+            qemu_mutex_unlock_iothread();
+            g_usleep(sleeptime_ns / SCALE_US);
+            qemu_mutex_lock_iothread();
+        }
+        sleeptime_ns = endtime_ns - qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    }
+    qatomic_set(&v->sleep_scheduled, false);
+}
+
+static void dirtylimit_timer_tick(void *opaque)
+{
+    CPUState *cpu;
+
+    /* Stop the timer once no vCPU is limited anymore */
+    if (!nr_limited) {
+        return;
+    }
+
+    CPU_FOREACH(cpu) {
+        VcpuDirtyLimitState *v = &vcpu_limits[cpu->cpu_index];
+
+        if (v->quota && v->throttle_pct &&
+            !qatomic_xchg(&v->sleep_scheduled, true)) {
+            async_run_on_cpu(cpu, dirtylimit_vcpu_sleep, RUN_ON_CPU_NULL);
+        }
+    }
+
+    timer_mod(dirtylimit_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL_RT) +
+                                DIRTYLIMIT_TIMESLICE_NS);
+}
+
+static void dirtylimit_start(void)
+{
+    QemuThread thread;
+
+    if (!dirtylimit_thread_running) {
+        dirtylimit_thread_running = true;
+        memory_global_dirty_log_start(GLOBAL_DIRTY_LIMIT);
+        qemu_thread_create(&thread, "dirtylimit", dirtylimit_thread,
+                           NULL, QEMU_THREAD_DETACHED);
+    }
+
+    if (!dirtylimit_timer) {
+        dirtylimit_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL_RT,
+                                        dirtylimit_timer_tick, NULL);
+    }
+    if (!timer_pending(dirtylimit_timer)) {
+        timer_mod(dirtylimit_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL_RT) +
+                                    DIRTYLIMIT_TIMESLICE_NS);
+    }
+}
+
+static void dirtylimit_state_init(void)
+{
+    if (!vcpu_limits) {
+        nr_vcpu_limits = current_machine->smp.max_cpus;
+        vcpu_limits = g_new0(VcpuDirtyLimitState, nr_vcpu_limits);
+    }
+}
+
+void dirtylimit_set_vcpu(int cpu_index, uint64_t quota)
+{
+    VcpuDirtyLimitState *v;
+
+    dirtylimit_state_init();
+
+    assert(cpu_index >= 0 && cpu_index < nr_vcpu_limits);
+    v = &vcpu_limits[cpu_index];
+    trace_dirtylimit_set_vcpu(cpu_index, quota);
+
+    if (!v->quota && quota) {
+        nr_limited++;
+        v->dirty_rate = 0;
+    } else if (v->quota && !quota) {
+        nr_limited--;
+        v->throttle_pct = 0;
+    }
+    v->quota = quota;
+
+    if (nr_limited) {
+        dirtylimit_start();
+    }
+}
+
+void dirtylimit_set_all(uint64_t quota)
+{
+    CPUState *cpu;
+    int i;
+
+    if (quota) {
+        CPU_FOREACH(cpu) {
+            dirtylimit_set_vcpu(cpu->cpu_index, quota);
+        }
+    } else {
+        /* Also covers the vCPUs that were unplugged while limited */
+        for (i = 0; i < nr_vcpu_limits; i++) {
+            dirtylimit_set_vcpu(i, 0);
+        }
+    }
+}
+
+void dirtylimit_migration_set(uint64_t quota)
+{
+    CPUState *cpu;
+    uint64_t user;
+    int i;
+
+    assert(quota);
+    if (!user_quotas) {
+        dirtylimit_state_init();
+        user_quotas = g_new0(uint64_t, nr_vcpu_limits);
+        for (i = 0; i < nr_vcpu_limits; i++) {
+            user_quotas[i] = vcpu_limits[i].quota;
+        }
+    }
+
+    CPU_FOREACH(cpu) {
+        user = user_quotas[cpu->cpu_index];
+        dirtylimit_set_vcpu(cpu->cpu_index, user ? MIN(user, quota) : quota);
+    }
+}
+
+void dirtylimit_migration_stop(void)
+{
+    int i;
+
+    if (!user_quotas) {
+        return;
+    }
+
+    for (i = 0; i < nr_vcpu_limits; i++) {
+        dirtylimit_set_vcpu(i, user_quotas[i]);
+    }
+    g_free(user_quotas);
+    user_quotas = NULL;
+}
+
+/* The user's limits are restored when migration finishes, see above */
+static bool dirtylimit_check_migration(Error **errp)
+{
+    if (user_quotas) {
+        error_setg(errp, "dirty page rate limits cannot be changed while "
+                   "migration limits them");
+        return false;
+    }
+    return true;
+}
+
+static bool dirtylimit_check_cpu_index(int64_t cpu_index, Error **errp)
+{
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        if (cpu->cpu_index == cpu_index) {
+            return true;
+        }
+    }
+
+    error_setg(errp, "incorrect cpu index specified");
+    return false;
+}
+
+void qmp_set_vcpu_dirty_limit(bool has_cpu_index, int64_t cpu_index,
+                              uint64_t dirty_rate, Error **errp)
+{
+    if (!dirtylimit_supported()) {
+        error_setg(errp, "dirty page rate limit requires KVM with the "
+                   "dirty ring enabled");
+        return;
+    }
+
+    if (!dirty_rate) {
+        error_setg(errp, "dirty-rate must be greater than 0, use "
+                   "cancel-vcpu-dirty-limit to lift the limit");
+        return;
+    }
+
+    if (!dirtylimit_check_migration(errp)) {
+        return;
+    }
+
+    if (!has_cpu_index) {
+        dirtylimit_set_all(dirty_rate);
+    } else if (dirtylimit_check_cpu_index(cpu_index, errp)) {
+        dirtylimit_set_vcpu(cpu_index, dirty_rate);
+    }
+}
+
+void qmp_cancel_vcpu_dirty_limit(bool has_cpu_index, int64_t cpu_index,
+                                 Error **errp)
+{
+    if (!dirtylimit_check_migration(errp)) {
+        return;
+    }
+
+    if (!has_cpu_index) {
+        dirtylimit_set_all(0);
+    } else if (dirtylimit_check_cpu_index(cpu_index, errp) &&
+               vcpu_limits) {
+        dirtylimit_set_vcpu(cpu_index, 0);
+    }
+}
+
+DirtyLimitInfoList *qmp_query_vcpu_dirty_limit(Error **errp)
+{
+    DirtyLimitInfoList *head = NULL, **tail = &head;
+    CPUState *cpu;
+
+    if (!dirtylimit_in_service()) {
+        return NULL;
+    }
+
+    CPU_FOREACH(cpu) {
+        VcpuDirtyLimitState *v = &vcpu_limits[cpu->cpu_index];
+        DirtyLimitInfo *info;
+
+        if (!v->quota) {
+            continue;
+        }
+
+        info = g_new0(DirtyLimitInfo, 1);
+        info->cpu_index = cpu->cpu_index;
+        info->limit_rate = v->quota;
+        info->current_rate = v->dirty_rate;
+        QAPI_LIST_APPEND(tail, info);
+    }
+
+    return head;
+}
+
+void hmp_set_vcpu_dirty_limit(Monitor *mon, const QDict *qdict)
+{
+    int64_t dirty_rate = qdict_get_int(qdict, "dirty_rate");
+    int64_t cpu_index = qdict_get_try_int(qdict, "cpu_index", -1);
+    Error *err = NULL;
+
+    if (dirty_rate <= 0) {
+        monitor_printf(mon, "Incorrect dirty rate specified!\n");
+        return;
+    }
+
+    qmp_set_vcpu_dirty_limit(cpu_index != -1, cpu_index, dirty_rate, &err);
+    hmp_handle_error(mon, err);
+}
+
+void hmp_cancel_vcpu_dirty_limit(Monitor *mon, const QDict *qdict)
+{
+    int64_t cpu_index = qdict_get_try_int(qdict, "cpu_index", -1);
+    Error *err = NULL;
+
+    qmp_cancel_vcpu_dirty_limit(cpu_index != -1, cpu_index, &err);
+    hmp_handle_error(mon, err);
+}
+
+void hmp_info_vcpu_dirty_limit(Monitor *mon, const QDict *qdict)
+{
+    DirtyLimitInfoList *list, *l;
+
+    if (!dirtylimit_in_service()) {
+        monitor_printf(mon, "Dirty page rate limit not enabled!\n");
+        return;
+    }
+
+    list = qmp_query_vcpu_dirty_limit(NULL);
+    for (l = list; l; l = l->next) {
+        monitor_printf(mon, "vcpu[%"PRIi64"], limit rate %"PRIu64" (MB/s), "
+                       "current rate %"PRIu64" (MB/s)\n",
+                       l->value->cpu_index, l->value->limit_rate,
+                       l->value->current_rate);
+    }
+    qapi_free_DirtyLimitInfoList(list);
+}
@@ -22,12 +22,12 @@ DEF_HELPER_FLAGS_1(rbit64, TCG_CALL_NO_RWG_SE, i64, i64)
 DEF_HELPER_2(msr_i_spsel, void, env, i32)
 DEF_HELPER_2(msr_i_daifset, void, env, i32)
 DEF_HELPER_2(msr_i_daifclear, void, env, i32)
-DEF_HELPER_3(vfp_cmph_a64, i64, f16, f16, ptr)
-DEF_HELPER_3(vfp_cmpeh_a64, i64, f16, f16, ptr)
-DEF_HELPER_3(vfp_cmps_a64, i64, f32, f32, ptr)
-DEF_HELPER_3(vfp_cmpes_a64, i64, f32, f32, ptr)
-DEF_HELPER_3(vfp_cmpd_a64, i64, f64, f64, ptr)
-DEF_HELPER_3(vfp_cmped_a64, i64, f64, f64, ptr)
+DEF_HELPER_FLAGS_3(vfp_cmph_a64, TCG_CALL_NO_RWG, i64, f16, f16, ptr)
+DEF_HELPER_FLAGS_3(vfp_cmpeh_a64, TCG_CALL_NO_RWG, i64, f16, f16, ptr)
+DEF_HELPER_FLAGS_3(vfp_cmps_a64, TCG_CALL_NO_RWG, i64, f32, f32, ptr)
+DEF_HELPER_FLAGS_3(vfp_cmpes_a64, TCG_CALL_NO_RWG, i64, f32, f32, ptr)
+DEF_HELPER_FLAGS_3(vfp_cmpd_a64, TCG_CALL_NO_RWG, i64, f64, f64, ptr)
+DEF_HELPER_FLAGS_3(vfp_cmped_a64, TCG_CALL_NO_RWG, i64, f64, f64, ptr)
 DEF_HELPER_FLAGS_4(simd_tblx, TCG_CALL_NO_RWG, void, ptr, ptr, ptr, i32)
 DEF_HELPER_FLAGS_3(vfp_mulxs, TCG_CALL_NO_RWG, f32, f32, f32, ptr)
 DEF_HELPER_FLAGS_3(vfp_mulxd, TCG_CALL_NO_RWG, f64, f64, f64, ptr)
@@ -62,32 +62,32 @@ DEF_HELPER_FLAGS_3(advsimd_maxh, TCG_CALL_NO_RWG, f16, f16, f16, ptr)
 DEF_HELPER_FLAGS_3(advsimd_minh, TCG_CALL_NO_RWG, f16, f16, f16, ptr)
 DEF_HELPER_FLAGS_3(advsimd_maxnumh, TCG_CALL_NO_RWG, f16, f16, f16, ptr)
 DEF_HELPER_FLAGS_3(advsimd_minnumh, TCG_CALL_NO_RWG, f16, f16, f16, ptr)
-DEF_HELPER_3(advsimd_addh, f16, f16, f16, ptr)
-DEF_HELPER_3(advsimd_subh, f16, f16, f16, ptr)
-DEF_HELPER_3(advsimd_mulh, f16, f16, f16, ptr)
-DEF_HELPER_3(advsimd_divh, f16, f16, f16, ptr)
-DEF_HELPER_3(advsimd_ceq_f16, i32, f16, f16, ptr)
-DEF_HELPER_3(advsimd_cge_f16, i32, f16, f16, ptr)
-DEF_HELPER_3(advsimd_cgt_f16, i32, f16, f16, ptr)
-DEF_HELPER_3(advsimd_acge_f16, i32, f16, f16, ptr)
-DEF_HELPER_3(advsimd_acgt_f16, i32, f16, f16, ptr)
-DEF_HELPER_3(advsimd_mulxh, f16, f16, f16, ptr)
-DEF_HELPER_4(advsimd_muladdh, f16, f16, f16, f16, ptr)
-DEF_HELPER_3(advsimd_add2h, i32, i32, i32, ptr)
-DEF_HELPER_3(advsimd_sub2h, i32, i32, i32, ptr)
-DEF_HELPER_3(advsimd_mul2h, i32, i32, i32, ptr)
-DEF_HELPER_3(advsimd_div2h, i32, i32, i32, ptr)
-DEF_HELPER_3(advsimd_max2h, i32, i32, i32, ptr)
-DEF_HELPER_3(advsimd_min2h, i32, i32, i32, ptr)
-DEF_HELPER_3(advsimd_maxnum2h, i32, i32, i32, ptr)
-DEF_HELPER_3(advsimd_minnum2h, i32, i32, i32, ptr)
-DEF_HELPER_3(advsimd_mulx2h, i32, i32, i32, ptr)
-DEF_HELPER_4(advsimd_muladd2h, i32, i32, i32, i32, ptr)
-DEF_HELPER_2(advsimd_rinth_exact, f16, f16, ptr)
-DEF_HELPER_2(advsimd_rinth, f16, f16, ptr)
-DEF_HELPER_2(advsimd_f16tosinth, i32, f16, ptr)
-DEF_HELPER_2(advsimd_f16touinth, i32, f16, ptr)
-DEF_HELPER_2(sqrt_f16, f16, f16, ptr)
+DEF_HELPER_FLAGS_3(advsimd_addh, TCG_CALL_NO_RWG, f16, f16, f16, ptr)
+DEF_HELPER_FLAGS_3(advsimd_subh, TCG_CALL_NO_RWG, f16, f16, f16, ptr)
+DEF_HELPER_FLAGS_3(advsimd_mulh, TCG_CALL_NO_RWG, f16, f16, f16, ptr)
+DEF_HELPER_FLAGS_3(advsimd_divh, TCG_CALL_NO_RWG, f16, f16, f16, ptr)
+DEF_HELPER_FLAGS_3(advsimd_ceq_f16, TCG_CALL_NO_RWG, i32, f16, f16, ptr)
+DEF_HELPER_FLAGS_3(advsimd_cge_f16, TCG_CALL_NO_RWG, i32, f16, f16, ptr)
+DEF_HELPER_FLAGS_3(advsimd_cgt_f16, TCG_CALL_NO_RWG, i32, f16, f16, ptr)
+DEF_HELPER_FLAGS_3(advsimd_acge_f16, TCG_CALL_NO_RWG, i32, f16, f16, ptr)
+DEF_HELPER_FLAGS_3(advsimd_acgt_f16, TCG_CALL_NO_RWG, i32, f16, f16, ptr)
+DEF_HELPER_FLAGS_3(advsimd_mulxh, TCG_CALL_NO_RWG, f16, f16, f16, ptr)
+DEF_HELPER_FLAGS_4(advsimd_muladdh, TCG_CALL_NO_RWG, f16, f16, f16, f16, ptr)
+DEF_HELPER_FLAGS_3(advsimd_add2h, TCG_CALL_NO_RWG, i32, i32, i32, ptr)
+DEF_HELPER_FLAGS_3(advsimd_sub2h, TCG_CALL_NO_RWG, i32, i32, i32, ptr)
+DEF_HELPER_FLAGS_3(advsimd_mul2h, TCG_CALL_NO_RWG, i32, i32, i32, ptr)
+DEF_HELPER_FLAGS_3(advsimd_div2h, TCG_CALL_NO_RWG, i32, i32, i32, ptr)
+DEF_HELPER_FLAGS_3(advsimd_max2h, TCG_CALL_NO_RWG, i32, i32, i32, ptr)
+DEF_HELPER_FLAGS_3(advsimd_min2h, TCG_CALL_NO_RWG, i32, i32, i32, ptr)
+DEF_HELPER_FLAGS_3(advsimd_maxnum2h, TCG_CALL_NO_RWG, i32, i32, i32, ptr)
+DEF_HELPER_FLAGS_3(advsimd_minnum2h, TCG_CALL_NO_RWG, i32, i32, i32, ptr)
+DEF_HELPER_FLAGS_3(advsimd_mulx2h, TCG_CALL_NO_RWG, i32, i32, i32, ptr)
+DEF_HELPER_FLAGS_4(advsimd_muladd2h, TCG_CALL_NO_RWG, i32, i32, i32, i32, ptr)
+DEF_HELPER_FLAGS_2(advsimd_rinth_exact, TCG_CALL_NO_RWG, f16, f16, ptr)
+DEF_HELPER_FLAGS_2(advsimd_rinth, TCG_CALL_NO_RWG, f16, f16, ptr)
+DEF_HELPER_FLAGS_2(advsimd_f16tosinth, TCG_CALL_NO_RWG, i32, f16, ptr)
+DEF_HELPER_FLAGS_2(advsimd_f16touinth, TCG_CALL_NO_RWG, i32, f16, ptr)
+DEF_HELPER_FLAGS_2(sqrt_f16, TCG_CALL_NO_RWG, f16, f16, ptr)
 
 DEF_HELPER_2(exception_return, void, env, i64)
 DEF_HELPER_FLAGS_2(dc_zva, TCG_CALL_NO_WG, void, env, i64)
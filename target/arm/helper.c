@@ -3998,9 +3998,39 @@ static void vmsa_tcr_el12_write(CPUARMState *env, const ARMCPRegInfo *ri,
     tcr->raw_tcr = value;
 }
 
+/*
+ * Return the ASID field of @ttbr, which is 16 bits wide if TCR.AS (bit 36)
+ * is set, and 8 bits wide otherwise.
+ */
+static uint16_t aa64_ttbr_asid(uint64_t tcr, uint64_t ttbr)
+{
+    return extract64(ttbr, 48, extract64(tcr, 36, 1) ? 16 : 8);
+}
+
 static void vmsa_ttbr_write(CPUARMState *env, const ARMCPRegInfo *ri,
                             uint64_t value)
 {
+    if (ri->state == ARM_CP_STATE_AA64 && arm_el_is_aa64(env, 1)) {
+        /*
+         * The ASID in use is that of TTBR1_EL1 if TCR_EL1.A1 is set, and
+         * of TTBR0_EL1 otherwise.  Let the TLB switch to it, keeping the
+         * entries of the previous one.
+         */
+        uint64_t tcr = env->cp15.tcr_el[1].raw_tcr;
+        uint16_t mask = ARMMMUIdxBit_E10_1 |
+                        ARMMMUIdxBit_E10_1_PAN |
+                        ARMMMUIdxBit_E10_0 |
+                        ARMMMUIdxBit_SE10_1 |
+                        ARMMMUIdxBit_SE10_1_PAN |
+                        ARMMMUIdxBit_SE10_0;
+        uint64_t ttbr;
+
+        raw_write(env, ri, value);
+        ttbr = tcr & TTBCR_A1 ? env->cp15.ttbr1_el[1] : env->cp15.ttbr0_el[1];
+        tlb_set_asid_by_mmuidx(env_cpu(env), mask, aa64_ttbr_asid(tcr, ttbr));
+        return;
+    }
+
     /* If the ASID changes (with a 64-bit write), we must flush the TLB.  */
     if (cpreg_field_is_64bit(ri) &&
         extract64(raw_read(env, ri) ^ value, 48, 16) != 0) {
@@ -4590,6 +4620,39 @@ static void tlbi_aa64_vmalle1_write(CPUARMState *env, const ARMCPRegInfo *ri,
     }
 }
 
+/* Return the ASID operand of a TLBI by ASID, for the regime of vae1_tlbmask. */
+static uint16_t tlbi_aa64_asid(CPUARMState *env, uint64_t value)
+{
+    uint64_t hcr = arm_hcr_el2_eff(env);
+    int el = (hcr & (HCR_E2H | HCR_TGE)) == (HCR_E2H | HCR_TGE) ? 2 : 1;
+
+    return aa64_ttbr_asid(env->cp15.tcr_el[el].raw_tcr, value);
+}
+
+static void tlbi_aa64_aside1is_write(CPUARMState *env, const ARMCPRegInfo *ri,
+                                     uint64_t value)
+{
+    CPUState *cs = env_cpu(env);
+    int mask = vae1_tlbmask(env);
+
+    tlb_flush_asid_by_mmuidx_all_cpus_synced(cs, mask,
+                                             tlbi_aa64_asid(env, value));
+}
+
+static void tlbi_aa64_aside1_write(CPUARMState *env, const ARMCPRegInfo *ri,
+                                   uint64_t value)
+{
+    CPUState *cs = env_cpu(env);
+    int mask = vae1_tlbmask(env);
+    uint16_t asid = tlbi_aa64_asid(env, value);
+
+    if (tlb_force_broadcast(env)) {
+        tlb_flush_asid_by_mmuidx_all_cpus_synced(cs, mask, asid);
+    } else {
+        tlb_flush_asid_by_mmuidx(cs, mask, asid);
+    }
+}
+
 static int alle1_tlbmask(CPUARMState *env)
 {
     /*
@@ -5135,7 +5198,7 @@ static const ARMCPRegInfo v8_cp_reginfo[] = {
     { .name = "TLBI_ASIDE1IS", .state = ARM_CP_STATE_AA64,
       .opc0 = 1, .opc1 = 0, .crn = 8, .crm = 3, .opc2 = 2,
       .access = PL1_W, .accessfn = access_ttlb, .type = ARM_CP_NO_RAW,
-      .writefn = tlbi_aa64_vmalle1is_write },
+      .writefn = tlbi_aa64_aside1is_write },
     { .name = "TLBI_VAAE1IS", .state = ARM_CP_STATE_AA64,
       .opc0 = 1, .opc1 = 0, .crn = 8, .crm = 3, .opc2 = 3,
       .access = PL1_W, .accessfn = access_ttlb, .type = ARM_CP_NO_RAW,
@@ -5159,7 +5222,7 @@ static const ARMCPRegInfo v8_cp_reginfo[] = {
     { .name = "TLBI_ASIDE1", .state = ARM_CP_STATE_AA64,
       .opc0 = 1, .opc1 = 0, .crn = 8, .crm = 7, .opc2 = 2,
       .access = PL1_W, .accessfn = access_ttlb, .type = ARM_CP_NO_RAW,
-      .writefn = tlbi_aa64_vmalle1_write },
+      .writefn = tlbi_aa64_aside1_write },
     { .name = "TLBI_VAAE1", .state = ARM_CP_STATE_AA64,
       .opc0 = 1, .opc1 = 0, .crn = 8, .crm = 7, .opc2 = 3,
       .access = PL1_W, .accessfn = access_ttlb, .type = ARM_CP_NO_RAW,
@@ -7216,7 +7279,7 @@ static const ARMCPRegInfo tlbios_reginfo[] = {
     { .name = "TLBI_ASIDE1OS", .state = ARM_CP_STATE_AA64,
       .opc0 = 1, .opc1 = 0, .crn = 8, .crm = 1, .opc2 = 2,
       .access = PL1_W, .type = ARM_CP_NO_RAW,
-      .writefn = tlbi_aa64_vmalle1is_write },
+      .writefn = tlbi_aa64_aside1is_write },
     { .name = "TLBI_ALLE2OS", .state = ARM_CP_STATE_AA64,
       .opc0 = 1, .opc1 = 4, .crn = 8, .crm = 1, .opc2 = 0,
       .access = PL2_W, .type = ARM_CP_NO_RAW,
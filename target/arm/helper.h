@@ -1,44 +1,44 @@
 DEF_HELPER_FLAGS_1(sxtb16, TCG_CALL_NO_RWG_SE, i32, i32)
 DEF_HELPER_FLAGS_1(uxtb16, TCG_CALL_NO_RWG_SE, i32, i32)
 
-DEF_HELPER_3(add_setq, i32, env, i32, i32)
-DEF_HELPER_3(add_saturate, i32, env, i32, i32)
-DEF_HELPER_3(sub_saturate, i32, env, i32, i32)
-DEF_HELPER_3(add_usaturate, i32, env, i32, i32)
-DEF_HELPER_3(sub_usaturate, i32, env, i32, i32)
+DEF_HELPER_FLAGS_3(add_setq, TCG_CALL_NO_RWG, i32, env, i32, i32)
+DEF_HELPER_FLAGS_3(add_saturate, TCG_CALL_NO_RWG, i32, env, i32, i32)
+DEF_HELPER_FLAGS_3(sub_saturate, TCG_CALL_NO_RWG, i32, env, i32, i32)
+DEF_HELPER_FLAGS_3(add_usaturate, TCG_CALL_NO_RWG, i32, env, i32, i32)
+DEF_HELPER_FLAGS_3(sub_usaturate, TCG_CALL_NO_RWG, i32, env, i32, i32)
 DEF_HELPER_FLAGS_2(sdiv, TCG_CALL_NO_RWG_SE, s32, s32, s32)
 DEF_HELPER_FLAGS_2(udiv, TCG_CALL_NO_RWG_SE, i32, i32, i32)
 DEF_HELPER_FLAGS_1(rbit, TCG_CALL_NO_RWG_SE, i32, i32)
 
 #define PAS_OP(pfx)  \
-    DEF_HELPER_3(pfx ## add8, i32, i32, i32, ptr) \
-    DEF_HELPER_3(pfx ## sub8, i32, i32, i32, ptr) \
-    DEF_HELPER_3(pfx ## sub16, i32, i32, i32, ptr) \
-    DEF_HELPER_3(pfx ## add16, i32, i32, i32, ptr) \
-    DEF_HELPER_3(pfx ## addsubx, i32, i32, i32, ptr) \
-    DEF_HELPER_3(pfx ## subaddx, i32, i32, i32, ptr)
+    DEF_HELPER_FLAGS_3(pfx ## add8, TCG_CALL_NO_RWG, i32, i32, i32, ptr) \
+    DEF_HELPER_FLAGS_3(pfx ## sub8, TCG_CALL_NO_RWG, i32, i32, i32, ptr) \
+    DEF_HELPER_FLAGS_3(pfx ## sub16, TCG_CALL_NO_RWG, i32, i32, i32, ptr) \
+    DEF_HELPER_FLAGS_3(pfx ## add16, TCG_CALL_NO_RWG, i32, i32, i32, ptr) \
+    DEF_HELPER_FLAGS_3(pfx ## addsubx, TCG_CALL_NO_RWG, i32, i32, i32, ptr) \
+    DEF_HELPER_FLAGS_3(pfx ## subaddx, TCG_CALL_NO_RWG, i32, i32, i32, ptr)
 
 PAS_OP(s)
 PAS_OP(u)
 #undef PAS_OP
 
 #define PAS_OP(pfx)  \
-    DEF_HELPER_2(pfx ## add8, i32, i32, i32) \
-    DEF_HELPER_2(pfx ## sub8, i32, i32, i32) \
-    DEF_HELPER_2(pfx ## sub16, i32, i32, i32) \
-    DEF_HELPER_2(pfx ## add16, i32, i32, i32) \
-    DEF_HELPER_2(pfx ## addsubx, i32, i32, i32) \
-    DEF_HELPER_2(pfx ## subaddx, i32, i32, i32)
+    DEF_HELPER_FLAGS_2(pfx ## add8, TCG_CALL_NO_RWG_SE, i32, i32, i32) \
+    DEF_HELPER_FLAGS_2(pfx ## sub8, TCG_CALL_NO_RWG_SE, i32, i32, i32) \
+    DEF_HELPER_FLAGS_2(pfx ## sub16, TCG_CALL_NO_RWG_SE, i32, i32, i32) \
+    DEF_HELPER_FLAGS_2(pfx ## add16, TCG_CALL_NO_RWG_SE, i32, i32, i32) \
+    DEF_HELPER_FLAGS_2(pfx ## addsubx, TCG_CALL_NO_RWG_SE, i32, i32, i32) \
+    DEF_HELPER_FLAGS_2(pfx ## subaddx, TCG_CALL_NO_RWG_SE, i32, i32, i32)
 PAS_OP(q)
 PAS_OP(sh)
 PAS_OP(uq)
 PAS_OP(uh)
 #undef PAS_OP
 
-DEF_HELPER_3(ssat, i32, env, i32, i32)
-DEF_HELPER_3(usat, i32, env, i32, i32)
-DEF_HELPER_3(ssat16, i32, env, i32, i32)
-DEF_HELPER_3(usat16, i32, env, i32, i32)
+DEF_HELPER_FLAGS_3(ssat, TCG_CALL_NO_RWG, i32, env, i32, i32)
+DEF_HELPER_FLAGS_3(usat, TCG_CALL_NO_RWG, i32, env, i32, i32)
+DEF_HELPER_FLAGS_3(ssat16, TCG_CALL_NO_RWG, i32, env, i32, i32)
+DEF_HELPER_FLAGS_3(usat16, TCG_CALL_NO_RWG, i32, env, i32, i32)
 
 DEF_HELPER_FLAGS_2(usad8, TCG_CALL_NO_RWG_SE, i32, i32, i32)
 
@@ -101,132 +101,138 @@ DEF_HELPER_FLAGS_5(probe_access, TCG_CALL_NO_WG, void, env, tl, i32, i32, i32)
 DEF_HELPER_1(vfp_get_fpscr, i32, env)
 DEF_HELPER_2(vfp_set_fpscr, void, env, i32)
 
-DEF_HELPER_3(vfp_addh, f16, f16, f16, ptr)
-DEF_HELPER_3(vfp_adds, f32, f32, f32, ptr)
-DEF_HELPER_3(vfp_addd, f64, f64, f64, ptr)
-DEF_HELPER_3(vfp_subh, f16, f16, f16, ptr)
-DEF_HELPER_3(vfp_subs, f32, f32, f32, ptr)
-DEF_HELPER_3(vfp_subd, f64, f64, f64, ptr)
-DEF_HELPER_3(vfp_mulh, f16, f16, f16, ptr)
-DEF_HELPER_3(vfp_muls, f32, f32, f32, ptr)
-DEF_HELPER_3(vfp_muld, f64, f64, f64, ptr)
-DEF_HELPER_3(vfp_divh, f16, f16, f16, ptr)
-DEF_HELPER_3(vfp_divs, f32, f32, f32, ptr)
-DEF_HELPER_3(vfp_divd, f64, f64, f64, ptr)
-DEF_HELPER_3(vfp_maxh, f16, f16, f16, ptr)
-DEF_HELPER_3(vfp_maxs, f32, f32, f32, ptr)
-DEF_HELPER_3(vfp_maxd, f64, f64, f64, ptr)
-DEF_HELPER_3(vfp_minh, f16, f16, f16, ptr)
-DEF_HELPER_3(vfp_mins, f32, f32, f32, ptr)
-DEF_HELPER_3(vfp_mind, f64, f64, f64, ptr)
-DEF_HELPER_3(vfp_maxnumh, f16, f16, f16, ptr)
-DEF_HELPER_3(vfp_maxnums, f32, f32, f32, ptr)
-DEF_HELPER_3(vfp_maxnumd, f64, f64, f64, ptr)
-DEF_HELPER_3(vfp_minnumh, f16, f16, f16, ptr)
-DEF_HELPER_3(vfp_minnums, f32, f32, f32, ptr)
-DEF_HELPER_3(vfp_minnumd, f64, f64, f64, ptr)
-DEF_HELPER_1(vfp_negh, f16, f16)
-DEF_HELPER_1(vfp_negs, f32, f32)
-DEF_HELPER_1(vfp_negd, f64, f64)
-DEF_HELPER_1(vfp_absh, f16, f16)
-DEF_HELPER_1(vfp_abss, f32, f32)
-DEF_HELPER_1(vfp_absd, f64, f64)
-DEF_HELPER_2(vfp_sqrth, f16, f16, env)
-DEF_HELPER_2(vfp_sqrts, f32, f32, env)
-DEF_HELPER_2(vfp_sqrtd, f64, f64, env)
-DEF_HELPER_3(vfp_cmph, void, f16, f16, env)
-DEF_HELPER_3(vfp_cmps, void, f32, f32, env)
-DEF_HELPER_3(vfp_cmpd, void, f64, f64, env)
-DEF_HELPER_3(vfp_cmpeh, void, f16, f16, env)
-DEF_HELPER_3(vfp_cmpes, void, f32, f32, env)
-DEF_HELPER_3(vfp_cmped, void, f64, f64, env)
-
-DEF_HELPER_2(vfp_fcvtds, f64, f32, env)
-DEF_HELPER_2(vfp_fcvtsd, f32, f64, env)
+DEF_HELPER_FLAGS_3(vfp_addh, TCG_CALL_NO_RWG, f16, f16, f16, ptr)
+DEF_HELPER_FLAGS_3(vfp_adds, TCG_CALL_NO_RWG, f32, f32, f32, ptr)
+DEF_HELPER_FLAGS_3(vfp_addd, TCG_CALL_NO_RWG, f64, f64, f64, ptr)
+DEF_HELPER_FLAGS_3(vfp_subh, TCG_CALL_NO_RWG, f16, f16, f16, ptr)
+DEF_HELPER_FLAGS_3(vfp_subs, TCG_CALL_NO_RWG, f32, f32, f32, ptr)
+DEF_HELPER_FLAGS_3(vfp_subd, TCG_CALL_NO_RWG, f64, f64, f64, ptr)
+DEF_HELPER_FLAGS_3(vfp_mulh, TCG_CALL_NO_RWG, f16, f16, f16, ptr)
+DEF_HELPER_FLAGS_3(vfp_muls, TCG_CALL_NO_RWG, f32, f32, f32, ptr)
+DEF_HELPER_FLAGS_3(vfp_muld, TCG_CALL_NO_RWG, f64, f64, f64, ptr)
+DEF_HELPER_FLAGS_3(vfp_divh, TCG_CALL_NO_RWG, f16, f16, f16, ptr)
+DEF_HELPER_FLAGS_3(vfp_divs, TCG_CALL_NO_RWG, f32, f32, f32, ptr)
+DEF_HELPER_FLAGS_3(vfp_divd, TCG_CALL_NO_RWG, f64, f64, f64, ptr)
+DEF_HELPER_FLAGS_3(vfp_maxh, TCG_CALL_NO_RWG, f16, f16, f16, ptr)
+DEF_HELPER_FLAGS_3(vfp_maxs, TCG_CALL_NO_RWG, f32, f32, f32, ptr)
+DEF_HELPER_FLAGS_3(vfp_maxd, TCG_CALL_NO_RWG, f64, f64, f64, ptr)
+DEF_HELPER_FLAGS_3(vfp_minh, TCG_CALL_NO_RWG, f16, f16, f16, ptr)
+DEF_HELPER_FLAGS_3(vfp_mins, TCG_CALL_NO_RWG, f32, f32, f32, ptr)
+DEF_HELPER_FLAGS_3(vfp_mind, TCG_CALL_NO_RWG, f64, f64, f64, ptr)
+DEF_HELPER_FLAGS_3(vfp_maxnumh, TCG_CALL_NO_RWG, f16, f16, f16, ptr)
+DEF_HELPER_FLAGS_3(vfp_maxnums, TCG_CALL_NO_RWG, f32, f32, f32, ptr)
+DEF_HELPER_FLAGS_3(vfp_maxnumd, TCG_CALL_NO_RWG, f64, f64, f64, ptr)
+DEF_HELPER_FLAGS_3(vfp_minnumh, TCG_CALL_NO_RWG, f16, f16, f16, ptr)
+DEF_HELPER_FLAGS_3(vfp_minnums, TCG_CALL_NO_RWG, f32, f32, f32, ptr)
+DEF_HELPER_FLAGS_3(vfp_minnumd, TCG_CALL_NO_RWG, f64, f64, f64, ptr)
+DEF_HELPER_FLAGS_2(vfp_sqrth, TCG_CALL_NO_RWG, f16, f16, env)
+DEF_HELPER_FLAGS_2(vfp_sqrts, TCG_CALL_NO_RWG, f32, f32, env)
+DEF_HELPER_FLAGS_2(vfp_sqrtd, TCG_CALL_NO_RWG, f64, f64, env)
+DEF_HELPER_FLAGS_3(vfp_cmph, TCG_CALL_NO_RWG, void, f16, f16, env)
+DEF_HELPER_FLAGS_3(vfp_cmps, TCG_CALL_NO_RWG, void, f32, f32, env)
+DEF_HELPER_FLAGS_3(vfp_cmpd, TCG_CALL_NO_RWG, void, f64, f64, env)
+DEF_HELPER_FLAGS_3(vfp_cmpeh, TCG_CALL_NO_RWG, void, f16, f16, env)
+DEF_HELPER_FLAGS_3(vfp_cmpes, TCG_CALL_NO_RWG, void, f32, f32, env)
+DEF_HELPER_FLAGS_3(vfp_cmped, TCG_CALL_NO_RWG, void, f64, f64, env)
+
+DEF_HELPER_FLAGS_2(vfp_fcvtds, TCG_CALL_NO_RWG, f64, f32, env)
+DEF_HELPER_FLAGS_2(vfp_fcvtsd, TCG_CALL_NO_RWG, f32, f64, env)
 DEF_HELPER_FLAGS_2(bfcvt, TCG_CALL_NO_RWG, i32, f32, ptr)
 DEF_HELPER_FLAGS_2(bfcvt_pair, TCG_CALL_NO_RWG, i32, i64, ptr)
 
-DEF_HELPER_2(vfp_uitoh, f16, i32, ptr)
-DEF_HELPER_2(vfp_uitos, f32, i32, ptr)
-DEF_HELPER_2(vfp_uitod, f64, i32, ptr)
-DEF_HELPER_2(vfp_sitoh, f16, i32, ptr)
-DEF_HELPER_2(vfp_sitos, f32, i32, ptr)
-DEF_HELPER_2(vfp_sitod, f64, i32, ptr)
-
-DEF_HELPER_2(vfp_touih, i32, f16, ptr)
-DEF_HELPER_2(vfp_touis, i32, f32, ptr)
-DEF_HELPER_2(vfp_touid, i32, f64, ptr)
-DEF_HELPER_2(vfp_touizh, i32, f16, ptr)
-DEF_HELPER_2(vfp_touizs, i32, f32, ptr)
-DEF_HELPER_2(vfp_touizd, i32, f64, ptr)
-DEF_HELPER_2(vfp_tosih, s32, f16, ptr)
-DEF_HELPER_2(vfp_tosis, s32, f32, ptr)
-DEF_HELPER_2(vfp_tosid, s32, f64, ptr)
-DEF_HELPER_2(vfp_tosizh, s32, f16, ptr)
-DEF_HELPER_2(vfp_tosizs, s32, f32, ptr)
-DEF_HELPER_2(vfp_tosizd, s32, f64, ptr)
-
-DEF_HELPER_3(vfp_toshh_round_to_zero, i32, f16, i32, ptr)
-DEF_HELPER_3(vfp_toslh_round_to_zero, i32, f16, i32, ptr)
-DEF_HELPER_3(vfp_touhh_round_to_zero, i32, f16, i32, ptr)
-DEF_HELPER_3(vfp_toulh_round_to_zero, i32, f16, i32, ptr)
-DEF_HELPER_3(vfp_toshs_round_to_zero, i32, f32, i32, ptr)
-DEF_HELPER_3(vfp_tosls_round_to_zero, i32, f32, i32, ptr)
-DEF_HELPER_3(vfp_touhs_round_to_zero, i32, f32, i32, ptr)
-DEF_HELPER_3(vfp_touls_round_to_zero, i32, f32, i32, ptr)
-DEF_HELPER_3(vfp_toshd_round_to_zero, i64, f64, i32, ptr)
-DEF_HELPER_3(vfp_tosld_round_to_zero, i64, f64, i32, ptr)
-DEF_HELPER_3(vfp_touhd_round_to_zero, i64, f64, i32, ptr)
-DEF_HELPER_3(vfp_tould_round_to_zero, i64, f64, i32, ptr)
-DEF_HELPER_3(vfp_touhh, i32, f16, i32, ptr)
-DEF_HELPER_3(vfp_toshh, i32, f16, i32, ptr)
-DEF_HELPER_3(vfp_toulh, i32, f16, i32, ptr)
-DEF_HELPER_3(vfp_toslh, i32, f16, i32, ptr)
-DEF_HELPER_3(vfp_touqh, i64, f16, i32, ptr)
-DEF_HELPER_3(vfp_tosqh, i64, f16, i32, ptr)
-DEF_HELPER_3(vfp_toshs, i32, f32, i32, ptr)
-DEF_HELPER_3(vfp_tosls, i32, f32, i32, ptr)
-DEF_HELPER_3(vfp_tosqs, i64, f32, i32, ptr)
-DEF_HELPER_3(vfp_touhs, i32, f32, i32, ptr)
-DEF_HELPER_3(vfp_touls, i32, f32, i32, ptr)
-DEF_HELPER_3(vfp_touqs, i64, f32, i32, ptr)
-DEF_HELPER_3(vfp_toshd, i64, f64, i32, ptr)
-DEF_HELPER_3(vfp_tosld, i64, f64, i32, ptr)
-DEF_HELPER_3(vfp_tosqd, i64, f64, i32, ptr)
-DEF_HELPER_3(vfp_touhd, i64, f64, i32, ptr)
-DEF_HELPER_3(vfp_tould, i64, f64, i32, ptr)
-DEF_HELPER_3(vfp_touqd, i64, f64, i32, ptr)
-DEF_HELPER_3(vfp_shtos, f32, i32, i32, ptr)
-DEF_HELPER_3(vfp_sltos, f32, i32, i32, ptr)
-DEF_HELPER_3(vfp_sqtos, f32, i64, i32, ptr)
-DEF_HELPER_3(vfp_uhtos, f32, i32, i32, ptr)
-DEF_HELPER_3(vfp_ultos, f32, i32, i32, ptr)
-DEF_HELPER_3(vfp_uqtos, f32, i64, i32, ptr)
-DEF_HELPER_3(vfp_shtod, f64, i64, i32, ptr)
-DEF_HELPER_3(vfp_sltod, f64, i64, i32, ptr)
-DEF_HELPER_3(vfp_sqtod, f64, i64, i32, ptr)
-DEF_HELPER_3(vfp_uhtod, f64, i64, i32, ptr)
-DEF_HELPER_3(vfp_ultod, f64, i64, i32, ptr)
-DEF_HELPER_3(vfp_uqtod, f64, i64, i32, ptr)
-DEF_HELPER_3(vfp_shtoh, f16, i32, i32, ptr)
-DEF_HELPER_3(vfp_uhtoh, f16, i32, i32, ptr)
-DEF_HELPER_3(vfp_sltoh, f16, i32, i32, ptr)
-DEF_HELPER_3(vfp_ultoh, f16, i32, i32, ptr)
-DEF_HELPER_3(vfp_sqtoh, f16, i64, i32, ptr)
-DEF_HELPER_3(vfp_uqtoh, f16, i64, i32, ptr)
-
-DEF_HELPER_3(vfp_shtos_round_to_nearest, f32, i32, i32, ptr)
-DEF_HELPER_3(vfp_sltos_round_to_nearest, f32, i32, i32, ptr)
-DEF_HELPER_3(vfp_uhtos_round_to_nearest, f32, i32, i32, ptr)
-DEF_HELPER_3(vfp_ultos_round_to_nearest, f32, i32, i32, ptr)
-DEF_HELPER_3(vfp_shtod_round_to_nearest, f64, i64, i32, ptr)
-DEF_HELPER_3(vfp_sltod_round_to_nearest, f64, i64, i32, ptr)
-DEF_HELPER_3(vfp_uhtod_round_to_nearest, f64, i64, i32, ptr)
-DEF_HELPER_3(vfp_ultod_round_to_nearest, f64, i64, i32, ptr)
-DEF_HELPER_3(vfp_shtoh_round_to_nearest, f16, i32, i32, ptr)
-DEF_HELPER_3(vfp_uhtoh_round_to_nearest, f16, i32, i32, ptr)
-DEF_HELPER_3(vfp_sltoh_round_to_nearest, f16, i32, i32, ptr)
-DEF_HELPER_3(vfp_ultoh_round_to_nearest, f16, i32, i32, ptr)
+DEF_HELPER_FLAGS_2(vfp_uitoh, TCG_CALL_NO_RWG, f16, i32, ptr)
+DEF_HELPER_FLAGS_2(vfp_uitos, TCG_CALL_NO_RWG, f32, i32, ptr)
+DEF_HELPER_FLAGS_2(vfp_uitod, TCG_CALL_NO_RWG, f64, i32, ptr)
+DEF_HELPER_FLAGS_2(vfp_sitoh, TCG_CALL_NO_RWG, f16, i32, ptr)
+DEF_HELPER_FLAGS_2(vfp_sitos, TCG_CALL_NO_RWG, f32, i32, ptr)
+DEF_HELPER_FLAGS_2(vfp_sitod, TCG_CALL_NO_RWG, f64, i32, ptr)
+
+DEF_HELPER_FLAGS_2(vfp_touih, TCG_CALL_NO_RWG, i32, f16, ptr)
+DEF_HELPER_FLAGS_2(vfp_touis, TCG_CALL_NO_RWG, i32, f32, ptr)
+DEF_HELPER_FLAGS_2(vfp_touid, TCG_CALL_NO_RWG, i32, f64, ptr)
+DEF_HELPER_FLAGS_2(vfp_touizh, TCG_CALL_NO_RWG, i32, f16, ptr)
+DEF_HELPER_FLAGS_2(vfp_touizs, TCG_CALL_NO_RWG, i32, f32, ptr)
+DEF_HELPER_FLAGS_2(vfp_touizd, TCG_CALL_NO_RWG, i32, f64, ptr)
+DEF_HELPER_FLAGS_2(vfp_tosih, TCG_CALL_NO_RWG, s32, f16, ptr)
+DEF_HELPER_FLAGS_2(vfp_tosis, TCG_CALL_NO_RWG, s32, f32, ptr)
+DEF_HELPER_FLAGS_2(vfp_tosid, TCG_CALL_NO_RWG, s32, f64, ptr)
+DEF_HELPER_FLAGS_2(vfp_tosizh, TCG_CALL_NO_RWG, s32, f16, ptr)
+DEF_HELPER_FLAGS_2(vfp_tosizs, TCG_CALL_NO_RWG, s32, f32, ptr)
+DEF_HELPER_FLAGS_2(vfp_tosizd, TCG_CALL_NO_RWG, s32, f64, ptr)
+
+DEF_HELPER_FLAGS_3(vfp_toshh_round_to_zero, TCG_CALL_NO_RWG, i32, f16, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_toslh_round_to_zero, TCG_CALL_NO_RWG, i32, f16, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_touhh_round_to_zero, TCG_CALL_NO_RWG, i32, f16, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_toulh_round_to_zero, TCG_CALL_NO_RWG, i32, f16, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_toshs_round_to_zero, TCG_CALL_NO_RWG, i32, f32, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_tosls_round_to_zero, TCG_CALL_NO_RWG, i32, f32, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_touhs_round_to_zero, TCG_CALL_NO_RWG, i32, f32, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_touls_round_to_zero, TCG_CALL_NO_RWG, i32, f32, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_toshd_round_to_zero, TCG_CALL_NO_RWG, i64, f64, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_tosld_round_to_zero, TCG_CALL_NO_RWG, i64, f64, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_touhd_round_to_zero, TCG_CALL_NO_RWG, i64, f64, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_tould_round_to_zero, TCG_CALL_NO_RWG, i64, f64, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_touhh, TCG_CALL_NO_RWG, i32, f16, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_toshh, TCG_CALL_NO_RWG, i32, f16, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_toulh, TCG_CALL_NO_RWG, i32, f16, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_toslh, TCG_CALL_NO_RWG, i32, f16, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_touqh, TCG_CALL_NO_RWG, i64, f16, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_tosqh, TCG_CALL_NO_RWG, i64, f16, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_toshs, TCG_CALL_NO_RWG, i32, f32, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_tosls, TCG_CALL_NO_RWG, i32, f32, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_tosqs, TCG_CALL_NO_RWG, i64, f32, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_touhs, TCG_CALL_NO_RWG, i32, f32, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_touls, TCG_CALL_NO_RWG, i32, f32, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_touqs, TCG_CALL_NO_RWG, i64, f32, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_toshd, TCG_CALL_NO_RWG, i64, f64, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_tosld, TCG_CALL_NO_RWG, i64, f64, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_tosqd, TCG_CALL_NO_RWG, i64, f64, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_touhd, TCG_CALL_NO_RWG, i64, f64, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_tould, TCG_CALL_NO_RWG, i64, f64, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_touqd, TCG_CALL_NO_RWG, i64, f64, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_shtos, TCG_CALL_NO_RWG, f32, i32, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_sltos, TCG_CALL_NO_RWG, f32, i32, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_sqtos, TCG_CALL_NO_RWG, f32, i64, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_uhtos, TCG_CALL_NO_RWG, f32, i32, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_ultos, TCG_CALL_NO_RWG, f32, i32, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_uqtos, TCG_CALL_NO_RWG, f32, i64, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_shtod, TCG_CALL_NO_RWG, f64, i64, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_sltod, TCG_CALL_NO_RWG, f64, i64, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_sqtod, TCG_CALL_NO_RWG, f64, i64, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_uhtod, TCG_CALL_NO_RWG, f64, i64, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_ultod, TCG_CALL_NO_RWG, f64, i64, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_uqtod, TCG_CALL_NO_RWG, f64, i64, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_shtoh, TCG_CALL_NO_RWG, f16, i32, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_uhtoh, TCG_CALL_NO_RWG, f16, i32, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_sltoh, TCG_CALL_NO_RWG, f16, i32, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_ultoh, TCG_CALL_NO_RWG, f16, i32, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_sqtoh, TCG_CALL_NO_RWG, f16, i64, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_uqtoh, TCG_CALL_NO_RWG, f16, i64, i32, ptr)
+
+DEF_HELPER_FLAGS_3(vfp_shtos_round_to_nearest, TCG_CALL_NO_RWG,
+                   f32, i32, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_sltos_round_to_nearest, TCG_CALL_NO_RWG,
+                   f32, i32, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_uhtos_round_to_nearest, TCG_CALL_NO_RWG,
+                   f32, i32, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_ultos_round_to_nearest, TCG_CALL_NO_RWG,
+                   f32, i32, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_shtod_round_to_nearest, TCG_CALL_NO_RWG,
+                   f64, i64, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_sltod_round_to_nearest, TCG_CALL_NO_RWG,
+                   f64, i64, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_uhtod_round_to_nearest, TCG_CALL_NO_RWG,
+                   f64, i64, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_ultod_round_to_nearest, TCG_CALL_NO_RWG,
+                   f64, i64, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_shtoh_round_to_nearest, TCG_CALL_NO_RWG,
+                   f16, i32, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_uhtoh_round_to_nearest, TCG_CALL_NO_RWG,
+                   f16, i32, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_sltoh_round_to_nearest, TCG_CALL_NO_RWG,
+                   f16, i32, i32, ptr)
+DEF_HELPER_FLAGS_3(vfp_ultoh_round_to_nearest, TCG_CALL_NO_RWG,
+                   f16, i32, i32, ptr)
 
 DEF_HELPER_FLAGS_2(set_rmode, TCG_CALL_NO_RWG, i32, i32, ptr)
 
@@ -235,9 +241,9 @@ DEF_HELPER_FLAGS_3(vfp_fcvt_f32_to_f16, TCG_CALL_NO_RWG, f16, f32, ptr, i32)
 DEF_HELPER_FLAGS_3(vfp_fcvt_f16_to_f64, TCG_CALL_NO_RWG, f64, f16, ptr, i32)
 DEF_HELPER_FLAGS_3(vfp_fcvt_f64_to_f16, TCG_CALL_NO_RWG, f16, f64, ptr, i32)
 
-DEF_HELPER_4(vfp_muladdd, f64, f64, f64, f64, ptr)
-DEF_HELPER_4(vfp_muladds, f32, f32, f32, f32, ptr)
-DEF_HELPER_4(vfp_muladdh, f16, f16, f16, f16, ptr)
+DEF_HELPER_FLAGS_4(vfp_muladdd, TCG_CALL_NO_RWG, f64, f64, f64, f64, ptr)
+DEF_HELPER_FLAGS_4(vfp_muladds, TCG_CALL_NO_RWG, f32, f32, f32, f32, ptr)
+DEF_HELPER_FLAGS_4(vfp_muladdh, TCG_CALL_NO_RWG, f16, f16, f16, f16, ptr)
 
 DEF_HELPER_FLAGS_2(recpe_f16, TCG_CALL_NO_RWG, f16, f16, ptr)
 DEF_HELPER_FLAGS_2(recpe_f32, TCG_CALL_NO_RWG, f32, f32, ptr)
@@ -281,147 +287,147 @@ DEF_HELPER_FLAGS_3(neon_sqadd_u8, TCG_CALL_NO_RWG, i32, env, i32, i32)
 DEF_HELPER_FLAGS_3(neon_sqadd_u16, TCG_CALL_NO_RWG, i32, env, i32, i32)
 DEF_HELPER_FLAGS_3(neon_sqadd_u32, TCG_CALL_NO_RWG, i32, env, i32, i32)
 DEF_HELPER_FLAGS_3(neon_sqadd_u64, TCG_CALL_NO_RWG, i64, env, i64, i64)
-DEF_HELPER_3(neon_qsub_u8, i32, env, i32, i32)
-DEF_HELPER_3(neon_qsub_s8, i32, env, i32, i32)
-DEF_HELPER_3(neon_qsub_u16, i32, env, i32, i32)
-DEF_HELPER_3(neon_qsub_s16, i32, env, i32, i32)
-DEF_HELPER_3(neon_qsub_u32, i32, env, i32, i32)
-DEF_HELPER_3(neon_qsub_s32, i32, env, i32, i32)
-DEF_HELPER_3(neon_qadd_u64, i64, env, i64, i64)
-DEF_HELPER_3(neon_qadd_s64, i64, env, i64, i64)
-DEF_HELPER_3(neon_qsub_u64, i64, env, i64, i64)
-DEF_HELPER_3(neon_qsub_s64, i64, env, i64, i64)
-
-DEF_HELPER_2(neon_hadd_s8, i32, i32, i32)
-DEF_HELPER_2(neon_hadd_u8, i32, i32, i32)
-DEF_HELPER_2(neon_hadd_s16, i32, i32, i32)
-DEF_HELPER_2(neon_hadd_u16, i32, i32, i32)
-DEF_HELPER_2(neon_hadd_s32, s32, s32, s32)
-DEF_HELPER_2(neon_hadd_u32, i32, i32, i32)
-DEF_HELPER_2(neon_rhadd_s8, i32, i32, i32)
-DEF_HELPER_2(neon_rhadd_u8, i32, i32, i32)
-DEF_HELPER_2(neon_rhadd_s16, i32, i32, i32)
-DEF_HELPER_2(neon_rhadd_u16, i32, i32, i32)
-DEF_HELPER_2(neon_rhadd_s32, s32, s32, s32)
-DEF_HELPER_2(neon_rhadd_u32, i32, i32, i32)
-DEF_HELPER_2(neon_hsub_s8, i32, i32, i32)
-DEF_HELPER_2(neon_hsub_u8, i32, i32, i32)
-DEF_HELPER_2(neon_hsub_s16, i32, i32, i32)
-DEF_HELPER_2(neon_hsub_u16, i32, i32, i32)
-DEF_HELPER_2(neon_hsub_s32, s32, s32, s32)
-DEF_HELPER_2(neon_hsub_u32, i32, i32, i32)
-
-DEF_HELPER_2(neon_pmin_u8, i32, i32, i32)
-DEF_HELPER_2(neon_pmin_s8, i32, i32, i32)
-DEF_HELPER_2(neon_pmin_u16, i32, i32, i32)
-DEF_HELPER_2(neon_pmin_s16, i32, i32, i32)
-DEF_HELPER_2(neon_pmax_u8, i32, i32, i32)
-DEF_HELPER_2(neon_pmax_s8, i32, i32, i32)
-DEF_HELPER_2(neon_pmax_u16, i32, i32, i32)
-DEF_HELPER_2(neon_pmax_s16, i32, i32, i32)
-
-DEF_HELPER_2(neon_shl_u16, i32, i32, i32)
-DEF_HELPER_2(neon_shl_s16, i32, i32, i32)
-DEF_HELPER_2(neon_rshl_u8, i32, i32, i32)
-DEF_HELPER_2(neon_rshl_s8, i32, i32, i32)
-DEF_HELPER_2(neon_rshl_u16, i32, i32, i32)
-DEF_HELPER_2(neon_rshl_s16, i32, i32, i32)
-DEF_HELPER_2(neon_rshl_u32, i32, i32, i32)
-DEF_HELPER_2(neon_rshl_s32, i32, i32, i32)
-DEF_HELPER_2(neon_rshl_u64, i64, i64, i64)
-DEF_HELPER_2(neon_rshl_s64, i64, i64, i64)
-DEF_HELPER_3(neon_qshl_u8, i32, env, i32, i32)
-DEF_HELPER_3(neon_qshl_s8, i32, env, i32, i32)
-DEF_HELPER_3(neon_qshl_u16, i32, env, i32, i32)
-DEF_HELPER_3(neon_qshl_s16, i32, env, i32, i32)
-DEF_HELPER_3(neon_qshl_u32, i32, env, i32, i32)
-DEF_HELPER_3(neon_qshl_s32, i32, env, i32, i32)
-DEF_HELPER_3(neon_qshl_u64, i64, env, i64, i64)
-DEF_HELPER_3(neon_qshl_s64, i64, env, i64, i64)
-DEF_HELPER_3(neon_qshlu_s8, i32, env, i32, i32)
-DEF_HELPER_3(neon_qshlu_s16, i32, env, i32, i32)
-DEF_HELPER_3(neon_qshlu_s32, i32, env, i32, i32)
-DEF_HELPER_3(neon_qshlu_s64, i64, env, i64, i64)
-DEF_HELPER_3(neon_qrshl_u8, i32, env, i32, i32)
-DEF_HELPER_3(neon_qrshl_s8, i32, env, i32, i32)
-DEF_HELPER_3(neon_qrshl_u16, i32, env, i32, i32)
-DEF_HELPER_3(neon_qrshl_s16, i32, env, i32, i32)
-DEF_HELPER_3(neon_qrshl_u32, i32, env, i32, i32)
-DEF_HELPER_3(neon_qrshl_s32, i32, env, i32, i32)
-DEF_HELPER_3(neon_qrshl_u64, i64, env, i64, i64)
-DEF_HELPER_3(neon_qrshl_s64, i64, env, i64, i64)
-
-DEF_HELPER_2(neon_add_u8, i32, i32, i32)
-DEF_HELPER_2(neon_add_u16, i32, i32, i32)
-DEF_HELPER_2(neon_padd_u8, i32, i32, i32)
-DEF_HELPER_2(neon_padd_u16, i32, i32, i32)
-DEF_HELPER_2(neon_sub_u8, i32, i32, i32)
-DEF_HELPER_2(neon_sub_u16, i32, i32, i32)
-DEF_HELPER_2(neon_mul_u8, i32, i32, i32)
-DEF_HELPER_2(neon_mul_u16, i32, i32, i32)
-
-DEF_HELPER_2(neon_tst_u8, i32, i32, i32)
-DEF_HELPER_2(neon_tst_u16, i32, i32, i32)
-DEF_HELPER_2(neon_tst_u32, i32, i32, i32)
-
-DEF_HELPER_1(neon_clz_u8, i32, i32)
-DEF_HELPER_1(neon_clz_u16, i32, i32)
-DEF_HELPER_1(neon_cls_s8, i32, i32)
-DEF_HELPER_1(neon_cls_s16, i32, i32)
-DEF_HELPER_1(neon_cls_s32, i32, i32)
-DEF_HELPER_1(neon_cnt_u8, i32, i32)
+DEF_HELPER_FLAGS_3(neon_qsub_u8, TCG_CALL_NO_RWG, i32, env, i32, i32)
+DEF_HELPER_FLAGS_3(neon_qsub_s8, TCG_CALL_NO_RWG, i32, env, i32, i32)
+DEF_HELPER_FLAGS_3(neon_qsub_u16, TCG_CALL_NO_RWG, i32, env, i32, i32)
+DEF_HELPER_FLAGS_3(neon_qsub_s16, TCG_CALL_NO_RWG, i32, env, i32, i32)
+DEF_HELPER_FLAGS_3(neon_qsub_u32, TCG_CALL_NO_RWG, i32, env, i32, i32)
+DEF_HELPER_FLAGS_3(neon_qsub_s32, TCG_CALL_NO_RWG, i32, env, i32, i32)
+DEF_HELPER_FLAGS_3(neon_qadd_u64, TCG_CALL_NO_RWG, i64, env, i64, i64)
+DEF_HELPER_FLAGS_3(neon_qadd_s64, TCG_CALL_NO_RWG, i64, env, i64, i64)
+DEF_HELPER_FLAGS_3(neon_qsub_u64, TCG_CALL_NO_RWG, i64, env, i64, i64)
+DEF_HELPER_FLAGS_3(neon_qsub_s64, TCG_CALL_NO_RWG, i64, env, i64, i64)
+
+DEF_HELPER_FLAGS_2(neon_hadd_s8, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+DEF_HELPER_FLAGS_2(neon_hadd_u8, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+DEF_HELPER_FLAGS_2(neon_hadd_s16, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+DEF_HELPER_FLAGS_2(neon_hadd_u16, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+DEF_HELPER_FLAGS_2(neon_hadd_s32, TCG_CALL_NO_RWG_SE, s32, s32, s32)
+DEF_HELPER_FLAGS_2(neon_hadd_u32, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+DEF_HELPER_FLAGS_2(neon_rhadd_s8, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+DEF_HELPER_FLAGS_2(neon_rhadd_u8, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+DEF_HELPER_FLAGS_2(neon_rhadd_s16, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+DEF_HELPER_FLAGS_2(neon_rhadd_u16, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+DEF_HELPER_FLAGS_2(neon_rhadd_s32, TCG_CALL_NO_RWG_SE, s32, s32, s32)
+DEF_HELPER_FLAGS_2(neon_rhadd_u32, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+DEF_HELPER_FLAGS_2(neon_hsub_s8, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+DEF_HELPER_FLAGS_2(neon_hsub_u8, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+DEF_HELPER_FLAGS_2(neon_hsub_s16, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+DEF_HELPER_FLAGS_2(neon_hsub_u16, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+DEF_HELPER_FLAGS_2(neon_hsub_s32, TCG_CALL_NO_RWG_SE, s32, s32, s32)
+DEF_HELPER_FLAGS_2(neon_hsub_u32, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+
+DEF_HELPER_FLAGS_2(neon_pmin_u8, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+DEF_HELPER_FLAGS_2(neon_pmin_s8, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+DEF_HELPER_FLAGS_2(neon_pmin_u16, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+DEF_HELPER_FLAGS_2(neon_pmin_s16, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+DEF_HELPER_FLAGS_2(neon_pmax_u8, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+DEF_HELPER_FLAGS_2(neon_pmax_s8, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+DEF_HELPER_FLAGS_2(neon_pmax_u16, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+DEF_HELPER_FLAGS_2(neon_pmax_s16, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+
+DEF_HELPER_FLAGS_2(neon_shl_u16, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+DEF_HELPER_FLAGS_2(neon_shl_s16, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+DEF_HELPER_FLAGS_2(neon_rshl_u8, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+DEF_HELPER_FLAGS_2(neon_rshl_s8, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+DEF_HELPER_FLAGS_2(neon_rshl_u16, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+DEF_HELPER_FLAGS_2(neon_rshl_s16, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+DEF_HELPER_FLAGS_2(neon_rshl_u32, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+DEF_HELPER_FLAGS_2(neon_rshl_s32, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+DEF_HELPER_FLAGS_2(neon_rshl_u64, TCG_CALL_NO_RWG_SE, i64, i64, i64)
+DEF_HELPER_FLAGS_2(neon_rshl_s64, TCG_CALL_NO_RWG_SE, i64, i64, i64)
+DEF_HELPER_FLAGS_3(neon_qshl_u8, TCG_CALL_NO_RWG, i32, env, i32, i32)
+DEF_HELPER_FLAGS_3(neon_qshl_s8, TCG_CALL_NO_RWG, i32, env, i32, i32)
+DEF_HELPER_FLAGS_3(neon_qshl_u16, TCG_CALL_NO_RWG, i32, env, i32, i32)
+DEF_HELPER_FLAGS_3(neon_qshl_s16, TCG_CALL_NO_RWG, i32, env, i32, i32)
+DEF_HELPER_FLAGS_3(neon_qshl_u32, TCG_CALL_NO_RWG, i32, env, i32, i32)
+DEF_HELPER_FLAGS_3(neon_qshl_s32, TCG_CALL_NO_RWG, i32, env, i32, i32)
+DEF_HELPER_FLAGS_3(neon_qshl_u64, TCG_CALL_NO_RWG, i64, env, i64, i64)
+DEF_HELPER_FLAGS_3(neon_qshl_s64, TCG_CALL_NO_RWG, i64, env, i64, i64)
+DEF_HELPER_FLAGS_3(neon_qshlu_s8, TCG_CALL_NO_RWG, i32, env, i32, i32)
+DEF_HELPER_FLAGS_3(neon_qshlu_s16, TCG_CALL_NO_RWG, i32, env, i32, i32)
+DEF_HELPER_FLAGS_3(neon_qshlu_s32, TCG_CALL_NO_RWG, i32, env, i32, i32)
+DEF_HELPER_FLAGS_3(neon_qshlu_s64, TCG_CALL_NO_RWG, i64, env, i64, i64)
+DEF_HELPER_FLAGS_3(neon_qrshl_u8, TCG_CALL_NO_RWG, i32, env, i32, i32)
+DEF_HELPER_FLAGS_3(neon_qrshl_s8, TCG_CALL_NO_RWG, i32, env, i32, i32)
+DEF_HELPER_FLAGS_3(neon_qrshl_u16, TCG_CALL_NO_RWG, i32, env, i32, i32)
+DEF_HELPER_FLAGS_3(neon_qrshl_s16, TCG_CALL_NO_RWG, i32, env, i32, i32)
+DEF_HELPER_FLAGS_3(neon_qrshl_u32, TCG_CALL_NO_RWG, i32, env, i32, i32)
+DEF_HELPER_FLAGS_3(neon_qrshl_s32, TCG_CALL_NO_RWG, i32, env, i32, i32)
+DEF_HELPER_FLAGS_3(neon_qrshl_u64, TCG_CALL_NO_RWG, i64, env, i64, i64)
+DEF_HELPER_FLAGS_3(neon_qrshl_s64, TCG_CALL_NO_RWG, i64, env, i64, i64)
+
+DEF_HELPER_FLAGS_2(neon_add_u8, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+DEF_HELPER_FLAGS_2(neon_add_u16, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+DEF_HELPER_FLAGS_2(neon_padd_u8, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+DEF_HELPER_FLAGS_2(neon_padd_u16, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+DEF_HELPER_FLAGS_2(neon_sub_u8, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+DEF_HELPER_FLAGS_2(neon_sub_u16, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+DEF_HELPER_FLAGS_2(neon_mul_u8, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+DEF_HELPER_FLAGS_2(neon_mul_u16, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+
+DEF_HELPER_FLAGS_2(neon_tst_u8, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+DEF_HELPER_FLAGS_2(neon_tst_u16, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+DEF_HELPER_FLAGS_2(neon_tst_u32, TCG_CALL_NO_RWG_SE, i32, i32, i32)
+
+DEF_HELPER_FLAGS_1(neon_clz_u8, TCG_CALL_NO_RWG_SE, i32, i32)
+DEF_HELPER_FLAGS_1(neon_clz_u16, TCG_CALL_NO_RWG_SE, i32, i32)
+DEF_HELPER_FLAGS_1(neon_cls_s8, TCG_CALL_NO_RWG_SE, i32, i32)
+DEF_HELPER_FLAGS_1(neon_cls_s16, TCG_CALL_NO_RWG_SE, i32, i32)
+DEF_HELPER_FLAGS_1(neon_cls_s32, TCG_CALL_NO_RWG_SE, i32, i32)
+DEF_HELPER_FLAGS_1(neon_cnt_u8, TCG_CALL_NO_RWG_SE, i32, i32)
 DEF_HELPER_FLAGS_1(neon_rbit_u8, TCG_CALL_NO_RWG_SE, i32, i32)
 
-DEF_HELPER_3(neon_qdmulh_s16, i32, env, i32, i32)
-DEF_HELPER_3(neon_qrdmulh_s16, i32, env, i32, i32)
-DEF_HELPER_4(neon_qrdmlah_s16, i32, env, i32, i32, i32)
-DEF_HELPER_4(neon_qrdmlsh_s16, i32, env, i32, i32, i32)
-DEF_HELPER_3(neon_qdmulh_s32, i32, env, i32, i32)
-DEF_HELPER_3(neon_qrdmulh_s32, i32, env, i32, i32)
-DEF_HELPER_4(neon_qrdmlah_s32, i32, env, s32, s32, s32)
-DEF_HELPER_4(neon_qrdmlsh_s32, i32, env, s32, s32, s32)
-
-DEF_HELPER_1(neon_narrow_u8, i32, i64)
-DEF_HELPER_1(neon_narrow_u16, i32, i64)
-DEF_HELPER_2(neon_unarrow_sat8, i32, env, i64)
-DEF_HELPER_2(neon_narrow_sat_u8, i32, env, i64)
-DEF_HELPER_2(neon_narrow_sat_s8, i32, env, i64)
-DEF_HELPER_2(neon_unarrow_sat16, i32, env, i64)
-DEF_HELPER_2(neon_narrow_sat_u16, i32, env, i64)
-DEF_HELPER_2(neon_narrow_sat_s16, i32, env, i64)
-DEF_HELPER_2(neon_unarrow_sat32, i32, env, i64)
-DEF_HELPER_2(neon_narrow_sat_u32, i32, env, i64)
-DEF_HELPER_2(neon_narrow_sat_s32, i32, env, i64)
-DEF_HELPER_1(neon_narrow_high_u8, i32, i64)
-DEF_HELPER_1(neon_narrow_high_u16, i32, i64)
-DEF_HELPER_1(neon_narrow_round_high_u8, i32, i64)
-DEF_HELPER_1(neon_narrow_round_high_u16, i32, i64)
-DEF_HELPER_1(neon_widen_u8, i64, i32)
-DEF_HELPER_1(neon_widen_s8, i64, i32)
-DEF_HELPER_1(neon_widen_u16, i64, i32)
-DEF_HELPER_1(neon_widen_s16, i64, i32)
-
-DEF_HELPER_2(neon_addl_u16, i64, i64, i64)
-DEF_HELPER_2(neon_addl_u32, i64, i64, i64)
-DEF_HELPER_2(neon_paddl_u16, i64, i64, i64)
-DEF_HELPER_2(neon_paddl_u32, i64, i64, i64)
-DEF_HELPER_2(neon_subl_u16, i64, i64, i64)
-DEF_HELPER_2(neon_subl_u32, i64, i64, i64)
-DEF_HELPER_3(neon_addl_saturate_s32, i64, env, i64, i64)
-DEF_HELPER_3(neon_addl_saturate_s64, i64, env, i64, i64)
-DEF_HELPER_2(neon_abdl_u16, i64, i32, i32)
-DEF_HELPER_2(neon_abdl_s16, i64, i32, i32)
-DEF_HELPER_2(neon_abdl_u32, i64, i32, i32)
-DEF_HELPER_2(neon_abdl_s32, i64, i32, i32)
-DEF_HELPER_2(neon_abdl_u64, i64, i32, i32)
-DEF_HELPER_2(neon_abdl_s64, i64, i32, i32)
-DEF_HELPER_2(neon_mull_u8, i64, i32, i32)
-DEF_HELPER_2(neon_mull_s8, i64, i32, i32)
-DEF_HELPER_2(neon_mull_u16, i64, i32, i32)
-DEF_HELPER_2(neon_mull_s16, i64, i32, i32)
-
-DEF_HELPER_1(neon_negl_u16, i64, i64)
-DEF_HELPER_1(neon_negl_u32, i64, i64)
+DEF_HELPER_FLAGS_3(neon_qdmulh_s16, TCG_CALL_NO_RWG, i32, env, i32, i32)
+DEF_HELPER_FLAGS_3(neon_qrdmulh_s16, TCG_CALL_NO_RWG, i32, env, i32, i32)
+DEF_HELPER_FLAGS_4(neon_qrdmlah_s16, TCG_CALL_NO_RWG, i32, env, i32, i32, i32)
+DEF_HELPER_FLAGS_4(neon_qrdmlsh_s16, TCG_CALL_NO_RWG, i32, env, i32, i32, i32)
+DEF_HELPER_FLAGS_3(neon_qdmulh_s32, TCG_CALL_NO_RWG, i32, env, i32, i32)
+DEF_HELPER_FLAGS_3(neon_qrdmulh_s32, TCG_CALL_NO_RWG, i32, env, i32, i32)
+DEF_HELPER_FLAGS_4(neon_qrdmlah_s32, TCG_CALL_NO_RWG, i32, env, s32, s32, s32)
+DEF_HELPER_FLAGS_4(neon_qrdmlsh_s32, TCG_CALL_NO_RWG, i32, env, s32, s32, s32)
+
+DEF_HELPER_FLAGS_1(neon_narrow_u8, TCG_CALL_NO_RWG_SE, i32, i64)
+DEF_HELPER_FLAGS_1(neon_narrow_u16, TCG_CALL_NO_RWG_SE, i32, i64)
+DEF_HELPER_FLAGS_2(neon_unarrow_sat8, TCG_CALL_NO_RWG, i32, env, i64)
+DEF_HELPER_FLAGS_2(neon_narrow_sat_u8, TCG_CALL_NO_RWG, i32, env, i64)
+DEF_HELPER_FLAGS_2(neon_narrow_sat_s8, TCG_CALL_NO_RWG, i32, env, i64)
+DEF_HELPER_FLAGS_2(neon_unarrow_sat16, TCG_CALL_NO_RWG, i32, env, i64)
+DEF_HELPER_FLAGS_2(neon_narrow_sat_u16, TCG_CALL_NO_RWG, i32, env, i64)
+DEF_HELPER_FLAGS_2(neon_narrow_sat_s16, TCG_CALL_NO_RWG, i32, env, i64)
+DEF_HELPER_FLAGS_2(neon_unarrow_sat32, TCG_CALL_NO_RWG, i32, env, i64)
+DEF_HELPER_FLAGS_2(neon_narrow_sat_u32, TCG_CALL_NO_RWG, i32, env, i64)
+DEF_HELPER_FLAGS_2(neon_narrow_sat_s32, TCG_CALL_NO_RWG, i32, env, i64)
+DEF_HELPER_FLAGS_1(neon_narrow_high_u8, TCG_CALL_NO_RWG_SE, i32, i64)
+DEF_HELPER_FLAGS_1(neon_narrow_high_u16, TCG_CALL_NO_RWG_SE, i32, i64)
+DEF_HELPER_FLAGS_1(neon_narrow_round_high_u8, TCG_CALL_NO_RWG_SE, i32, i64)
+DEF_HELPER_FLAGS_1(neon_narrow_round_high_u16, TCG_CALL_NO_RWG_SE, i32, i64)
+DEF_HELPER_FLAGS_1(neon_widen_u8, TCG_CALL_NO_RWG_SE, i64, i32)
+DEF_HELPER_FLAGS_1(neon_widen_s8, TCG_CALL_NO_RWG_SE, i64, i32)
+DEF_HELPER_FLAGS_1(neon_widen_u16, TCG_CALL_NO_RWG_SE, i64, i32)
+DEF_HELPER_FLAGS_1(neon_widen_s16, TCG_CALL_NO_RWG_SE, i64, i32)
+
+DEF_HELPER_FLAGS_2(neon_addl_u16, TCG_CALL_NO_RWG_SE, i64, i64, i64)
+DEF_HELPER_FLAGS_2(neon_addl_u32, TCG_CALL_NO_RWG_SE, i64, i64, i64)
+DEF_HELPER_FLAGS_2(neon_paddl_u16, TCG_CALL_NO_RWG_SE, i64, i64, i64)
+DEF_HELPER_FLAGS_2(neon_paddl_u32, TCG_CALL_NO_RWG_SE, i64, i64, i64)
+DEF_HELPER_FLAGS_2(neon_subl_u16, TCG_CALL_NO_RWG_SE, i64, i64, i64)
+DEF_HELPER_FLAGS_2(neon_subl_u32, TCG_CALL_NO_RWG_SE, i64, i64, i64)
+DEF_HELPER_FLAGS_3(neon_addl_saturate_s32, TCG_CALL_NO_RWG, i64, env, i64, i64)
+DEF_HELPER_FLAGS_3(neon_addl_saturate_s64, TCG_CALL_NO_RWG, i64, env, i64, i64)
+DEF_HELPER_FLAGS_2(neon_abdl_u16, TCG_CALL_NO_RWG_SE, i64, i32, i32)
+DEF_HELPER_FLAGS_2(neon_abdl_s16, TCG_CALL_NO_RWG_SE, i64, i32, i32)
+DEF_HELPER_FLAGS_2(neon_abdl_u32, TCG_CALL_NO_RWG_SE, i64, i32, i32)
+DEF_HELPER_FLAGS_2(neon_abdl_s32, TCG_CALL_NO_RWG_SE, i64, i32, i32)
+DEF_HELPER_FLAGS_2(neon_abdl_u64, TCG_CALL_NO_RWG_SE, i64, i32, i32)
+DEF_HELPER_FLAGS_2(neon_abdl_s64, TCG_CALL_NO_RWG_SE, i64, i32, i32)
+DEF_HELPER_FLAGS_2(neon_mull_u8, TCG_CALL_NO_RWG_SE, i64, i32, i32)
+DEF_HELPER_FLAGS_2(neon_mull_s8, TCG_CALL_NO_RWG_SE, i64, i32, i32)
+DEF_HELPER_FLAGS_2(neon_mull_u16, TCG_CALL_NO_RWG_SE, i64, i32, i32)
+DEF_HELPER_FLAGS_2(neon_mull_s16, TCG_CALL_NO_RWG_SE, i64, i32, i32)
+
+DEF_HELPER_FLAGS_1(neon_negl_u16, TCG_CALL_NO_RWG_SE, i64, i64)
+DEF_HELPER_FLAGS_1(neon_negl_u32, TCG_CALL_NO_RWG_SE, i64, i64)
 
 DEF_HELPER_FLAGS_2(neon_qabs_s8, TCG_CALL_NO_RWG, i32, env, i32)
 DEF_HELPER_FLAGS_2(neon_qabs_s16, TCG_CALL_NO_RWG, i32, env, i32)
@@ -432,13 +438,13 @@ DEF_HELPER_FLAGS_2(neon_qneg_s16, TCG_CALL_NO_RWG, i32, env, i32)
 DEF_HELPER_FLAGS_2(neon_qneg_s32, TCG_CALL_NO_RWG, i32, env, i32)
 DEF_HELPER_FLAGS_2(neon_qneg_s64, TCG_CALL_NO_RWG, i64, env, i64)
 
-DEF_HELPER_3(neon_ceq_f32, i32, i32, i32, ptr)
-DEF_HELPER_3(neon_cge_f32, i32, i32, i32, ptr)
-DEF_HELPER_3(neon_cgt_f32, i32, i32, i32, ptr)
-DEF_HELPER_3(neon_acge_f32, i32, i32, i32, ptr)
-DEF_HELPER_3(neon_acgt_f32, i32, i32, i32, ptr)
-DEF_HELPER_3(neon_acge_f64, i64, i64, i64, ptr)
-DEF_HELPER_3(neon_acgt_f64, i64, i64, i64, ptr)
+DEF_HELPER_FLAGS_3(neon_ceq_f32, TCG_CALL_NO_RWG, i32, i32, i32, ptr)
+DEF_HELPER_FLAGS_3(neon_cge_f32, TCG_CALL_NO_RWG, i32, i32, i32, ptr)
+DEF_HELPER_FLAGS_3(neon_cgt_f32, TCG_CALL_NO_RWG, i32, i32, i32, ptr)
+DEF_HELPER_FLAGS_3(neon_acge_f32, TCG_CALL_NO_RWG, i32, i32, i32, ptr)
+DEF_HELPER_FLAGS_3(neon_acgt_f32, TCG_CALL_NO_RWG, i32, i32, i32, ptr)
+DEF_HELPER_FLAGS_3(neon_acge_f64, TCG_CALL_NO_RWG, i64, i64, i64, ptr)
+DEF_HELPER_FLAGS_3(neon_acgt_f64, TCG_CALL_NO_RWG, i64, i64, i64, ptr)
 
 /* iwmmxt_helper.c */
 DEF_HELPER_2(iwmmxt_maddsq, i64, i64, i64)
@@ -743,17 +749,25 @@ DEF_HELPER_FLAGS_5(gvec_fmax_s, TCG_CALL_NO_RWG, void, ptr, ptr, ptr, ptr, i32)
 DEF_HELPER_FLAGS_5(gvec_fmin_h, TCG_CALL_NO_RWG, void, ptr, ptr, ptr, ptr, i32)
 DEF_HELPER_FLAGS_5(gvec_fmin_s, TCG_CALL_NO_RWG, void, ptr, ptr, ptr, ptr, i32)
 
-DEF_HELPER_FLAGS_5(gvec_fmaxnum_h, TCG_CALL_NO_RWG, void, ptr, ptr, ptr, ptr, i32)
-DEF_HELPER_FLAGS_5(gvec_fmaxnum_s, TCG_CALL_NO_RWG, void, ptr, ptr, ptr, ptr, i32)
+DEF_HELPER_FLAGS_5(gvec_fmaxnum_h, TCG_CALL_NO_RWG,
+                   void, ptr, ptr, ptr, ptr, i32)
+DEF_HELPER_FLAGS_5(gvec_fmaxnum_s, TCG_CALL_NO_RWG,
+                   void, ptr, ptr, ptr, ptr, i32)
 
-DEF_HELPER_FLAGS_5(gvec_fminnum_h, TCG_CALL_NO_RWG, void, ptr, ptr, ptr, ptr, i32)
-DEF_HELPER_FLAGS_5(gvec_fminnum_s, TCG_CALL_NO_RWG, void, ptr, ptr, ptr, ptr, i32)
+DEF_HELPER_FLAGS_5(gvec_fminnum_h, TCG_CALL_NO_RWG,
+                   void, ptr, ptr, ptr, ptr, i32)
+DEF_HELPER_FLAGS_5(gvec_fminnum_s, TCG_CALL_NO_RWG,
+                   void, ptr, ptr, ptr, ptr, i32)
 
-DEF_HELPER_FLAGS_5(gvec_recps_nf_h, TCG_CALL_NO_RWG, void, ptr, ptr, ptr, ptr, i32)
-DEF_HELPER_FLAGS_5(gvec_recps_nf_s, TCG_CALL_NO_RWG, void, ptr, ptr, ptr, ptr, i32)
+DEF_HELPER_FLAGS_5(gvec_recps_nf_h, TCG_CALL_NO_RWG,
+                   void, ptr, ptr, ptr, ptr, i32)
+DEF_HELPER_FLAGS_5(gvec_recps_nf_s, TCG_CALL_NO_RWG,
+                   void, ptr, ptr, ptr, ptr, i32)
 
-DEF_HELPER_FLAGS_5(gvec_rsqrts_nf_h, TCG_CALL_NO_RWG, void, ptr, ptr, ptr, ptr, i32)
-DEF_HELPER_FLAGS_5(gvec_rsqrts_nf_s, TCG_CALL_NO_RWG, void, ptr, ptr, ptr, ptr, i32)
+DEF_HELPER_FLAGS_5(gvec_rsqrts_nf_h, TCG_CALL_NO_RWG,
+                   void, ptr, ptr, ptr, ptr, i32)
+DEF_HELPER_FLAGS_5(gvec_rsqrts_nf_s, TCG_CALL_NO_RWG,
+                   void, ptr, ptr, ptr, ptr, i32)
 
 DEF_HELPER_FLAGS_5(gvec_fmla_h, TCG_CALL_NO_RWG, void, ptr, ptr, ptr, ptr, i32)
 DEF_HELPER_FLAGS_5(gvec_fmla_s, TCG_CALL_NO_RWG, void, ptr, ptr, ptr, ptr, i32)
@@ -200,8 +200,17 @@ bool arm_cpu_tlb_fill(CPUState *cs, vaddr address, int size,
             arm_tlb_mte_tagged(&attrs) = true;
         }
 
-        tlb_set_page_with_attrs(cs, address, phys_addr, attrs,
-                                prot, mmu_idx, page_size);
+        /*
+         * A block is physically contiguous, unless a second stage of
+         * translation may map it with smaller pages.
+         */
+        if (!(arm_hcr_el2_eff(&cpu->env) & (HCR_VM | HCR_DC))) {
+            tlb_set_large_page_with_attrs(cs, address, phys_addr, attrs,
+                                          prot, mmu_idx, page_size);
+        } else {
+            tlb_set_page_with_attrs(cs, address, phys_addr, attrs,
+                                    prot, mmu_idx, page_size);
+        }
         return true;
     } else if (probe) {
         return false;
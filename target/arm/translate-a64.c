@@ -1297,6 +1297,48 @@ static inline AArch64DecodeFn *lookup_disas_fn(const AArch64DecodeTable *table,
  * match up with those in the manual.
  */
 
+/*
+ * In a superblock, a direct branch back to the first insn of the TB may
+ * loop within the TB.  The TB flags must then describe the state at the
+ * branch; of those, a direct branch only changes BTYPE, to zero.
+ */
+static TCGLabel *a64_loop_head(DisasContext *s, uint64_t dest)
+{
+    if (s->ss_active ||
+        EX_TBFLAG_A64(arm_tbflags_from_tb(s->base.tb), BTYPE) != 0) {
+        return NULL;
+    }
+    return translator_loop_head(&s->base, dest);
+}
+
+/* Return true if gen_trace_cond_branch() can be used for @dest.  */
+static bool use_trace_cond_branch(DisasContext *s, uint64_t dest)
+{
+    return a64_loop_head(s, dest) ||
+           (!s->ss_active && translator_side_exit(&s->base));
+}
+
+/*
+ * Branch to @dest if @cond holds between @cmp and zero, either looping
+ * back within the superblock or leaving it through a side exit, and go
+ * on translating the not-taken path.
+ */
+static void gen_trace_cond_branch(DisasContext *s, TCGCond cond,
+                                  TCGv_i64 cmp, uint64_t dest)
+{
+    TCGLabel *label = a64_loop_head(s, dest);
+
+    if (label) {
+        tcg_gen_brcondi_i64(cond, cmp, 0, label);
+        return;
+    }
+    label = gen_new_label();
+    tcg_gen_brcondi_i64(tcg_invert_cond(cond), cmp, 0, label);
+    gen_a64_set_pc_im(dest);
+    tcg_gen_lookup_and_goto_ptr();
+    gen_set_label(label);
+}
+
 /* Unconditional branch (immediate)
  *   31  30       26 25                                  0
  * +----+-----------+-------------------------------------+
@@ -1306,6 +1348,7 @@ static inline AArch64DecodeFn *lookup_disas_fn(const AArch64DecodeTable *table,
 static void disas_uncond_b_imm(DisasContext *s, uint32_t insn)
 {
     uint64_t addr = s->pc_curr + sextract32(insn, 0, 26) * 4;
+    TCGLabel *label;
 
     if (insn & (1U << 31)) {
         /* BL Branch with link */
@@ -1314,6 +1357,19 @@ static void disas_uncond_b_imm(DisasContext *s, uint32_t insn)
 
     /* B Branch / BL Branch with link */
     reset_btype(s);
+    label = a64_loop_head(s, addr);
+    if (label) {
+        tcg_gen_br(label);
+        s->base.is_jmp = DISAS_NORETURN;
+        return;
+    }
+    if (!s->ss_active && translator_follow_jump(&s->base, addr)) {
+        /* Keep the superblock within the insns left on the page.  */
+        int bound = -(addr | TARGET_PAGE_MASK) / 4;
+
+        s->base.max_insns = MIN(s->base.max_insns, s->base.num_insns + bound);
+        return;
+    }
     gen_goto_tb(s, 0, addr);
 }
 
@@ -1336,9 +1392,14 @@ static void disas_comp_b_imm(DisasContext *s, uint32_t insn)
     addr = s->pc_curr + sextract32(insn, 5, 19) * 4;
 
     tcg_cmp = read_cpu_reg(s, rt, sf);
-    label_match = gen_new_label();
 
     reset_btype(s);
+    if (use_trace_cond_branch(s, addr)) {
+        gen_trace_cond_branch(s, op ? TCG_COND_NE : TCG_COND_EQ,
+                              tcg_cmp, addr);
+        return;
+    }
+    label_match = gen_new_label();
     tcg_gen_brcondi_i64(op ? TCG_COND_NE : TCG_COND_EQ,
                         tcg_cmp, 0, label_match);
 
@@ -1367,9 +1428,15 @@ static void disas_test_b_imm(DisasContext *s, uint32_t insn)
 
     tcg_cmp = tcg_temp_new_i64();
     tcg_gen_andi_i64(tcg_cmp, cpu_reg(s, rt), (1ULL << bit_pos));
-    label_match = gen_new_label();
 
     reset_btype(s);
+    if (use_trace_cond_branch(s, addr)) {
+        gen_trace_cond_branch(s, op ? TCG_COND_NE : TCG_COND_EQ,
+                              tcg_cmp, addr);
+        tcg_temp_free_i64(tcg_cmp);
+        return;
+    }
+    label_match = gen_new_label();
     tcg_gen_brcondi_i64(op ? TCG_COND_NE : TCG_COND_EQ,
                         tcg_cmp, 0, label_match);
     tcg_temp_free_i64(tcg_cmp);
@@ -1397,7 +1464,13 @@ static void disas_cond_b_imm(DisasContext *s, uint32_t insn)
     cond = extract32(insn, 0, 4);
 
     reset_btype(s);
-    if (cond < 0x0e) {
+    if (cond < 0x0e && use_trace_cond_branch(s, addr)) {
+        DisasCompare64 c;
+
+        a64_test_cc(&c, cond);
+        gen_trace_cond_branch(s, c.cond, c.value, addr);
+        a64_free_cc(&c);
+    } else if (cond < 0x0e) {
         /* genuinely conditional branches */
         TCGLabel *label_match = gen_new_label();
         arm_gen_test_cc(cond, label_match);
@@ -6247,10 +6320,10 @@ static void handle_fp_1src_single(DisasContext *s, int opcode, int rd, int rn)
         tcg_gen_mov_i32(tcg_res, tcg_op);
         goto done;
     case 0x1: /* FABS */
-        gen_helper_vfp_abss(tcg_res, tcg_op);
+        gen_vfp_abss(tcg_res, tcg_op);
         goto done;
     case 0x2: /* FNEG */
-        gen_helper_vfp_negs(tcg_res, tcg_op);
+        gen_vfp_negs(tcg_res, tcg_op);
         goto done;
     case 0x3: /* FSQRT */
         gen_helper_vfp_sqrts(tcg_res, tcg_op, cpu_env);
@@ -6327,10 +6400,10 @@ static void handle_fp_1src_double(DisasContext *s, int opcode, int rd, int rn)
 
     switch (opcode) {
     case 0x1: /* FABS */
-        gen_helper_vfp_absd(tcg_res, tcg_op);
+        gen_vfp_absd(tcg_res, tcg_op);
         goto done;
     case 0x2: /* FNEG */
-        gen_helper_vfp_negd(tcg_res, tcg_op);
+        gen_vfp_negd(tcg_res, tcg_op);
         goto done;
     case 0x3: /* FSQRT */
         gen_helper_vfp_sqrtd(tcg_res, tcg_op, cpu_env);
@@ -6599,7 +6672,7 @@ static void handle_fp_2src_single(DisasContext *s, int opcode,
         break;
     case 0x8: /* FNMUL */
         gen_helper_vfp_muls(tcg_res, tcg_op1, tcg_op2, fpst);
-        gen_helper_vfp_negs(tcg_res, tcg_res);
+        gen_vfp_negs(tcg_res, tcg_res);
         break;
     }
 
@@ -6652,7 +6725,7 @@ static void handle_fp_2src_double(DisasContext *s, int opcode,
         break;
     case 0x8: /* FNMUL */
         gen_helper_vfp_muld(tcg_res, tcg_op1, tcg_op2, fpst);
-        gen_helper_vfp_negd(tcg_res, tcg_res);
+        gen_vfp_negd(tcg_res, tcg_res);
         break;
     }
 
@@ -6787,11 +6860,11 @@ static void handle_fp_3src_single(DisasContext *s, bool o0, bool o1,
      * flipped if it is a negated-input.
      */
     if (o1 == true) {
-        gen_helper_vfp_negs(tcg_op3, tcg_op3);
+        gen_vfp_negs(tcg_op3, tcg_op3);
     }
 
     if (o0 != o1) {
-        gen_helper_vfp_negs(tcg_op1, tcg_op1);
+        gen_vfp_negs(tcg_op1, tcg_op1);
     }
 
     gen_helper_vfp_muladds(tcg_res, tcg_op1, tcg_op2, tcg_op3, fpst);
@@ -6825,11 +6898,11 @@ static void handle_fp_3src_double(DisasContext *s, bool o0, bool o1,
      * flipped if it is a negated-input.
      */
     if (o1 == true) {
-        gen_helper_vfp_negd(tcg_op3, tcg_op3);
+        gen_vfp_negd(tcg_op3, tcg_op3);
     }
 
     if (o0 != o1) {
-        gen_helper_vfp_negd(tcg_op1, tcg_op1);
+        gen_vfp_negd(tcg_op1, tcg_op1);
     }
 
     gen_helper_vfp_muladdd(tcg_res, tcg_op1, tcg_op2, tcg_op3, fpst);
@@ -9340,7 +9413,7 @@ static void handle_3same_float(DisasContext *s, int size, int elements,
             switch (fpopcode) {
             case 0x39: /* FMLS */
                 /* As usual for ARM, separate negation for fused multiply-add */
-                gen_helper_vfp_negd(tcg_op1, tcg_op1);
+                gen_vfp_negd(tcg_op1, tcg_op1);
                 /* fall through */
             case 0x19: /* FMLA */
                 read_vec_element(s, tcg_res, rd, pass, MO_64);
@@ -9391,7 +9464,7 @@ static void handle_3same_float(DisasContext *s, int size, int elements,
                 break;
             case 0x7a: /* FABD */
                 gen_helper_vfp_subd(tcg_res, tcg_op1, tcg_op2, fpst);
-                gen_helper_vfp_absd(tcg_res, tcg_res);
+                gen_vfp_absd(tcg_res, tcg_res);
                 break;
             case 0x7c: /* FCMGT */
                 gen_helper_neon_cgt_f64(tcg_res, tcg_op1, tcg_op2, fpst);
@@ -9420,7 +9493,7 @@ static void handle_3same_float(DisasContext *s, int size, int elements,
             switch (fpopcode) {
             case 0x39: /* FMLS */
                 /* As usual for ARM, separate negation for fused multiply-add */
-                gen_helper_vfp_negs(tcg_op1, tcg_op1);
+                gen_vfp_negs(tcg_op1, tcg_op1);
                 /* fall through */
             case 0x19: /* FMLA */
                 read_vec_element_i32(s, tcg_res, rd, pass, MO_32);
@@ -9471,7 +9544,7 @@ static void handle_3same_float(DisasContext *s, int size, int elements,
                 break;
             case 0x7a: /* FABD */
                 gen_helper_vfp_subs(tcg_res, tcg_op1, tcg_op2, fpst);
-                gen_helper_vfp_abss(tcg_res, tcg_res);
+                gen_vfp_abss(tcg_res, tcg_res);
                 break;
             case 0x7c: /* FCMGT */
                 gen_helper_neon_cgt_f32(tcg_res, tcg_op1, tcg_op2, fpst);
@@ -9906,10 +9979,10 @@ static void handle_2misc_64(DisasContext *s, int opcode, bool u,
         }
         break;
     case 0x2f: /* FABS */
-        gen_helper_vfp_absd(tcg_rd, tcg_rn);
+        gen_vfp_absd(tcg_rd, tcg_rn);
         break;
     case 0x6f: /* FNEG */
-        gen_helper_vfp_negd(tcg_rd, tcg_rn);
+        gen_vfp_negd(tcg_rd, tcg_rn);
         break;
     case 0x7f: /* FSQRT */
         gen_helper_vfp_sqrtd(tcg_rd, tcg_rn, cpu_env);
@@ -12883,10 +12956,10 @@ static void disas_simd_two_reg_misc(DisasContext *s, uint32_t insn)
                     }
                     break;
                 case 0x2f: /* FABS */
-                    gen_helper_vfp_abss(tcg_res, tcg_op);
+                    gen_vfp_abss(tcg_res, tcg_op);
                     break;
                 case 0x6f: /* FNEG */
-                    gen_helper_vfp_negs(tcg_res, tcg_op);
+                    gen_vfp_negs(tcg_res, tcg_op);
                     break;
                 case 0x7f: /* FSQRT */
                     gen_helper_vfp_sqrts(tcg_res, tcg_op, cpu_env);
@@ -13651,7 +13724,7 @@ static void disas_simd_indexed(DisasContext *s, uint32_t insn)
             switch (16 * u + opcode) {
             case 0x05: /* FMLS */
                 /* As usual for ARM, separate negation for fused multiply-add */
-                gen_helper_vfp_negd(tcg_op, tcg_op);
+                gen_vfp_negd(tcg_op, tcg_op);
                 /* fall through */
             case 0x01: /* FMLA */
                 read_vec_element(s, tcg_res, rd, pass, MO_64);
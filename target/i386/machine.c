@@ -824,10 +824,15 @@ static bool hyperv_synic_enable_needed(void *opaque)
     return false;
 }
 
+static void hyperv_synic_update(void *opaque)
+{
+    hyperv_x86_synic_update(opaque);
+}
+
 static int hyperv_synic_post_load(void *opaque, int version_id)
 {
-    X86CPU *cpu = opaque;
-    hyperv_x86_synic_update(cpu);
+    /* Remapping the SynIC pages needs the BQL */
+    vmstate_run_locked(hyperv_synic_update, opaque);
     return 0;
 }
 
@@ -1400,6 +1405,7 @@ const VMStateDescription vmstate_x86_cpu = {
     .name = "cpu",
     .version_id = 12,
     .minimum_version_id = 11,
+    .parallel = true,
     .pre_save = cpu_pre_save,
     .post_load = cpu_post_load,
     .fields = (VMStateField[]) {
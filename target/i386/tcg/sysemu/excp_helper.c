@@ -435,8 +435,17 @@ static int handle_mmu_fault(CPUState *cs, vaddr addr, int size,
         paddr &= TARGET_PAGE_MASK;
 
         assert(prot & (1 << is_write1));
-        tlb_set_page_with_attrs(cs, vaddr, paddr, cpu_get_mem_attrs(env),
-                                prot, mmu_idx, page_size);
+        if (!(env->hflags2 & HF2_NPT_MASK) && x86_get_a20_mask(env) == -1) {
+            /* Without nested paging or A20 masking, large pages are
+               physically contiguous and the softmmu can fill their other
+               4KB pages itself */
+            tlb_set_large_page_with_attrs(cs, vaddr, paddr,
+                                          cpu_get_mem_attrs(env),
+                                          prot, mmu_idx, page_size);
+        } else {
+            tlb_set_page_with_attrs(cs, vaddr, paddr, cpu_get_mem_attrs(env),
+                                    prot, mmu_idx, page_size);
+        }
         return 0;
     } else {
         if (env->intercept_exceptions & (1 << EXCP0E_PAGE)) {
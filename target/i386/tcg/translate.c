@@ -2652,9 +2652,12 @@ static void gen_bnd_jmp(DisasContext *s)
 /* Generate an end of block. Trace exception is also generated if needed.
    If INHIBIT, set HF_INHIBIT_IRQ_MASK if it isn't already set.
    If RECHECK_TF, emit a rechecking helper for #DB, ignoring the state of
-   S->TF.  This is used by the syscall/sysret insns.  */
+   S->TF.  This is used by the syscall/sysret insns.
+   If JR, look up the next TB directly, using the return address stack
+   if RET.  */
 static void
-do_gen_eob_worker(DisasContext *s, bool inhibit, bool recheck_tf, bool jr)
+do_gen_eob_worker(DisasContext *s, bool inhibit, bool recheck_tf, bool jr,
+                  bool ret)
 {
     gen_update_cc_op(s);
 
@@ -2675,6 +2678,8 @@ do_gen_eob_worker(DisasContext *s, bool inhibit, bool recheck_tf, bool jr)
         tcg_gen_exit_tb(NULL, 0);
     } else if (s->flags & HF_TF_MASK) {
         gen_helper_single_step(cpu_env);
+    } else if (jr && ret) {
+        translator_goto_return(&s->base);
     } else if (jr) {
         tcg_gen_lookup_and_goto_ptr();
     } else {
@@ -2686,7 +2691,7 @@ do_gen_eob_worker(DisasContext *s, bool inhibit, bool recheck_tf, bool jr)
 static inline void
 gen_eob_worker(DisasContext *s, bool inhibit, bool recheck_tf)
 {
-    do_gen_eob_worker(s, inhibit, recheck_tf, false);
+    do_gen_eob_worker(s, inhibit, recheck_tf, false, false);
 }
 
 /* End of block.
@@ -2705,7 +2710,13 @@ static void gen_eob(DisasContext *s)
 /* Jump to register */
 static void gen_jr(DisasContext *s, TCGv dest)
 {
-    do_gen_eob_worker(s, false, false, true);
+    do_gen_eob_worker(s, false, false, true, false);
+}
+
+/* Near return to register */
+static void gen_jr_ret(DisasContext *s, TCGv dest)
+{
+    do_gen_eob_worker(s, false, false, true, true);
 }
 
 /* generate a jump to eip. No segment change must happen before as a
@@ -5137,6 +5148,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
             next_eip = s->pc - s->cs_base;
             tcg_gen_movi_tl(s->T1, next_eip);
             gen_push_v(s, s->T1);
+            translator_push_return(&s->base, s->pc);
             gen_op_jmp_v(s->T0);
             gen_bnd_jmp(s);
             gen_jr(s, s->T0);
@@ -6656,7 +6668,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         /* Note that gen_pop_T0 uses a zero-extending load.  */
         gen_op_jmp_v(s->T0);
         gen_bnd_jmp(s);
-        gen_jr(s, s->T0);
+        gen_jr_ret(s, s->T0);
         break;
     case 0xc3: /* ret */
         ot = gen_pop_T0(s);
@@ -6664,7 +6676,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         /* Note that gen_pop_T0 uses a zero-extending load.  */
         gen_op_jmp_v(s->T0);
         gen_bnd_jmp(s);
-        gen_jr(s, s->T0);
+        gen_jr_ret(s, s->T0);
         break;
     case 0xca: /* lret im */
         val = x86_ldsw_code(env, s);
@@ -6724,6 +6736,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
             }
             tcg_gen_movi_tl(s->T0, next_eip);
             gen_push_v(s, s->T0);
+            translator_push_return(&s->base, s->pc);
             gen_bnd_jmp(s);
             gen_jmp(s, tval);
         }
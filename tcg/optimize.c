@@ -600,6 +600,488 @@ static bool swap_commutative2(TCGArg *p1, TCGArg *p2)
     return false;
 }
 
+/*
+ * Redundant load and dead store elimination for host memory relative
+ * to env, within a basic block.
+ *
+ * A load from env is replaced by a move when the same location was
+ * already loaded, or stored with a value of the same size, and neither
+ * the location nor the temp holding the value changed since.  A store to
+ * env is removed when a later store overwrites it before anything could
+ * observe it.  As for TCG globals, qemu_ld/st are assumed to possibly
+ * read env (e.g. when raising an exception) but not to write it.  The
+ * negative offsets (CPUNegativeOffsetState) are written by other threads
+ * and left alone.  Like the register allocator, we assume that frontends
+ * do not access the env slots of TCG globals with explicit loads/stores.
+ */
+
+#define ENV_MEM_SLOTS 16
+
+typedef struct EnvMemSlot {
+    TCGOp *op;          /* the ld or st that made this slot valid */
+    TCGTemp *val;       /* temp holding the value in memory */
+    intptr_t ofs;
+    unsigned size;
+    TCGOpcode ld_opc;   /* load that would yield @val */
+} EnvMemSlot;
+
+typedef struct EnvMemState {
+    EnvMemSlot avail[ENV_MEM_SLOTS];  /* known memory contents */
+    EnvMemSlot store[ENV_MEM_SLOTS];  /* stores not yet observed */
+    unsigned n_avail, n_store;
+} EnvMemState;
+
+/*
+ * Return the access size for an integer host load or store, or 0.
+ * For stores, *ld_opc is set to the load that would read back the
+ * stored temp unchanged, or INDEX_op_discard if there is none.
+ */
+static unsigned env_mem_size(TCGOpcode opc, bool *is_store, TCGOpcode *ld_opc)
+{
+    *is_store = false;
+    *ld_opc = opc;
+    switch (opc) {
+    case INDEX_op_ld8u_i32:
+    case INDEX_op_ld8s_i32:
+    case INDEX_op_ld8u_i64:
+    case INDEX_op_ld8s_i64:
+        return 1;
+    case INDEX_op_ld16u_i32:
+    case INDEX_op_ld16s_i32:
+    case INDEX_op_ld16u_i64:
+    case INDEX_op_ld16s_i64:
+        return 2;
+    case INDEX_op_ld_i32:
+    case INDEX_op_ld32u_i64:
+    case INDEX_op_ld32s_i64:
+        return 4;
+    case INDEX_op_ld_i64:
+        return 8;
+    default:
+        break;
+    }
+
+    *is_store = true;
+    *ld_opc = INDEX_op_discard;
+    switch (opc) {
+    case INDEX_op_st8_i32:
+    case INDEX_op_st8_i64:
+        return 1;
+    case INDEX_op_st16_i32:
+    case INDEX_op_st16_i64:
+        return 2;
+    case INDEX_op_st_i32:
+        *ld_opc = INDEX_op_ld_i32;
+        return 4;
+    case INDEX_op_st32_i64:
+        return 4;
+    case INDEX_op_st_i64:
+        *ld_opc = INDEX_op_ld_i64;
+        return 8;
+    default:
+        *is_store = false;
+        return 0;
+    }
+}
+
+static bool env_mem_overlap(const EnvMemSlot *m, intptr_t ofs, unsigned size)
+{
+    return m->ofs < ofs + size && ofs < m->ofs + m->size;
+}
+
+static void env_mem_push(EnvMemSlot *slots, unsigned *n, EnvMemSlot *m)
+{
+    if (*n == ENV_MEM_SLOTS) {
+        /* Forget the oldest entry.  */
+        memmove(slots, slots + 1, (ENV_MEM_SLOTS - 1) * sizeof(*slots));
+        *n -= 1;
+    }
+    slots[(*n)++] = *m;
+}
+
+/* Forget the memory contents held in temp @ts, which is being redefined. */
+static void env_mem_kill_val(EnvMemState *st, TCGTemp *ts)
+{
+    unsigned i, j;
+
+    for (i = j = 0; i < st->n_avail; i++) {
+        if (st->avail[i].val != ts) {
+            st->avail[j++] = st->avail[i];
+        }
+    }
+    st->n_avail = j;
+}
+
+/* Forget the memory contents overlapping [@ofs, @ofs + @size).  */
+static void env_mem_kill_avail(EnvMemState *st, intptr_t ofs, unsigned size)
+{
+    unsigned i, j;
+
+    for (i = j = 0; i < st->n_avail; i++) {
+        if (!env_mem_overlap(&st->avail[i], ofs, size)) {
+            st->avail[j++] = st->avail[i];
+        }
+    }
+    st->n_avail = j;
+}
+
+/* The stores overlapping [@ofs, @ofs + @size) have been observed.  */
+static void env_mem_kill_store(EnvMemState *st, intptr_t ofs, unsigned size)
+{
+    unsigned i, j;
+
+    for (i = j = 0; i < st->n_store; i++) {
+        if (!env_mem_overlap(&st->store[i], ofs, size)) {
+            st->store[j++] = st->store[i];
+        }
+    }
+    st->n_store = j;
+}
+
+static void tcg_optimize_env_mem(TCGContext *s)
+{
+    TCGTemp *env = tcgv_ptr_temp(cpu_env);
+    EnvMemState st = { };
+    TCGOp *op, *op_next;
+
+    QTAILQ_FOREACH_SAFE(op, &s->ops, link, op_next) {
+        TCGOpcode opc = op->opc;
+        const TCGOpDef *def = &tcg_op_defs[opc];
+        TCGOpcode ld_opc;
+        bool is_store;
+        unsigned size = env_mem_size(opc, &is_store, &ld_opc);
+        int i, nb_oargs;
+
+        if (size && (arg_temp(op->args[1]) != env ||
+                     (intptr_t)op->args[2] < 0)) {
+            /* Host memory that may alias env.  */
+            if (is_store) {
+                st.n_avail = 0;
+            }
+            st.n_store = 0;
+            size = 0;
+        } else if (size) {
+            intptr_t ofs = op->args[2];
+            TCGTemp *val = arg_temp(op->args[0]);
+            EnvMemSlot m = {
+                .op = op, .val = val, .ofs = ofs,
+                .size = size, .ld_opc = ld_opc,
+            };
+            unsigned j;
+
+            if (is_store) {
+                /* Remove earlier stores that this one overwrites.  */
+                for (i = j = 0; i < st.n_store; i++) {
+                    EnvMemSlot *p = &st.store[i];
+
+                    if (ofs <= p->ofs && p->ofs + p->size <= ofs + size) {
+                        tcg_op_remove(s, p->op);
+                        qatomic_set(&s->opt_counts.env_st_elim,
+                                    s->opt_counts.env_st_elim + 1);
+                    } else {
+                        st.store[j++] = *p;
+                    }
+                }
+                st.n_store = j;
+                env_mem_kill_avail(&st, ofs, size);
+                env_mem_push(st.store, &st.n_store, &m);
+                if (ld_opc != INDEX_op_discard) {
+                    env_mem_push(st.avail, &st.n_avail, &m);
+                }
+                continue;
+            }
+
+            for (i = (int)st.n_avail - 1; i >= 0; i--) {
+                EnvMemSlot *p = &st.avail[i];
+
+                if (p->ofs == ofs && p->ld_opc == opc) {
+                    break;
+                }
+            }
+            if (i >= 0) {
+                TCGTemp *src = st.avail[i].val;
+
+                qatomic_set(&s->opt_counts.env_ld_elim,
+                            s->opt_counts.env_ld_elim + 1);
+                if (src == val) {
+                    tcg_op_remove(s, op);
+                    continue;
+                }
+                op->opc = (def->flags & TCG_OPF_64BIT
+                           ? INDEX_op_mov_i64 : INDEX_op_mov_i32);
+                op->args[1] = temp_arg(src);
+                env_mem_kill_val(&st, val);
+                continue;
+            }
+
+            env_mem_kill_store(&st, ofs, size);
+            env_mem_kill_val(&st, val);
+            env_mem_push(st.avail, &st.n_avail, &m);
+            continue;
+        }
+
+        switch (opc) {
+        case INDEX_op_ld_vec:
+        case INDEX_op_dupm_vec:
+            st.n_store = 0;
+            break;
+        case INDEX_op_st_vec:
+            st.n_avail = 0;
+            st.n_store = 0;
+            break;
+        case INDEX_op_call:
+            if ((tcg_call_flags(op) & TCG_CALL_NO_WG_SE) != TCG_CALL_NO_WG_SE) {
+                st.n_avail = 0;
+            }
+            st.n_store = 0;
+            break;
+        default:
+            if (def->flags & TCG_OPF_BB_END) {
+                st.n_avail = 0;
+                st.n_store = 0;
+            } else if (def->flags & (TCG_OPF_SIDE_EFFECTS |
+                                     TCG_OPF_CALL_CLOBBER)) {
+                st.n_store = 0;
+            }
+            break;
+        }
+
+        nb_oargs = opc == INDEX_op_call ? TCGOP_CALLO(op) : def->nb_oargs;
+        for (i = 0; i < nb_oargs; i++) {
+            env_mem_kill_val(&st, arg_temp(op->args[i]));
+        }
+    }
+}
+
+/*
+ * Common subexpression elimination within a basic block.
+ *
+ * An op without side effects that applies the same opcode to the same
+ * inputs as an earlier op of the basic block becomes a move from the
+ * output of that op, as long as neither that output nor the inputs have
+ * been redefined since.  Inputs are compared after looking through the
+ * moves of the basic block, including those left by the env load
+ * forwarding above.  A helper call that may write globals forgets
+ * everything that involves a global.
+ */
+
+#define CSE_SLOTS 32
+#define CSE_MAX_ARGS 6
+
+typedef struct CSEExpr {
+    TCGOpcode opc;
+    TCGTemp *out;
+    /* inputs, looked through copies, followed by the constant args */
+    TCGArg args[CSE_MAX_ARGS];
+} CSEExpr;
+
+typedef struct CSECopy {
+    TCGTemp *dst;
+    TCGTemp *src;
+} CSECopy;
+
+typedef struct CSEState {
+    CSEExpr expr[CSE_SLOTS];
+    CSECopy copy[CSE_SLOTS];
+    unsigned n_expr, n_copy;
+} CSEState;
+
+static bool cse_candidate(TCGOpcode opc)
+{
+    const TCGOpDef *def = &tcg_op_defs[opc];
+    TCGOpcode ld_opc;
+    bool is_store;
+
+    if (def->nb_oargs != 1 || def->nb_iargs + def->nb_cargs > CSE_MAX_ARGS) {
+        return false;
+    }
+    if (def->flags & (TCG_OPF_BB_END | TCG_OPF_CALL_CLOBBER |
+                      TCG_OPF_SIDE_EFFECTS | TCG_OPF_NOT_PRESENT |
+                      TCG_OPF_VECTOR)) {
+        return false;
+    }
+    /* Host loads read memory that may have changed in between.  */
+    return env_mem_size(opc, &is_store, &ld_opc) == 0;
+}
+
+static TCGTemp *cse_find_copy(CSEState *st, TCGTemp *ts)
+{
+    unsigned i;
+
+    for (i = 0; i < st->n_copy; i++) {
+        if (st->copy[i].dst == ts) {
+            return st->copy[i].src;
+        }
+    }
+    return ts;
+}
+
+static bool cse_expr_uses(const CSEExpr *e, TCGTemp *ts)
+{
+    int i, nb_iargs = tcg_op_defs[e->opc].nb_iargs;
+
+    if (e->out == ts) {
+        return true;
+    }
+    for (i = 0; i < nb_iargs; i++) {
+        if (arg_temp(e->args[i]) == ts) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Forget what involves @ts, or any global if @ts is NULL.  */
+static void cse_kill(CSEState *st, TCGTemp *ts)
+{
+    unsigned i, j;
+
+    for (i = j = 0; i < st->n_expr; i++) {
+        CSEExpr *e = &st->expr[i];
+        bool kill;
+
+        if (ts) {
+            kill = cse_expr_uses(e, ts);
+        } else {
+            int k, nb_iargs = tcg_op_defs[e->opc].nb_iargs;
+
+            kill = e->out->kind == TEMP_GLOBAL;
+            for (k = 0; k < nb_iargs && !kill; k++) {
+                kill = arg_temp(e->args[k])->kind == TEMP_GLOBAL;
+            }
+        }
+        if (!kill) {
+            st->expr[j++] = *e;
+        }
+    }
+    st->n_expr = j;
+
+    for (i = j = 0; i < st->n_copy; i++) {
+        CSECopy *c = &st->copy[i];
+        bool kill = ts ? c->dst == ts || c->src == ts
+                       : c->dst->kind == TEMP_GLOBAL ||
+                         c->src->kind == TEMP_GLOBAL;
+
+        if (!kill) {
+            st->copy[j++] = *c;
+        }
+    }
+    st->n_copy = j;
+}
+
+static void cse_push_copy(CSEState *st, TCGTemp *dst, TCGTemp *src)
+{
+    if (st->n_copy == CSE_SLOTS) {
+        /* Forget the oldest entry.  */
+        memmove(st->copy, st->copy + 1, (CSE_SLOTS - 1) * sizeof(CSECopy));
+        st->n_copy--;
+    }
+    st->copy[st->n_copy++] = (CSECopy){ .dst = dst, .src = src };
+}
+
+static void cse_push_expr(CSEState *st, const CSEExpr *e)
+{
+    if (st->n_expr == CSE_SLOTS) {
+        /* Forget the oldest entry.  */
+        memmove(st->expr, st->expr + 1, (CSE_SLOTS - 1) * sizeof(CSEExpr));
+        st->n_expr--;
+    }
+    st->expr[st->n_expr++] = *e;
+}
+
+static void tcg_optimize_cse(TCGContext *s)
+{
+    CSEState st = { };
+    TCGOp *op, *op_next;
+
+    QTAILQ_FOREACH_SAFE(op, &s->ops, link, op_next) {
+        TCGOpcode opc = op->opc;
+        const TCGOpDef *def = &tcg_op_defs[opc];
+        TCGTemp *out, *src;
+        CSEExpr e;
+        int i, nb_args;
+
+        switch (opc) {
+        case INDEX_op_call:
+            if (!(tcg_call_flags(op) & TCG_CALL_NO_WRITE_GLOBALS)) {
+                cse_kill(&st, NULL);
+            }
+            for (i = 0; i < TCGOP_CALLO(op); i++) {
+                cse_kill(&st, arg_temp(op->args[i]));
+            }
+            continue;
+        case INDEX_op_mov_i32:
+        case INDEX_op_mov_i64:
+            out = arg_temp(op->args[0]);
+            src = cse_find_copy(&st, arg_temp(op->args[1]));
+            cse_kill(&st, out);
+            if (src != out) {
+                cse_push_copy(&st, out, src);
+            }
+            continue;
+        default:
+            break;
+        }
+
+        if (def->flags & TCG_OPF_BB_END) {
+            st.n_expr = 0;
+            st.n_copy = 0;
+            continue;
+        }
+        if (!cse_candidate(opc)) {
+            for (i = 0; i < def->nb_oargs; i++) {
+                cse_kill(&st, arg_temp(op->args[i]));
+            }
+            continue;
+        }
+
+        out = arg_temp(op->args[0]);
+        e.opc = opc;
+        e.out = out;
+        nb_args = def->nb_iargs + def->nb_cargs;
+        for (i = 0; i < def->nb_iargs; i++) {
+            src = cse_find_copy(&st, arg_temp(op->args[1 + i]));
+            e.args[i] = temp_arg(src);
+        }
+        for (; i < nb_args; i++) {
+            e.args[i] = op->args[1 + i];
+        }
+
+        for (i = (int)st.n_expr - 1; i >= 0; i--) {
+            CSEExpr *p = &st.expr[i];
+
+            if (p->opc == opc &&
+                !memcmp(p->args, e.args, nb_args * sizeof(TCGArg))) {
+                break;
+            }
+        }
+        if (i >= 0) {
+            src = st.expr[i].out;
+            qatomic_set(&s->opt_counts.cse_elim, s->opt_counts.cse_elim + 1);
+            if (src == out) {
+                tcg_op_remove(s, op);
+                continue;
+            }
+            op->opc = (out->type == TCG_TYPE_I32
+                       ? INDEX_op_mov_i32 : INDEX_op_mov_i64);
+            op->args[1] = temp_arg(src);
+            cse_kill(&st, out);
+            cse_push_copy(&st, out, src);
+            continue;
+        }
+
+        cse_kill(&st, out);
+        for (i = 0; i < def->nb_iargs; i++) {
+            if (arg_temp(e.args[i]) == out) {
+                break;
+            }
+        }
+        if (i == def->nb_iargs) {
+            cse_push_expr(&st, &e);
+        }
+    }
+}
+
 /* Propagate constants and copies, fold constant expressions. */
 void tcg_optimize(TCGContext *s)
 {
@@ -1600,4 +2082,7 @@ void tcg_optimize(TCGContext *s)
             prev_mb = op;
         }
     }
+
+    tcg_optimize_env_mem(s);
+    tcg_optimize_cse(s);
 }
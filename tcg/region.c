@@ -24,6 +24,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/units.h"
+#include "qemu/bitops.h"
 #include "qapi/error.h"
 #include "exec/exec-all.h"
 #include "tcg/tcg.h"
@@ -52,10 +53,14 @@ struct tcg_region_state {
     size_t size; /* size of one region */
     size_t stride; /* .size + guard size */
     size_t total_size; /* size of entire buffer, >= n * stride */
+    bool evict; /* reclaim single regions instead of flushing them all */
 
     /* fields protected by the lock */
     size_t current; /* current region index */
     size_t agg_size_full; /* aggregate size of full regions */
+    unsigned long *evicted; /* regions reclaimed by tcg_region_evict() */
+    uint64_t *alloc_seq; /* per-region allocation order, for eviction */
+    uint64_t seq;
 };
 
 static struct tcg_region_state region;
@@ -163,10 +168,23 @@ static void tcg_region_trees_init(void)
     }
 }
 
-static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
+/* Return the index of the region containing @p, a pointer in the rw buffer */
+static size_t tcg_region_index(const void *p)
 {
-    size_t region_idx;
+    ptrdiff_t offset;
+
+    if (p < region.start_aligned) {
+        return 0;
+    }
+    offset = p - region.start_aligned;
+    if (offset > region.stride * (region.n - 1)) {
+        return region.n - 1;
+    }
+    return offset / region.stride;
+}
 
+static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
+{
     /*
      * Like tcg_splitwx_to_rw, with no assert.  The pc may come from
      * a signal handler over which the caller has no control.
@@ -177,19 +195,7 @@ static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
             return NULL;
         }
     }
-
-    if (p < region.start_aligned) {
-        region_idx = 0;
-    } else {
-        ptrdiff_t offset = p - region.start_aligned;
-
-        if (offset > region.stride * (region.n - 1)) {
-            region_idx = region.n - 1;
-        } else {
-            region_idx = offset / region.stride;
-        }
-    }
-    return region_trees + region_idx * tree_size;
+    return region_trees + tcg_region_index(p) * tree_size;
 }
 
 void tcg_tb_insert(TranslationBlock *tb)
@@ -331,11 +337,20 @@ static void tcg_region_assign(TCGContext *s, size_t curr_region)
 
 static bool tcg_region_alloc__locked(TCGContext *s)
 {
-    if (region.current == region.n) {
-        return true;
+    size_t curr_region;
+
+    if (region.current < region.n) {
+        curr_region = region.current++;
+    } else {
+        /* Once every region has been handed out, reuse evicted ones. */
+        curr_region = find_first_bit(region.evicted, region.n);
+        if (curr_region == region.n) {
+            return true;
+        }
+        clear_bit(curr_region, region.evicted);
     }
-    tcg_region_assign(s, region.current);
-    region.current++;
+    tcg_region_assign(s, curr_region);
+    region.alloc_seq[curr_region] = ++region.seq;
     return false;
 }
 
@@ -384,6 +399,7 @@ void tcg_region_reset_all(void)
     qemu_mutex_lock(&region.lock);
     region.current = 0;
     region.agg_size_full = 0;
+    bitmap_zero(region.evicted, region.n);
 
     for (i = 0; i < n_ctxs; i++) {
         TCGContext *s = qatomic_read(&tcg_ctxs[i]);
@@ -394,13 +410,85 @@ void tcg_region_reset_all(void)
     tcg_region_tree_reset_all();
 }
 
-static size_t tcg_n_regions(size_t tb_size, unsigned max_cpus)
+/*
+ * Reclaim the least recently allocated region that no TCG context is
+ * translating into, so that it can be handed out again by
+ * tcg_region_alloc() while the remaining regions stay live.
+ * @func is called on each TB of the region, with the region's tree locked,
+ * so that the caller can unlink and invalidate it before its code and
+ * TranslationBlock struct are overwritten.
+ *
+ * Returns false if eviction is disabled or no region can be reclaimed;
+ * the caller must then fall back to tcg_region_reset_all().
+ *
+ * Call from a safe-work context.
+ */
+bool tcg_region_evict(GTraverseFunc func, gpointer user_data)
+{
+    unsigned int n_ctxs = qatomic_read(&tcg_cur_ctxs);
+    g_autofree unsigned long *busy = NULL;
+    struct tcg_region_tree *rt;
+    size_t i, victim = region.n;
+    void *start, *end;
+
+    if (!region.evict) {
+        return false;
+    }
+
+    busy = bitmap_new(region.n);
+    qemu_mutex_lock(&region.lock);
+    for (i = 0; i < n_ctxs; i++) {
+        const TCGContext *s = qatomic_read(&tcg_ctxs[i]);
+        set_bit(tcg_region_index(s->code_gen_buffer), busy);
+    }
+    for (i = 0; i < region.current; i++) {
+        if (test_bit(i, busy) || test_bit(i, region.evicted)) {
+            continue;
+        }
+        if (victim == region.n ||
+            region.alloc_seq[i] < region.alloc_seq[victim]) {
+            victim = i;
+        }
+    }
+    if (victim == region.n) {
+        qemu_mutex_unlock(&region.lock);
+        return false;
+    }
+
+    rt = region_trees + victim * tree_size;
+    qemu_mutex_lock(&rt->lock);
+    g_tree_foreach(rt->tree, func, user_data);
+    /* Increment the refcount first so that destroy acts as a reset */
+    g_tree_ref(rt->tree);
+    g_tree_destroy(rt->tree);
+    qemu_mutex_unlock(&rt->lock);
+
+    tcg_region_bounds(victim, &start, &end);
+    region.agg_size_full -= end - start - TCG_HIGHWATER;
+    set_bit(victim, region.evicted);
+    qemu_mutex_unlock(&region.lock);
+    return true;
+}
+
+static size_t tcg_n_regions(size_t tb_size, unsigned max_cpus, bool evict)
 {
 #ifdef CONFIG_USER_ONLY
     return 1;
 #else
     size_t n_regions;
 
+    /*
+     * With eviction, regions are also the unit of reclamation, so we want
+     * more of them than TCG threads even when there is only one thread:
+     * a region can only be evicted if no thread is translating into it.
+     */
+    if (evict) {
+        unsigned n_threads = qemu_tcg_mttcg_enabled() ? max_cpus : 1;
+
+        n_regions = MIN(tb_size / (2 * MiB), n_threads * 8);
+        return MAX(n_regions, n_threads);
+    }
+
     /*
      * It is likely that some vCPUs will translate more code than others,
      * so we first try to set more regions than max_cpus, with those regions
@@ -797,7 +885,9 @@ static int alloc_code_gen_buffer(size_t size, int splitwx, Error **errp)
  * code in parallel without synchronization.
  *
  * In softmmu the number of TCG threads is bounded by max_cpus, so we use at
- * least max_cpus regions in MTTCG. In !MTTCG we use a single region.
+ * least max_cpus regions in MTTCG. In !MTTCG we use a single region, unless
+ * @evict is set: regions are then also the unit that tcg_region_evict()
+ * reclaims when the buffer is full, so we want several of them.
  * Note that the TCG options from the command-line (i.e. -accel accel=tcg,[...])
  * must have been parsed before calling this function, since it calls
  * qemu_tcg_mttcg_enabled().
@@ -814,7 +904,8 @@ static int alloc_code_gen_buffer(size_t size, int splitwx, Error **errp)
  * in practice. Multi-threaded guests share most if not all of their translated
  * code, which makes parallel code generation less appealing than in softmmu.
  */
-void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
+void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus,
+                     bool evict)
 {
     const size_t page_size = qemu_real_host_page_size;
     size_t region_size;
@@ -852,7 +943,8 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
      * As a result of this we might end up with a few extra pages at the end of
      * the buffer; we will assign those to the last region.
      */
-    region.n = tcg_n_regions(tb_size, max_cpus);
+    region.n = tcg_n_regions(tb_size, max_cpus, evict);
+    region.evict = evict;
     region_size = tb_size / region.n;
     region_size = QEMU_ALIGN_DOWN(region_size, page_size);
 
@@ -873,6 +965,8 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
 
     /* init the region struct */
     qemu_mutex_init(&region.lock);
+    region.evicted = bitmap_new(region.n);
+    region.alloc_seq = g_new0(uint64_t, region.n);
 
     /*
      * Set guard pages in the rw buffer, as that's the one into which
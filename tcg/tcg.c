@@ -58,6 +58,7 @@
 
 #include "elf.h"
 #include "exec/log.h"
+#include "exec/perf.h"
 #include "tcg-internal.h"
 
 #ifdef CONFIG_TCG_INTERPRETER
@@ -686,10 +687,10 @@ static void tcg_context_init(unsigned max_cpus)
     cpu_env = temp_tcgv_ptr(ts);
 }
 
-void tcg_init(size_t tb_size, int splitwx, unsigned max_cpus)
+void tcg_init(size_t tb_size, int splitwx, unsigned max_cpus, bool evict)
 {
     tcg_context_init(max_cpus);
-    tcg_region_init(tb_size, splitwx, max_cpus);
+    tcg_region_init(tb_size, splitwx, max_cpus, evict);
 }
 
 /*
@@ -752,6 +753,8 @@ void tcg_prologue_init(TCGContext *s)
                         (uintptr_t)s->code_buf, prologue_size);
 #endif
 
+    perf_report_prologue(tcg_splitwx_to_rx(s->code_buf), prologue_size);
+
 #ifdef DEBUG_DISAS
     if (qemu_loglevel_mask(CPU_LOG_TB_OUT_ASM)) {
         FILE *logfile = qemu_log_lock();
@@ -821,6 +824,7 @@ void tcg_func_start(TCGContext *s)
     QTAILQ_INIT(&s->ops);
     QTAILQ_INIT(&s->free_ops);
     QSIMPLEQ_INIT(&s->labels);
+    s->emit_before_op = NULL;
 }
 
 static TCGTemp *tcg_temp_alloc(TCGContext *s)
@@ -2225,7 +2229,12 @@ static TCGOp *tcg_op_alloc(TCGOpcode opc)
 TCGOp *tcg_emit_op(TCGOpcode opc)
 {
     TCGOp *op = tcg_op_alloc(opc);
-    QTAILQ_INSERT_TAIL(&tcg_ctx->ops, op, link);
+
+    if (tcg_ctx->emit_before_op) {
+        QTAILQ_INSERT_BEFORE(tcg_ctx->emit_before_op, op, link);
+    } else {
+        QTAILQ_INSERT_TAIL(&tcg_ctx->ops, op, link);
+    }
     return op;
 }
 
@@ -4046,6 +4055,21 @@ static void tcg_reg_alloc_call(TCGContext *s, TCGOp *op)
     }
 }
 
+/* Sum the counts of all the TCG contexts into a zeroed @counts */
+void tcg_opt_counts(TCGOptCounts *counts)
+{
+    unsigned int n_ctxs = qatomic_read(&tcg_cur_ctxs);
+    unsigned int i;
+
+    for (i = 0; i < n_ctxs; i++) {
+        const TCGContext *s = qatomic_read(&tcg_ctxs[i]);
+
+        counts->env_ld_elim += qatomic_read(&s->opt_counts.env_ld_elim);
+        counts->env_st_elim += qatomic_read(&s->opt_counts.env_st_elim);
+        counts->cse_elim += qatomic_read(&s->opt_counts.cse_elim);
+    }
+}
+
 #ifdef CONFIG_PROFILER
 
 /* avoid copy/paste errors */
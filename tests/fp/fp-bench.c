@@ -130,6 +130,8 @@ static unsigned int duration = DEFAULT_DURATION_SECS;
 static int64_t ns_elapsed;
 /* disable optimizations with volatile */
 static volatile union fp res;
+/* clear the exception flags before each operation, as many guests do */
+static bool clear_flags;
 
 /*
  * From: https://en.wikipedia.org/wiki/Xorshift
@@ -318,6 +320,9 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 float32 b = ops[1].f32;
                 float32 c = ops[2].f32;
 
+                if (clear_flags) {
+                    soft_status.float_exception_flags = 0;
+                }
                 switch (op) {
                 case OP_ADD:
                     res.f32 = float32_add(a, b, &soft_status);
@@ -353,6 +358,9 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 float64 b = ops[1].f64;
                 float64 c = ops[2].f64;
 
+                if (clear_flags) {
+                    soft_status.float_exception_flags = 0;
+                }
                 switch (op) {
                 case OP_ADD:
                     res.f64 = float64_add(a, b, &soft_status);
@@ -388,6 +396,9 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 float128 b = ops[1].f128;
                 float128 c = ops[2].f128;
 
+                if (clear_flags) {
+                    soft_status.float_exception_flags = 0;
+                }
                 switch (op) {
                 case OP_ADD:
                     res.f128 = float128_add(a, b, &soft_status);
@@ -515,6 +526,8 @@ static void usage_complete(int argc, char *argv[])
     fprintf(stderr, "options:\n");
     fprintf(stderr, " -d = duration, in seconds. Default: %d\n",
             DEFAULT_DURATION_SECS);
+    fprintf(stderr, " -f = clear the exception flags before each operation "
+            "(soft tester only). Default: disabled\n");
     fprintf(stderr, " -h = show this help message.\n");
     fprintf(stderr, " -o = floating point operation (%s). Default: %s\n",
             op_list, op_names[0]);
@@ -614,7 +627,7 @@ static void parse_args(int argc, char *argv[])
     int rounding = ROUND_EVEN;
 
     for (;;) {
-        c = getopt(argc, argv, "d:ho:p:r:t:zZ");
+        c = getopt(argc, argv, "d:fho:p:r:t:zZ");
         if (c < 0) {
             break;
         }
@@ -622,6 +635,9 @@ static void parse_args(int argc, char *argv[])
         case 'd':
             duration = atoi(optarg);
             break;
+        case 'f':
+            clear_flags = true;
+            break;
         case 'h':
             usage_complete(argc, argv);
             exit(EXIT_SUCCESS);
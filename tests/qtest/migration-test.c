@@ -15,6 +15,7 @@
 #include "libqos/libqtest.h"
 #include "qapi/error.h"
 #include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qlist.h"
 #include "qemu/module.h"
 #include "qemu/option.h"
 #include "qemu/range.h"
@@ -795,7 +796,8 @@ static void test_baddest(void)
     test_migrate_end(from, to, false);
 }
 
-static void test_precopy_unix_common(bool dirty_ring)
+static void test_precopy_unix_common(bool dirty_ring,
+                                     bool parallel_device_state)
 {
     g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
     MigrateStart *args = migrate_start_new();
@@ -807,6 +809,11 @@ static void test_precopy_unix_common(bool dirty_ring)
         return;
     }
 
+    if (parallel_device_state) {
+        migrate_set_capability(from, "parallel-device-state", true);
+        migrate_set_capability(to, "parallel-device-state", true);
+    }
+
     /* We want to pick a speed slow enough that the test completes
      * quickly, but that it doesn't complete precopy even on a slow
      * machine, so also set the downtime.
@@ -840,13 +847,19 @@ static void test_precopy_unix_common(bool dirty_ring)
 static void test_precopy_unix(void)
 {
     /* Using default dirty logging */
-    test_precopy_unix_common(false);
+    test_precopy_unix_common(false, false);
 }
 
 static void test_precopy_unix_dirty_ring(void)
 {
     /* Using dirty ring tracking */
-    test_precopy_unix_common(true);
+    test_precopy_unix_common(true, false);
+}
+
+static void test_precopy_unix_parallel_device_state(void)
+{
+    /* The vCPU sections are saved and loaded by worker threads */
+    test_precopy_unix_common(false, true);
 }
 
 #if 0
@@ -1224,7 +1237,92 @@ static void test_migrate_auto_converge(void)
     test_migrate_end(from, to, true);
 }
 
-static void test_multifd_tcp(const char *method)
+/* Returns the dirty page rate limit of vCPU 0, 0 if it is not limited */
+static uint64_t read_vcpu_dirty_limit(QTestState *who)
+{
+    QDict *rsp, *info;
+    QList *list;
+    uint64_t result = 0;
+
+    rsp = qtest_qmp(who, "{ 'execute': 'query-vcpu-dirty-limit' }");
+    g_assert(qdict_haskey(rsp, "return"));
+    list = qdict_get_qlist(rsp, "return");
+    if (!qlist_empty(list)) {
+        info = qobject_to(QDict, qlist_peek(list));
+        g_assert_cmpint(qdict_get_int(info, "cpu-index"), ==, 0);
+        result = qdict_get_int(info, "limit-rate");
+    }
+    qobject_unref(rsp);
+    return result;
+}
+
+static void test_migrate_dirty_limit(void)
+{
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    MigrateStart *args = migrate_start_new();
+    QTestState *from, *to;
+    QDict *rsp;
+    uint64_t limit;
+
+    args->use_dirty_ring = true;
+
+    if (test_migrate_start(&from, &to, uri, args)) {
+        return;
+    }
+
+    /* Set and lift a limit by hand */
+    rsp = wait_command(from, "{ 'execute': 'set-vcpu-dirty-limit',"
+                             "'arguments': { 'cpu-index': 0,"
+                             "               'dirty-rate': 100 } }");
+    qobject_unref(rsp);
+    g_assert_cmpint(read_vcpu_dirty_limit(from), ==, 100);
+    rsp = wait_command(from, "{ 'execute': 'cancel-vcpu-dirty-limit' }");
+    qobject_unref(rsp);
+    g_assert_cmpint(read_vcpu_dirty_limit(from), ==, 0);
+
+    migrate_set_capability(from, "dirty-limit", true);
+
+    /*
+     * Set the initial parameters so that the migration could not converge
+     * without throttling.
+     */
+    migrate_set_parameter_int(from, "downtime-limit", 1);
+    migrate_set_parameter_int(from, "max-bandwidth", 100000000); /* ~100Mb/s */
+
+    /* Wait for the first serial output from the source */
+    wait_for_serial("src_serial");
+
+    migrate_qmp(from, uri, "{}");
+
+    /* Wait for migration to limit the dirty page rate of the vCPU */
+    limit = 0;
+    while (limit == 0) {
+        limit = read_vcpu_dirty_limit(from);
+        usleep(100);
+        g_assert_false(got_stop);
+    }
+
+    /* Now, when we tested that the limit is set, let it converge */
+    migrate_set_parameter_int(from, "downtime-limit", CONVERGE_DOWNTIME);
+
+    if (!got_stop) {
+        qtest_qmp_eventwait(from, "STOP");
+    }
+
+    qtest_qmp_eventwait(to, "RESUME");
+
+    wait_for_serial("dest_serial");
+    wait_for_migration_complete(from);
+
+    /* The limit is lifted once migration finishes */
+    while (read_vcpu_dirty_limit(from)) {
+        usleep(1000);
+    }
+
+    test_migrate_end(from, to, true);
+}
+
+static void test_multifd_tcp(const char *method, bool zero_page)
 {
     MigrateStart *args = migrate_start_new();
     QTestState *from, *to;
@@ -1254,6 +1352,11 @@ static void test_multifd_tcp(const char *method)
     migrate_set_capability(from, "multifd", true);
     migrate_set_capability(to, "multifd", true);
 
+    if (zero_page) {
+        migrate_set_capability(from, "multifd-zero-page", true);
+        migrate_set_capability(to, "multifd-zero-page", true);
+    }
+
     /* Start incoming migration from the 1st socket */
     rsp = wait_command(to, "{ 'execute': 'migrate-incoming',"
                            "  'arguments': { 'uri': 'tcp:127.0.0.1:0' }}");
@@ -1282,18 +1385,37 @@ static void test_multifd_tcp(const char *method)
 
 static void test_multifd_tcp_none(void)
 {
-    test_multifd_tcp("none");
+    test_multifd_tcp("none", false);
+}
+
+static void test_multifd_tcp_zero_page(void)
+{
+    test_multifd_tcp("none", true);
 }
 
 static void test_multifd_tcp_zlib(void)
 {
-    test_multifd_tcp("zlib");
+    test_multifd_tcp("zlib", false);
 }
 
 #ifdef CONFIG_ZSTD
 static void test_multifd_tcp_zstd(void)
 {
-    test_multifd_tcp("zstd");
+    test_multifd_tcp("zstd", false);
+}
+#endif
+
+#ifdef CONFIG_LZ4
+static void test_multifd_tcp_lz4(void)
+{
+    test_multifd_tcp("lz4", false);
+}
+#endif
+
+#if defined(CONFIG_LZ4) && defined(CONFIG_ZSTD)
+static void test_multifd_tcp_adaptive(void)
+{
+    test_multifd_tcp("adaptive", false);
 }
 #endif
 
@@ -1468,6 +1590,8 @@ int main(int argc, char **argv)
     qtest_add_func("/migration/bad_dest", test_baddest);
     qtest_add_func("/migration/precopy/unix", test_precopy_unix);
     qtest_add_func("/migration/precopy/tcp", test_precopy_tcp);
+    qtest_add_func("/migration/precopy/unix/parallel-device-state",
+                   test_precopy_unix_parallel_device_state);
     /* qtest_add_func("/migration/ignore_shared", test_ignore_shared); */
     qtest_add_func("/migration/xbzrle/unix", test_xbzrle_unix);
     qtest_add_func("/migration/fd_proto", test_migrate_fd_proto);
@@ -1480,15 +1604,26 @@ int main(int argc, char **argv)
 
     qtest_add_func("/migration/auto_converge", test_migrate_auto_converge);
     qtest_add_func("/migration/multifd/tcp/none", test_multifd_tcp_none);
+    qtest_add_func("/migration/multifd/tcp/zero-page",
+                   test_multifd_tcp_zero_page);
     qtest_add_func("/migration/multifd/tcp/cancel", test_multifd_tcp_cancel);
     qtest_add_func("/migration/multifd/tcp/zlib", test_multifd_tcp_zlib);
 #ifdef CONFIG_ZSTD
     qtest_add_func("/migration/multifd/tcp/zstd", test_multifd_tcp_zstd);
 #endif
+#ifdef CONFIG_LZ4
+    qtest_add_func("/migration/multifd/tcp/lz4", test_multifd_tcp_lz4);
+#endif
+#if defined(CONFIG_LZ4) && defined(CONFIG_ZSTD)
+    qtest_add_func("/migration/multifd/tcp/adaptive",
+                   test_multifd_tcp_adaptive);
+#endif
 
     if (kvm_dirty_ring_supported()) {
         qtest_add_func("/migration/dirty_ring",
                        test_precopy_unix_dirty_ring);
+        qtest_add_func("/migration/dirty_limit",
+                       test_migrate_dirty_limit);
     }
 
     ret = g_test_run();
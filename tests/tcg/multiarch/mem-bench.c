@@ -0,0 +1,95 @@
+/*
+ * Guest memory access benchmark
+ *
+ * A loop dominated by loads and stores of various sizes, to measure the
+ * cost of guest memory accesses in linux-user, e.g. with and without a
+ * guest_base:
+ *
+ *   qemu-i386 mem-bench 50
+ *   qemu-i386 -B 0x100000000 mem-bench 50
+ *
+ * The optional argument is the number of passes (default: 2).  Each
+ * pass walks a 1 MiB buffer with byte, word and pointer sized accesses
+ * and follows a chain of pointers through it.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BUF_SIZE (1 << 20)
+
+static uint8_t buf[BUF_SIZE];
+
+static uint32_t pass_bytes(void)
+{
+    uint32_t sum = 0;
+    size_t i;
+
+    for (i = 0; i < BUF_SIZE; i++) {
+        buf[i] = buf[i] * 3 + i;
+        sum += buf[i];
+    }
+    return sum;
+}
+
+static uint32_t pass_words(void)
+{
+    uint32_t *w = (uint32_t *)buf;
+    uint32_t sum = 0;
+    size_t i;
+
+    for (i = 1; i < BUF_SIZE / sizeof(*w); i++) {
+        w[i] ^= w[i - 1] + (uint32_t)i;
+        sum += w[i];
+    }
+    return sum;
+}
+
+static uint32_t pass_chase(void)
+{
+    uintptr_t *p = (uintptr_t *)buf;
+    size_t n = BUF_SIZE / sizeof(*p);
+    uint32_t sum = 0;
+    size_t i, j;
+
+    /* Link the slots with a stride that is coprime with their number. */
+    for (i = 0; i < n; i++) {
+        p[i] = (uintptr_t)&p[(i + 4099) % n];
+    }
+    for (i = 0, j = 0; i < n; i++) {
+        uintptr_t *next = (uintptr_t *)p[j];
+
+        j = next - p;
+        sum += j;
+    }
+    return sum;
+}
+
+int main(int argc, char **argv)
+{
+    struct timespec start, end;
+    int passes = argc > 1 ? atoi(argv[1]) : 2;
+    uint32_t sum = 0;
+    double secs;
+    int i;
+
+    memset(buf, 0x5a, sizeof(buf));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < passes; i++) {
+        sum += pass_bytes();
+        sum += pass_words();
+        sum += pass_chase();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%d passes, checksum %08x, %.3f s, %.1f ns/pass/KiB\n",
+           passes, sum, secs, secs * 1e9 / passes / (BUF_SIZE / 1024));
+    return 0;
+}
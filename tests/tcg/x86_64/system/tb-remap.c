@@ -0,0 +1,151 @@
+/*
+ * Code remapped at the same virtual address
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Two blocks of RAM hold code that only differs by the value it returns.
+ * They are mapped in turn at the same virtual address, followed by an
+ * invlpg, and each call must run the code that is mapped at the time,
+ * however the translator cached the jump into it.  This includes the
+ * return into the window from a function that remapped it.
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <minilib.h>
+
+/*
+ * boot.S identity maps the first 4GB with 2MB pages: the window is the
+ * large page at 1GB, pointed in turn at one of two unused 2MB blocks.
+ */
+#define WINDOW      0x40000000UL
+#define CODE_A      0x400000UL
+#define CODE_B      0x600000UL
+#define PDE_FLAGS   0xe7    /* present, rw, user, accessed, dirty, 2MB */
+
+/* Offset of the code that calls back out of the window */
+#define CALL_OFFSET 0x100
+
+static uint64_t *window_pde(void)
+{
+    uint64_t cr3, *pml4, *pdp, *pd;
+
+    asm volatile("mov %%cr3, %0" : "=r"(cr3));
+    pml4 = (uint64_t *)(cr3 & ~0xfffUL);
+    pdp = (uint64_t *)(pml4[0] & ~0xfffUL);
+    pd = (uint64_t *)(pdp[WINDOW >> 30] & ~0xfffUL);
+    return &pd[(WINDOW >> 21) & 511];
+}
+
+static void map_window(uint64_t phys)
+{
+    *window_pde() = phys | PDE_FLAGS;
+    asm volatile("invlpg (%0)" : : "r"(WINDOW) : "memory");
+}
+
+static void write_bytes(uint64_t phys, const uint8_t *code, int len)
+{
+    uint8_t *p = (uint8_t *)phys;
+    int i;
+
+    for (i = 0; i < len; i++) {
+        p[i] = code[i];
+    }
+}
+
+static void write_code(uint64_t phys, uint8_t value)
+{
+    /* mov $value, %eax; ret */
+    const uint8_t ret_value[] = {
+        0xb8, value, 0, 0, 0,
+        0xc3,
+    };
+    /* sub $8, %rsp; call *%rdi; add $8, %rsp; mov $value, %eax; ret */
+    const uint8_t call_fn[] = {
+        0x48, 0x83, 0xec, 0x08,
+        0xff, 0xd7,
+        0x48, 0x83, 0xc4, 0x08,
+        0xb8, value, 0, 0, 0,
+        0xc3,
+    };
+
+    write_bytes(phys, ret_value, sizeof(ret_value));
+    write_bytes(phys + CALL_OFFSET, call_fn, sizeof(call_fn));
+}
+
+/*
+ * Indirect calls from the same site, so that the translator predicts the
+ * target of the call from the previous ones.
+ */
+static int __attribute__((noinline)) call_window(void)
+{
+    int (*fn)(void) = (int (*)(void))WINDOW;
+
+    return fn();
+}
+
+/* Physical address remap_callee() maps the window to, if not zero */
+static uint64_t remap_to;
+
+static void remap_callee(void)
+{
+    if (remap_to) {
+        map_window(remap_to);
+        remap_to = 0;
+    }
+}
+
+/*
+ * Call out of the window to remap_callee(), so that the return into the
+ * window follows the return address stack of the translator.
+ */
+static int __attribute__((noinline)) call_window_ret(void)
+{
+    int (*fn)(void (*)(void)) =
+        (int (*)(void (*)(void)))(WINDOW + CALL_OFFSET);
+
+    return fn(remap_callee);
+}
+
+static bool check_calls(uint64_t phys, int expected, int (*call)(void))
+{
+    int i;
+
+    map_window(phys);
+    for (i = 0; i < 10; i++) {
+        int ret = call();
+
+        if (ret != expected) {
+            ml_printf("call %d with %lx mapped returned %d, expected %d\n",
+                      i, phys, ret, expected);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(void)
+{
+    write_code(CODE_A, 1);
+    write_code(CODE_B, 2);
+
+    if (!check_calls(CODE_A, 1, call_window) ||
+        !check_calls(CODE_B, 2, call_window) ||
+        !check_calls(CODE_A, 1, call_window)) {
+        return -1;
+    }
+
+    /* The window is remapped while the call out of it is in progress */
+    if (!check_calls(CODE_A, 1, call_window_ret)) {
+        return -1;
+    }
+    remap_to = CODE_B;
+    if (call_window_ret() != 2) {
+        ml_printf("return into the window remapped to %lx ran stale code\n",
+                  CODE_B);
+        return -1;
+    }
+
+    ml_printf("Test PASSED\n");
+    return 0;
+}
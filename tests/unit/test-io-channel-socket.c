@@ -331,6 +331,69 @@ static void test_io_channel_ipv4_async(void)
 }
 
 
+static void test_io_channel_ipv4_zero_copy(void)
+{
+    SocketAddress *listen_addr = g_new0(SocketAddress, 1);
+    SocketAddress *connect_addr = g_new0(SocketAddress, 1);
+    QIOChannel *src, *dst, *srv;
+    size_t len = 16 * 1024;
+    char *bufsend = g_malloc(len);
+    char *bufrecv = g_malloc0(len);
+    struct iovec iosend[1];
+    size_t i;
+    int ret;
+
+    listen_addr->type = SOCKET_ADDRESS_TYPE_INET;
+    listen_addr->u.inet = (InetSocketAddress) {
+        .host = g_strdup("127.0.0.1"),
+        .port = NULL, /* Auto-select */
+    };
+
+    connect_addr->type = SOCKET_ADDRESS_TYPE_INET;
+    connect_addr->u.inet = (InetSocketAddress) {
+        .host = g_strdup("127.0.0.1"),
+        .port = NULL, /* Filled in later */
+    };
+
+    test_io_channel_setup_sync(listen_addr, connect_addr, &srv, &src, &dst);
+
+    if (!qio_channel_has_feature(src, QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY)) {
+        g_test_skip("MSG_ZEROCOPY not supported");
+        goto cleanup;
+    }
+
+    for (i = 0; i < len; i++) {
+        bufsend[i] = i;
+    }
+    iosend[0].iov_base = bufsend;
+    iosend[0].iov_len = len;
+
+    /* Small enough to fit in the socket buffers before dst reads it */
+    ret = qio_channel_writev_full_all(src, iosend, 1, NULL, 0,
+                                      QIO_CHANNEL_WRITE_FLAG_ZERO_COPY,
+                                      &error_abort);
+    g_assert_cmpint(ret, ==, 0);
+    ret = qio_channel_read_all(dst, bufrecv, len, &error_abort);
+    g_assert_cmpint(ret, ==, 0);
+
+    /* Loopback may copy the data of every write, which flush reports as 1 */
+    g_assert_cmpint(qio_channel_flush(src, &error_abort), >=, 0);
+    g_assert(memcmp(bufsend, bufrecv, len) == 0);
+
+    /* Nothing is pending any more */
+    g_assert_cmpint(qio_channel_flush(src, &error_abort), ==, 0);
+
+ cleanup:
+    object_unref(OBJECT(src));
+    object_unref(OBJECT(dst));
+    object_unref(OBJECT(srv));
+    qapi_free_SocketAddress(listen_addr);
+    qapi_free_SocketAddress(connect_addr);
+    g_free(bufsend);
+    g_free(bufrecv);
+}
+
+
 static void test_io_channel_ipv6(bool async)
 {
     SocketAddress *listen_addr = g_new0(SocketAddress, 1);
@@ -444,6 +507,7 @@ static void test_io_channel_unix_fd_pass(void)
                             G_N_ELEMENTS(iosend),
                             fdsend,
                             G_N_ELEMENTS(fdsend),
+                            0,
                             &error_abort);
 
     qio_channel_readv_full(dst,
@@ -579,6 +643,8 @@ int main(int argc, char **argv)
                         test_io_channel_ipv4_async);
         g_test_add_func("/io/channel/socket/ipv4-fd",
                         test_io_channel_ipv4_fd);
+        g_test_add_func("/io/channel/socket/ipv4-zero-copy",
+                        test_io_channel_ipv4_zero_copy);
     }
     if (has_ipv6) {
         g_test_add_func("/io/channel/socket/ipv6-sync",